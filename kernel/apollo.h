@@ -9,32 +9,42 @@
 #include <linux/pci.h>
 #include <linux/interrupt.h>
 #include <linux/version.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/delay.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
+#include <sound/memalloc.h>
+#include "apollo_regs.h"	/* generated from apollo_regs.map */
+#include "apollo_flight.h"
 
-/* Device register offsets (placeholder - requires reverse engineering) */
-#define APOLLO_REG_CONTROL	0x00
-#define APOLLO_REG_STATUS	0x04
-#define APOLLO_REG_SAMPLE_RATE	0x08
-#define APOLLO_REG_FORMAT	0x0C
-#define APOLLO_REG_DMA_ADDR	0x10
-#define APOLLO_REG_DMA_SIZE	0x14
-#define APOLLO_REG_DMA_CONTROL	0x18
-
-/* Control commands */
-#define APOLLO_CMD_START	0x01
-#define APOLLO_CMD_STOP		0x02
-#define APOLLO_CMD_RESET	0x03
-
-/* Status bits */
-#define APOLLO_STATUS_READY	(1 << 0)
-#define APOLLO_STATUS_RUNNING	(1 << 1)
-#define APOLLO_STATUS_ERROR	(1 << 2)
-
-/* Audio formats */
-#define APOLLO_FORMAT_S16_LE	0
-#define APOLLO_FORMAT_S24_3LE	1
-#define APOLLO_FORMAT_S32_LE	2
+/*
+ * BAR0 layout: the first page holds strictly ordered control/status
+ * registers and is mapped uncached. Everything above it is bulk memory
+ * (parameter tables, on-device buffers) and is mapped write-combined.
+ */
+#define APOLLO_CTRL_WINDOW_SIZE	0x1000
+
+/* DMA buffer limits */
+#define APOLLO_MAX_BUFFER_SIZE	(8 * 1024 * 1024)	/* 8MB, scatter-gather */
+#define APOLLO_MAX_PERIOD_SIZE	(512 * 1024)		/* 512KB */
+
+/*
+ * Scatter-gather descriptor (placeholder layout - requires reverse engineering).
+ * The engine walks the table in order and wraps to the first entry after
+ * the one flagged APOLLO_DESC_EOL.
+ */
+struct apollo_dma_desc {
+	__le64 addr;
+	__le32 len;
+	__le32 flags;
+};
+
+#define APOLLO_DESC_EOL		(1 << 0)
+
+/* Playback mixing */
+#define APOLLO_MAX_PLAYBACK_SUBSTREAMS	8
+#define APOLLO_MIX_PERIODS		2	/* length of the mixed ring */
 
 /* Sample rates */
 #define APOLLO_RATE_44100	44100
@@ -44,6 +54,190 @@
 #define APOLLO_RATE_176400	176400
 #define APOLLO_RATE_192000	192000
 
+/* Parameter automation */
+#define APOLLO_PARAM_COUNT	3	/* APOLLO_PARAM_* */
+#define APOLLO_SCHED_DEPTH	64	/* pending changes per device */
+#define APOLLO_SCHED_ASAP	U64_MAX	/* frame: the next boundary still open */
+
+/* Firmware upload state, reported through sysfs */
+enum apollo_fw_state {
+	APOLLO_FW_NONE,		/* no image needed or available */
+	APOLLO_FW_LOADING,	/* waiting for request_firmware_nowait() */
+	APOLLO_FW_UPLOADING,
+	APOLLO_FW_READY,
+	APOLLO_FW_FAILED,
+};
+
+/* Per-direction DMA state */
+struct apollo_stream {
+	/* Position tracking for period detection in the IRQ */
+	bool running;
+	snd_pcm_uframes_t last_pos;
+	u64 frames;			/* boundary last crossed, frames since start */
+
+	/* Descriptor table, only used in scatter-gather mode */
+	struct apollo_dma_desc *desc;
+	dma_addr_t desc_addr;
+	size_t desc_bytes;
+	unsigned int desc_count;
+};
+
+/* A parameter change waiting for its period */
+struct apollo_sched_event {
+	u64 frame;		/* target, in frames since the stream started */
+	u32 seq;		/* submission order, breaks ties */
+	u32 param;		/* APOLLO_PARAM_* */
+	u32 value;
+	u32 ramp;		/* frames, 0 for a step */
+};
+
+/* One of a group of changes that land together */
+struct apollo_sched_change {
+	u32 param;
+	u32 value;
+};
+
+/* Software ramp, stepped once per period boundary */
+struct apollo_sched_ramp {
+	bool active;
+	u64 start;
+	u64 end;
+	u32 from;
+	u32 to;
+};
+
+/*
+ * Parameter changes tagged with a playback frame. The device latches a
+ * staged change at the next period boundary, so staging from the period
+ * interrupt makes a change land on a fixed boundary whatever the
+ * interrupt latency: the one at or before its target frame. Pending
+ * changes are kept in a min-heap on (frame, seq).
+ */
+struct apollo_sched {
+	spinlock_t lock;		/* protects everything below */
+	/* Stage one value for the next boundary; called with lock held */
+	void (*stage)(struct apollo_sched *sched, u32 param, u32 value, u32 ramp);
+	bool hw_ramp;			/* device ramps by itself */
+	bool running;			/* staging from the period interrupt */
+	u64 next;			/* first boundary not staged yet */
+
+	struct apollo_sched_event heap[APOLLO_SCHED_DEPTH];
+	unsigned int count;
+	u32 seq;
+
+	u32 value[APOLLO_PARAM_COUNT];	/* last value staged */
+	struct apollo_sched_ramp ramps[APOLLO_PARAM_COUNT];
+
+	u64 applied;
+	u64 late;			/* staged after their boundary had passed */
+};
+
+/* Bucket i counts latencies up to 2^i us; the last one everything above */
+#define APOLLO_LATENCY_BUCKETS	16
+
+/*
+ * Stream health, read by the controls without locking. Latency and errors
+ * are counted from the interrupt handler, their only writer; xruns from
+ * the prepare callbacks.
+ */
+struct apollo_stats {
+	unsigned long irq_latency[2][APOLLO_LATENCY_BUCKETS];	/* per stream */
+	atomic_long_t xruns[2];
+	unsigned long engine_errors;	/* APOLLO_STATUS_ERROR */
+	struct snd_kcontrol *xrun_ctl;
+};
+
+/* Set in apollo_flight.head once the ring is frozen */
+#define APOLLO_FLIGHT_FROZEN	0x80000000U
+
+/*
+ * Flight recorder: the last events before an xrun or engine error. Any
+ * context may log; a slot is claimed by advancing head, so writers never
+ * wait on each other. Freezing sets APOLLO_FLIGHT_FROZEN in head, after
+ * which nothing can claim a slot until userspace re-arms it.
+ */
+struct apollo_flight {
+	atomic_t head;			/* events logged | APOLLO_FLIGHT_FROZEN */
+	struct apollo_flight_event *ring;	/* NULL when disabled */
+	unsigned int size;		/* power of two */
+	struct apollo_flight_header frozen;	/* filled in before freezing */
+	atomic_t freezing;		/* header claimed by a freeze */
+	bool settled;			/* in-flight loggers waited for since */
+	struct snd_card *card;
+	struct snd_kcontrol *frozen_ctl;
+};
+
+/* Fixed-point fraction of the DLL period and time estimates, in ns */
+#define APOLLO_DLL_SHIFT	24
+
+/*
+ * Second-order delay-locked loop locking the period boundaries of a stream
+ * to CLOCK_MONOTONIC. Filtered boundary times follow t0, t1 and the filtered
+ * period e2 tracks the actual length of a device period, so nominal / e2 is
+ * the rate of the sample clock against the system clock.
+ */
+struct apollo_dll {
+	u32 period;			/* frames between boundaries */
+	u64 nominal;			/* nominal period, ns << APOLLO_DLL_SHIFT */
+	u64 b, c;			/* loop gains, Q32 */
+	u32 settle;			/* updates before the estimate is trusted */
+
+	u64 t0;				/* filtered time of the last boundary, ns */
+	u64 f0;				/* frames since the stream started, at t0 */
+	u64 t1;				/* predicted time of the next boundary, ns */
+	u32 t1_frac;
+	u64 e2;				/* filtered period, ns << APOLLO_DLL_SHIFT */
+
+	s64 err;			/* last boundary against its prediction, ns */
+	u64 jitter;			/* running average of |err|, ns */
+	u32 updates;			/* since the loop last (re)started */
+	u32 resets;			/* restarts after a phase jump */
+};
+
+/*
+ * Sample clock drift, estimated from the period interrupts of whichever
+ * stream started first. Published through the read-only "Clock Drift"
+ * control, so clients can resample without running their own loop.
+ */
+struct apollo_drift {
+	spinlock_t lock;		/* protects everything below */
+	int dir;			/* stream feeding the loop, -1 when idle */
+	u32 rate;			/* nominal rate of that stream */
+	struct apollo_dll dll;
+	bool settled;
+	struct snd_kcontrol *ctl;
+};
+
+/* One playback substream feeding the mixer, indexed by substream number */
+struct apollo_mix_voice {
+	bool configured;		/* hw_params done */
+	bool running;
+	snd_pcm_uframes_t pos;		/* frames consumed from its buffer */
+};
+
+/*
+ * With several playback substreams the engine plays a driver-owned ring
+ * of APOLLO_MIX_PERIODS periods, filled one period ahead of the hardware
+ * with the sum of all running substreams.
+ */
+struct apollo_mix {
+	struct mutex config_lock;	/* serializes hw_params/hw_free */
+	spinlock_t lock;		/* protects everything below */
+	unsigned int users;		/* configured substreams */
+	unsigned int active;		/* running substreams */
+
+	/* Shared by all substreams, fixed by the first one configured */
+	snd_pcm_format_t pcm_format;
+	u32 format;
+	unsigned int rate;
+	unsigned int channels;
+	snd_pcm_uframes_t period_size;
+	size_t period_bytes;
+
+	struct snd_dma_buffer ring;
+	struct apollo_mix_voice voices[APOLLO_MAX_PLAYBACK_SUBSTREAMS];
+};
+
 struct apollo_device {
 	/* PCI device */
 	struct pci_dev *pci;
@@ -51,19 +245,55 @@ struct apollo_device {
 	struct snd_card *card;
 	struct snd_pcm *pcm;
 
+	/* Playback loopback capture, PCM device 1 (NULL when disabled) */
+	struct snd_pcm *loopback_pcm;
+	struct mutex loopback_mutex;	/* serializes attach/detach */
+	spinlock_t loopback_lock;	/* protects the fields below */
+	struct snd_pcm_substream *loopback;		/* open loopback substream */
+	struct snd_pcm_substream *loopback_source;	/* prepared playback */
+	bool loopback_running;
+
 	/* Device registers */
-	void __iomem *regs;
+	void __iomem *regs;		/* control window, uncached */
 	resource_size_t regs_size;
+	void __iomem *bulk;		/* bulk window, write-combined if allowed */
+	resource_size_t bulk_size;
+	bool bulk_wc;
 
 	/* DMA resources */
-	dma_addr_t dma_addr;
-	void *dma_area;
-	size_t dma_size;
+	bool sg;
+	bool noncoherent;		/* cacheable buffers, synced explicitly */
+	unsigned int dma_bits;		/* negotiated DMA mask width */
+	atomic_t dma_unreachable;	/* buffers found outside the DMA mask */
+	struct apollo_stream streams[2];	/* indexed by SNDRV_PCM_STREAM_* */
+	struct apollo_mix *mix;		/* NULL with a single playback substream */
 
 	/* Interrupt handling */
 	int irq;
 	atomic_t running;
 
+	/* Sample clock, updated from the interrupt */
+	spinlock_t clock_lock;
+	u32 clock_source;		/* APOLLO_CLOCK_* */
+	bool clock_locked;
+	u32 clock_rate;			/* detected rate, Hz */
+	atomic_t clock_lock_losses;	/* locked -> unlocked transitions */
+	struct snd_kcontrol *clock_locked_ctl;
+	struct snd_kcontrol *clock_rate_ctl;
+	struct snd_kcontrol *clock_losses_ctl;
+
+	/* Parameter automation, staged from the playback period interrupt */
+	struct apollo_sched sched;
+
+	/* Interrupt latency and xruns, for monitoring */
+	struct apollo_stats stats;
+
+	/* Sample clock against CLOCK_MONOTONIC */
+	struct apollo_drift drift;
+
+	/* Recent driver events, frozen on the first xrun or engine error */
+	struct apollo_flight flight;
+
 	/* Device state */
 	u32 sample_rate;
 	u32 format;
@@ -73,8 +303,12 @@ struct apollo_device {
 	struct mutex control_lock;
 	wait_queue_head_t control_wait;
 
-	/* Firmware info */
-	const struct firmware *fw;
+	/* Firmware upload */
+	struct work_struct fw_work;
+	struct completion fw_requested;
+	enum apollo_fw_state fw_state;
+	atomic_t fw_progress;		/* percent */
+	bool card_registered;
 
 	/* Device activation state */
 	bool activated;
@@ -94,6 +328,7 @@ int apollo_pcm_hw_free(struct snd_pcm_substream *substream);
 int apollo_pcm_prepare(struct snd_pcm_substream *substream);
 int apollo_pcm_trigger(struct snd_pcm_substream *substream, int cmd);
 snd_pcm_uframes_t apollo_pcm_pointer(struct snd_pcm_substream *substream);
+snd_pcm_uframes_t apollo_pcm_hw_pos(struct snd_pcm_substream *substream);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
 int apollo_pcm_copy_user(struct snd_pcm_substream *substream, int channel, unsigned long pos,
 			void __user *buf, unsigned long bytes);
@@ -104,13 +339,197 @@ int apollo_hw_init(struct apollo_device *apollo);
 void apollo_hw_suspend(struct apollo_device *apollo);
 int apollo_hw_resume(struct apollo_device *apollo);
 int apollo_hw_constraints(struct snd_pcm *pcm);
+int apollo_hw_map(struct apollo_device *apollo);
+void apollo_hw_unmap(struct apollo_device *apollo);
+int apollo_bulk_write(struct apollo_device *apollo, u32 offset,
+		      const void *src, size_t len);
+
+
+/* DMA buffer management */
+int apollo_dma_set_mask(struct apollo_device *apollo);
+int apollo_dma_init(struct apollo_device *apollo);
+int apollo_dma_build_table(struct apollo_device *apollo,
+			   struct snd_pcm_substream *substream);
+void apollo_dma_free_table(struct apollo_device *apollo,
+			   struct snd_pcm_substream *substream);
+void apollo_dma_program(struct apollo_device *apollo,
+			struct snd_pcm_substream *substream);
+bool apollo_dma_fixed(struct apollo_device *apollo,
+		      struct snd_pcm_substream *substream);
+int apollo_dma_type(struct apollo_device *apollo);
+unsigned int apollo_dma_info(struct apollo_device *apollo);
+void apollo_dma_sync_for_device(struct apollo_device *apollo, struct snd_dma_buffer *dmab);
+void apollo_dma_sync_range_for_device(struct apollo_device *apollo,
+				      struct snd_dma_buffer *dmab, size_t offset, size_t len);
+void apollo_dma_bench(struct apollo_device *apollo);
+int apollo_dma_map_ring(struct apollo_device *apollo, struct apollo_stream *stream,
+			struct snd_dma_buffer *dmab, size_t bytes);
+void apollo_dma_unmap_ring(struct apollo_device *apollo, struct apollo_stream *stream);
+void apollo_dma_program_ring(struct apollo_device *apollo, struct apollo_stream *stream,
+			     dma_addr_t addr, size_t bytes);
+long apollo_dma_ring_pos(struct apollo_device *apollo, dma_addr_t addr, size_t bytes);
+
+/* Playback mixing */
+unsigned int apollo_mix_substreams(void);
+int apollo_mix_new(struct apollo_device *apollo);
+void apollo_mix_irq(struct apollo_device *apollo);
+void apollo_mix_samples(void *dst, const void *const *src, unsigned int nsrc,
+			unsigned int samples, u32 format);
+
+/* Playback loopback */
+int apollo_loopback_new(struct apollo_device *apollo);
+void apollo_loopback_set_source(struct apollo_device *apollo,
+				struct snd_pcm_substream *source);
+void apollo_loopback_period(struct apollo_device *apollo);
 
+/* Firmware loading */
+int apollo_fw_load(struct apollo_device *apollo);
+void apollo_fw_reload(struct apollo_device *apollo);
+void apollo_fw_cancel(struct apollo_device *apollo);
+void apollo_fw_cache_free(void);
+const char *apollo_fw_state_name(struct apollo_device *apollo);
+
+/* Clock source and lock status */
+int apollo_clock_init(struct apollo_device *apollo);
+void apollo_clock_irq(struct apollo_device *apollo);
+void apollo_clock_restore(struct apollo_device *apollo);
+
+/* Parameter automation */
+void apollo_sched_init(struct apollo_sched *sched,
+		       void (*stage)(struct apollo_sched *sched, u32 param, u32 value, u32 ramp),
+		       bool hw_ramp);
+int apollo_sched_add(struct apollo_sched *sched, u32 param, u32 value, u64 frame, u32 ramp);
+int apollo_sched_add_group(struct apollo_sched *sched, const struct apollo_sched_change *changes,
+			   unsigned int n, u64 frame, u32 ramp);
+void apollo_sched_start(struct apollo_sched *sched, u32 period);
+void apollo_sched_started(struct apollo_sched *sched, u32 period);
+void apollo_sched_stop(struct apollo_sched *sched);
+void apollo_sched_boundary(struct apollo_sched *sched, u64 boundary, u32 period);
+int apollo_sched_new(struct apollo_device *apollo);
+void apollo_sched_period(struct apollo_device *apollo, unsigned int crossed, u32 period);
+
+/* Stream health counters */
+int apollo_stats_new(struct apollo_device *apollo);
+void apollo_stats_period(struct apollo_device *apollo, int dir, snd_pcm_uframes_t late,
+			 unsigned int rate);
+void apollo_stats_prepare(struct apollo_device *apollo, struct snd_pcm_substream *substream);
+void apollo_stats_error(struct apollo_device *apollo);
+
+/* Clock drift estimation */
+void apollo_dll_init(struct apollo_dll *dll, u32 period, u32 rate, u32 bw_mhz);
+void apollo_dll_update(struct apollo_dll *dll, u64 now, unsigned int crossed, u32 late);
+s64 apollo_dll_ppb(const struct apollo_dll *dll);
+u32 apollo_dll_confidence(const struct apollo_dll *dll);
+int apollo_drift_new(struct apollo_device *apollo);
+void apollo_drift_start(struct apollo_device *apollo, int dir, u32 period, u32 rate);
+void apollo_drift_stop(struct apollo_device *apollo, int dir);
+void apollo_drift_restart(struct apollo_device *apollo);
+void apollo_drift_period(struct apollo_device *apollo, int dir, unsigned int crossed,
+			 snd_pcm_uframes_t late);
+
+/* Flight recorder */
+void apollo_flight_init(struct apollo_flight *flight, struct apollo_flight_event *ring,
+			unsigned int size);
+int apollo_flight_new(struct apollo_device *apollo);
+void apollo_flight_log(struct apollo_flight *flight, u8 type, u8 stream, u16 arg, u32 value);
+bool apollo_flight_freeze(struct apollo_flight *flight, u8 reason,
+			  struct snd_pcm_substream *substream);
+ssize_t apollo_flight_read(struct apollo_flight *flight, char *buf, loff_t off, size_t count);
+int apollo_flight_rearm(struct apollo_flight *flight);
 
 /* Control interface */
 int apollo_control_init(struct apollo_device *apollo);
 void apollo_control_cleanup(struct apollo_device *apollo);
 int apollo_control_command(struct apollo_device *apollo, u32 cmd, u32 *data);
 
+/*
+ * PCM math helpers. These never touch registers so they can be covered by
+ * the KUnit suite in apollo_kunit.c.
+ */
+
+/* Map an ALSA sample format to the device format code */
+static inline int apollo_format_from_pcm(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SNDRV_PCM_FORMAT_S16_LE:
+		return APOLLO_FORMAT_S16_LE;
+	case SNDRV_PCM_FORMAT_S24_3LE:
+		return APOLLO_FORMAT_S24_3LE;
+	case SNDRV_PCM_FORMAT_S32_LE:
+		return APOLLO_FORMAT_S32_LE;
+	default:
+		return -EINVAL;
+	}
+}
+
+static inline unsigned int apollo_frame_bytes(u32 format, unsigned int channels)
+{
+	static const unsigned int sample_bytes[] = {
+		[APOLLO_FORMAT_S16_LE] = 2,
+		[APOLLO_FORMAT_S24_3LE] = 3,
+		[APOLLO_FORMAT_S32_LE] = 4,
+	};
+
+	if (format >= ARRAY_SIZE(sample_bytes))
+		return 0;
+	return sample_bytes[format] * channels;
+}
+
+/*
+ * Number of period boundaries crossed moving from last to cur (both in
+ * frames, inside a ring of buffer frames). A position that has not moved
+ * counts as no progress rather than a full lap.
+ */
+static inline unsigned int apollo_periods_crossed(snd_pcm_uframes_t last,
+						  snd_pcm_uframes_t cur,
+						  snd_pcm_uframes_t period,
+						  snd_pcm_uframes_t buffer)
+{
+	snd_pcm_uframes_t delta;
+
+	if (!period || !buffer || last >= buffer || cur >= buffer)
+		return 0;
+
+	delta = cur >= last ? cur - last : cur + buffer - last;
+	return (last % period + delta) / period;
+}
+
+/*
+ * Histogram bucket for an interrupt that ran late frames past the period
+ * boundary: bucket i holds latencies up to 2^i us.
+ */
+static inline unsigned int apollo_latency_bucket(snd_pcm_uframes_t late, unsigned int rate)
+{
+	u64 us;
+
+	if (!rate)
+		return 0;
+
+	us = div_u64((u64)late * USEC_PER_SEC + rate - 1, rate);
+	if (us <= 1)
+		return 0;
+	return min_t(unsigned int, fls64(us - 1), APOLLO_LATENCY_BUCKETS - 1);
+}
+
+/* Layout rules the DMA engine relies on, checked again in hw_params */
+static inline int apollo_check_period_layout(size_t period_bytes, size_t buffer_bytes,
+					     unsigned int frame_bytes)
+{
+	if (!frame_bytes || period_bytes < 64 || period_bytes > APOLLO_MAX_PERIOD_SIZE)
+		return -EINVAL;
+	if (period_bytes % frame_bytes || buffer_bytes % period_bytes)
+		return -EINVAL;
+	if (buffer_bytes / period_bytes < 2 || buffer_bytes > APOLLO_MAX_BUFFER_SIZE)
+		return -EINVAL;
+	return 0;
+}
+
+/* Throughput for the probe-time benchmarks */
+static inline u64 apollo_kbps(size_t bytes, u64 ns)
+{
+	return ns ? div64_u64((u64)bytes * NSEC_PER_SEC, ns * 1024) : 0;
+}
+
 /* Utility functions */
 static inline void apollo_write_reg(struct apollo_device *apollo, u32 offset, u32 value)
 {
@@ -122,5 +541,22 @@ static inline u32 apollo_read_reg(struct apollo_device *apollo, u32 offset)
 	return readl(apollo->regs + offset);
 }
 
+/* Register sequences, shared with the VFIO engine */
+#define APOLLO_SEQ_CTX				struct apollo_device
+#define apollo_seq_read(apollo, reg)		apollo_read_reg(apollo, reg)
+#define apollo_seq_write(apollo, reg, val)	apollo_write_reg(apollo, reg, val)
+#define apollo_seq_msleep(ms)			msleep(ms)
+#include "apollo_seq.h"
+
+/*
+ * Order all outstanding bulk window writes before the next control register
+ * write. Write-combined stores may otherwise still sit in the WC buffer when
+ * the device is told to consume them.
+ */
+static inline void apollo_bulk_flush(struct apollo_device *apollo)
+{
+	wmb();
+}
+
 #endif /* _APOLLO_H */
 
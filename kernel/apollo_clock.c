@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Twin Clock Source and Lock Status
+ *
+ * The sample clock source is an ALSA enum control. The device raises
+ * APOLLO_STATUS_CLOCK whenever the lock state or the detected external
+ * rate changes, and the interrupt handler turns that straight into control
+ * change notifications. User space waiting in poll() on the control device
+ * learns about a clock drop within the interrupt latency, without reading
+ * registers over the link.
+ */
+
+#include <linux/module.h>
+#include <sound/core.h>
+#include <sound/control.h>
+#include "apollo.h"
+#include "apollo_trace.h"
+
+static const char *const apollo_clock_names[] = {
+	[APOLLO_CLOCK_INTERNAL]	= "Internal",
+	[APOLLO_CLOCK_SPDIF]	= "S/PDIF",
+	[APOLLO_CLOCK_ADAT]	= "ADAT",
+};
+
+static int apollo_clock_source_info(struct snd_kcontrol *kcontrol,
+				    struct snd_ctl_elem_info *uinfo)
+{
+	return snd_ctl_enum_info(uinfo, 1, ARRAY_SIZE(apollo_clock_names),
+				 apollo_clock_names);
+}
+
+static int apollo_clock_source_get(struct snd_kcontrol *kcontrol,
+				   struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+
+	uvalue->value.enumerated.item[0] = READ_ONCE(apollo->clock_source);
+	return 0;
+}
+
+static int apollo_clock_source_put(struct snd_kcontrol *kcontrol,
+				   struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+	unsigned int source = uvalue->value.enumerated.item[0];
+
+	if (source >= ARRAY_SIZE(apollo_clock_names))
+		return -EINVAL;
+
+	if (source == READ_ONCE(apollo->clock_source))
+		return 0;
+
+	/* Lock and rate changes that follow arrive through the interrupt */
+	WRITE_ONCE(apollo->clock_source, source);
+	apollo_write_reg(apollo, APOLLO_REG_CLOCK_SOURCE, source);
+	return 1;
+}
+
+static int apollo_clock_locked_get(struct snd_kcontrol *kcontrol,
+				   struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+
+	uvalue->value.integer.value[0] = READ_ONCE(apollo->clock_locked);
+	return 0;
+}
+
+static int apollo_clock_rate_info(struct snd_kcontrol *kcontrol,
+				  struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = APOLLO_RATE_192000;
+	return 0;
+}
+
+static int apollo_clock_rate_get(struct snd_kcontrol *kcontrol,
+				 struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+
+	uvalue->value.integer.value[0] = READ_ONCE(apollo->clock_rate);
+	return 0;
+}
+
+static int apollo_clock_losses_info(struct snd_kcontrol *kcontrol,
+				    struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = INT_MAX;
+	return 0;
+}
+
+static int apollo_clock_losses_get(struct snd_kcontrol *kcontrol,
+				   struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+
+	uvalue->value.integer.value[0] = atomic_read(&apollo->clock_lock_losses);
+	return 0;
+}
+
+#define APOLLO_CLOCK_STATUS_ACCESS \
+	(SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE)
+
+static const struct snd_kcontrol_new apollo_clock_source_ctl = {
+	.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name = "Clock Source",
+	.access = SNDRV_CTL_ELEM_ACCESS_READWRITE,
+	.info = apollo_clock_source_info,
+	.get = apollo_clock_source_get,
+	.put = apollo_clock_source_put,
+};
+
+static const struct snd_kcontrol_new apollo_clock_locked_ctl = {
+	.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name = "Clock Lock Status",
+	.access = APOLLO_CLOCK_STATUS_ACCESS,
+	.info = snd_ctl_boolean_mono_info,
+	.get = apollo_clock_locked_get,
+};
+
+static const struct snd_kcontrol_new apollo_clock_rate_ctl = {
+	.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name = "Clock Detected Rate",
+	.access = APOLLO_CLOCK_STATUS_ACCESS,
+	.info = apollo_clock_rate_info,
+	.get = apollo_clock_rate_get,
+};
+
+static const struct snd_kcontrol_new apollo_clock_losses_ctl = {
+	.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name = "Clock Lock Losses",
+	.access = APOLLO_CLOCK_STATUS_ACCESS,
+	.info = apollo_clock_losses_info,
+	.get = apollo_clock_losses_get,
+};
+
+static int apollo_clock_add(struct apollo_device *apollo,
+			    const struct snd_kcontrol_new *tmpl,
+			    struct snd_kcontrol **kctl)
+{
+	struct snd_kcontrol *new = snd_ctl_new1(tmpl, apollo);
+	int err;
+
+	err = snd_ctl_add(apollo->card, new);
+	if (err < 0) {
+		dev_err(&apollo->pci->dev, "Failed to add control %s\n", tmpl->name);
+		return err;
+	}
+
+	if (kctl)
+		*kctl = new;
+	return 0;
+}
+
+/* Latch the current status; returns which of lock and rate changed */
+static void apollo_clock_update(struct apollo_device *apollo, bool *lock_changed,
+				bool *rate_changed)
+{
+	u32 status = apollo_read_reg(apollo, APOLLO_REG_CLOCK_STATUS);
+	bool locked = apollo_clock_status_locked(status);
+	u32 rate = apollo_clock_status_rate(status);
+
+	*lock_changed = locked != apollo->clock_locked;
+	*rate_changed = rate != apollo->clock_rate;
+
+	if (*lock_changed && !locked)
+		atomic_inc(&apollo->clock_lock_losses);
+
+	WRITE_ONCE(apollo->clock_locked, locked);
+	WRITE_ONCE(apollo->clock_rate, rate);
+
+	trace_apollo_clock(status, atomic_read(&apollo->clock_lock_losses));
+}
+
+/* APOLLO_STATUS_CLOCK handler, called from the interrupt */
+void apollo_clock_irq(struct apollo_device *apollo)
+{
+	bool lock_changed, rate_changed;
+
+	spin_lock(&apollo->clock_lock);
+	apollo_clock_update(apollo, &lock_changed, &rate_changed);
+	spin_unlock(&apollo->clock_lock);
+
+	/* A new clock makes the drift estimate meaningless */
+	if (lock_changed || rate_changed)
+		apollo_drift_restart(apollo);
+
+	if (lock_changed && apollo->clock_locked_ctl) {
+		snd_ctl_notify(apollo->card, SNDRV_CTL_EVENT_MASK_VALUE,
+			       &apollo->clock_locked_ctl->id);
+		if (!READ_ONCE(apollo->clock_locked))
+			snd_ctl_notify(apollo->card, SNDRV_CTL_EVENT_MASK_VALUE,
+				       &apollo->clock_losses_ctl->id);
+	}
+
+	if (rate_changed && apollo->clock_rate_ctl)
+		snd_ctl_notify(apollo->card, SNDRV_CTL_EVENT_MASK_VALUE,
+			       &apollo->clock_rate_ctl->id);
+}
+
+/* Reprogram the selected source after the device lost its state */
+void apollo_clock_restore(struct apollo_device *apollo)
+{
+	apollo_write_reg(apollo, APOLLO_REG_CLOCK_SOURCE, READ_ONCE(apollo->clock_source));
+}
+
+int apollo_clock_init(struct apollo_device *apollo)
+{
+	bool lock_changed, rate_changed;
+	int err;
+
+	spin_lock_init(&apollo->clock_lock);
+	atomic_set(&apollo->clock_lock_losses, 0);
+
+	apollo->clock_source = APOLLO_CLOCK_INTERNAL;
+	apollo_clock_restore(apollo);
+	apollo_clock_update(apollo, &lock_changed, &rate_changed);
+
+	err = apollo_clock_add(apollo, &apollo_clock_source_ctl, NULL);
+	if (err)
+		return err;
+	err = apollo_clock_add(apollo, &apollo_clock_locked_ctl, &apollo->clock_locked_ctl);
+	if (err)
+		return err;
+	err = apollo_clock_add(apollo, &apollo_clock_rate_ctl, &apollo->clock_rate_ctl);
+	if (err)
+		return err;
+	return apollo_clock_add(apollo, &apollo_clock_losses_ctl, &apollo->clock_losses_ctl);
+}
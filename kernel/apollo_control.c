@@ -72,6 +72,7 @@ int apollo_control_command(struct apollo_device *apollo, u32 cmd, u32 *data)
 
 	/* Send command to device */
 	apollo_write_reg(apollo, APOLLO_REG_CONTROL, cmd);
+	apollo_flight_log(&apollo->flight, APOLLO_FLIGHT_CONTROL, 0, 0, cmd);
 
 	if (data) {
 		/* Wait for response or timeout */
@@ -107,10 +108,9 @@ static int apollo_ctl_master_get(struct snd_kcontrol *kcontrol,
 {
 	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
 
-	/* Read current master volume from device */
-	/* Placeholder - implement based on reverse engineered protocol */
-	uvalue->value.integer.value[0] = 75;  /* Left */
-	uvalue->value.integer.value[1] = 75;  /* Right */
+	/* Last level staged to the device */
+	uvalue->value.integer.value[0] = READ_ONCE(apollo->sched.value[APOLLO_PARAM_MASTER_L]);
+	uvalue->value.integer.value[1] = READ_ONCE(apollo->sched.value[APOLLO_PARAM_MASTER_R]);
 
 	return 0;
 }
@@ -119,13 +119,30 @@ static int apollo_ctl_master_put(struct snd_kcontrol *kcontrol,
 				struct snd_ctl_elem_value *uvalue)
 {
 	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+	long left = uvalue->value.integer.value[0];
+	long right = uvalue->value.integer.value[1];
+	const struct apollo_sched_change changes[] = {
+		{ APOLLO_PARAM_MASTER_L, left },
+		{ APOLLO_PARAM_MASTER_R, right },
+	};
+	bool changed;
+	int err;
 
-	/* Set master volume on device */
-	/* Placeholder - implement based on reverse engineered protocol */
-	dev_info(&apollo->pci->dev, "Setting master volume: L=%ld R=%ld\n",
-		 uvalue->value.integer.value[0], uvalue->value.integer.value[1]);
+	if (left < 0 || left > 100 || right < 0 || right > 100)
+		return -EINVAL;
 
-	return 0;
+	changed = left != READ_ONCE(apollo->sched.value[APOLLO_PARAM_MASTER_L]) ||
+		  right != READ_ONCE(apollo->sched.value[APOLLO_PARAM_MASTER_R]);
+
+	/*
+	 * Lands on the next period boundary while playing, not mid-period;
+	 * both sides on the same one. Queued even when unchanged, so it
+	 * still overrides a change pending for a later boundary.
+	 */
+	err = apollo_sched_add_group(&apollo->sched, changes, ARRAY_SIZE(changes),
+				     APOLLO_SCHED_ASAP, 0);
+
+	return err < 0 ? err : changed;
 }
 
 static int apollo_ctl_input_info(struct snd_kcontrol *kcontrol,
@@ -0,0 +1,436 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Twin DMA Buffer Management
+ *
+ * Buffers are owned by ALSA and allocated per substream. In scatter-gather
+ * mode the buffer is a list of pages described to the device through a
+ * descriptor table, so large buffers never need contiguous memory. In
+ * contiguous mode a buffer is preallocated at probe time and reused for
+ * every stream, so later fragmentation cannot make hw_params fail. With
+ * the loopback enabled the playback buffer is always preallocated, since
+ * the loopback capture maps it too.
+ *
+ * Coherent DMA memory is mapped uncached on most non-x86 platforms, which
+ * makes every CPU access to a buffer (mmap clients, the mixer, format
+ * conversion) a bus access. In non-coherent mode buffers are ordinary
+ * cacheable pages. Ownership then has to be handed over explicitly:
+ * the PCM core syncs client buffers on read/write and SYNC_PTR, because
+ * the runtime advertises SNDRV_PCM_INFO_EXPLICIT_SYNC. The driver syncs
+ * what it writes itself: each period of the mixed ring as it is filled.
+ * On x86 the two modes cost the same, and coherent mode keeps the status
+ * page mmap-able, so the default picks non-coherent everywhere else.
+ */
+
+#include <linux/module.h>
+#include <linux/dma-mapping.h>
+#include <linux/ktime.h>
+#include <linux/sizes.h>
+#include <sound/core.h>
+#include <sound/pcm.h>
+#include <sound/memalloc.h>
+#include "apollo.h"
+
+static bool sg_buffers = true;
+module_param(sg_buffers, bool, 0444);
+MODULE_PARM_DESC(sg_buffers, "Use scatter-gather DMA buffers (default: true)");
+
+static unsigned int prealloc_kb = 4096;
+module_param(prealloc_kb, uint, 0444);
+MODULE_PARM_DESC(prealloc_kb, "Buffer preallocated per stream when sg_buffers=0, and for playback with loopback (KB)");
+
+static int dma_noncoherent = -1;
+module_param(dma_noncoherent, int, 0444);
+MODULE_PARM_DESC(dma_noncoherent, "Cacheable DMA buffers with explicit sync (-1: auto, default; 0: off; 1: on)");
+
+static bool dma_bench;
+module_param(dma_bench, bool, 0444);
+MODULE_PARM_DESC(dma_bench, "Benchmark CPU access to coherent and non-coherent buffers at probe (default: false)");
+
+/* snd_dma_buffer_sync() and SNDRV_PCM_INFO_EXPLICIT_SYNC */
+#define APOLLO_HAVE_NONCOHERENT	(LINUX_VERSION_CODE >= KERNEL_VERSION(5, 15, 0))
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+/*
+ * Before 5.5 the core finds the pages of an SG buffer for mmap only
+ * through ops->page. Contiguous buffers must not have one: with .page set
+ * the core faults pages in instead of using dma_mmap_coherent(), and
+ * snd_pcm_sgbuf_ops_page() knows no pages outside an SG buffer. So the
+ * ops tables leave it out, and SG mode gets a copy with it added.
+ */
+static int apollo_dma_sg_ops(struct device *dev, struct snd_pcm_str *pstr)
+{
+	struct snd_pcm_substream *substream = pstr->substream;
+	struct snd_pcm_ops *ops;
+
+	if (!substream)
+		return 0;
+
+	ops = devm_kmemdup(dev, substream->ops, sizeof(*ops), GFP_KERNEL);
+	if (!ops)
+		return -ENOMEM;
+	ops->page = snd_pcm_sgbuf_ops_page;
+
+	for (; substream; substream = substream->next)
+		substream->ops = ops;
+	return 0;
+}
+
+static int apollo_dma_set_page_ops(struct apollo_device *apollo)
+{
+	struct device *dev = &apollo->pci->dev;
+	int err;
+
+	if (!apollo->sg)
+		return 0;
+
+	err = apollo_dma_sg_ops(dev, &apollo->pcm->streams[SNDRV_PCM_STREAM_PLAYBACK]);
+	if (!err)
+		err = apollo_dma_sg_ops(dev, &apollo->pcm->streams[SNDRV_PCM_STREAM_CAPTURE]);
+	if (!err && apollo->loopback_pcm)
+		err = apollo_dma_sg_ops(dev,
+					&apollo->loopback_pcm->streams[SNDRV_PCM_STREAM_CAPTURE]);
+	return err;
+}
+#else
+static int apollo_dma_set_page_ops(struct apollo_device *apollo)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Negotiate the widest DMA mask the platform accepts. The engine takes a
+ * full 64-bit address through DMA_ADDR/DMA_ADDR_HI, so anything narrower
+ * than 64 bits comes from the platform, not the device.
+ */
+int apollo_dma_set_mask(struct apollo_device *apollo)
+{
+	struct device *dev = &apollo->pci->dev;
+	static const unsigned int widths[] = { 64, 48, 40, 32 };
+	int i, err = -EIO;
+
+	for (i = 0; i < ARRAY_SIZE(widths); i++) {
+		err = dma_set_mask_and_coherent(dev, DMA_BIT_MASK(widths[i]));
+		if (!err) {
+			apollo->dma_bits = widths[i];
+			break;
+		}
+	}
+
+	if (err) {
+		dev_err(dev, "No usable DMA mask\n");
+		return err;
+	}
+
+	atomic_set(&apollo->dma_unreachable, 0);
+
+	dev_info(dev, "Using %u-bit DMA addressing%s\n", apollo->dma_bits,
+		 dma_addressing_limited(dev) ? " (limited, may bounce)" : "");
+	return 0;
+}
+
+/*
+ * Buffers come from the DMA allocator and are never bounced, but make sure
+ * every address the engine is given is actually reachable under the mask.
+ */
+static int apollo_dma_check_reach(struct apollo_device *apollo, dma_addr_t addr,
+				  size_t len)
+{
+	u64 mask = dma_get_mask(&apollo->pci->dev);
+
+	if (addr + len - 1 <= mask)
+		return 0;
+
+	atomic_inc(&apollo->dma_unreachable);
+	dev_err(&apollo->pci->dev, "DMA address %pad+%zu outside %u-bit mask\n",
+		&addr, len, apollo->dma_bits);
+	return -EIO;
+}
+
+static int apollo_dma_setup_stream(struct snd_pcm_str *pstr, int type,
+				   struct device *dev, size_t size, size_t max)
+{
+	struct snd_pcm_substream *substream;
+	int err = 0;
+
+	for (substream = pstr->substream; substream && !err; substream = substream->next) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+		snd_pcm_set_managed_buffer(substream, type, dev, size, max);
+#else
+		err = snd_pcm_lib_preallocate_pages(substream, type, dev, size, max);
+#endif
+	}
+
+	return err;
+}
+
+static bool apollo_dma_want_noncoherent(void)
+{
+	if (!APOLLO_HAVE_NONCOHERENT)
+		return false;
+	if (dma_noncoherent >= 0)
+		return dma_noncoherent;
+	return !IS_ENABLED(CONFIG_X86);
+}
+
+/* Buffer type for the current mode */
+int apollo_dma_type(struct apollo_device *apollo)
+{
+#if APOLLO_HAVE_NONCOHERENT
+	if (apollo->noncoherent)
+		return apollo->sg ? SNDRV_DMA_TYPE_NONCONTIG : SNDRV_DMA_TYPE_NONCOHERENT;
+#endif
+	return apollo->sg ? SNDRV_DMA_TYPE_DEV_SG : SNDRV_DMA_TYPE_DEV;
+}
+
+/* Extra runtime info flags for the current mode */
+unsigned int apollo_dma_info(struct apollo_device *apollo)
+{
+#if APOLLO_HAVE_NONCOHERENT
+	if (apollo->noncoherent)
+		return SNDRV_PCM_INFO_EXPLICIT_SYNC;
+#endif
+	return 0;
+}
+
+/* Hand a buffer the CPU has just written over to the device */
+void apollo_dma_sync_for_device(struct apollo_device *apollo, struct snd_dma_buffer *dmab)
+{
+#if APOLLO_HAVE_NONCOHERENT
+	if (apollo->noncoherent)
+		snd_dma_buffer_sync(dmab, SNDRV_DMA_SYNC_DEVICE);
+#endif
+}
+
+/*
+ * The same for len bytes at offset. A contiguous buffer is one mapping,
+ * so only the range is synced; a scatter-gather one has no single handle
+ * for it and is synced whole.
+ */
+void apollo_dma_sync_range_for_device(struct apollo_device *apollo,
+				      struct snd_dma_buffer *dmab, size_t offset, size_t len)
+{
+#if APOLLO_HAVE_NONCOHERENT
+	if (!apollo->noncoherent)
+		return;
+	if (dmab->dev.type == SNDRV_DMA_TYPE_NONCOHERENT)
+		dma_sync_single_range_for_device(dmab->dev.dev, dmab->addr, offset, len,
+						 DMA_TO_DEVICE);
+	else
+		snd_dma_buffer_sync(dmab, SNDRV_DMA_SYNC_DEVICE);
+#endif
+}
+
+int apollo_dma_init(struct apollo_device *apollo)
+{
+	struct device *dev = &apollo->pci->dev;
+	struct snd_pcm_str *streams = apollo->pcm->streams;
+	size_t prealloc = (size_t)prealloc_kb * 1024;
+	size_t size, max;
+	int type, err;
+
+	apollo->sg = sg_buffers;
+	apollo->noncoherent = apollo_dma_want_noncoherent();
+	prealloc = clamp_t(size_t, prealloc, PAGE_SIZE, APOLLO_MAX_BUFFER_SIZE);
+	type = apollo_dma_type(apollo);
+
+	if (apollo->sg) {
+		dev_info(dev, "Using %s scatter-gather DMA buffers (max %d KB)\n",
+			 apollo->noncoherent ? "non-coherent" : "coherent",
+			 APOLLO_MAX_BUFFER_SIZE / 1024);
+		size = 0;
+		max = APOLLO_MAX_BUFFER_SIZE;
+	} else {
+		dev_info(dev, "Using %s contiguous DMA buffers (%zu KB preallocated)\n",
+			 apollo->noncoherent ? "non-coherent" : "coherent", prealloc / 1024);
+		/* max == 0: only the preallocated buffer is ever used */
+		size = prealloc;
+		max = 0;
+	}
+
+	err = apollo_dma_set_page_ops(apollo);
+	if (err)
+		return err;
+
+	err = apollo_dma_setup_stream(&streams[SNDRV_PCM_STREAM_CAPTURE], type, dev, size, max);
+	if (err)
+		return err;
+
+	/*
+	 * The loopback reads the playback ring in place, so that ring must
+	 * never be reallocated or freed under it: preallocate it in either
+	 * mode and never grow past it.
+	 */
+	if (apollo->loopback_pcm) {
+		size = prealloc;
+		max = 0;
+	}
+
+	return apollo_dma_setup_stream(&streams[SNDRV_PCM_STREAM_PLAYBACK], type, dev, size, max);
+}
+
+/* Is this substream limited to the buffer preallocated at probe? */
+bool apollo_dma_fixed(struct apollo_device *apollo,
+		      struct snd_pcm_substream *substream)
+{
+	return !apollo->sg ||
+	       (apollo->loopback_pcm && substream->stream == SNDRV_PCM_STREAM_PLAYBACK);
+}
+
+void apollo_dma_unmap_ring(struct apollo_device *apollo, struct apollo_stream *stream)
+{
+	if (!stream->desc)
+		return;
+
+	dma_free_coherent(&apollo->pci->dev, stream->desc_bytes,
+			  stream->desc, stream->desc_addr);
+	stream->desc = NULL;
+	stream->desc_count = 0;
+}
+
+/*
+ * Describe the first bytes of dmab to the engine. In contiguous mode this
+ * only checks reachability; in scatter-gather mode it (re)builds the
+ * descriptor table of the stream.
+ */
+int apollo_dma_map_ring(struct apollo_device *apollo, struct apollo_stream *stream,
+			struct snd_dma_buffer *dmab, size_t bytes)
+{
+	unsigned int max_desc, n = 0;
+	size_t ofs = 0;
+
+	if (!apollo->sg)
+		return apollo_dma_check_reach(apollo, dmab->addr, bytes);
+
+	apollo_dma_unmap_ring(apollo, stream);
+
+	/* Worst case is one descriptor per page; contiguous runs are merged */
+	max_desc = DIV_ROUND_UP(bytes, PAGE_SIZE);
+	stream->desc_bytes = max_desc * sizeof(*stream->desc);
+	stream->desc = dma_alloc_coherent(&apollo->pci->dev, stream->desc_bytes,
+					  &stream->desc_addr, GFP_KERNEL);
+	if (!stream->desc)
+		return -ENOMEM;
+
+	if (apollo_dma_check_reach(apollo, stream->desc_addr, stream->desc_bytes)) {
+		apollo_dma_unmap_ring(apollo, stream);
+		return -EIO;
+	}
+
+	while (ofs < bytes && n < max_desc) {
+		unsigned int chunk = snd_sgbuf_get_chunk_size(dmab, ofs, bytes - ofs);
+		dma_addr_t addr = snd_sgbuf_get_addr(dmab, ofs);
+
+		if (apollo_dma_check_reach(apollo, addr, chunk)) {
+			apollo_dma_unmap_ring(apollo, stream);
+			return -EIO;
+		}
+
+		stream->desc[n].addr = cpu_to_le64(addr);
+		stream->desc[n].len = cpu_to_le32(chunk);
+		stream->desc[n].flags = 0;
+		ofs += chunk;
+		n++;
+	}
+	stream->desc[n - 1].flags = cpu_to_le32(APOLLO_DESC_EOL);
+	stream->desc_count = n;
+
+	dev_dbg(&apollo->pci->dev, "Ring: %zu bytes in %u descriptors\n", bytes, n);
+
+	return 0;
+}
+
+void apollo_dma_program_ring(struct apollo_device *apollo, struct apollo_stream *stream,
+			     dma_addr_t addr, size_t bytes)
+{
+	if (apollo->sg)
+		addr = stream->desc_addr;
+
+	apollo_seq_dma_ring(apollo, addr, bytes);
+}
+
+/* Byte offset of the engine inside a ring at addr, or -ERANGE */
+long apollo_dma_ring_pos(struct apollo_device *apollo, dma_addr_t addr, size_t bytes)
+{
+	return apollo_seq_ring_pos(apollo, apollo->sg, addr, bytes);
+}
+
+void apollo_dma_free_table(struct apollo_device *apollo,
+			   struct snd_pcm_substream *substream)
+{
+	apollo_dma_unmap_ring(apollo, &apollo->streams[substream->stream]);
+}
+
+int apollo_dma_build_table(struct apollo_device *apollo,
+			   struct snd_pcm_substream *substream)
+{
+	return apollo_dma_map_ring(apollo, &apollo->streams[substream->stream],
+				   snd_pcm_get_dma_buf(substream),
+				   substream->runtime->dma_bytes);
+}
+
+void apollo_dma_program(struct apollo_device *apollo,
+			struct snd_pcm_substream *substream)
+{
+	struct snd_pcm_runtime *runtime = substream->runtime;
+
+	apollo_dma_program_ring(apollo, &apollo->streams[substream->stream],
+				runtime->dma_addr, runtime->dma_bytes);
+}
+
+/*
+ * CPU side of a period in each mode: the playback pattern writes a buffer
+ * and hands it to the device, the capture pattern takes it back and reads
+ * it. The engine is idle, so only the cache behaviour is measured.
+ */
+static void apollo_dma_bench_type(struct apollo_device *apollo, int type, const char *name)
+{
+	const unsigned int passes = 16;
+	struct snd_dma_buffer dmab;
+	u64 t0, t_write, t_read, sum = 0;
+	unsigned int i;
+	size_t j;
+
+	if (snd_dma_alloc_pages(type, &apollo->pci->dev, SZ_1M, &dmab) < 0) {
+		dev_info(&apollo->pci->dev, "DMA bench: no %s buffer\n", name);
+		return;
+	}
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < passes; i++) {
+		memset(dmab.area, i, dmab.bytes);
+#if APOLLO_HAVE_NONCOHERENT
+		snd_dma_buffer_sync(&dmab, SNDRV_DMA_SYNC_DEVICE);
+#endif
+	}
+	t_write = ktime_get_ns() - t0;
+
+	t0 = ktime_get_ns();
+	for (i = 0; i < passes; i++) {
+#if APOLLO_HAVE_NONCOHERENT
+		snd_dma_buffer_sync(&dmab, SNDRV_DMA_SYNC_CPU);
+#endif
+		for (j = 0; j < dmab.bytes / sizeof(u64); j++)
+			sum += READ_ONCE(((u64 *)dmab.area)[j]);
+	}
+	t_read = ktime_get_ns() - t0;
+
+	/* The checksum keeps the read loop from being optimised away */
+	dev_info(&apollo->pci->dev, "DMA bench %s: CPU write %llu KB/s, read %llu KB/s (%02llx)\n",
+		 name, apollo_kbps(dmab.bytes * passes, t_write),
+		 apollo_kbps(dmab.bytes * passes, t_read), sum & 0xff);
+
+	snd_dma_free_pages(&dmab);
+}
+
+/* Compare CPU access to both buffer kinds, whatever the current mode */
+void apollo_dma_bench(struct apollo_device *apollo)
+{
+	if (!dma_bench)
+		return;
+
+	apollo_dma_bench_type(apollo, SNDRV_DMA_TYPE_DEV, "coherent");
+#if APOLLO_HAVE_NONCOHERENT
+	apollo_dma_bench_type(apollo, SNDRV_DMA_TYPE_NONCOHERENT, "non-coherent");
+#endif
+}
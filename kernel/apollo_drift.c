@@ -0,0 +1,331 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Twin Sample Clock Drift Estimator
+ *
+ * PipeWire, A/V sync tools and aggregate devices all need the rate of the
+ * device clock against CLOCK_MONOTONIC, and each used to run its own loop
+ * on noisy poll() timestamps. The driver has better input: the period
+ * interrupt knows how far the hardware position already is past the
+ * boundary, so the boundary time can be recovered to within a frame
+ * whatever the interrupt latency. A second-order DLL (F. Adriaensen,
+ * "Using a DLL to filter time") filters those boundary times.
+ *
+ * The "Clock Drift" control publishes the result as 64-bit integers:
+ *
+ *   0  rate deviation, ppb (positive: the device clock runs fast)
+ *   1  CLOCK_MONOTONIC time of the reference boundary, ns
+ *   2  frames since the stream started at that boundary
+ *   3  last boundary against its prediction, ns
+ *   4  average absolute error, ns
+ *   5  confidence, 0-1000
+ *   6  stream feeding the loop (SNDRV_PCM_STREAM_*), -1 when idle
+ *
+ * The device frame at time t is then about
+ * frame + (t - time) * rate * (1 + ppb / 1e9) / 1e9. A change event is
+ * sent when the loop starts, settles or stops.
+ *
+ * The loop itself never touches the device; the KUnit suite drives it
+ * with a simulated drifting clock.
+ */
+
+#include <linux/module.h>
+#include <linux/math64.h>
+#include <linux/timekeeping.h>
+#include <sound/core.h>
+#include <sound/control.h>
+#include <sound/pcm.h>
+#include "apollo.h"
+
+static unsigned int drift_bw_mhz = 250;
+module_param(drift_bw_mhz, uint, 0444);
+MODULE_PARM_DESC(drift_bw_mhz, "Bandwidth of the clock drift estimator (mHz, default: 250)");
+
+#define APOLLO_DLL_FRAC		(BIT_ULL(APOLLO_DLL_SHIFT) - 1)
+#define APOLLO_DLL_2PI_Q32	26986075409ULL		/* 2 * pi << 32 */
+#define APOLLO_DLL_MAX_PPM	10000			/* clamp of the period estimate */
+
+/* Confidence at or above which the loop counts as settled */
+#define APOLLO_DRIFT_SETTLED	900
+
+enum {
+	APOLLO_DRIFT_PPB,
+	APOLLO_DRIFT_TIME,
+	APOLLO_DRIFT_FRAME,
+	APOLLO_DRIFT_ERROR,
+	APOLLO_DRIFT_JITTER,
+	APOLLO_DRIFT_CONFIDENCE,
+	APOLLO_DRIFT_STREAM,
+	APOLLO_DRIFT_VALUES,
+};
+
+static void apollo_dll_advance(struct apollo_dll *dll, u64 inc)
+{
+	inc += dll->t1_frac;
+	dll->t1 += inc >> APOLLO_DLL_SHIFT;
+	dll->t1_frac = inc & APOLLO_DLL_FRAC;
+}
+
+/* (Re)start the loop on the boundary at 'boundary', keeping the period estimate */
+static void apollo_dll_lock(struct apollo_dll *dll, u64 boundary)
+{
+	dll->t0 = boundary;
+	dll->t1 = boundary;
+	dll->t1_frac = 0;
+	apollo_dll_advance(dll, dll->e2);
+	dll->err = 0;
+	dll->jitter = 0;
+	dll->updates = 1;
+}
+
+/*
+ * Loop gains for a bandwidth of bw_mhz: omega = 2 pi B T, b = sqrt(2) omega,
+ * c = omega^2. The loop settles in a few 1 / omega periods.
+ */
+void apollo_dll_init(struct apollo_dll *dll, u32 period, u32 rate, u32 bw_mhz)
+{
+	u64 omega;
+
+	memset(dll, 0, sizeof(*dll));
+	if (!period || !rate)
+		return;
+
+	dll->period = period;
+	dll->nominal = mul_u64_u32_div((u64)NSEC_PER_SEC << APOLLO_DLL_SHIFT, period, rate);
+	dll->e2 = dll->nominal;
+
+	omega = mul_u64_u32_div(APOLLO_DLL_2PI_Q32, max(bw_mhz, 1U), 1000);
+	omega = mul_u64_u32_div(omega, min_t(u64, dll->nominal >> APOLLO_DLL_SHIFT, U32_MAX),
+				NSEC_PER_SEC);
+	omega = clamp_t(u64, omega, 1, BIT_ULL(31));
+
+	dll->b = mul_u64_u32_div(omega, 1414214, 1000000);
+	dll->c = (omega * omega) >> 32;
+	dll->settle = clamp_t(u64, div64_u64(4ULL << 32, omega), 16, U32_MAX);
+}
+
+/*
+ * A period interrupt 'crossed' boundaries after the last one, at 'now',
+ * with the hardware position 'late' frames past the newest boundary. The
+ * position is truncated to a frame, so take the boundary to be half a
+ * frame further back. A boundary more than half a period off its
+ * prediction means interrupts were lost or the clock jumped: restart from
+ * it rather than let the loop slew.
+ */
+void apollo_dll_update(struct apollo_dll *dll, u64 now, unsigned int crossed, u32 late)
+{
+	u64 boundary, abs_err;
+	s64 err;
+
+	if (!dll->period || !crossed)
+		return;
+
+	boundary = now - (mul_u64_u32_div(dll->e2, 2 * late + 1, 2 * dll->period) >>
+			  APOLLO_DLL_SHIFT);
+	dll->f0 += (u64)crossed * dll->period;
+
+	if (!dll->updates) {
+		apollo_dll_lock(dll, boundary);
+		return;
+	}
+
+	if (crossed > 1)
+		apollo_dll_advance(dll, (u64)(crossed - 1) * dll->e2);
+
+	err = (s64)(boundary - dll->t1);
+	abs_err = abs(err);
+	if (abs_err > dll->e2 >> (APOLLO_DLL_SHIFT + 1)) {
+		dll->resets++;
+		apollo_dll_lock(dll, boundary);
+		return;
+	}
+
+	dll->t0 = dll->t1;
+	apollo_dll_advance(dll, dll->e2 + (((s64)dll->b * err) >> (32 - APOLLO_DLL_SHIFT)));
+	dll->e2 += ((s64)dll->c * err) >> (32 - APOLLO_DLL_SHIFT);
+	dll->e2 = clamp_t(u64, dll->e2,
+			  dll->nominal - mul_u64_u32_div(dll->nominal, APOLLO_DLL_MAX_PPM, 1000000),
+			  dll->nominal + mul_u64_u32_div(dll->nominal, APOLLO_DLL_MAX_PPM, 1000000));
+
+	dll->err = err;
+	dll->jitter += (abs_err >> 4) - (dll->jitter >> 4);
+	if (dll->updates < U32_MAX)
+		dll->updates++;
+}
+
+/* Device rate against its nominal rate, in parts per billion */
+s64 apollo_dll_ppb(const struct apollo_dll *dll)
+{
+	u64 scale = div_u64(dll->e2, NSEC_PER_SEC);
+
+	if (!scale)
+		return 0;
+	return div64_s64((s64)(dll->nominal - dll->e2), scale);
+}
+
+/*
+ * 0 right after a (re)start, rising to 1000 once the loop has run for its
+ * settling time with an average error well inside the period.
+ */
+u32 apollo_dll_confidence(const struct apollo_dll *dll)
+{
+	u64 period_ns = dll->e2 >> APOLLO_DLL_SHIFT;
+	u32 settled, quality;
+
+	if (!dll->updates || !period_ns || dll->jitter * 4 >= period_ns)
+		return 0;
+
+	settled = div_u64((u64)min(dll->updates - 1, dll->settle) * 1000, dll->settle);
+	quality = 1000 - div64_u64(dll->jitter * 4000, period_ns);
+	return settled * quality / 1000;
+}
+
+static void apollo_drift_notify(struct apollo_device *apollo)
+{
+	if (apollo->drift.ctl)
+		snd_ctl_notify(apollo->card, SNDRV_CTL_EVENT_MASK_VALUE, &apollo->drift.ctl->id);
+}
+
+/* Trigger start: the first stream to start feeds the loop */
+void apollo_drift_start(struct apollo_device *apollo, int dir, u32 period, u32 rate)
+{
+	struct apollo_drift *drift = &apollo->drift;
+	unsigned long flags;
+	bool started = false;
+
+	spin_lock_irqsave(&drift->lock, flags);
+	if (drift->dir < 0) {
+		drift->dir = dir;
+		drift->rate = rate;
+		drift->settled = false;
+		apollo_dll_init(&drift->dll, period, rate, drift_bw_mhz);
+		started = true;
+	}
+	spin_unlock_irqrestore(&drift->lock, flags);
+
+	if (started)
+		apollo_drift_notify(apollo);
+}
+
+void apollo_drift_stop(struct apollo_device *apollo, int dir)
+{
+	struct apollo_drift *drift = &apollo->drift;
+	unsigned long flags;
+	bool stopped = false;
+
+	spin_lock_irqsave(&drift->lock, flags);
+	if (drift->dir == dir) {
+		drift->dir = -1;
+		drift->settled = false;
+		stopped = true;
+	}
+	spin_unlock_irqrestore(&drift->lock, flags);
+
+	if (stopped)
+		apollo_drift_notify(apollo);
+}
+
+/* The clock source, lock or rate changed: forget the old estimate */
+void apollo_drift_restart(struct apollo_device *apollo)
+{
+	struct apollo_drift *drift = &apollo->drift;
+	struct apollo_dll *dll = &drift->dll;
+	unsigned long flags;
+	bool running;
+
+	spin_lock_irqsave(&drift->lock, flags);
+	running = drift->dir >= 0;
+	if (running) {
+		u64 frames = dll->f0;
+
+		apollo_dll_init(dll, dll->period, drift->rate, drift_bw_mhz);
+		dll->f0 = frames;
+		drift->settled = false;
+	}
+	spin_unlock_irqrestore(&drift->lock, flags);
+
+	if (running)
+		apollo_drift_notify(apollo);
+}
+
+/* Period interrupt of stream dir; late is the position past the boundary */
+void apollo_drift_period(struct apollo_device *apollo, int dir, unsigned int crossed,
+			 snd_pcm_uframes_t late)
+{
+	struct apollo_drift *drift = &apollo->drift;
+	u64 now = ktime_get_ns();
+	bool changed = false;
+
+	spin_lock(&drift->lock);
+	if (drift->dir == dir) {
+		bool settled;
+
+		apollo_dll_update(&drift->dll, now, crossed, late);
+		settled = apollo_dll_confidence(&drift->dll) >= APOLLO_DRIFT_SETTLED;
+		changed = settled != drift->settled;
+		drift->settled = settled;
+	}
+	spin_unlock(&drift->lock);
+
+	if (changed)
+		apollo_drift_notify(apollo);
+}
+
+static int apollo_drift_info(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER64;
+	uinfo->count = APOLLO_DRIFT_VALUES;
+	uinfo->value.integer64.min = LLONG_MIN;
+	uinfo->value.integer64.max = LLONG_MAX;
+	return 0;
+}
+
+static int apollo_drift_get(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+	struct apollo_drift *drift = &apollo->drift;
+	const struct apollo_dll *dll = &drift->dll;
+	long long *v = uvalue->value.integer64.value;
+	unsigned long flags;
+
+	memset(v, 0, APOLLO_DRIFT_VALUES * sizeof(*v));
+
+	spin_lock_irqsave(&drift->lock, flags);
+	v[APOLLO_DRIFT_STREAM] = drift->dir;
+	if (drift->dir >= 0 && dll->updates) {
+		v[APOLLO_DRIFT_PPB] = apollo_dll_ppb(dll);
+		v[APOLLO_DRIFT_TIME] = dll->t0;
+		v[APOLLO_DRIFT_FRAME] = dll->f0;
+		v[APOLLO_DRIFT_ERROR] = dll->err;
+		v[APOLLO_DRIFT_JITTER] = dll->jitter;
+		v[APOLLO_DRIFT_CONFIDENCE] = apollo_dll_confidence(dll);
+	}
+	spin_unlock_irqrestore(&drift->lock, flags);
+	return 0;
+}
+
+static const struct snd_kcontrol_new apollo_drift_ctl = {
+	.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name = "Clock Drift",
+	.access = SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE,
+	.info = apollo_drift_info,
+	.get = apollo_drift_get,
+};
+
+int apollo_drift_new(struct apollo_device *apollo)
+{
+	struct snd_kcontrol *kctl;
+	int err;
+
+	spin_lock_init(&apollo->drift.lock);
+	apollo->drift.dir = -1;
+
+	kctl = snd_ctl_new1(&apollo_drift_ctl, apollo);
+	err = snd_ctl_add(apollo->card, kctl);
+	if (err < 0) {
+		dev_err(&apollo->pci->dev, "Failed to add control %s\n", apollo_drift_ctl.name);
+		return err;
+	}
+	apollo->drift.ctl = kctl;
+
+	return 0;
+}
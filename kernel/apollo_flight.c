@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Twin Flight Recorder
+ *
+ * Keeps the last few seconds of driver activity in a fixed ring of
+ * 16-byte events: interrupt status, hardware positions, pointer
+ * callbacks, triggers and writes to the device. The first xrun, seen
+ * when the stream is prepared again, or the first engine error freezes
+ * the ring, so the events leading up to it survive until
+ * apollod has read the flight_recorder sysfs file and re-armed it. The
+ * "Flight Recorder Frozen" control announces the freeze.
+ *
+ * Logging is one cmpxchg on the head, a clock read and a 16-byte store,
+ * with no lock, so any context may log, including the interrupt handler.
+ * A logger that claimed a slot just before the freeze may still be
+ * filling it; the first read after a freeze waits for such loggers with
+ * synchronize_rcu(), since each runs with preemption disabled.
+ */
+
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/rcupdate.h>
+#include <linux/timekeeping.h>
+#include <sound/core.h>
+#include <sound/control.h>
+#include <sound/pcm.h>
+#include "apollo.h"
+
+static unsigned int flight_events = 8192;
+module_param(flight_events, uint, 0444);
+MODULE_PARM_DESC(flight_events, "Events kept by the xrun flight recorder, 0 to disable (default: 8192)");
+
+#define APOLLO_FLIGHT_MIN_EVENTS	64
+#define APOLLO_FLIGHT_MAX_EVENTS	(1U << 20)
+
+void apollo_flight_init(struct apollo_flight *flight, struct apollo_flight_event *ring,
+			unsigned int size)
+{
+	flight->ring = ring;
+	flight->size = size;
+	memset(&flight->frozen, 0, sizeof(flight->frozen));
+	atomic_set(&flight->freezing, 0);
+	flight->settled = false;
+	atomic_set(&flight->head, 0);
+}
+
+void apollo_flight_log(struct apollo_flight *flight, u8 type, u8 stream, u16 arg, u32 value)
+{
+	struct apollo_flight_event *ev;
+	unsigned int old, new, cur;
+
+	if (!flight->ring)
+		return;
+
+	/* Claim to fill without preemption: apollo_flight_read() relies on it */
+	preempt_disable();
+
+	old = atomic_read(&flight->head);
+	for (;;) {
+		if (old & APOLLO_FLIGHT_FROZEN)
+			goto out;
+		/* After 2^31 events, carry on from an index that keeps the ring full */
+		new = old + 1 == APOLLO_FLIGHT_FROZEN ? flight->size : old + 1;
+		cur = atomic_cmpxchg(&flight->head, old, new);
+		if (cur == old)
+			break;
+		old = cur;
+	}
+
+	ev = &flight->ring[old & (flight->size - 1)];
+	ev->ns = ktime_get_mono_fast_ns();
+	ev->value = value;
+	ev->type = type;
+	ev->stream = stream;
+	ev->arg = arg;
+out:
+	preempt_enable();
+}
+
+/*
+ * Log the event that ended the stream and stop the ring, unless it is
+ * already stopped: the first failure is the interesting one, the rest
+ * usually follow from it. Called from the interrupt handler and from the
+ * prepare callbacks; the first caller claims the header. Returns true if
+ * this call froze the ring.
+ */
+bool apollo_flight_freeze(struct apollo_flight *flight, u8 reason,
+			  struct snd_pcm_substream *substream)
+{
+	struct apollo_flight_header *hdr = &flight->frozen;
+	struct snd_pcm_runtime *runtime = substream ? substream->runtime : NULL;
+	unsigned int old, cur;
+
+	if (!flight->ring || atomic_read(&flight->head) & APOLLO_FLIGHT_FROZEN)
+		return false;
+	if (atomic_cmpxchg(&flight->freezing, 0, 1))
+		return false;
+
+	apollo_flight_log(flight, reason, substream ? substream->stream : 0, 0,
+			  runtime ? runtime->status->hw_ptr : 0);
+
+	hdr->reason = reason;
+	hdr->stream = substream ? substream->stream : -1;
+	hdr->rate = runtime ? runtime->rate : 0;
+	hdr->period_size = runtime ? runtime->period_size : 0;
+	hdr->buffer_size = runtime ? runtime->buffer_size : 0;
+	hdr->mono_ns = ktime_get_mono_fast_ns();
+	hdr->real_ns = ktime_get_real_ns();
+
+	/* Fully ordered, so readers that see the bit also see the header */
+	old = atomic_read(&flight->head);
+	while ((cur = atomic_cmpxchg(&flight->head, old, old | APOLLO_FLIGHT_FROZEN)) != old)
+		old = cur;
+
+	if (flight->frozen_ctl)
+		snd_ctl_notify(flight->card, SNDRV_CTL_EVENT_MASK_VALUE, &flight->frozen_ctl->id);
+	return true;
+}
+
+/*
+ * The flight_recorder file: a struct apollo_flight_header, then the
+ * frozen events oldest first. While armed the header reports reason 0
+ * and no events. Large reads arrive in pieces, so this serves any offset.
+ * Process context only: the first read after a freeze may sleep.
+ */
+ssize_t apollo_flight_read(struct apollo_flight *flight, char *buf, loff_t off, size_t count)
+{
+	const size_t esize = sizeof(struct apollo_flight_event);
+	struct apollo_flight_header hdr = { .stream = -1 };
+	unsigned int head, first;
+	size_t len, done = 0;
+
+	if (!flight->ring)
+		return -ENODEV;
+
+	head = atomic_read(&flight->head);
+	smp_rmb();	/* pairs with the cmpxchg in apollo_flight_freeze() */
+
+	if (head & APOLLO_FLIGHT_FROZEN) {
+		/* Let loggers that claimed a slot before the freeze finish it */
+		if (!READ_ONCE(flight->settled)) {
+			synchronize_rcu();
+			WRITE_ONCE(flight->settled, true);
+		}
+		hdr = flight->frozen;
+		hdr.total = head & ~APOLLO_FLIGHT_FROZEN;
+		hdr.count = min(hdr.total, flight->size);
+	} else {
+		hdr.total = head;
+	}
+	hdr.magic = APOLLO_FLIGHT_MAGIC;
+	hdr.version = APOLLO_FLIGHT_VERSION;
+	hdr.event_size = esize;
+	hdr.size = flight->size;
+
+	len = sizeof(hdr) + (size_t)hdr.count * esize;
+	if (off < 0 || off >= len)
+		return 0;
+	count = min_t(size_t, count, len - off);
+	first = hdr.total - hdr.count;
+
+	while (done < count) {
+		size_t pos = off + done, n;
+		const u8 *src;
+
+		if (pos < sizeof(hdr)) {
+			src = (const u8 *)&hdr + pos;
+			n = sizeof(hdr) - pos;
+		} else {
+			size_t i = (pos - sizeof(hdr)) / esize;
+			size_t in = (pos - sizeof(hdr)) % esize;
+
+			src = (const u8 *)&flight->ring[(first + i) & (flight->size - 1)] + in;
+			n = esize - in;
+		}
+
+		n = min(n, count - done);
+		memcpy(buf + done, src, n);
+		done += n;
+	}
+
+	return done;
+}
+
+/* Start recording again after the frozen events have been collected */
+int apollo_flight_rearm(struct apollo_flight *flight)
+{
+	if (!flight->ring)
+		return -ENODEV;
+	if (!(atomic_read(&flight->head) & APOLLO_FLIGHT_FROZEN))
+		return 0;
+
+	/* Nothing else moves head while it is frozen */
+	WRITE_ONCE(flight->settled, false);
+	atomic_set(&flight->freezing, 0);
+	smp_wmb();	/* a freeze that sees the ring armed may claim it */
+	atomic_set(&flight->head, 0);
+
+	if (flight->frozen_ctl)
+		snd_ctl_notify(flight->card, SNDRV_CTL_EVENT_MASK_VALUE, &flight->frozen_ctl->id);
+	return 0;
+}
+
+static int apollo_flight_frozen_info(struct snd_kcontrol *kcontrol,
+				     struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_BOOLEAN;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = 1;
+	return 0;
+}
+
+static int apollo_flight_frozen_get(struct snd_kcontrol *kcontrol,
+				    struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+
+	uvalue->value.integer.value[0] =
+		!!(atomic_read(&apollo->flight.head) & APOLLO_FLIGHT_FROZEN);
+	return 0;
+}
+
+static const struct snd_kcontrol_new apollo_flight_control = {
+	.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name = "Flight Recorder Frozen",
+	.access = SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE,
+	.info = apollo_flight_frozen_info,
+	.get = apollo_flight_frozen_get,
+};
+
+static void apollo_flight_free(void *ring)
+{
+	vfree(ring);
+}
+
+int apollo_flight_new(struct apollo_device *apollo)
+{
+	struct apollo_flight *flight = &apollo->flight;
+	struct apollo_flight_event *ring;
+	struct snd_kcontrol *kctl;
+	unsigned int size;
+	int err;
+
+	if (!flight_events)
+		return 0;
+
+	size = roundup_pow_of_two(clamp_t(unsigned int, flight_events, APOLLO_FLIGHT_MIN_EVENTS,
+					  APOLLO_FLIGHT_MAX_EVENTS));
+	ring = vzalloc(size * sizeof(*ring));
+	if (!ring)
+		return -ENOMEM;
+
+	/* Freed after remove, once the interrupt can no longer log */
+	err = devm_add_action_or_reset(&apollo->pci->dev, apollo_flight_free, ring);
+	if (err)
+		return err;
+
+	apollo_flight_init(flight, ring, size);
+
+	flight->card = apollo->card;
+	kctl = snd_ctl_new1(&apollo_flight_control, apollo);
+	err = snd_ctl_add(apollo->card, kctl);
+	if (err < 0) {
+		dev_err(&apollo->pci->dev, "Failed to add control %s\n",
+			apollo_flight_control.name);
+		return err;
+	}
+	flight->frozen_ctl = kctl;
+
+	return 0;
+}
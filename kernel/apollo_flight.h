@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Apollo Twin Flight Recorder Format
+ *
+ * Layout of the driver's flight_recorder sysfs file, shared with apollod
+ * (userspace/apollo_flight_report.c): one header followed by header.count
+ * events, oldest first. Only fixed-width UAPI types, so the file can be
+ * included from both sides. Fields may be appended to the header and the
+ * event: readers take the event size from the header and find the events
+ * at the end of the file.
+ */
+
+#ifndef _APOLLO_FLIGHT_H
+#define _APOLLO_FLIGHT_H
+
+#include <linux/types.h>
+
+#define APOLLO_FLIGHT_MAGIC	0x52465041	/* "APFR" */
+#define APOLLO_FLIGHT_VERSION	1
+
+/* Event types; APOLLO_FLIGHT_XRUN and APOLLO_FLIGHT_ERROR freeze the ring */
+enum apollo_flight_type {
+	APOLLO_FLIGHT_IRQ = 1,		/* value: interrupt status */
+	APOLLO_FLIGHT_PERIOD,		/* value: hw position, arg: periods crossed */
+	APOLLO_FLIGHT_POINTER,		/* value: position reported, arg: substream */
+	APOLLO_FLIGHT_TRIGGER,		/* value: substream, arg: SNDRV_PCM_TRIGGER_* */
+	APOLLO_FLIGHT_CONTROL,		/* value: command written to the device */
+	APOLLO_FLIGHT_PARAM,		/* value: staged value, arg: APOLLO_PARAM_* */
+	APOLLO_FLIGHT_XRUN,		/* value: ALSA hw_ptr */
+	APOLLO_FLIGHT_ERROR,		/* follows the APOLLO_FLIGHT_IRQ with the status */
+};
+
+struct apollo_flight_event {
+	__u64 ns;		/* CLOCK_MONOTONIC */
+	__u32 value;
+	__u8 type;		/* APOLLO_FLIGHT_* */
+	__u8 stream;		/* SNDRV_PCM_STREAM_*, 0 if none */
+	__u16 arg;
+};
+
+struct apollo_flight_header {
+	__u32 magic;
+	__u16 version;
+	__u16 event_size;
+	__u32 reason;		/* event that froze the ring, 0 while armed */
+	__s32 stream;		/* the stream that ran out, -1 if none */
+	__u32 rate;		/* its parameters at the time */
+	__u32 period_size;
+	__u32 buffer_size;
+	__u32 count;		/* events that follow */
+	__u32 total;		/* events logged since armed, including lost ones */
+	__u32 size;		/* capacity of the ring */
+	__u64 mono_ns;		/* CLOCK_MONOTONIC when it froze */
+	__u64 real_ns;		/* CLOCK_REALTIME when it froze */
+};
+
+#endif /* _APOLLO_FLIGHT_H */
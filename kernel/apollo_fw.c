@@ -0,0 +1,268 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Twin Firmware Loading
+ *
+ * The firmware image is requested asynchronously so probe never blocks
+ * enumeration. Once read it is verified and kept in a module-wide cache,
+ * so resume and replug upload straight from memory. The ALSA card is only
+ * registered after the first upload has finished.
+ */
+
+#include <linux/module.h>
+#include <linux/firmware.h>
+#include <linux/crc32.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/delay.h>
+#include <sound/core.h>
+#include "apollo.h"
+
+#define APOLLO_FW_CHUNK		4096
+#define APOLLO_FW_TIMEOUT_MS	100
+
+static char *firmware = "apollo/apollo_twin.bin";
+module_param(firmware, charp, 0444);
+MODULE_PARM_DESC(firmware, "Firmware image to upload, empty to skip (default: apollo/apollo_twin.bin)");
+
+static uint fw_crc;
+module_param(fw_crc, uint, 0444);
+MODULE_PARM_DESC(fw_crc, "Expected CRC32 of the firmware image, 0 to accept any");
+
+MODULE_FIRMWARE("apollo/apollo_twin.bin");
+
+/* Verified image shared by all devices, survives suspend and replug */
+static DEFINE_MUTEX(apollo_fw_cache_lock);
+static void *apollo_fw_cache;
+static size_t apollo_fw_cache_size;
+static u32 apollo_fw_cache_crc;
+
+static const char *const apollo_fw_state_names[] = {
+	[APOLLO_FW_NONE]	= "none",
+	[APOLLO_FW_LOADING]	= "loading",
+	[APOLLO_FW_UPLOADING]	= "uploading",
+	[APOLLO_FW_READY]	= "ready",
+	[APOLLO_FW_FAILED]	= "failed",
+};
+
+const char *apollo_fw_state_name(struct apollo_device *apollo)
+{
+	return apollo_fw_state_names[READ_ONCE(apollo->fw_state)];
+}
+
+static int apollo_fw_wait_ready(struct apollo_device *apollo)
+{
+	int timeout = APOLLO_FW_TIMEOUT_MS;
+
+	while (timeout--) {
+		if (apollo_read_reg(apollo, APOLLO_REG_STATUS) & APOLLO_STATUS_READY)
+			return 0;
+		usleep_range(1000, 2000);
+	}
+
+	return -ETIMEDOUT;
+}
+
+/*
+ * Stream the image through the bulk window one chunk at a time, telling
+ * the device where each chunk belongs (placeholder protocol).
+ */
+static int apollo_fw_upload(struct apollo_device *apollo, const u8 *data,
+			    size_t size)
+{
+	size_t chunk_max = min_t(size_t, APOLLO_FW_CHUNK, apollo->bulk_size);
+	size_t ofs = 0;
+	int err;
+
+	if (!chunk_max)
+		return -ENODEV;
+
+	WRITE_ONCE(apollo->fw_state, APOLLO_FW_UPLOADING);
+	atomic_set(&apollo->fw_progress, 0);
+
+	while (ofs < size) {
+		size_t chunk = min(chunk_max, size - ofs);
+
+		err = apollo_bulk_write(apollo, 0, data + ofs, chunk);
+		if (err)
+			return err;
+
+		apollo_write_reg(apollo, APOLLO_REG_FW_ADDR, ofs);
+		apollo_write_reg(apollo, APOLLO_REG_FW_LEN, chunk);
+		apollo_write_reg(apollo, APOLLO_REG_CONTROL, APOLLO_CMD_FW_CHUNK);
+
+		err = apollo_fw_wait_ready(apollo);
+		if (err)
+			return err;
+
+		ofs += chunk;
+		atomic_set(&apollo->fw_progress, div_u64((u64)ofs * 100, size));
+	}
+
+	apollo_write_reg(apollo, APOLLO_REG_CONTROL, APOLLO_CMD_FW_BOOT);
+	return apollo_fw_wait_ready(apollo);
+}
+
+/* Upload from the cache and expose the card the first time through */
+static void apollo_fw_work(struct work_struct *work)
+{
+	struct apollo_device *apollo = container_of(work, struct apollo_device, fw_work);
+	struct device *dev = &apollo->pci->dev;
+	bool lost = false;
+	int err = 0;
+
+	mutex_lock(&apollo_fw_cache_lock);
+	if (apollo_fw_cache) {
+		if (crc32_le(~0, apollo_fw_cache, apollo_fw_cache_size) != apollo_fw_cache_crc) {
+			dev_err(dev, "Cached firmware corrupted, dropping it\n");
+			kvfree(apollo_fw_cache);
+			apollo_fw_cache = NULL;
+			err = -EIO;
+		} else {
+			err = apollo_fw_upload(apollo, apollo_fw_cache, apollo_fw_cache_size);
+		}
+	} else if (apollo->card_registered && READ_ONCE(apollo->fw_state) == APOLLO_FW_READY) {
+		/* Uploaded straight from the image at probe: nothing to restore */
+		lost = true;
+	}
+	mutex_unlock(&apollo_fw_cache_lock);
+
+	if (lost) {
+		dev_warn_once(dev, "Firmware was never cached, not restored after resume\n");
+		WRITE_ONCE(apollo->fw_state, APOLLO_FW_NONE);
+		return;
+	}
+
+	if (err) {
+		dev_err(dev, "Firmware upload failed (err: %d)\n", err);
+		WRITE_ONCE(apollo->fw_state, APOLLO_FW_FAILED);
+		return;
+	}
+
+	if (READ_ONCE(apollo->fw_state) == APOLLO_FW_UPLOADING) {
+		WRITE_ONCE(apollo->fw_state, APOLLO_FW_READY);
+		dev_info(dev, "Firmware uploaded\n");
+	}
+
+	if (!apollo->card_registered) {
+		err = snd_card_register(apollo->card);
+		if (err) {
+			dev_err(dev, "Failed to register ALSA card (err: %d)\n", err);
+			return;
+		}
+		apollo->card_registered = true;
+	}
+}
+
+static void apollo_fw_loaded(const struct firmware *fw, void *context)
+{
+	struct apollo_device *apollo = context;
+	struct device *dev = &apollo->pci->dev;
+	bool cached;
+	u32 crc;
+	int err;
+
+	if (!fw) {
+		dev_info(dev, "No firmware image %s, continuing without upload\n", firmware);
+		WRITE_ONCE(apollo->fw_state, APOLLO_FW_NONE);
+		goto out;
+	}
+
+	crc = crc32_le(~0, fw->data, fw->size);
+	if (fw_crc && crc != fw_crc) {
+		dev_err(dev, "Firmware %s checksum mismatch (0x%08x, expected 0x%08x)\n",
+			firmware, crc, fw_crc);
+		WRITE_ONCE(apollo->fw_state, APOLLO_FW_FAILED);
+		release_firmware(fw);
+		complete(&apollo->fw_requested);
+		return;
+	}
+
+	mutex_lock(&apollo_fw_cache_lock);
+	if (!apollo_fw_cache) {
+		apollo_fw_cache = kvmalloc(fw->size, GFP_KERNEL);
+		if (apollo_fw_cache) {
+			memcpy(apollo_fw_cache, fw->data, fw->size);
+			apollo_fw_cache_size = fw->size;
+			apollo_fw_cache_crc = crc;
+		}
+	}
+	cached = apollo_fw_cache != NULL;
+	mutex_unlock(&apollo_fw_cache_lock);
+
+	dev_info(dev, "Loaded firmware %s (%zu bytes, crc32 0x%08x)\n",
+		 firmware, fw->size, crc);
+
+	/* No memory for the cache: upload this once, resume goes without */
+	if (!cached) {
+		dev_warn(dev, "Cannot cache firmware, uploading it directly\n");
+		err = apollo_fw_upload(apollo, fw->data, fw->size);
+		if (err) {
+			dev_err(dev, "Firmware upload failed (err: %d)\n", err);
+			WRITE_ONCE(apollo->fw_state, APOLLO_FW_FAILED);
+			release_firmware(fw);
+			complete(&apollo->fw_requested);
+			return;
+		}
+	}
+	release_firmware(fw);
+
+out:
+	schedule_work(&apollo->fw_work);
+	complete(&apollo->fw_requested);
+}
+
+/*
+ * Kick off firmware loading. Never blocks; the card is registered from
+ * apollo_fw_work() once the device is ready.
+ */
+int apollo_fw_load(struct apollo_device *apollo)
+{
+	bool cached;
+	int err;
+
+	INIT_WORK(&apollo->fw_work, apollo_fw_work);
+	init_completion(&apollo->fw_requested);
+	atomic_set(&apollo->fw_progress, 0);
+
+	mutex_lock(&apollo_fw_cache_lock);
+	cached = apollo_fw_cache != NULL;
+	mutex_unlock(&apollo_fw_cache_lock);
+
+	if (cached || !firmware || !*firmware) {
+		WRITE_ONCE(apollo->fw_state, APOLLO_FW_NONE);
+		schedule_work(&apollo->fw_work);
+		complete(&apollo->fw_requested);
+		return 0;
+	}
+
+	WRITE_ONCE(apollo->fw_state, APOLLO_FW_LOADING);
+	err = request_firmware_nowait(THIS_MODULE, true, firmware, &apollo->pci->dev,
+				      GFP_KERNEL, apollo, apollo_fw_loaded);
+	if (err) {
+		WRITE_ONCE(apollo->fw_state, APOLLO_FW_FAILED);
+		complete(&apollo->fw_requested);
+	}
+
+	return err;
+}
+
+/* Re-upload after the device lost its state, e.g. on resume */
+void apollo_fw_reload(struct apollo_device *apollo)
+{
+	schedule_work(&apollo->fw_work);
+}
+
+/* Wait for any outstanding request or upload before the device goes away */
+void apollo_fw_cancel(struct apollo_device *apollo)
+{
+	wait_for_completion(&apollo->fw_requested);
+	cancel_work_sync(&apollo->fw_work);
+}
+
+void apollo_fw_cache_free(void)
+{
+	mutex_lock(&apollo_fw_cache_lock);
+	kvfree(apollo_fw_cache);
+	apollo_fw_cache = NULL;
+	mutex_unlock(&apollo_fw_cache_lock);
+}
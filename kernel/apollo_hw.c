@@ -5,9 +5,187 @@
 
 #include <linux/module.h>
 #include <linux/delay.h>
+#include <linux/io.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/sizes.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
 #include "apollo.h"
+#include "apollo_trace.h"
+
+static bool bulk_wc = true;
+module_param(bulk_wc, bool, 0444);
+MODULE_PARM_DESC(bulk_wc, "Map the BAR0 bulk window write-combined (default: true)");
+
+static bool bulk_bench;
+module_param(bulk_bench, bool, 0444);
+MODULE_PARM_DESC(bulk_bench, "Benchmark bulk window uploads at probe (default: false)");
+
+/*
+ * Signal ALSA only when the hardware has actually crossed a period
+ * boundary since the last interrupt, and on a bogus position so the core
+ * can report the xrun.
+ */
+static void apollo_stream_irq(struct apollo_device *apollo,
+			     struct snd_pcm_substream *substream)
+{
+	struct apollo_stream *stream = &apollo->streams[substream->stream];
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	unsigned int crossed = 0;
+	snd_pcm_uframes_t pos;
+
+	if (!READ_ONCE(stream->running))
+		return;
+
+	pos = apollo_pcm_hw_pos(substream);
+	trace_apollo_period(substream, pos);
+
+	if (pos != SNDRV_PCM_POS_XRUN)
+		crossed = apollo_periods_crossed(stream->last_pos, pos, runtime->period_size,
+						 runtime->buffer_size);
+	apollo_flight_log(&apollo->flight, APOLLO_FLIGHT_PERIOD, substream->stream, crossed, pos);
+
+	if (pos != SNDRV_PCM_POS_XRUN) {
+		if (!crossed)
+			return;
+		stream->last_pos = pos;
+		apollo_stats_period(apollo, substream->stream, pos % runtime->period_size,
+				    runtime->rate);
+		apollo_drift_period(apollo, substream->stream, crossed,
+				    pos % runtime->period_size);
+	}
+
+	/* Stage automation first; the device latches it at the next boundary */
+	if (crossed && substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+		apollo_sched_period(apollo, crossed, runtime->period_size);
+
+	snd_pcm_period_elapsed(substream);
+
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+		apollo_loopback_period(apollo);
+}
+
+/*
+ * Upload the same data through an uncached and a write-combined mapping
+ * and report throughput. Runs before the bulk window is mapped for use,
+ * and maps one flavour at a time: on x86 a second mapping of the range
+ * inherits the memory type of the first, so the uncached numbers would
+ * really be write-combined ones. The window is read first and written
+ * back as-is, so the device contents are unchanged.
+ */
+static void apollo_bulk_bench(struct apollo_device *apollo)
+{
+	struct pci_dev *pci = apollo->pci;
+	size_t len = min_t(resource_size_t, apollo->bulk_size, SZ_64K);
+	void __iomem *map;
+	void *buf;
+	u64 t0, t_uc, t_wc;
+
+	buf = kmalloc(len, GFP_KERNEL);
+	if (!buf)
+		return;
+
+	map = pci_iomap_range(pci, 0, APOLLO_CTRL_WINDOW_SIZE, len);
+	if (!map) {
+		kfree(buf);
+		return;
+	}
+
+	memcpy_fromio(buf, map, len);
+
+	/* The trailing control read waits for all posted writes to land */
+	t0 = ktime_get_ns();
+	memcpy_toio(map, buf, len);
+	apollo_read_reg(apollo, APOLLO_REG_STATUS);
+	t_uc = ktime_get_ns() - t0;
+	pci_iounmap(pci, map);
+
+	map = pci_iomap_wc_range(pci, 0, APOLLO_CTRL_WINDOW_SIZE, len);
+	if (!map) {
+		dev_info(&pci->dev, "Bulk upload %zu KB: uncached %llu KB/s\n",
+			 len / 1024, apollo_kbps(len, t_uc));
+		kfree(buf);
+		return;
+	}
+
+	t0 = ktime_get_ns();
+	memcpy_toio(map, buf, len);
+	wmb();
+	apollo_read_reg(apollo, APOLLO_REG_STATUS);
+	t_wc = ktime_get_ns() - t0;
+	pci_iounmap(pci, map);
+
+	dev_info(&pci->dev, "Bulk upload %zu KB: uncached %llu KB/s, write-combined %llu KB/s\n",
+		 len / 1024, apollo_kbps(len, t_uc), apollo_kbps(len, t_wc));
+
+	kfree(buf);
+}
+
+int apollo_hw_map(struct apollo_device *apollo)
+{
+	struct pci_dev *pci = apollo->pci;
+	resource_size_t len = pci_resource_len(pci, 0);
+
+	apollo->regs_size = min_t(resource_size_t, len, APOLLO_CTRL_WINDOW_SIZE);
+	apollo->regs = pci_iomap_range(pci, 0, 0, apollo->regs_size);
+	if (!apollo->regs)
+		return -EIO;
+
+	if (len <= APOLLO_CTRL_WINDOW_SIZE)
+		return 0;
+
+	apollo->bulk_size = len - APOLLO_CTRL_WINDOW_SIZE;
+	if (bulk_bench)
+		apollo_bulk_bench(apollo);
+
+	if (bulk_wc)
+		apollo->bulk = pci_iomap_wc_range(pci, 0, APOLLO_CTRL_WINDOW_SIZE,
+						  apollo->bulk_size);
+	apollo->bulk_wc = apollo->bulk != NULL;
+	if (!apollo->bulk)
+		apollo->bulk = pci_iomap_range(pci, 0, APOLLO_CTRL_WINDOW_SIZE,
+					       apollo->bulk_size);
+	if (!apollo->bulk) {
+		apollo_hw_unmap(apollo);
+		return -EIO;
+	}
+
+	dev_info(&pci->dev, "BAR0: %pa control, %pa bulk (%s)\n",
+		 &apollo->regs_size, &apollo->bulk_size,
+		 apollo->bulk_wc ? "write-combined" : "uncached");
+
+	return 0;
+}
+
+void apollo_hw_unmap(struct apollo_device *apollo)
+{
+	if (apollo->bulk)
+		pci_iounmap(apollo->pci, apollo->bulk);
+	if (apollo->regs)
+		pci_iounmap(apollo->pci, apollo->regs);
+	apollo->bulk = NULL;
+	apollo->regs = NULL;
+}
+
+/*
+ * Copy a parameter block into the bulk window. The data is flushed before
+ * returning, so the caller may kick the device through a control register
+ * straight away.
+ */
+int apollo_bulk_write(struct apollo_device *apollo, u32 offset,
+		      const void *src, size_t len)
+{
+	if (!apollo->bulk)
+		return -ENODEV;
+	if (offset > apollo->bulk_size || len > apollo->bulk_size - offset)
+		return -EINVAL;
+
+	memcpy_toio(apollo->bulk + offset, src, len);
+	apollo_bulk_flush(apollo);
+
+	return 0;
+}
 
 irqreturn_t apollo_interrupt(int irq, void *dev_id)
 {
@@ -16,18 +194,28 @@ irqreturn_t apollo_interrupt(int irq, void *dev_id)
 
 	/* Read interrupt status */
 	status = apollo_read_reg(apollo, APOLLO_REG_STATUS);
+	trace_apollo_irq(status);
+	apollo_flight_log(&apollo->flight, APOLLO_FLIGHT_IRQ, 0, 0, status);
 
 	if (status & APOLLO_STATUS_ERROR) {
 		dev_err(&apollo->pci->dev, "Hardware error detected\n");
+		apollo_stats_error(apollo);
+		apollo_flight_freeze(&apollo->flight, APOLLO_FLIGHT_ERROR, NULL);
 		/* Handle error condition */
 		atomic_set(&apollo->running, 0);
 	}
 
+	if (status & APOLLO_STATUS_CLOCK)
+		apollo_clock_irq(apollo);
+
 	if (status & APOLLO_STATUS_READY) {
 		/* DMA transfer complete */
 		if (apollo->pcm) {
-			snd_pcm_period_elapsed(apollo->pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream);
-			snd_pcm_period_elapsed(apollo->pcm->streams[SNDRV_PCM_STREAM_CAPTURE].substream);
+			if (apollo->mix)
+				apollo_mix_irq(apollo);
+			else
+				apollo_stream_irq(apollo, apollo->pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream);
+			apollo_stream_irq(apollo, apollo->pcm->streams[SNDRV_PCM_STREAM_CAPTURE].substream);
 		}
 	}
 
@@ -39,31 +227,19 @@ irqreturn_t apollo_interrupt(int irq, void *dev_id)
 
 int apollo_hw_init(struct apollo_device *apollo)
 {
-	u32 status;
-	int timeout = 100;  /* 100ms timeout */
+	int err;
 
 	dev_info(&apollo->pci->dev, "Initializing Apollo Twin hardware\n");
 
-	/* Reset device */
-	apollo_write_reg(apollo, APOLLO_REG_CONTROL, APOLLO_CMD_RESET);
-	msleep(10);
-
-	/* Wait for device ready */
-	while (timeout--) {
-		status = apollo_read_reg(apollo, APOLLO_REG_STATUS);
-		if (status & APOLLO_STATUS_READY)
-			break;
-		msleep(1);
-	}
-
-	if (!(status & APOLLO_STATUS_READY)) {
+	/* Reset device and wait for ready */
+	err = apollo_seq_reset(apollo);
+	if (err) {
 		dev_err(&apollo->pci->dev, "Device failed to become ready\n");
-		return -ETIMEDOUT;
+		return err;
 	}
 
 	/* Configure default settings */
-	apollo_write_reg(apollo, APOLLO_REG_SAMPLE_RATE, APOLLO_RATE_48000);
-	apollo_write_reg(apollo, APOLLO_REG_FORMAT, APOLLO_FORMAT_S32_LE);
+	apollo_seq_configure(apollo, APOLLO_RATE_48000, APOLLO_FORMAT_S32_LE);
 
 	dev_info(&apollo->pci->dev, "Apollo Twin hardware initialized\n");
 	return 0;
@@ -75,7 +251,7 @@ void apollo_hw_suspend(struct apollo_device *apollo)
 
 	/* Stop any running operations */
 	atomic_set(&apollo->running, 0);
-	apollo_write_reg(apollo, APOLLO_REG_DMA_CONTROL, APOLLO_CMD_STOP);
+	apollo_seq_stop(apollo);
 }
 
 int apollo_hw_resume(struct apollo_device *apollo)
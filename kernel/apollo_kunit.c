@@ -0,0 +1,784 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Twin PCM Math KUnit Tests
+ *
+ * Covers the register-free helpers in apollo.h: format mapping, frame
+ * sizes, ring offsets (including 4GB wrap), period boundary detection and
+ * buffer layout rules, the saturating playback mixer, parameter
+ * automation against a software stand-in for the device, interrupt
+ * latency buckets, flight recorder snapshots and the clock drift loop
+ * against a simulated drifting clock, plus timing checks of
+ * the per-interrupt position logic and event logging. Runs without
+ * hardware, e.g. under UML:
+ *
+ *   ./tools/testing/kunit/kunit.py run --kunitconfig=sound/pci/apollo
+ */
+
+#include <kunit/test.h>
+#include <linux/ktime.h>
+#include <linux/limits.h>
+#include "apollo.h"
+
+#define APOLLO_BENCH_ITERS	100000
+#define APOLLO_BENCH_BUDGET_NS	500	/* per iteration, generous for UML */
+
+static void apollo_test_format_mapping(struct kunit *test)
+{
+	KUNIT_EXPECT_EQ(test, apollo_format_from_pcm(SNDRV_PCM_FORMAT_S16_LE),
+			APOLLO_FORMAT_S16_LE);
+	KUNIT_EXPECT_EQ(test, apollo_format_from_pcm(SNDRV_PCM_FORMAT_S24_3LE),
+			APOLLO_FORMAT_S24_3LE);
+	KUNIT_EXPECT_EQ(test, apollo_format_from_pcm(SNDRV_PCM_FORMAT_S32_LE),
+			APOLLO_FORMAT_S32_LE);
+	KUNIT_EXPECT_EQ(test, apollo_format_from_pcm(SNDRV_PCM_FORMAT_S24_LE), -EINVAL);
+	KUNIT_EXPECT_EQ(test, apollo_format_from_pcm(SNDRV_PCM_FORMAT_FLOAT_LE), -EINVAL);
+}
+
+static void apollo_test_frame_bytes(struct kunit *test)
+{
+	KUNIT_EXPECT_EQ(test, apollo_frame_bytes(APOLLO_FORMAT_S16_LE, 2), 4U);
+	KUNIT_EXPECT_EQ(test, apollo_frame_bytes(APOLLO_FORMAT_S24_3LE, 2), 6U);
+	KUNIT_EXPECT_EQ(test, apollo_frame_bytes(APOLLO_FORMAT_S24_3LE, 8), 24U);
+	KUNIT_EXPECT_EQ(test, apollo_frame_bytes(APOLLO_FORMAT_S32_LE, 8), 32U);
+	KUNIT_EXPECT_EQ(test, apollo_frame_bytes(7, 2), 0U);
+}
+
+static void apollo_test_ring_offset(struct kunit *test)
+{
+	const size_t ring = 0x4000;
+
+	KUNIT_EXPECT_EQ(test, apollo_ring_offset(0x10000000, 0x10000000, ring), 0L);
+	KUNIT_EXPECT_EQ(test, apollo_ring_offset(0x10000100, 0x10000000, ring), 0x100L);
+	KUNIT_EXPECT_EQ(test, apollo_ring_offset(0x10003ffc, 0x10000000, ring), 0x3ffcL);
+
+	/* One past the end and before the start are out of range */
+	KUNIT_EXPECT_EQ(test, apollo_ring_offset(0x10004000, 0x10000000, ring), (long)-ERANGE);
+	KUNIT_EXPECT_EQ(test, apollo_ring_offset(0x0ffffffc, 0x10000000, ring), (long)-ERANGE);
+
+	/* Only the low 32 bits of the base matter */
+	KUNIT_EXPECT_EQ(test, apollo_ring_offset(0x10000200, 0x110000000ULL, ring), 0x200L);
+}
+
+static void apollo_test_ring_offset_4g_wrap(struct kunit *test)
+{
+	/* Ring starting 4KB below a 4GB boundary */
+	const dma_addr_t base = 0xfffff000;
+	const size_t ring = 0x2000;
+
+	KUNIT_EXPECT_EQ(test, apollo_ring_offset(0xfffff800, base, ring), 0x800L);
+	KUNIT_EXPECT_EQ(test, apollo_ring_offset(0x00000000, base, ring), 0x1000L);
+	KUNIT_EXPECT_EQ(test, apollo_ring_offset(0x00000ffc, base, ring), 0x1ffcL);
+	KUNIT_EXPECT_EQ(test, apollo_ring_offset(0x00001000, base, ring), (long)-ERANGE);
+}
+
+static void apollo_test_periods_crossed(struct kunit *test)
+{
+	const snd_pcm_uframes_t period = 64, buffer = 256;
+
+	/* No movement, movement inside one period */
+	KUNIT_EXPECT_EQ(test, apollo_periods_crossed(0, 0, period, buffer), 0U);
+	KUNIT_EXPECT_EQ(test, apollo_periods_crossed(0, 63, period, buffer), 0U);
+	KUNIT_EXPECT_EQ(test, apollo_periods_crossed(10, 40, period, buffer), 0U);
+
+	/* Landing exactly on and just past a boundary */
+	KUNIT_EXPECT_EQ(test, apollo_periods_crossed(0, 64, period, buffer), 1U);
+	KUNIT_EXPECT_EQ(test, apollo_periods_crossed(60, 70, period, buffer), 1U);
+
+	/* Several periods at once (late interrupt) */
+	KUNIT_EXPECT_EQ(test, apollo_periods_crossed(0, 200, period, buffer), 3U);
+
+	/* Wrapping past the end of the ring */
+	KUNIT_EXPECT_EQ(test, apollo_periods_crossed(250, 2, period, buffer), 1U);
+	KUNIT_EXPECT_EQ(test, apollo_periods_crossed(192, 0, period, buffer), 1U);
+	KUNIT_EXPECT_EQ(test, apollo_periods_crossed(130, 66, period, buffer), 3U);
+
+	/* Invalid inputs never report progress */
+	KUNIT_EXPECT_EQ(test, apollo_periods_crossed(0, 300, period, buffer), 0U);
+	KUNIT_EXPECT_EQ(test, apollo_periods_crossed(0, 64, 0, buffer), 0U);
+}
+
+static void apollo_test_period_layout(struct kunit *test)
+{
+	const unsigned int frame = apollo_frame_bytes(APOLLO_FORMAT_S24_3LE, 2);
+
+	KUNIT_EXPECT_EQ(test, apollo_check_period_layout(96 * frame, 4 * 96 * frame, frame), 0);
+	KUNIT_EXPECT_EQ(test, apollo_check_period_layout(APOLLO_MAX_PERIOD_SIZE,
+							 2 * APOLLO_MAX_PERIOD_SIZE, 4), 0);
+
+	/* Period not frame aligned, buffer not a whole number of periods */
+	KUNIT_EXPECT_EQ(test, apollo_check_period_layout(100, 400, frame), -EINVAL);
+	KUNIT_EXPECT_EQ(test, apollo_check_period_layout(96 * frame, 96 * frame * 5 / 2, frame),
+			-EINVAL);
+
+	/* Size limits */
+	KUNIT_EXPECT_EQ(test, apollo_check_period_layout(32, 128, 4), -EINVAL);
+	KUNIT_EXPECT_EQ(test, apollo_check_period_layout(1024, 1024, 4), -EINVAL);
+	KUNIT_EXPECT_EQ(test, apollo_check_period_layout(APOLLO_MAX_PERIOD_SIZE * 2,
+							 APOLLO_MAX_PERIOD_SIZE * 4, 4), -EINVAL);
+	KUNIT_EXPECT_EQ(test, apollo_check_period_layout(1024, 1024, 0), -EINVAL);
+}
+
+static void apollo_test_mix_s16(struct kunit *test)
+{
+	const __le16 a[] = { cpu_to_le16(1000), cpu_to_le16(30000), cpu_to_le16(-30000) };
+	const __le16 b[] = { cpu_to_le16(-400), cpu_to_le16(10000), cpu_to_le16(-10000) };
+	const __le16 c[] = { cpu_to_le16(0), cpu_to_le16(-10000), cpu_to_le16(0) };
+	const void *src[] = { a, b, c };
+	__le16 out[3];
+
+	/* Clipping applies to the sum, not to each partial sum */
+	apollo_mix_samples(out, src, 3, 3, APOLLO_FORMAT_S16_LE);
+	KUNIT_EXPECT_EQ(test, (s16)le16_to_cpu(out[0]), 600);
+	KUNIT_EXPECT_EQ(test, (s16)le16_to_cpu(out[1]), 30000);
+	KUNIT_EXPECT_EQ(test, (s16)le16_to_cpu(out[2]), S16_MIN);
+
+	apollo_mix_samples(out, src, 2, 3, APOLLO_FORMAT_S16_LE);
+	KUNIT_EXPECT_EQ(test, (s16)le16_to_cpu(out[1]), S16_MAX);
+}
+
+static void apollo_test_mix_s24_3(struct kunit *test)
+{
+	/* 0x400000 + 0x500000 clips high, -2 + -3 stays exact */
+	const u8 a[] = { 0x00, 0x00, 0x40,  0xfe, 0xff, 0xff };
+	const u8 b[] = { 0x00, 0x00, 0x50,  0xfd, 0xff, 0xff };
+	const u8 c[] = { 0x00, 0x00, 0xc0,  0x00, 0x00, 0x00 };
+	const void *src[] = { a, b };
+	const void *neg[] = { c, c };
+	u8 out[6];
+
+	apollo_mix_samples(out, src, 2, 2, APOLLO_FORMAT_S24_3LE);
+	KUNIT_EXPECT_EQ(test, out[0], 0xff);
+	KUNIT_EXPECT_EQ(test, out[1], 0xff);
+	KUNIT_EXPECT_EQ(test, out[2], 0x7f);
+	KUNIT_EXPECT_EQ(test, out[3], 0xfb);
+	KUNIT_EXPECT_EQ(test, out[4], 0xff);
+	KUNIT_EXPECT_EQ(test, out[5], 0xff);
+
+	/* -0x400000 twice is exactly the negative limit */
+	apollo_mix_samples(out, neg, 2, 1, APOLLO_FORMAT_S24_3LE);
+	KUNIT_EXPECT_EQ(test, out[0], 0x00);
+	KUNIT_EXPECT_EQ(test, out[1], 0x00);
+	KUNIT_EXPECT_EQ(test, out[2], 0x80);
+}
+
+static void apollo_test_mix_s32(struct kunit *test)
+{
+	const __le32 a[] = { cpu_to_le32(S32_MAX), cpu_to_le32(S32_MIN), cpu_to_le32(5) };
+	const __le32 b[] = { cpu_to_le32(1), cpu_to_le32(-1), cpu_to_le32(-7) };
+	const void *src[] = { a, b };
+	__le32 out[3];
+
+	apollo_mix_samples(out, src, 2, 3, APOLLO_FORMAT_S32_LE);
+	KUNIT_EXPECT_EQ(test, (s32)le32_to_cpu(out[0]), S32_MAX);
+	KUNIT_EXPECT_EQ(test, (s32)le32_to_cpu(out[1]), S32_MIN);
+	KUNIT_EXPECT_EQ(test, (s32)le32_to_cpu(out[2]), -2);
+}
+
+static void apollo_test_regmap(struct kunit *test)
+{
+	/* Locked at 48 kHz */
+	KUNIT_EXPECT_EQ(test, apollo_clock_status_locked(0x00bb8001), 1);
+	KUNIT_EXPECT_EQ(test, apollo_clock_status_rate(0x00bb8001), 48000);
+	KUNIT_EXPECT_EQ(test, apollo_clock_status_locked(0x00bb8000), 0);
+	KUNIT_EXPECT_EQ(test, apollo_status_clock(APOLLO_STATUS_CLOCK | APOLLO_STATUS_READY), 1);
+
+	/* Status and position are never cached */
+	KUNIT_EXPECT_EQ(test, apollo_reg_cache_policy(APOLLO_REG_STATUS), APOLLO_CACHE_NONE);
+	KUNIT_EXPECT_EQ(test, apollo_reg_cache_policy(APOLLO_REG_DMA_POS), APOLLO_CACHE_NONE);
+	KUNIT_EXPECT_EQ(test, apollo_reg_cache_policy(APOLLO_REG_CONTROL), APOLLO_CACHE_NONE);
+	KUNIT_EXPECT_EQ(test, apollo_reg_cache_policy(APOLLO_REG_FW_LEN), APOLLO_CACHE_WRITE_ONLY);
+	KUNIT_EXPECT_EQ(test, apollo_reg_cache_policy(APOLLO_REG_CLOCK_SOURCE),
+			APOLLO_CACHE_WRITE_THROUGH);
+
+	/* The driver model stays clear of the identity block */
+	KUNIT_EXPECT_EQ(test, apollo_reg_cache_policy(APOLLO_REG_ID), APOLLO_CACHE_ONCE);
+	KUNIT_EXPECT_EQ(test, apollo_reg_cache_policy(APOLLO_REG_SERIAL3), APOLLO_CACHE_ONCE);
+}
+
+/*
+ * Software stand-in for the device's parameter port: a staged value takes
+ * effect at the boundary the harness says is next, as the hardware latch
+ * does. Every change is logged with that boundary.
+ */
+#define APOLLO_STANDIN_LOG	256
+
+struct apollo_standin {
+	struct apollo_sched sched;
+	u64 latch;			/* boundary the next staged value lands on */
+	unsigned int n;
+	struct {
+		u64 at;
+		u32 param;
+		u32 value;
+		u32 ramp;
+	} log[APOLLO_STANDIN_LOG];
+};
+
+static void apollo_standin_stage(struct apollo_sched *sched, u32 param, u32 value, u32 ramp)
+{
+	struct apollo_standin *dev = container_of(sched, struct apollo_standin, sched);
+
+	if (dev->n < APOLLO_STANDIN_LOG) {
+		dev->log[dev->n].at = dev->latch;
+		dev->log[dev->n].param = param;
+		dev->log[dev->n].value = value;
+		dev->log[dev->n].ramp = ramp;
+	}
+	dev->n++;
+}
+
+/* Trigger: stage before the engine starts, then again once it runs */
+static void apollo_standin_start(struct apollo_standin *dev, u32 period)
+{
+	dev->latch = 0;
+	apollo_sched_start(&dev->sched, period);
+	dev->latch = period;
+	apollo_sched_started(&dev->sched, period);
+}
+
+/*
+ * Interrupt for the boundary at frame b: stage the one after it. As on
+ * the device, the first one comes at b = period.
+ */
+static void apollo_standin_irq(struct apollo_standin *dev, u64 b, u32 period)
+{
+	dev->latch = b + period;
+	apollo_sched_boundary(&dev->sched, b + period, period);
+}
+
+static struct apollo_standin *apollo_standin_new(struct kunit *test, bool hw_ramp)
+{
+	struct apollo_standin *dev = kunit_kzalloc(test, sizeof(*dev), GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_NULL(test, dev);
+	apollo_sched_init(&dev->sched, apollo_standin_stage, hw_ramp);
+	return dev;
+}
+
+static void apollo_test_sched_boundary(struct kunit *test)
+{
+	static const u64 frames[] = { 0, 5, 31, 32, 100, 1000 };
+	struct apollo_standin *dev = apollo_standin_new(test, false);
+	const u32 period = 32;
+	unsigned int i;
+	u64 b;
+
+	for (i = 0; i < ARRAY_SIZE(frames); i++)
+		KUNIT_ASSERT_EQ(test, apollo_sched_add(&dev->sched, APOLLO_PARAM_MASTER_L,
+						       i + 1, frames[i], 0), 0);
+
+	apollo_standin_start(dev, period);
+	for (b = period; b < 2048; b += period)
+		apollo_standin_irq(dev, b, period);
+
+	/* Each change lands on the boundary at or before its frame */
+	KUNIT_ASSERT_EQ(test, dev->n, (unsigned int)ARRAY_SIZE(frames));
+	for (i = 0; i < ARRAY_SIZE(frames); i++) {
+		KUNIT_EXPECT_EQ(test, dev->log[i].at, frames[i] / period * period);
+		KUNIT_EXPECT_EQ(test, dev->log[i].value, i + 1);
+	}
+	KUNIT_EXPECT_EQ(test, dev->sched.late, 0ULL);
+	KUNIT_EXPECT_EQ(test, dev->sched.applied, (u64)ARRAY_SIZE(frames));
+}
+
+static void apollo_test_sched_order(struct kunit *test)
+{
+	struct apollo_standin *dev = apollo_standin_new(test, false);
+	const u32 period = 32;
+	u64 b;
+
+	/* Queued out of frame order; equal frames keep submission order */
+	apollo_sched_add(&dev->sched, APOLLO_PARAM_MONITOR, 1, 200, 0);
+	apollo_sched_add(&dev->sched, APOLLO_PARAM_MONITOR, 2, 100, 0);
+	apollo_sched_add(&dev->sched, APOLLO_PARAM_MONITOR, 3, 200, 0);
+
+	apollo_standin_start(dev, period);
+	for (b = period; b < 512; b += period)
+		apollo_standin_irq(dev, b, period);
+
+	KUNIT_ASSERT_EQ(test, dev->n, 3U);
+	KUNIT_EXPECT_EQ(test, dev->log[0].value, 2U);
+	KUNIT_EXPECT_EQ(test, dev->log[0].at, 96ULL);
+	KUNIT_EXPECT_EQ(test, dev->log[1].value, 1U);
+	KUNIT_EXPECT_EQ(test, dev->log[2].value, 3U);
+	KUNIT_EXPECT_EQ(test, dev->log[2].at, 192ULL);
+	KUNIT_EXPECT_EQ(test, dev->sched.value[APOLLO_PARAM_MONITOR], 3U);
+}
+
+static void apollo_test_sched_late(struct kunit *test)
+{
+	struct apollo_standin *dev = apollo_standin_new(test, false);
+	const u32 period = 32;
+
+	apollo_sched_add(&dev->sched, APOLLO_PARAM_MASTER_R, 7, 130, 0);
+
+	/* The interrupt for boundary 64 is lost; 96 stages 128 on time */
+	apollo_standin_start(dev, period);
+	apollo_standin_irq(dev, 32, period);
+	apollo_standin_irq(dev, 96, period);
+	KUNIT_ASSERT_EQ(test, dev->n, 1U);
+	KUNIT_EXPECT_EQ(test, dev->log[0].at, 128ULL);
+	KUNIT_EXPECT_EQ(test, dev->sched.late, 0ULL);
+
+	/* Losing the one for 128 as well makes a change for 150 a period late */
+	apollo_sched_add(&dev->sched, APOLLO_PARAM_MASTER_R, 8, 150, 0);
+	apollo_standin_irq(dev, 160, period);
+	KUNIT_ASSERT_EQ(test, dev->n, 2U);
+	KUNIT_EXPECT_EQ(test, dev->log[1].at, 192ULL);
+	KUNIT_EXPECT_EQ(test, dev->sched.late, 1ULL);
+
+	/* ASAP takes the next boundary still open and is never late */
+	apollo_sched_add(&dev->sched, APOLLO_PARAM_MASTER_R, 9, APOLLO_SCHED_ASAP, 0);
+	apollo_standin_irq(dev, 192, period);
+	KUNIT_ASSERT_EQ(test, dev->n, 3U);
+	KUNIT_EXPECT_EQ(test, dev->log[2].at, 224ULL);
+	KUNIT_EXPECT_EQ(test, dev->sched.late, 1ULL);
+}
+
+static void apollo_test_sched_ramp(struct kunit *test)
+{
+	struct apollo_standin *dev = apollo_standin_new(test, false);
+	const u32 period = 32;
+	unsigned int i;
+	u64 b;
+
+	/* Software: one step per boundary, the last one on the ramp's end */
+	apollo_sched_add(&dev->sched, APOLLO_PARAM_MASTER_L, 100, 64, 128);
+	apollo_standin_start(dev, period);
+	for (b = period; b < 512; b += period)
+		apollo_standin_irq(dev, b, period);
+
+	KUNIT_ASSERT_EQ(test, dev->n, 4U);
+	for (i = 0; i < 4; i++) {
+		KUNIT_EXPECT_EQ(test, dev->log[i].at, 96ULL + i * period);
+		KUNIT_EXPECT_EQ(test, dev->log[i].value, 25U * (i + 1));
+		KUNIT_EXPECT_EQ(test, dev->log[i].ramp, 0U);
+	}
+
+	/* Ramping down from there, from the first boundary still open (544) */
+	apollo_sched_add(&dev->sched, APOLLO_PARAM_MASTER_L, 0, 544, 64);
+	for (; b < 1024; b += period)
+		apollo_standin_irq(dev, b, period);
+	KUNIT_ASSERT_EQ(test, dev->n, 6U);
+	KUNIT_EXPECT_EQ(test, dev->log[4].value, 50U);
+	KUNIT_EXPECT_EQ(test, dev->log[5].value, 0U);
+	KUNIT_EXPECT_EQ(test, dev->log[5].at, 608ULL);
+	KUNIT_EXPECT_EQ(test, dev->sched.late, 0ULL);
+
+	/* Hardware: a single write carrying the ramp length */
+	dev = apollo_standin_new(test, true);
+	apollo_sched_add(&dev->sched, APOLLO_PARAM_MASTER_L, 100, 64, 128);
+	apollo_standin_start(dev, period);
+	for (b = period; b < 512; b += period)
+		apollo_standin_irq(dev, b, period);
+	KUNIT_ASSERT_EQ(test, dev->n, 1U);
+	KUNIT_EXPECT_EQ(test, dev->log[0].at, 64ULL);
+	KUNIT_EXPECT_EQ(test, dev->log[0].ramp, 128U);
+}
+
+static void apollo_test_sched_limits(struct kunit *test)
+{
+	struct apollo_standin *dev = apollo_standin_new(test, false);
+	int i;
+
+	KUNIT_EXPECT_EQ(test, apollo_sched_add(&dev->sched, APOLLO_PARAM_COUNT, 0, 0, 0), -EINVAL);
+	KUNIT_EXPECT_EQ(test, apollo_sched_add(&dev->sched, 0, 0, 0, 1 << 24), -EINVAL);
+
+	/* Not running: ASAP writes at once, frames queue for the start */
+	KUNIT_EXPECT_EQ(test, apollo_sched_add(&dev->sched, 0, 42, APOLLO_SCHED_ASAP, 0), 0);
+	KUNIT_EXPECT_EQ(test, dev->n, 1U);
+	KUNIT_EXPECT_EQ(test, dev->sched.count, 0U);
+
+	for (i = 0; i < APOLLO_SCHED_DEPTH; i++)
+		KUNIT_EXPECT_EQ(test, apollo_sched_add(&dev->sched, 0, i, 1000 - i, 0), 0);
+	KUNIT_EXPECT_EQ(test, apollo_sched_add(&dev->sched, 0, 0, 0, 0), -ENOSPC);
+
+	/* Stop drops what is pending */
+	apollo_sched_stop(&dev->sched);
+	KUNIT_EXPECT_EQ(test, dev->sched.count, 0U);
+}
+
+static void apollo_test_sched_group(struct kunit *test)
+{
+	static const struct apollo_sched_change pair[] = {
+		{ APOLLO_PARAM_MASTER_L, 10 },
+		{ APOLLO_PARAM_MASTER_R, 20 },
+	};
+	struct apollo_standin *dev = apollo_standin_new(test, false);
+	const u32 period = 32;
+	int i;
+
+	/* One slot left: neither side is queued */
+	for (i = 0; i < APOLLO_SCHED_DEPTH - 1; i++)
+		apollo_sched_add(&dev->sched, APOLLO_PARAM_MONITOR, i, 100000, 0);
+	KUNIT_EXPECT_EQ(test, apollo_sched_add_group(&dev->sched, pair, 2, 64, 0), -ENOSPC);
+	KUNIT_EXPECT_EQ(test, dev->sched.count, (unsigned int)APOLLO_SCHED_DEPTH - 1);
+	apollo_sched_stop(&dev->sched);
+
+	/* Both sides land on the same boundary */
+	apollo_standin_start(dev, period);
+	apollo_standin_irq(dev, 32, period);
+	KUNIT_ASSERT_EQ(test, apollo_sched_add_group(&dev->sched, pair, 2, APOLLO_SCHED_ASAP, 0), 0);
+	apollo_standin_irq(dev, 64, period);
+	KUNIT_ASSERT_EQ(test, dev->n, 2U);
+	KUNIT_EXPECT_EQ(test, dev->log[0].at, 96ULL);
+	KUNIT_EXPECT_EQ(test, dev->log[1].at, 96ULL);
+	KUNIT_EXPECT_EQ(test, dev->log[0].param, (u32)APOLLO_PARAM_MASTER_L);
+	KUNIT_EXPECT_EQ(test, dev->log[1].param, (u32)APOLLO_PARAM_MASTER_R);
+}
+
+/*
+ * Random schedule against the stand-in, with interrupts delayed by up to
+ * a period and the odd one lost: every change lands on the boundary at or
+ * before its frame, a period late at worst after a lost interrupt, and
+ * changes to one parameter land in frame order.
+ */
+static void apollo_test_sched_accuracy(struct kunit *test)
+{
+	struct apollo_standin *dev = apollo_standin_new(test, false);
+	const u32 period = 32;
+	u32 rnd = 12345, last_value = 0;
+	u64 b, worst = 0;
+	unsigned int i, lost = 0;
+
+	for (i = 0; i < APOLLO_SCHED_DEPTH; i++) {
+		rnd = rnd * 1103515245 + 12345;
+		/* value encodes the target so the log can be checked */
+		apollo_sched_add(&dev->sched, APOLLO_PARAM_MONITOR, (rnd >> 8) % 8192,
+				 (rnd >> 8) % 8192, 0);
+	}
+
+	apollo_standin_start(dev, period);
+	for (b = period; b < 8192 + 2 * period; b += period) {
+		rnd = rnd * 1103515245 + 12345;
+		if ((rnd >> 16) % 50 == 0) {
+			lost++;
+			continue;
+		}
+		apollo_standin_irq(dev, b, period);
+	}
+
+	KUNIT_ASSERT_EQ(test, dev->n, (unsigned int)APOLLO_SCHED_DEPTH);
+	for (i = 0; i < dev->n; i++) {
+		u64 target = dev->log[i].value;
+		u64 ideal = target / period * period;
+
+		KUNIT_EXPECT_GE(test, dev->log[i].at, ideal);
+		KUNIT_EXPECT_LE(test, dev->log[i].at, ideal + period);
+		KUNIT_EXPECT_GE(test, dev->log[i].value, last_value);
+		worst = max(worst, dev->log[i].at - ideal);
+		last_value = dev->log[i].value;
+	}
+
+	kunit_info(test, "sched: %u changes, %u lost interrupts, %llu late, worst %llu frames past the boundary\n",
+		   dev->n, lost, dev->sched.late, worst);
+	KUNIT_EXPECT_LE(test, dev->sched.late, (u64)lost * 2);
+}
+
+static void apollo_test_latency_bucket(struct kunit *test)
+{
+	/* On time, and anything within the first microsecond */
+	KUNIT_EXPECT_EQ(test, apollo_latency_bucket(0, 48000), 0U);
+	KUNIT_EXPECT_EQ(test, apollo_latency_bucket(0, 0), 0U);
+
+	/* One frame is 20.8 us at 48 kHz, 5.2 us at 192 kHz */
+	KUNIT_EXPECT_EQ(test, apollo_latency_bucket(1, 48000), 5U);
+	KUNIT_EXPECT_EQ(test, apollo_latency_bucket(1, 192000), 3U);
+
+	/* Upper bounds are inclusive: 32 us is bucket 5, 33 us bucket 6 */
+	KUNIT_EXPECT_EQ(test, apollo_latency_bucket(32, 1000000), 5U);
+	KUNIT_EXPECT_EQ(test, apollo_latency_bucket(33, 1000000), 6U);
+
+	/* A whole 4096-frame period late lands in the overflow bucket */
+	KUNIT_EXPECT_EQ(test, apollo_latency_bucket(4096, 44100), APOLLO_LATENCY_BUCKETS - 1);
+}
+
+static void apollo_test_flight_snapshot(struct kunit *test)
+{
+	const size_t hsize = sizeof(struct apollo_flight_header);
+	const size_t len = hsize + 64 * sizeof(struct apollo_flight_event);
+	struct apollo_flight *flight = kunit_kzalloc(test, sizeof(*flight), GFP_KERNEL);
+	struct apollo_flight_event *ring = kunit_kcalloc(test, 64, sizeof(*ring), GFP_KERNEL);
+	char *buf = kunit_kzalloc(test, len, GFP_KERNEL);
+	struct apollo_flight_header *hdr = (void *)buf;
+	struct apollo_flight_event *ev = (void *)(buf + hsize);
+	size_t off = 0;
+	ssize_t n;
+	int i;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, flight);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ring);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+	apollo_flight_init(flight, ring, 64);
+
+	/* Armed: a header with no events */
+	KUNIT_EXPECT_EQ(test, apollo_flight_read(flight, buf, 0, len), (ssize_t)hsize);
+	KUNIT_EXPECT_EQ(test, hdr->magic, (u32)APOLLO_FLIGHT_MAGIC);
+	KUNIT_EXPECT_EQ(test, hdr->reason, 0U);
+
+	for (i = 0; i < 100; i++)
+		apollo_flight_log(flight, APOLLO_FLIGHT_PERIOD, 1, 1, i);
+
+	/* Only the first failure is kept, and nothing is logged after it */
+	KUNIT_EXPECT_TRUE(test, apollo_flight_freeze(flight, APOLLO_FLIGHT_XRUN, NULL));
+	KUNIT_EXPECT_FALSE(test, apollo_flight_freeze(flight, APOLLO_FLIGHT_ERROR, NULL));
+	apollo_flight_log(flight, APOLLO_FLIGHT_IRQ, 0, 0, 0);
+
+	/* Read in pieces that split the header and events, as sysfs may */
+	do {
+		n = apollo_flight_read(flight, buf + off, off, min_t(size_t, 7, len - off));
+		off += n > 0 ? n : 0;
+	} while (n > 0 && off < len);
+	KUNIT_EXPECT_EQ(test, off, len);
+	KUNIT_EXPECT_EQ(test, apollo_flight_read(flight, buf, len, 16), (ssize_t)0);
+
+	KUNIT_EXPECT_EQ(test, hdr->reason, (u32)APOLLO_FLIGHT_XRUN);
+	KUNIT_EXPECT_EQ(test, hdr->stream, -1);
+	KUNIT_EXPECT_EQ(test, hdr->event_size, (u16)sizeof(*ev));
+	KUNIT_EXPECT_EQ(test, hdr->count, 64U);
+	KUNIT_EXPECT_EQ(test, hdr->total, 101U);
+
+	/* Oldest first: the last 63 periods, then the xrun */
+	for (i = 0; i < 63; i++)
+		KUNIT_EXPECT_EQ(test, ev[i].value, (u32)(37 + i));
+	KUNIT_EXPECT_EQ(test, ev[63].type, (u8)APOLLO_FLIGHT_XRUN);
+	KUNIT_EXPECT_LE(test, ev[0].ns, ev[63].ns);
+
+	/* Re-armed, it records from scratch */
+	KUNIT_EXPECT_EQ(test, apollo_flight_rearm(flight), 0);
+	apollo_flight_log(flight, APOLLO_FLIGHT_IRQ, 0, 0, 0);
+	KUNIT_EXPECT_EQ(test, apollo_flight_read(flight, buf, 0, len), (ssize_t)hsize);
+	KUNIT_EXPECT_EQ(test, hdr->reason, 0U);
+	KUNIT_EXPECT_EQ(test, hdr->total, 1U);
+
+	/* The count never runs into the frozen bit */
+	atomic_set(&flight->head, APOLLO_FLIGHT_FROZEN - 2);
+	for (i = 0; i < 3; i++)
+		apollo_flight_log(flight, APOLLO_FLIGHT_IRQ, 0, 0, i);
+	KUNIT_EXPECT_EQ(test, (unsigned int)atomic_read(&flight->head), 64U + 1);
+	KUNIT_EXPECT_EQ(test, ring[0].value, 2U);
+
+	/* Re-arming also releases the header for the next freeze */
+	KUNIT_EXPECT_TRUE(test, apollo_flight_freeze(flight, APOLLO_FLIGHT_ERROR, NULL));
+}
+
+/*
+ * Simulated device: boundary k at k * period_ns, interrupts 0-200 us late
+ * with the position truncated to a frame, as the driver sees them.
+ */
+struct apollo_drift_sim {
+	u64 start;
+	u64 period_ps;		/* actual period, picoseconds */
+	u32 rate;
+	s32 ppm;
+	u32 seed;
+};
+
+static void apollo_drift_sim_irq(struct apollo_dll *dll, struct apollo_drift_sim *sim,
+				 u64 k, unsigned int crossed)
+{
+	u64 boundary = sim->start + div_u64(k * sim->period_ps, 1000);
+	u32 latency, late;
+
+	sim->seed = sim->seed * 1103515245 + 12345;
+	latency = (sim->seed >> 16) % 200000;
+	late = div64_u64((u64)latency * sim->rate * (1000000 + sim->ppm),
+			 1000000ULL * NSEC_PER_SEC);
+	apollo_dll_update(dll, boundary + latency, crossed, late);
+}
+
+static void apollo_drift_sim_init(struct apollo_drift_sim *sim, u32 period, u32 rate, s32 ppm)
+{
+	sim->start = 1000ULL * NSEC_PER_SEC;
+	sim->rate = rate;
+	sim->ppm = ppm;
+	sim->seed = 1;
+	sim->period_ps = mul_u64_u32_div(div_u64((u64)period * NSEC_PER_SEC * 1000, rate),
+					 1000000, 1000000 + ppm);
+}
+
+static void apollo_test_drift_converges(struct kunit *test)
+{
+	static const s32 ppms[] = { 0, 50, -80, 300 };
+	struct apollo_dll *dll = kunit_kzalloc(test, sizeof(*dll), GFP_KERNEL);
+	struct apollo_drift_sim sim;
+	u64 k, expect;
+	int i;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dll);
+
+	for (i = 0; i < ARRAY_SIZE(ppms); i++) {
+		apollo_drift_sim_init(&sim, 64, 48000, ppms[i]);
+		apollo_dll_init(dll, 64, 48000, 250);
+		KUNIT_EXPECT_EQ(test, apollo_dll_confidence(dll), 0U);
+
+		/* One minute of 64-frame periods */
+		for (k = 1; k <= 45000; k++)
+			apollo_drift_sim_irq(dll, &sim, k, 1);
+
+		/* Within 2 ppm, the reference within 5 us of the true boundary */
+		KUNIT_EXPECT_LE(test, abs(apollo_dll_ppb(dll) - ppms[i] * 1000LL), 2000LL);
+		KUNIT_EXPECT_EQ(test, dll->f0, 45000ULL * 64);
+		expect = sim.start + div_u64(45000ULL * sim.period_ps, 1000);
+		KUNIT_EXPECT_LE(test, abs((s64)(dll->t0 - expect)), 5000LL);
+		KUNIT_EXPECT_GE(test, apollo_dll_confidence(dll), 500U);
+		KUNIT_EXPECT_EQ(test, dll->resets, 0U);
+	}
+}
+
+static void apollo_test_drift_gaps(struct kunit *test)
+{
+	struct apollo_dll *dll = kunit_kzalloc(test, sizeof(*dll), GFP_KERNEL);
+	struct apollo_drift_sim sim;
+	u64 k;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dll);
+	apollo_drift_sim_init(&sim, 256, 96000, 100);
+	apollo_dll_init(dll, 256, 96000, 250);
+
+	/* Every tenth interrupt lost: the next one reports two boundaries */
+	for (k = 1; k <= 20000; k++) {
+		if (k % 10 == 9)
+			continue;
+		apollo_drift_sim_irq(dll, &sim, k, k % 10 == 0 ? 2 : 1);
+	}
+	KUNIT_EXPECT_EQ(test, dll->resets, 0U);
+	KUNIT_EXPECT_EQ(test, dll->f0, 20000ULL * 256);
+	KUNIT_EXPECT_LE(test, abs(apollo_dll_ppb(dll) - 100000LL), 2000LL);
+
+	/* A jump of half a period restarts the loop but keeps the rate */
+	sim.start += div_u64(sim.period_ps, 2000) + 20000;
+	apollo_drift_sim_irq(dll, &sim, ++k, 1);
+	KUNIT_EXPECT_EQ(test, dll->resets, 1U);
+	KUNIT_EXPECT_EQ(test, apollo_dll_confidence(dll), 0U);
+	KUNIT_EXPECT_LE(test, abs(apollo_dll_ppb(dll) - 100000LL), 2000LL);
+}
+
+static void apollo_test_drift_long_period(struct kunit *test)
+{
+	struct apollo_dll *dll = kunit_kzalloc(test, sizeof(*dll), GFP_KERNEL);
+	struct apollo_drift_sim sim;
+	u64 k;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dll);
+	apollo_drift_sim_init(&sim, 4096, 44100, -50);
+	apollo_dll_init(dll, 4096, 44100, 250);
+
+	/* period * NSEC_PER_SEC << APOLLO_DLL_SHIFT no longer fits in 64 bits */
+	KUNIT_EXPECT_EQ(test, dll->nominal >> APOLLO_DLL_SHIFT,
+			div_u64(4096ULL * NSEC_PER_SEC, 44100));
+
+	/* Five minutes */
+	for (k = 1; k <= 3300; k++)
+		apollo_drift_sim_irq(dll, &sim, k, 1);
+	KUNIT_EXPECT_EQ(test, dll->resets, 0U);
+	KUNIT_EXPECT_LE(test, abs(apollo_dll_ppb(dll) + 50000LL), 2000LL);
+	KUNIT_EXPECT_GE(test, apollo_dll_confidence(dll), 500U);
+}
+
+/*
+ * Time the pure part of the per-interrupt work: turning a register value
+ * into a ring offset and checking for a period boundary.
+ */
+static void apollo_bench_irq_position(struct kunit *test)
+{
+	const dma_addr_t base = 0xfffff000;
+	const size_t ring_bytes = 256 * 8;
+	snd_pcm_uframes_t last = 0;
+	unsigned int periods = 0;
+	u64 start, ns;
+	int i;
+
+	start = ktime_get_ns();
+	for (i = 0; i < APOLLO_BENCH_ITERS; i++) {
+		u32 hw = lower_32_bits(base) + (i * 24 * 8) % ring_bytes;
+		long ofs = apollo_ring_offset(hw, base, ring_bytes);
+		snd_pcm_uframes_t pos = ofs / 8;
+
+		periods += apollo_periods_crossed(last, pos, 64, 256);
+		last = pos;
+	}
+	ns = ktime_get_ns() - start;
+
+	kunit_info(test, "irq position: %llu ns/iter over %d iters (%u periods)\n",
+		   div_u64(ns, APOLLO_BENCH_ITERS), APOLLO_BENCH_ITERS, periods);
+
+	/* Position advances 24 frames per step after the first sample */
+	KUNIT_EXPECT_EQ(test, periods, (unsigned int)((APOLLO_BENCH_ITERS - 1) * 24 / 64));
+	KUNIT_EXPECT_LT(test, div_u64(ns, APOLLO_BENCH_ITERS), (u64)APOLLO_BENCH_BUDGET_NS);
+}
+
+static void apollo_bench_period_layout(struct kunit *test)
+{
+	u64 start, ns;
+	int i, ok = 0;
+
+	start = ktime_get_ns();
+	for (i = 0; i < APOLLO_BENCH_ITERS; i++)
+		ok += !apollo_check_period_layout(64 * (1 + i % 64), 64 * (1 + i % 64) * 4, 4);
+	ns = ktime_get_ns() - start;
+
+	kunit_info(test, "period layout: %llu ns/iter\n", div_u64(ns, APOLLO_BENCH_ITERS));
+
+	KUNIT_EXPECT_EQ(test, ok, APOLLO_BENCH_ITERS);
+	KUNIT_EXPECT_LT(test, div_u64(ns, APOLLO_BENCH_ITERS), (u64)APOLLO_BENCH_BUDGET_NS);
+}
+
+/* Cost of one flight recorder event, paid several times per period */
+static void apollo_bench_flight_log(struct kunit *test)
+{
+	struct apollo_flight *flight = kunit_kzalloc(test, sizeof(*flight), GFP_KERNEL);
+	struct apollo_flight_event *ring = kunit_kcalloc(test, 8192, sizeof(*ring), GFP_KERNEL);
+	u64 start, ns;
+	int i;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, flight);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ring);
+	apollo_flight_init(flight, ring, 8192);
+
+	start = ktime_get_ns();
+	for (i = 0; i < APOLLO_BENCH_ITERS; i++)
+		apollo_flight_log(flight, APOLLO_FLIGHT_POINTER, 0, 0, i);
+	ns = ktime_get_ns() - start;
+
+	kunit_info(test, "flight recorder: %llu ns/event\n", div_u64(ns, APOLLO_BENCH_ITERS));
+
+	KUNIT_EXPECT_EQ(test, atomic_read(&flight->head), APOLLO_BENCH_ITERS);
+	KUNIT_EXPECT_LT(test, div_u64(ns, APOLLO_BENCH_ITERS), (u64)APOLLO_BENCH_BUDGET_NS);
+}
+
+static struct kunit_case apollo_pcm_test_cases[] = {
+	KUNIT_CASE(apollo_test_format_mapping),
+	KUNIT_CASE(apollo_test_frame_bytes),
+	KUNIT_CASE(apollo_test_ring_offset),
+	KUNIT_CASE(apollo_test_ring_offset_4g_wrap),
+	KUNIT_CASE(apollo_test_periods_crossed),
+	KUNIT_CASE(apollo_test_period_layout),
+	KUNIT_CASE(apollo_test_mix_s16),
+	KUNIT_CASE(apollo_test_mix_s24_3),
+	KUNIT_CASE(apollo_test_mix_s32),
+	KUNIT_CASE(apollo_test_regmap),
+	KUNIT_CASE(apollo_test_sched_boundary),
+	KUNIT_CASE(apollo_test_sched_order),
+	KUNIT_CASE(apollo_test_sched_late),
+	KUNIT_CASE(apollo_test_sched_ramp),
+	KUNIT_CASE(apollo_test_sched_limits),
+	KUNIT_CASE(apollo_test_sched_group),
+	KUNIT_CASE(apollo_test_sched_accuracy),
+	KUNIT_CASE(apollo_test_latency_bucket),
+	KUNIT_CASE(apollo_test_flight_snapshot),
+	KUNIT_CASE(apollo_test_drift_converges),
+	KUNIT_CASE(apollo_test_drift_gaps),
+	KUNIT_CASE(apollo_test_drift_long_period),
+	KUNIT_CASE(apollo_bench_irq_position),
+	KUNIT_CASE(apollo_bench_period_layout),
+	KUNIT_CASE(apollo_bench_flight_log),
+	{}
+};
+
+static struct kunit_suite apollo_pcm_test_suite = {
+	.name = "apollo-pcm",
+	.test_cases = apollo_pcm_test_cases,
+};
+
+kunit_test_suite(apollo_pcm_test_suite);
@@ -0,0 +1,303 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Twin Playback Loopback
+ *
+ * PCM device 1 is a capture-only device that reads back what is being
+ * played. Its runtime buffer is the playback DMA ring itself and its
+ * position is the playback hardware position, so the captured stream is
+ * sample-aligned with what the device clocks out and nothing is copied in
+ * the kernel. The loopback takes the playback configuration as-is; it
+ * cannot be opened before playback has been prepared.
+ *
+ * The playback application may refill a region as soon as it has been
+ * played. A reader that falls behind far enough to have frames overwritten
+ * gets an overrun instead of silently reading the next lap.
+ */
+
+#include <linux/module.h>
+#include <sound/core.h>
+#include <sound/pcm.h>
+#include <sound/pcm_params.h>
+#include "apollo.h"
+
+static bool loopback = true;
+module_param(loopback, bool, 0444);
+MODULE_PARM_DESC(loopback, "Expose playback loopback capture as PCM device 1 (default: true)");
+
+/* Does the loopback runtime still describe the playback ring? */
+static bool apollo_loopback_matches(struct snd_pcm_runtime *runtime,
+				    struct snd_pcm_runtime *src)
+{
+	return runtime->format == src->format &&
+	       runtime->rate == src->rate &&
+	       runtime->channels == src->channels &&
+	       runtime->period_size == src->period_size &&
+	       runtime->buffer_size == src->buffer_size &&
+	       runtime->dma_area == src->dma_area;
+}
+
+/*
+ * Frames still unread by the loopback are lost once the playback fill
+ * level and the capture backlog together exceed the ring. Both hardware
+ * pointers track the same ring position, so the two can be added.
+ */
+static bool apollo_loopback_overrun(struct snd_pcm_runtime *runtime,
+				    struct snd_pcm_runtime *src)
+{
+	snd_pcm_sframes_t fill, backlog;
+
+	fill = READ_ONCE(src->control->appl_ptr) - READ_ONCE(src->status->hw_ptr);
+	if (fill < 0)
+		fill += src->boundary;
+
+	backlog = READ_ONCE(runtime->status->hw_ptr) - READ_ONCE(runtime->control->appl_ptr);
+	if (backlog < 0)
+		backlog += runtime->boundary;
+
+	return fill + backlog > runtime->buffer_size;
+}
+
+static int apollo_loopback_open(struct snd_pcm_substream *substream)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct snd_pcm_runtime *src;
+	int err = 0;
+
+	mutex_lock(&apollo->loopback_mutex);
+
+	if (!apollo->loopback_source) {
+		dev_dbg(&apollo->pci->dev, "Loopback open without prepared playback\n");
+		err = -EBADFD;
+		goto out;
+	}
+
+	/* Everything but the access mode is fixed by the playback stream */
+	src = apollo->loopback_source->runtime;
+	runtime->hw.info = SNDRV_PCM_INFO_MMAP |
+			   SNDRV_PCM_INFO_INTERLEAVED |
+			   SNDRV_PCM_INFO_BLOCK_TRANSFER |
+			   SNDRV_PCM_INFO_MMAP_VALID;
+	runtime->hw.formats = pcm_format_to_bits(src->format);
+	runtime->hw.rates = snd_pcm_rate_to_rate_bit(src->rate);
+	runtime->hw.rate_min = src->rate;
+	runtime->hw.rate_max = src->rate;
+	runtime->hw.channels_min = src->channels;
+	runtime->hw.channels_max = src->channels;
+	runtime->hw.buffer_bytes_max = frames_to_bytes(src, src->buffer_size);
+	runtime->hw.period_bytes_min = frames_to_bytes(src, src->period_size);
+	runtime->hw.period_bytes_max = frames_to_bytes(src, src->period_size);
+	runtime->hw.periods_min = src->periods;
+	runtime->hw.periods_max = src->periods;
+
+	spin_lock_irq(&apollo->loopback_lock);
+	apollo->loopback = substream;
+	apollo->loopback_running = false;
+	spin_unlock_irq(&apollo->loopback_lock);
+
+out:
+	mutex_unlock(&apollo->loopback_mutex);
+	return err;
+}
+
+static int apollo_loopback_close(struct snd_pcm_substream *substream)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+
+	mutex_lock(&apollo->loopback_mutex);
+	spin_lock_irq(&apollo->loopback_lock);
+	apollo->loopback = NULL;
+	apollo->loopback_running = false;
+	spin_unlock_irq(&apollo->loopback_lock);
+	mutex_unlock(&apollo->loopback_mutex);
+
+	return 0;
+}
+
+static int apollo_loopback_hw_params(struct snd_pcm_substream *substream,
+				     struct snd_pcm_hw_params *params)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+	struct snd_pcm_substream *source;
+	struct snd_pcm_runtime *src;
+	int err = 0;
+
+	mutex_lock(&apollo->loopback_mutex);
+
+	source = apollo->loopback_source;
+	if (!source) {
+		err = -EBADFD;
+		goto out;
+	}
+
+	src = source->runtime;
+	if (params_format(params) != src->format ||
+	    params_rate(params) != src->rate ||
+	    params_channels(params) != src->channels ||
+	    params_period_size(params) != src->period_size ||
+	    params_buffer_size(params) != src->buffer_size) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	/* Point at the playback ring; the loopback owns no memory */
+	snd_pcm_set_runtime_buffer(substream, snd_pcm_get_dma_buf(source));
+	substream->runtime->dma_bytes = src->dma_bytes;
+
+out:
+	mutex_unlock(&apollo->loopback_mutex);
+	return err;
+}
+
+static int apollo_loopback_hw_free(struct snd_pcm_substream *substream)
+{
+	snd_pcm_set_runtime_buffer(substream, NULL);
+	return 0;
+}
+
+static int apollo_loopback_prepare(struct snd_pcm_substream *substream)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+	struct snd_pcm_substream *source;
+	int err = 0;
+
+	/* Playback may have been reconfigured since hw_params */
+	mutex_lock(&apollo->loopback_mutex);
+	source = apollo->loopback_source;
+	if (!source || !apollo_loopback_matches(substream->runtime, source->runtime))
+		err = -EBADFD;
+	mutex_unlock(&apollo->loopback_mutex);
+
+	return err;
+}
+
+static int apollo_loopback_trigger(struct snd_pcm_substream *substream, int cmd)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+
+	/* The playback stream owns the DMA engine; only follow it */
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+		spin_lock(&apollo->loopback_lock);
+		apollo->loopback_running = true;
+		spin_unlock(&apollo->loopback_lock);
+		break;
+	case SNDRV_PCM_TRIGGER_STOP:
+		spin_lock(&apollo->loopback_lock);
+		apollo->loopback_running = false;
+		spin_unlock(&apollo->loopback_lock);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static snd_pcm_uframes_t apollo_loopback_pointer(struct snd_pcm_substream *substream)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct snd_pcm_substream *source;
+	snd_pcm_uframes_t pos;
+
+	spin_lock(&apollo->loopback_lock);
+	source = apollo->loopback_source;
+	if (!source || !READ_ONCE(apollo->streams[SNDRV_PCM_STREAM_PLAYBACK].running))
+		pos = runtime->status->hw_ptr % runtime->buffer_size;
+	else if (apollo_loopback_overrun(runtime, source->runtime))
+		pos = SNDRV_PCM_POS_XRUN;
+	else
+		pos = apollo_pcm_hw_pos(substream);
+	spin_unlock(&apollo->loopback_lock);
+
+	return pos;
+}
+
+static const struct snd_pcm_ops apollo_loopback_ops = {
+	.open = apollo_loopback_open,
+	.close = apollo_loopback_close,
+	.ioctl = snd_pcm_lib_ioctl,
+	.hw_params = apollo_loopback_hw_params,
+	.hw_free = apollo_loopback_hw_free,
+	.prepare = apollo_loopback_prepare,
+	.trigger = apollo_loopback_trigger,
+	.pointer = apollo_loopback_pointer,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+	.copy_user = apollo_pcm_copy_user,
+#endif
+};
+
+/*
+ * Called whenever the playback ring is (re)configured or released, from
+ * playback prepare and hw_free. A running reader that no longer matches
+ * the ring is stopped with an overrun.
+ */
+void apollo_loopback_set_source(struct apollo_device *apollo,
+				struct snd_pcm_substream *source)
+{
+	struct snd_pcm_substream *substream;
+
+	if (!apollo->loopback_pcm)
+		return;
+
+	mutex_lock(&apollo->loopback_mutex);
+
+	spin_lock_irq(&apollo->loopback_lock);
+	apollo->loopback_source = source;
+	spin_unlock_irq(&apollo->loopback_lock);
+
+	substream = apollo->loopback;
+	if (substream && (!source ||
+			  !apollo_loopback_matches(substream->runtime, source->runtime)))
+		snd_pcm_stop_xrun(substream);
+
+	mutex_unlock(&apollo->loopback_mutex);
+}
+
+/* Playback crossed a period boundary; the loopback shares its position */
+void apollo_loopback_period(struct apollo_device *apollo)
+{
+	struct snd_pcm_substream *substream = NULL;
+
+	if (!apollo->loopback_pcm)
+		return;
+
+	spin_lock(&apollo->loopback_lock);
+	if (apollo->loopback_running)
+		substream = apollo->loopback;
+	spin_unlock(&apollo->loopback_lock);
+
+	/* Outside the lock: this calls back into apollo_loopback_pointer() */
+	if (substream)
+		snd_pcm_period_elapsed(substream);
+}
+
+int apollo_loopback_new(struct apollo_device *apollo)
+{
+	int err;
+
+	mutex_init(&apollo->loopback_mutex);
+	spin_lock_init(&apollo->loopback_lock);
+
+	if (!loopback)
+		return 0;
+
+	/* Mixed playback has no single substream ring to read back */
+	if (apollo->mix) {
+		dev_info(&apollo->pci->dev, "Loopback disabled with mixed playback\n");
+		return 0;
+	}
+
+	err = snd_pcm_new(apollo->card, "Apollo Twin Loopback", 1, 0, 1,
+			  &apollo->loopback_pcm);
+	if (err)
+		return err;
+
+	apollo->loopback_pcm->private_data = apollo;
+	strcpy(apollo->loopback_pcm->name, "Apollo Twin Loopback");
+	snd_pcm_set_ops(apollo->loopback_pcm, SNDRV_PCM_STREAM_CAPTURE,
+			&apollo_loopback_ops);
+
+	return 0;
+}
@@ -18,6 +18,9 @@
 #include <sound/control.h>
 #include "apollo.h"
 
+#define CREATE_TRACE_POINTS
+#include "apollo_trace.h"
+
 #define DRIVER_NAME "apollo"
 #define DRIVER_DESC "Universal Audio Apollo Twin ALSA Driver"
 
@@ -26,7 +29,6 @@
 
 /* Device capabilities */
 #define APOLLO_MAX_CHANNELS 8
-#define APOLLO_MAX_BUFFER_SIZE (1024 * 1024)  /* 1MB */
 #define APOLLO_MAX_PERIODS 32
 
 static const struct pci_device_id apollo_ids[] = {
@@ -65,6 +67,111 @@ static struct snd_pcm_ops apollo_pcm_ops = {
 #endif
 };
 
+/* sysfs attributes */
+static ssize_t dma_bits_show(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	struct apollo_device *apollo = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", apollo->dma_bits);
+}
+static DEVICE_ATTR_RO(dma_bits);
+
+static ssize_t dma_limited_show(struct device *dev, struct device_attribute *attr,
+				char *buf)
+{
+	return sprintf(buf, "%d\n", dma_addressing_limited(dev));
+}
+static DEVICE_ATTR_RO(dma_limited);
+
+static ssize_t dma_unreachable_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct apollo_device *apollo = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", atomic_read(&apollo->dma_unreachable));
+}
+static DEVICE_ATTR_RO(dma_unreachable);
+
+static ssize_t dma_noncoherent_show(struct device *dev,
+				    struct device_attribute *attr, char *buf)
+{
+	struct apollo_device *apollo = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", apollo->noncoherent);
+}
+static DEVICE_ATTR_RO(dma_noncoherent);
+
+static ssize_t firmware_state_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct apollo_device *apollo = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%s\n", apollo_fw_state_name(apollo));
+}
+static DEVICE_ATTR_RO(firmware_state);
+
+static ssize_t firmware_progress_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct apollo_device *apollo = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", atomic_read(&apollo->fw_progress));
+}
+static DEVICE_ATTR_RO(firmware_progress);
+
+static ssize_t clock_lock_losses_show(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct apollo_device *apollo = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", atomic_read(&apollo->clock_lock_losses));
+}
+static DEVICE_ATTR_RO(clock_lock_losses);
+
+/* Frozen flight recorder events; writing anything re-arms it */
+static ssize_t flight_recorder_read(struct file *file, struct kobject *kobj,
+				    struct bin_attribute *attr, char *buf,
+				    loff_t off, size_t count)
+{
+	struct apollo_device *apollo = dev_get_drvdata(kobj_to_dev(kobj));
+
+	return apollo_flight_read(&apollo->flight, buf, off, count);
+}
+
+static ssize_t flight_recorder_write(struct file *file, struct kobject *kobj,
+				     struct bin_attribute *attr, char *buf,
+				     loff_t off, size_t count)
+{
+	struct apollo_device *apollo = dev_get_drvdata(kobj_to_dev(kobj));
+	int err;
+
+	err = apollo_flight_rearm(&apollo->flight);
+	return err ? err : count;
+}
+static BIN_ATTR(flight_recorder, 0644, flight_recorder_read, flight_recorder_write, 0);
+
+static struct attribute *apollo_attrs[] = {
+	&dev_attr_firmware_state.attr,
+	&dev_attr_firmware_progress.attr,
+	&dev_attr_dma_bits.attr,
+	&dev_attr_dma_limited.attr,
+	&dev_attr_dma_unreachable.attr,
+	&dev_attr_dma_noncoherent.attr,
+	&dev_attr_clock_lock_losses.attr,
+	NULL,
+};
+
+static struct bin_attribute *apollo_bin_attrs[] = {
+	&bin_attr_flight_recorder,
+	NULL,
+};
+
+static const struct attribute_group apollo_attr_group = {
+	.attrs = apollo_attrs,
+	.bin_attrs = apollo_bin_attrs,
+};
+
 static int apollo_probe(struct pci_dev *pci, const struct pci_device_id *id)
 {
 	struct apollo_device *apollo;
@@ -97,26 +204,18 @@ static int apollo_probe(struct pci_dev *pci, const struct pci_device_id *id)
 	}
 
 	/* Map device registers */
-	apollo->regs = pci_ioremap_bar(pci, 0);
-	if (!apollo->regs) {
+	err = apollo_hw_map(apollo);
+	if (err) {
 		dev_err(&pci->dev, "Failed to map device registers\n");
-		err = -EIO;
 		goto release_regions;
 	}
-	apollo->regs_size = pci_resource_len(pci, 0);
 
 	/* Enable bus mastering and DMA */
 	pci_set_master(pci);
 
-	/* Allocate DMA buffer */
-	apollo->dma_size = APOLLO_MAX_BUFFER_SIZE;
-	apollo->dma_area = dma_alloc_coherent(&pci->dev, apollo->dma_size,
-					     &apollo->dma_addr, GFP_KERNEL);
-	if (!apollo->dma_area) {
-		dev_err(&pci->dev, "Failed to allocate DMA buffer\n");
-		err = -ENOMEM;
+	err = apollo_dma_set_mask(apollo);
+	if (err)
 		goto unmap_regs;
-	}
 
 	/* Initialize device state */
 	atomic_set(&apollo->running, 0);
@@ -128,7 +227,7 @@ static int apollo_probe(struct pci_dev *pci, const struct pci_device_id *id)
 			  THIS_MODULE, 0, &card);
 	if (err) {
 		dev_err(&pci->dev, "Failed to create ALSA card (err: %d)\n", err);
-		goto free_dma;
+		goto unmap_regs;
 	}
 
 	apollo->card = card;
@@ -137,7 +236,8 @@ static int apollo_probe(struct pci_dev *pci, const struct pci_device_id *id)
 	strcpy(card->longname, "Universal Audio Apollo Twin");
 
 	/* Create PCM device */
-	err = snd_pcm_new(card, "Apollo Twin PCM", 0, 1, 1, &apollo->pcm);
+	err = snd_pcm_new(card, "Apollo Twin PCM", 0, apollo_mix_substreams(), 1,
+			  &apollo->pcm);
 	if (err) {
 		dev_err(&pci->dev, "Failed to create PCM device (err: %d)\n", err);
 		goto free_card;
@@ -150,6 +250,26 @@ static int apollo_probe(struct pci_dev *pci, const struct pci_device_id *id)
 	snd_pcm_set_ops(apollo->pcm, SNDRV_PCM_STREAM_PLAYBACK, &apollo_pcm_ops);
 	snd_pcm_set_ops(apollo->pcm, SNDRV_PCM_STREAM_CAPTURE, &apollo_pcm_ops);
 
+	/* Several playback substreams are summed into one ring */
+	err = apollo_mix_new(apollo);
+	if (err)
+		goto free_card;
+
+	/* Loopback capture must exist before buffers are set up */
+	err = apollo_loopback_new(apollo);
+	if (err) {
+		dev_err(&pci->dev, "Failed to create loopback PCM (err: %d)\n", err);
+		goto free_card;
+	}
+
+	/* Set up per-substream DMA buffers */
+	err = apollo_dma_init(apollo);
+	if (err) {
+		dev_err(&pci->dev, "Failed to set up DMA buffers (err: %d)\n", err);
+		goto free_card;
+	}
+	apollo_dma_bench(apollo);
+
 	/* Set up hardware constraints */
 	err = apollo_hw_constraints(apollo->pcm);
 	if (err) {
@@ -157,42 +277,71 @@ static int apollo_probe(struct pci_dev *pci, const struct pci_device_id *id)
 		goto free_card;
 	}
 
-	/* Register the card */
-	err = snd_card_register(card);
-	if (err) {
-		dev_err(&pci->dev, "Failed to register ALSA card (err: %d)\n", err);
+	/* Clock controls; lock changes are reported once the IRQ is up */
+	err = apollo_clock_init(apollo);
+	if (err)
+		goto free_card;
+
+	/* Parameter automation, staged from the playback period interrupt */
+	err = apollo_sched_new(apollo);
+	if (err)
+		goto free_card;
+
+	/* Interrupt latency and xrun counters for monitoring */
+	err = apollo_stats_new(apollo);
+	if (err)
+		goto free_card;
+
+	/* Sample clock drift, fed by the period interrupts */
+	err = apollo_drift_new(apollo);
+	if (err)
+		goto free_card;
+
+	/* Event ring frozen on the first xrun, before the IRQ can log */
+	err = apollo_flight_new(apollo);
+	if (err)
 		goto free_card;
-	}
 
 	/* Request interrupt */
 	err = request_irq(pci->irq, apollo_interrupt, IRQF_SHARED,
 			 DRIVER_NAME, apollo);
 	if (err) {
 		dev_err(&pci->dev, "Failed to request IRQ\n");
-		goto unregister_card;
+		goto free_card;
 	}
 	apollo->irq = pci->irq;
 
+	err = sysfs_create_group(&pci->dev.kobj, &apollo_attr_group);
+	if (err) {
+		dev_err(&pci->dev, "Failed to create sysfs attributes\n");
+		goto free_irq;
+	}
+
 	/* Initialize hardware */
 	err = apollo_hw_init(apollo);
 	if (err) {
 		dev_err(&pci->dev, "Failed to initialize hardware\n");
-		goto free_irq;
+		goto remove_sysfs;
+	}
+
+	/* Upload firmware in the background; the card is registered after */
+	err = apollo_fw_load(apollo);
+	if (err) {
+		dev_err(&pci->dev, "Failed to request firmware (err: %d)\n", err);
+		goto remove_sysfs;
 	}
 
 	dev_info(&pci->dev, "Apollo Twin initialized successfully\n");
 	return 0;
 
+remove_sysfs:
+	sysfs_remove_group(&pci->dev.kobj, &apollo_attr_group);
 free_irq:
 	free_irq(apollo->irq, apollo);
-unregister_card:
-	snd_card_free(card);
 free_card:
-free_dma:
-	dma_free_coherent(&pci->dev, apollo->dma_size, apollo->dma_area,
-			 apollo->dma_addr);
+	snd_card_free(card);
 unmap_regs:
-	iounmap(apollo->regs);
+	apollo_hw_unmap(apollo);
 release_regions:
 	pci_release_regions(pci);
 disable_pci:
@@ -206,18 +355,16 @@ static void apollo_remove(struct pci_dev *pci)
 
 	dev_info(&pci->dev, "Removing Apollo Twin driver\n");
 
+	apollo_fw_cancel(apollo);
+	sysfs_remove_group(&pci->dev.kobj, &apollo_attr_group);
+
 	if (apollo->irq)
 		free_irq(apollo->irq, apollo);
 
 	if (apollo->card)
 		snd_card_free(apollo->card);
 
-	if (apollo->dma_area)
-		dma_free_coherent(&pci->dev, apollo->dma_size, apollo->dma_area,
-				 apollo->dma_addr);
-
-	if (apollo->regs)
-		iounmap(apollo->regs);
+	apollo_hw_unmap(apollo);
 
 	pci_release_regions(pci);
 	pci_disable_device(pci);
@@ -246,6 +393,11 @@ static int apollo_resume(struct pci_dev *pci)
 	if (err)
 		return err;
 
+	apollo_clock_restore(apollo);
+
+	/* Device lost its firmware; re-upload from the in-memory cache */
+	apollo_fw_reload(apollo);
+
 	return 0;
 }
 
@@ -268,6 +420,7 @@ static void __exit apollo_exit(void)
 {
 	pr_info(DRIVER_DESC " unloading\n");
 	pci_unregister_driver(&apollo_driver);
+	apollo_fw_cache_free();
 }
 
 module_init(apollo_init);
@@ -0,0 +1,476 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Twin Playback Mixing
+ *
+ * With playback_substreams > 1 the playback PCM offers that many
+ * substreams, so several applications can play without dmix or a sound
+ * server in between. The substreams keep their own buffers; the engine
+ * plays a two-period ring owned by the driver. On every period interrupt
+ * the period after the one now playing is filled with the saturating sum
+ * of all running substreams, or copied as-is when only one is running.
+ *
+ * All substreams share the rate, format, channel count and period size
+ * of the first one configured. Buffer sizes may differ.
+ */
+
+#include <linux/module.h>
+#include <linux/limits.h>
+#include <linux/bitops.h>
+#include <sound/core.h>
+#include <sound/pcm.h>
+#include <sound/pcm_params.h>
+#include "apollo.h"
+#include "apollo_trace.h"
+
+static unsigned int playback_substreams = 1;
+module_param(playback_substreams, uint, 0444);
+MODULE_PARM_DESC(playback_substreams, "Playback substreams mixed in the kernel, 1 to play directly (default: 1, max: 8)");
+
+unsigned int apollo_mix_substreams(void)
+{
+	return clamp_t(unsigned int, playback_substreams, 1, APOLLO_MAX_PLAYBACK_SUBSTREAMS);
+}
+
+static void apollo_mix_s16(__le16 *dst, const void *const *src, unsigned int nsrc,
+			   unsigned int samples)
+{
+	unsigned int i, j;
+
+	for (j = 0; j < samples; j++) {
+		s32 acc = 0;
+
+		for (i = 0; i < nsrc; i++)
+			acc += (s16)le16_to_cpu(((const __le16 *)src[i])[j]);
+		dst[j] = cpu_to_le16(clamp_t(s32, acc, S16_MIN, S16_MAX));
+	}
+}
+
+static void apollo_mix_s24_3(u8 *dst, const void *const *src, unsigned int nsrc,
+			     unsigned int samples)
+{
+	unsigned int i, j;
+
+	for (j = 0; j < samples; j++, dst += 3) {
+		s32 acc = 0;
+
+		for (i = 0; i < nsrc; i++) {
+			const u8 *p = (const u8 *)src[i] + j * 3;
+
+			acc += sign_extend32(p[0] | p[1] << 8 | p[2] << 16, 23);
+		}
+		acc = clamp_t(s32, acc, -(1 << 23), (1 << 23) - 1);
+		dst[0] = acc;
+		dst[1] = acc >> 8;
+		dst[2] = acc >> 16;
+	}
+}
+
+static void apollo_mix_s32(__le32 *dst, const void *const *src, unsigned int nsrc,
+			   unsigned int samples)
+{
+	unsigned int i, j;
+
+	for (j = 0; j < samples; j++) {
+		s64 acc = 0;
+
+		for (i = 0; i < nsrc; i++)
+			acc += (s32)le32_to_cpu(((const __le32 *)src[i])[j]);
+		dst[j] = cpu_to_le32(clamp_t(s64, acc, S32_MIN, S32_MAX));
+	}
+}
+
+/*
+ * Sum nsrc interleaved buffers of samples into dst. Accumulation is wide
+ * enough for APOLLO_MAX_PLAYBACK_SUBSTREAMS full-scale sources, and only
+ * the result is clipped, so the order of the sources does not matter.
+ */
+void apollo_mix_samples(void *dst, const void *const *src, unsigned int nsrc,
+			unsigned int samples, u32 format)
+{
+	switch (format) {
+	case APOLLO_FORMAT_S16_LE:
+		apollo_mix_s16(dst, src, nsrc, samples);
+		break;
+	case APOLLO_FORMAT_S24_3LE:
+		apollo_mix_s24_3(dst, src, nsrc, samples);
+		break;
+	case APOLLO_FORMAT_S32_LE:
+		apollo_mix_s32(dst, src, nsrc, samples);
+		break;
+	}
+}
+
+static size_t apollo_mix_ring_bytes(struct apollo_mix *mix)
+{
+	return mix->period_bytes * APOLLO_MIX_PERIODS;
+}
+
+/*
+ * Fill one ring period from the running substreams and advance them by
+ * the number of periods the hardware moved. Called with mix->lock held.
+ */
+static void apollo_mix_fill(struct apollo_device *apollo, unsigned int slot,
+			    unsigned int periods)
+{
+	struct apollo_mix *mix = apollo->mix;
+	const void *src[APOLLO_MAX_PLAYBACK_SUBSTREAMS];
+	void *dst = mix->ring.area + slot * mix->period_bytes;
+	struct snd_pcm_substream *substream;
+	unsigned int n = 0;
+
+	for (substream = apollo->pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream;
+	     substream; substream = substream->next) {
+		struct apollo_mix_voice *voice = &mix->voices[substream->number];
+		struct snd_pcm_runtime *runtime = substream->runtime;
+
+		if (!voice->running)
+			continue;
+
+		src[n++] = runtime->dma_area + frames_to_bytes(runtime, voice->pos);
+		voice->pos = (voice->pos + periods * mix->period_size) % runtime->buffer_size;
+	}
+
+	if (!n)
+		memset(dst, 0, mix->period_bytes);
+	else if (n == 1)
+		memcpy(dst, src[0], mix->period_bytes);
+	else
+		apollo_mix_samples(dst, src, n, mix->period_size * mix->channels, mix->format);
+
+	apollo_dma_sync_range_for_device(apollo, &mix->ring, slot * mix->period_bytes,
+					 mix->period_bytes);
+}
+
+void apollo_mix_irq(struct apollo_device *apollo)
+{
+	struct apollo_mix *mix = apollo->mix;
+	struct apollo_stream *stream = &apollo->streams[SNDRV_PCM_STREAM_PLAYBACK];
+	struct snd_pcm_substream *notify[APOLLO_MAX_PLAYBACK_SUBSTREAMS];
+	struct snd_pcm_substream *substream;
+	unsigned int i, n = 0, crossed = 0;
+	snd_pcm_uframes_t pos = 0;
+	long ofs;
+
+	if (!READ_ONCE(stream->running))
+		return;
+
+	spin_lock(&mix->lock);
+
+	ofs = apollo_dma_ring_pos(apollo, mix->ring.addr, apollo_mix_ring_bytes(mix));
+	if (ofs >= 0) {
+		pos = ofs / (mix->period_bytes / mix->period_size);
+		crossed = apollo_periods_crossed(stream->last_pos, pos, mix->period_size,
+						 mix->period_size * APOLLO_MIX_PERIODS);
+	}
+
+	apollo_flight_log(&apollo->flight, APOLLO_FLIGHT_PERIOD, SNDRV_PCM_STREAM_PLAYBACK,
+			  crossed, ofs < 0 ? SNDRV_PCM_POS_XRUN : pos);
+
+	if (crossed) {
+		/* The period just finished plays next after the current one */
+		stream->last_pos = pos;
+		apollo_stats_period(apollo, SNDRV_PCM_STREAM_PLAYBACK, pos % mix->period_size,
+				    mix->rate);
+		apollo_drift_period(apollo, SNDRV_PCM_STREAM_PLAYBACK, crossed,
+				    pos % mix->period_size);
+		apollo_mix_fill(apollo, (pos / mix->period_size + 1) % APOLLO_MIX_PERIODS,
+				crossed);
+	}
+
+	if (crossed || ofs < 0) {
+		for (substream = apollo->pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream;
+		     substream; substream = substream->next)
+			if (mix->voices[substream->number].running)
+				notify[n++] = substream;
+	}
+
+	spin_unlock(&mix->lock);
+
+	if (crossed)
+		apollo_sched_period(apollo, crossed, mix->period_size);
+
+	/* Outside the lock: both call back into apollo_mix_pointer() */
+	for (i = 0; i < n; i++) {
+		if (ofs < 0)
+			snd_pcm_stop_xrun(notify[i]);
+		else
+			snd_pcm_period_elapsed(notify[i]);
+	}
+}
+
+static int apollo_mix_open(struct snd_pcm_substream *substream)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+	struct apollo_mix *mix = apollo->mix;
+	struct snd_pcm_hardware *hw = &substream->runtime->hw;
+	int err;
+
+	err = apollo_pcm_open(substream);
+	if (err)
+		return err;
+
+	/* Advertise what the ring already plays; hw_params checks again */
+	mutex_lock(&mix->config_lock);
+	if (mix->users) {
+		hw->formats = pcm_format_to_bits(mix->pcm_format);
+		hw->rates = snd_pcm_rate_to_rate_bit(mix->rate);
+		hw->rate_min = mix->rate;
+		hw->rate_max = mix->rate;
+		hw->channels_min = mix->channels;
+		hw->channels_max = mix->channels;
+		hw->period_bytes_min = mix->period_bytes;
+		hw->period_bytes_max = mix->period_bytes;
+	}
+	mutex_unlock(&mix->config_lock);
+
+	return 0;
+}
+
+static int apollo_mix_close(struct snd_pcm_substream *substream)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+
+	dev_dbg(&apollo->pci->dev, "PCM close: playback %d\n", substream->number);
+	return 0;
+}
+
+/* Called with mix->config_lock held */
+static int apollo_mix_alloc_ring(struct apollo_device *apollo,
+				 struct snd_pcm_hw_params *params, u32 format)
+{
+	struct apollo_mix *mix = apollo->mix;
+	size_t bytes = params_period_bytes(params) * APOLLO_MIX_PERIODS;
+	int err;
+
+	err = snd_dma_alloc_pages(apollo_dma_type(apollo), &apollo->pci->dev, bytes, &mix->ring);
+	if (err)
+		return err;
+
+	err = apollo_dma_map_ring(apollo, &apollo->streams[SNDRV_PCM_STREAM_PLAYBACK],
+				  &mix->ring, bytes);
+	if (err) {
+		snd_dma_free_pages(&mix->ring);
+		return err;
+	}
+
+	mix->pcm_format = params_format(params);
+	mix->format = format;
+	mix->rate = params_rate(params);
+	mix->channels = params_channels(params);
+	mix->period_size = params_period_size(params);
+	mix->period_bytes = params_period_bytes(params);
+
+	return 0;
+}
+
+/* Drop a substream's claim on the ring. Called with mix->config_lock held */
+static void apollo_mix_put(struct apollo_device *apollo, struct apollo_mix_voice *voice)
+{
+	struct apollo_mix *mix = apollo->mix;
+
+	if (!voice->configured)
+		return;
+
+	voice->configured = false;
+	if (--mix->users)
+		return;
+
+	apollo_dma_unmap_ring(apollo, &apollo->streams[SNDRV_PCM_STREAM_PLAYBACK]);
+	snd_dma_free_pages(&mix->ring);
+	memset(&mix->ring, 0, sizeof(mix->ring));
+}
+
+static int apollo_mix_hw_params(struct snd_pcm_substream *substream,
+				struct snd_pcm_hw_params *params)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+	struct apollo_mix *mix = apollo->mix;
+	struct apollo_mix_voice *voice = &mix->voices[substream->number];
+	int format, err;
+
+	format = apollo_format_from_pcm(params_format(params));
+	if (format < 0)
+		return format;
+
+	err = apollo_check_period_layout(params_period_bytes(params),
+					 params_buffer_bytes(params),
+					 apollo_frame_bytes(format, params_channels(params)));
+	if (err)
+		return err;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+	err = snd_pcm_lib_malloc_pages(substream, params_buffer_bytes(params));
+	if (err < 0)
+		return err;
+	err = 0;
+#endif
+
+	mutex_lock(&mix->config_lock);
+
+	/* Reconfiguring the only user may change the shared parameters */
+	apollo_mix_put(apollo, voice);
+
+	if (!mix->users)
+		err = apollo_mix_alloc_ring(apollo, params, format);
+	else if (params_format(params) != mix->pcm_format ||
+		 params_rate(params) != mix->rate ||
+		 params_channels(params) != mix->channels ||
+		 params_period_size(params) != mix->period_size)
+		err = -EBUSY;
+
+	if (!err) {
+		voice->configured = true;
+		mix->users++;
+	}
+
+	mutex_unlock(&mix->config_lock);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+	if (err)
+		snd_pcm_lib_free_pages(substream);
+#endif
+	return err;
+}
+
+static int apollo_mix_hw_free(struct snd_pcm_substream *substream)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+	struct apollo_mix *mix = apollo->mix;
+
+	mutex_lock(&mix->config_lock);
+	apollo_mix_put(apollo, &mix->voices[substream->number]);
+	mutex_unlock(&mix->config_lock);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+	return snd_pcm_lib_free_pages(substream);
+#else
+	return 0;
+#endif
+}
+
+static int apollo_mix_prepare(struct snd_pcm_substream *substream)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+	struct apollo_mix *mix = apollo->mix;
+	struct apollo_stream *stream = &apollo->streams[SNDRV_PCM_STREAM_PLAYBACK];
+	bool idle;
+
+	apollo_stats_prepare(apollo, substream);
+
+	spin_lock_irq(&mix->lock);
+	mix->voices[substream->number].pos = 0;
+	idle = !stream->running;
+	spin_unlock_irq(&mix->lock);
+
+	/* Only the first substream to start touches the engine */
+	if (idle) {
+		apollo_write_reg(apollo, APOLLO_REG_SAMPLE_RATE, mix->rate);
+		apollo_write_reg(apollo, APOLLO_REG_FORMAT, mix->format);
+		apollo_dma_program_ring(apollo, stream, mix->ring.addr,
+					apollo_mix_ring_bytes(mix));
+	}
+
+	return 0;
+}
+
+static int apollo_mix_trigger(struct snd_pcm_substream *substream, int cmd)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+	struct apollo_mix *mix = apollo->mix;
+	struct apollo_mix_voice *voice = &mix->voices[substream->number];
+	struct apollo_stream *stream = &apollo->streams[SNDRV_PCM_STREAM_PLAYBACK];
+	int err = 0;
+
+	trace_apollo_trigger(substream, cmd);
+	apollo_flight_log(&apollo->flight, APOLLO_FLIGHT_TRIGGER, substream->stream, cmd,
+			  substream->number);
+
+	spin_lock(&mix->lock);
+
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+		voice->running = true;
+		if (mix->active++)
+			break;
+
+		/* Start on silence; the first interrupt fills the next period */
+		memset(mix->ring.area, 0, apollo_mix_ring_bytes(mix));
+		apollo_dma_sync_for_device(apollo, &mix->ring);
+		stream->last_pos = 0;
+		stream->frames = 0;
+		WRITE_ONCE(stream->running, true);
+		atomic_set(&apollo->running, 1);
+		apollo_sched_start(&apollo->sched, mix->period_size);
+		apollo_drift_start(apollo, SNDRV_PCM_STREAM_PLAYBACK, mix->period_size, mix->rate);
+		apollo_seq_start(apollo, apollo->sg);
+		apollo_sched_started(&apollo->sched, mix->period_size);
+		break;
+	case SNDRV_PCM_TRIGGER_STOP:
+		if (!voice->running)
+			break;
+		voice->running = false;
+		if (--mix->active)
+			break;
+
+		WRITE_ONCE(stream->running, false);
+		atomic_set(&apollo->running, 0);
+		apollo_seq_stop(apollo);
+		apollo_sched_stop(&apollo->sched);
+		apollo_drift_stop(apollo, SNDRV_PCM_STREAM_PLAYBACK);
+		break;
+	default:
+		err = -EINVAL;
+	}
+
+	spin_unlock(&mix->lock);
+	return err;
+}
+
+static snd_pcm_uframes_t apollo_mix_pointer(struct snd_pcm_substream *substream)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+	snd_pcm_uframes_t pos = READ_ONCE(apollo->mix->voices[substream->number].pos);
+
+	trace_apollo_pointer(substream, pos);
+	apollo_flight_log(&apollo->flight, APOLLO_FLIGHT_POINTER, substream->stream,
+			  substream->number, pos);
+	return pos;
+}
+
+static const struct snd_pcm_ops apollo_mix_ops = {
+	.open = apollo_mix_open,
+	.close = apollo_mix_close,
+	.ioctl = snd_pcm_lib_ioctl,
+	.hw_params = apollo_mix_hw_params,
+	.hw_free = apollo_mix_hw_free,
+	.prepare = apollo_mix_prepare,
+	.trigger = apollo_mix_trigger,
+	.pointer = apollo_mix_pointer,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+	.copy_user = apollo_pcm_copy_user,
+#endif
+};
+
+/* Switch the playback stream to mixing when it has several substreams */
+int apollo_mix_new(struct apollo_device *apollo)
+{
+	struct snd_pcm_str *pstr = &apollo->pcm->streams[SNDRV_PCM_STREAM_PLAYBACK];
+	struct apollo_mix *mix;
+
+	if (pstr->substream_count < 2)
+		return 0;
+
+	mix = devm_kzalloc(&apollo->pci->dev, sizeof(*mix), GFP_KERNEL);
+	if (!mix)
+		return -ENOMEM;
+
+	mutex_init(&mix->config_lock);
+	spin_lock_init(&mix->lock);
+	apollo->mix = mix;
+
+	snd_pcm_set_ops(apollo->pcm, SNDRV_PCM_STREAM_PLAYBACK, &apollo_mix_ops);
+
+	dev_info(&apollo->pci->dev, "Mixing %u playback substreams\n",
+		 pstr->substream_count);
+	return 0;
+}
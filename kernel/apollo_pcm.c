@@ -8,6 +8,7 @@
 #include <sound/pcm.h>
 #include <sound/pcm_params.h>
 #include "apollo.h"
+#include "apollo_trace.h"
 
 static const struct snd_pcm_hardware apollo_pcm_hardware = {
 	.info = (SNDRV_PCM_INFO_MMAP |
@@ -27,9 +28,9 @@ static const struct snd_pcm_hardware apollo_pcm_hardware = {
 	.rate_max = 192000,
 	.channels_min = 2,
 	.channels_max = 8,
-	.buffer_bytes_max = 1024 * 1024,  /* 1MB */
+	.buffer_bytes_max = APOLLO_MAX_BUFFER_SIZE,
 	.period_bytes_min = 64,
-	.period_bytes_max = 1024 * 512,   /* 512KB */
+	.period_bytes_max = APOLLO_MAX_PERIOD_SIZE,
 	.periods_min = 2,
 	.periods_max = 32,
 	.fifo_size = 0,
@@ -43,6 +44,17 @@ int apollo_pcm_open(struct snd_pcm_substream *substream)
 	dev_dbg(&apollo->pci->dev, "PCM open: stream %d\n", substream->stream);
 
 	runtime->hw = apollo_pcm_hardware;
+	runtime->hw.info |= apollo_dma_info(apollo);
+
+	/* The engine requires the buffer to be a whole number of periods */
+	snd_pcm_hw_constraint_integer(runtime, SNDRV_PCM_HW_PARAM_PERIODS);
+
+	/* Fixed buffers never grow past what was preallocated at probe */
+	if (apollo_dma_fixed(apollo, substream)) {
+		runtime->hw.buffer_bytes_max = substream->dma_buffer.bytes;
+		runtime->hw.period_bytes_max = min_t(size_t, APOLLO_MAX_PERIOD_SIZE,
+						     substream->dma_buffer.bytes / 2);
+	}
 
 	/* Set initial device state */
 	apollo->sample_rate = 48000;
@@ -74,28 +86,32 @@ int apollo_pcm_ioctl(struct snd_pcm_substream *substream, unsigned int cmd, void
 int apollo_pcm_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_hw_params *params)
 {
 	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+	int format, err;
 
 	dev_dbg(&apollo->pci->dev, "PCM hw_params\n");
 
+	format = apollo_format_from_pcm(params_format(params));
+	if (format < 0)
+		return format;
+
+	err = apollo_check_period_layout(params_period_bytes(params),
+					 params_buffer_bytes(params),
+					 apollo_frame_bytes(format, params_channels(params)));
+	if (err)
+		return err;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+	err = snd_pcm_lib_malloc_pages(substream, params_buffer_bytes(params));
+	if (err < 0)
+		return err;
+#endif
+
 	/* Extract parameters */
 	apollo->sample_rate = params_rate(params);
 	apollo->channels = params_channels(params);
+	apollo->format = format;
 
-	switch (params_format(params)) {
-	case SNDRV_PCM_FORMAT_S16_LE:
-		apollo->format = APOLLO_FORMAT_S16_LE;
-		break;
-	case SNDRV_PCM_FORMAT_S24_3LE:
-		apollo->format = APOLLO_FORMAT_S24_3LE;
-		break;
-	case SNDRV_PCM_FORMAT_S32_LE:
-		apollo->format = APOLLO_FORMAT_S32_LE;
-		break;
-	default:
-		return -EINVAL;
-	}
-
-	return 0;
+	return apollo_dma_build_table(apollo, substream);
 }
 
 int apollo_pcm_hw_free(struct snd_pcm_substream *substream)
@@ -107,23 +123,37 @@ int apollo_pcm_hw_free(struct snd_pcm_substream *substream)
 	/* Reset device state */
 	atomic_set(&apollo->running, 0);
 
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+		apollo_loopback_set_source(apollo, NULL);
+
+	apollo_dma_free_table(apollo, substream);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+	return snd_pcm_lib_free_pages(substream);
+#else
 	return 0;
+#endif
 }
 
 int apollo_pcm_prepare(struct snd_pcm_substream *substream)
 {
 	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
-	struct snd_pcm_runtime *runtime = substream->runtime;
 
 	dev_dbg(&apollo->pci->dev, "PCM prepare\n");
+	apollo_stats_prepare(apollo, substream);
+
+	apollo->streams[substream->stream].last_pos = 0;
+	apollo->streams[substream->stream].frames = 0;
 
 	/* Configure device registers */
-	apollo_write_reg(apollo, APOLLO_REG_SAMPLE_RATE, apollo->sample_rate);
-	apollo_write_reg(apollo, APOLLO_REG_FORMAT, apollo->format);
+	apollo_seq_configure(apollo, apollo->sample_rate, apollo->format);
 
 	/* Set up DMA */
-	apollo_write_reg(apollo, APOLLO_REG_DMA_ADDR, lower_32_bits(apollo->dma_addr));
-	apollo_write_reg(apollo, APOLLO_REG_DMA_SIZE, runtime->dma_bytes);
+	apollo_dma_program(apollo, substream);
+
+	/* The runtime is fully configured now; let the loopback follow it */
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+		apollo_loopback_set_source(apollo, substream);
 
 	return 0;
 }
@@ -133,15 +163,29 @@ int apollo_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
 
 	dev_dbg(&apollo->pci->dev, "PCM trigger: %d\n", cmd);
+	trace_apollo_trigger(substream, cmd);
+	apollo_flight_log(&apollo->flight, APOLLO_FLIGHT_TRIGGER, substream->stream, cmd,
+			  substream->number);
 
 	switch (cmd) {
 	case SNDRV_PCM_TRIGGER_START:
+		WRITE_ONCE(apollo->streams[substream->stream].running, true);
 		atomic_set(&apollo->running, 1);
-		apollo_write_reg(apollo, APOLLO_REG_DMA_CONTROL, APOLLO_CMD_START);
+		if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+			apollo_sched_start(&apollo->sched, substream->runtime->period_size);
+		apollo_drift_start(apollo, substream->stream, substream->runtime->period_size,
+				   substream->runtime->rate);
+		apollo_seq_start(apollo, apollo->sg);
+		if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+			apollo_sched_started(&apollo->sched, substream->runtime->period_size);
 		break;
 	case SNDRV_PCM_TRIGGER_STOP:
+		WRITE_ONCE(apollo->streams[substream->stream].running, false);
 		atomic_set(&apollo->running, 0);
-		apollo_write_reg(apollo, APOLLO_REG_DMA_CONTROL, APOLLO_CMD_STOP);
+		apollo_seq_stop(apollo);
+		if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+			apollo_sched_stop(&apollo->sched);
+		apollo_drift_stop(apollo, substream->stream);
 		break;
 	default:
 		return -EINVAL;
@@ -150,29 +194,41 @@ int apollo_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 	return 0;
 }
 
-snd_pcm_uframes_t apollo_pcm_pointer(struct snd_pcm_substream *substream)
+/* Current hardware position in frames, without tracing */
+snd_pcm_uframes_t apollo_pcm_hw_pos(struct snd_pcm_substream *substream)
 {
 	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
 	struct snd_pcm_runtime *runtime = substream->runtime;
-	u32 position;
+	long offset;
 
-	/* Read current DMA position from device */
-	position = apollo_read_reg(apollo, APOLLO_REG_DMA_ADDR);
+	offset = apollo_dma_ring_pos(apollo, runtime->dma_addr, runtime->dma_bytes);
+	if (offset < 0)
+		return SNDRV_PCM_POS_XRUN;
 
 	/* Convert to frames */
-	return bytes_to_frames(runtime, position - lower_32_bits(apollo->dma_addr));
+	return bytes_to_frames(runtime, offset);
+}
+
+snd_pcm_uframes_t apollo_pcm_pointer(struct snd_pcm_substream *substream)
+{
+	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
+	snd_pcm_uframes_t pos = apollo_pcm_hw_pos(substream);
+
+	trace_apollo_pointer(substream, pos);
+	apollo_flight_log(&apollo->flight, APOLLO_FLIGHT_POINTER, substream->stream,
+			  substream->number, pos);
+	return pos;
 }
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
 int apollo_pcm_copy_user(struct snd_pcm_substream *substream, int channel,
 			unsigned long pos, void __user *buf, unsigned long bytes)
 {
-	struct apollo_device *apollo = snd_pcm_substream_chip(substream);
 	struct snd_pcm_runtime *runtime = substream->runtime;
 	void *dma_ptr;
 
 	/* Calculate DMA buffer position */
-	dma_ptr = apollo->dma_area + frames_to_bytes(runtime, pos);
+	dma_ptr = runtime->dma_area + frames_to_bytes(runtime, pos);
 
 	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
 		/* Copy from user space to DMA buffer */
@@ -0,0 +1,305 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Apollo Twin Register Map
+ *
+ * Generated from apollo_regs.map by tools/apollo_regmap.awk. Do not edit;
+ * change the map and run "make -C tools regs".
+ */
+
+#ifndef _APOLLO_REGS_H
+#define _APOLLO_REGS_H
+
+#include <linux/types.h>
+#include <linux/bits.h>
+#include <linux/bitfield.h>
+#include <linux/io.h>
+
+/* Device identification, reads 0x00000100 */
+#define APOLLO_REG_ID			0x00
+
+/* Serial number, characters 1-4 */
+#define APOLLO_REG_SERIAL0		0x20
+
+/* Serial number, characters 5-8 */
+#define APOLLO_REG_SERIAL1		0x24
+
+/* Serial number, characters 9-12 */
+#define APOLLO_REG_SERIAL2		0x28
+
+/* Serial number, characters 13-14 */
+#define APOLLO_REG_SERIAL3		0x2c
+
+/* Device command (APOLLO_CMD_*) (placeholder) */
+#define APOLLO_REG_CONTROL		0x40
+#define APOLLO_CONTROL_CMD		GENMASK(7, 0)
+
+/* Interrupt status, write back to clear (placeholder) */
+#define APOLLO_REG_STATUS		0x44
+#define APOLLO_STATUS_READY		BIT(0)
+#define APOLLO_STATUS_RUNNING		BIT(1)
+#define APOLLO_STATUS_ERROR		BIT(2)
+#define APOLLO_STATUS_CLOCK		BIT(3)
+
+/* Sample rate in Hz (placeholder) */
+#define APOLLO_REG_SAMPLE_RATE		0x48
+#define APOLLO_SAMPLE_RATE_RATE		GENMASK(31, 0)
+
+/* Sample format (APOLLO_FORMAT_*) (placeholder) */
+#define APOLLO_REG_FORMAT		0x4c
+#define APOLLO_FORMAT_FORMAT		GENMASK(1, 0)
+
+/* Ring or descriptor table address, low word; live address in contiguous mode (placeholder) */
+#define APOLLO_REG_DMA_ADDR		0x50
+
+/* Ring size in bytes (placeholder) */
+#define APOLLO_REG_DMA_SIZE		0x54
+
+/* DMA engine command (placeholder) */
+#define APOLLO_REG_DMA_CONTROL		0x58
+#define APOLLO_DMA_CONTROL_CMD		GENMASK(3, 0)
+#define APOLLO_DMA_CONTROL_SG		BIT(4)
+
+/* Byte offset of the engine inside the ring (scatter-gather) (placeholder) */
+#define APOLLO_REG_DMA_POS		0x5c
+
+/* Ring or descriptor table address, high word (placeholder) */
+#define APOLLO_REG_DMA_ADDR_HI		0x60
+
+/* Firmware chunk destination offset (placeholder) */
+#define APOLLO_REG_FW_ADDR		0x64
+
+/* Firmware chunk length (placeholder) */
+#define APOLLO_REG_FW_LEN		0x68
+
+/* Sample clock source (APOLLO_CLOCK_*) (placeholder) */
+#define APOLLO_REG_CLOCK_SOURCE		0x6c
+#define APOLLO_CLOCK_SOURCE_SOURCE	GENMASK(1, 0)
+
+/* Clock lock state (placeholder) */
+#define APOLLO_REG_CLOCK_STATUS		0x70
+#define APOLLO_CLOCK_STATUS_LOCKED	BIT(0)
+#define APOLLO_CLOCK_STATUS_RATE	GENMASK(31, 8)
+
+/* Stage a parameter change for the next period boundary (placeholder) */
+#define APOLLO_REG_PARAM		0x74
+#define APOLLO_PARAM_ID			GENMASK(7, 0)
+#define APOLLO_PARAM_RAMP		GENMASK(31, 8)
+
+/* Value of the staged parameter; writing it commits the change (placeholder) */
+#define APOLLO_REG_PARAM_VALUE		0x78
+
+/* Register values */
+#define APOLLO_CMD_START		0x01
+#define APOLLO_CMD_STOP			0x02
+#define APOLLO_CMD_RESET		0x03
+#define APOLLO_CMD_FW_CHUNK		0x04	/* consume chunk staged in the bulk window */
+#define APOLLO_CMD_FW_BOOT		0x05	/* start the uploaded firmware */
+
+#define APOLLO_FORMAT_S16_LE		0
+#define APOLLO_FORMAT_S24_3LE		1
+#define APOLLO_FORMAT_S32_LE		2
+
+#define APOLLO_CLOCK_INTERNAL		0
+#define APOLLO_CLOCK_SPDIF		1
+#define APOLLO_CLOCK_ADAT		2
+
+#define APOLLO_PARAM_MASTER_L		0	/* main output left level, 0-100 */
+#define APOLLO_PARAM_MASTER_R		1	/* main output right level, 0-100 */
+#define APOLLO_PARAM_MONITOR		2	/* monitor level, 0-100 */
+
+/* How a shadow register layer may cache each register */
+enum apollo_reg_cache {
+	APOLLO_CACHE_NONE,		/* volatile: always access the device */
+	APOLLO_CACHE_ONCE,		/* read-only constant: read it once */
+	APOLLO_CACHE_WRITE_THROUGH,	/* write through, serve reads from the cache */
+	APOLLO_CACHE_WRITE_ONLY,	/* unreadable: the cache holds the last write */
+};
+
+static inline enum apollo_reg_cache apollo_reg_cache_policy(u32 offset)
+{
+	switch (offset) {
+	case APOLLO_REG_SAMPLE_RATE:
+		return APOLLO_CACHE_WRITE_THROUGH;
+	case APOLLO_REG_FORMAT:
+		return APOLLO_CACHE_WRITE_THROUGH;
+	case APOLLO_REG_DMA_SIZE:
+		return APOLLO_CACHE_WRITE_THROUGH;
+	case APOLLO_REG_DMA_ADDR_HI:
+		return APOLLO_CACHE_WRITE_THROUGH;
+	case APOLLO_REG_FW_ADDR:
+		return APOLLO_CACHE_WRITE_ONLY;
+	case APOLLO_REG_FW_LEN:
+		return APOLLO_CACHE_WRITE_ONLY;
+	case APOLLO_REG_CLOCK_SOURCE:
+		return APOLLO_CACHE_WRITE_THROUGH;
+	case APOLLO_REG_PARAM:
+		return APOLLO_CACHE_WRITE_ONLY;
+	case APOLLO_REG_PARAM_VALUE:
+		return APOLLO_CACHE_WRITE_ONLY;
+	case APOLLO_REG_ID:
+		return APOLLO_CACHE_ONCE;
+	case APOLLO_REG_SERIAL0:
+		return APOLLO_CACHE_ONCE;
+	case APOLLO_REG_SERIAL1:
+		return APOLLO_CACHE_ONCE;
+	case APOLLO_REG_SERIAL2:
+		return APOLLO_CACHE_ONCE;
+	case APOLLO_REG_SERIAL3:
+		return APOLLO_CACHE_ONCE;
+	default:
+		return APOLLO_CACHE_NONE;
+	}
+}
+
+/*
+ * Field accessors. apollo_<reg>_<field>() decodes a value already read,
+ * apollo_read_/write_ access the device directly. apollo_update_ is used
+ * for read-write registers with several fields and costs a read; a
+ * write-only register with several fields is written whole.
+ */
+
+static inline void apollo_write_control_cmd(void __iomem *regs, u32 val)
+{
+	writel(FIELD_PREP(APOLLO_CONTROL_CMD, val), regs + APOLLO_REG_CONTROL);
+}
+
+static inline u32 apollo_status_ready(u32 val)
+{
+	return FIELD_GET(APOLLO_STATUS_READY, val);
+}
+
+static inline u32 apollo_read_status_ready(const void __iomem *regs)
+{
+	return FIELD_GET(APOLLO_STATUS_READY, readl(regs + APOLLO_REG_STATUS));
+}
+
+static inline void apollo_write_status_ready(void __iomem *regs, u32 val)
+{
+	writel(FIELD_PREP(APOLLO_STATUS_READY, val), regs + APOLLO_REG_STATUS);
+}
+
+static inline u32 apollo_status_running(u32 val)
+{
+	return FIELD_GET(APOLLO_STATUS_RUNNING, val);
+}
+
+static inline u32 apollo_read_status_running(const void __iomem *regs)
+{
+	return FIELD_GET(APOLLO_STATUS_RUNNING, readl(regs + APOLLO_REG_STATUS));
+}
+
+static inline void apollo_write_status_running(void __iomem *regs, u32 val)
+{
+	writel(FIELD_PREP(APOLLO_STATUS_RUNNING, val), regs + APOLLO_REG_STATUS);
+}
+
+static inline u32 apollo_status_error(u32 val)
+{
+	return FIELD_GET(APOLLO_STATUS_ERROR, val);
+}
+
+static inline u32 apollo_read_status_error(const void __iomem *regs)
+{
+	return FIELD_GET(APOLLO_STATUS_ERROR, readl(regs + APOLLO_REG_STATUS));
+}
+
+static inline void apollo_write_status_error(void __iomem *regs, u32 val)
+{
+	writel(FIELD_PREP(APOLLO_STATUS_ERROR, val), regs + APOLLO_REG_STATUS);
+}
+
+static inline u32 apollo_status_clock(u32 val)
+{
+	return FIELD_GET(APOLLO_STATUS_CLOCK, val);
+}
+
+static inline u32 apollo_read_status_clock(const void __iomem *regs)
+{
+	return FIELD_GET(APOLLO_STATUS_CLOCK, readl(regs + APOLLO_REG_STATUS));
+}
+
+static inline void apollo_write_status_clock(void __iomem *regs, u32 val)
+{
+	writel(FIELD_PREP(APOLLO_STATUS_CLOCK, val), regs + APOLLO_REG_STATUS);
+}
+
+static inline u32 apollo_sample_rate_rate(u32 val)
+{
+	return FIELD_GET(APOLLO_SAMPLE_RATE_RATE, val);
+}
+
+static inline u32 apollo_read_sample_rate_rate(const void __iomem *regs)
+{
+	return FIELD_GET(APOLLO_SAMPLE_RATE_RATE, readl(regs + APOLLO_REG_SAMPLE_RATE));
+}
+
+static inline void apollo_write_sample_rate_rate(void __iomem *regs, u32 val)
+{
+	writel(FIELD_PREP(APOLLO_SAMPLE_RATE_RATE, val), regs + APOLLO_REG_SAMPLE_RATE);
+}
+
+static inline u32 apollo_format_format(u32 val)
+{
+	return FIELD_GET(APOLLO_FORMAT_FORMAT, val);
+}
+
+static inline u32 apollo_read_format_format(const void __iomem *regs)
+{
+	return FIELD_GET(APOLLO_FORMAT_FORMAT, readl(regs + APOLLO_REG_FORMAT));
+}
+
+static inline void apollo_write_format_format(void __iomem *regs, u32 val)
+{
+	writel(FIELD_PREP(APOLLO_FORMAT_FORMAT, val), regs + APOLLO_REG_FORMAT);
+}
+
+static inline void apollo_write_dma_control(void __iomem *regs, u32 cmd, u32 sg)
+{
+	writel(FIELD_PREP(APOLLO_DMA_CONTROL_CMD, cmd) |
+	       FIELD_PREP(APOLLO_DMA_CONTROL_SG, sg),
+	       regs + APOLLO_REG_DMA_CONTROL);
+}
+
+static inline u32 apollo_clock_source_source(u32 val)
+{
+	return FIELD_GET(APOLLO_CLOCK_SOURCE_SOURCE, val);
+}
+
+static inline u32 apollo_read_clock_source_source(const void __iomem *regs)
+{
+	return FIELD_GET(APOLLO_CLOCK_SOURCE_SOURCE, readl(regs + APOLLO_REG_CLOCK_SOURCE));
+}
+
+static inline void apollo_write_clock_source_source(void __iomem *regs, u32 val)
+{
+	writel(FIELD_PREP(APOLLO_CLOCK_SOURCE_SOURCE, val), regs + APOLLO_REG_CLOCK_SOURCE);
+}
+
+static inline u32 apollo_clock_status_locked(u32 val)
+{
+	return FIELD_GET(APOLLO_CLOCK_STATUS_LOCKED, val);
+}
+
+static inline u32 apollo_read_clock_status_locked(const void __iomem *regs)
+{
+	return FIELD_GET(APOLLO_CLOCK_STATUS_LOCKED, readl(regs + APOLLO_REG_CLOCK_STATUS));
+}
+
+static inline u32 apollo_clock_status_rate(u32 val)
+{
+	return FIELD_GET(APOLLO_CLOCK_STATUS_RATE, val);
+}
+
+static inline u32 apollo_read_clock_status_rate(const void __iomem *regs)
+{
+	return FIELD_GET(APOLLO_CLOCK_STATUS_RATE, readl(regs + APOLLO_REG_CLOCK_STATUS));
+}
+
+static inline void apollo_write_param(void __iomem *regs, u32 id, u32 ramp)
+{
+	writel(FIELD_PREP(APOLLO_PARAM_ID, id) |
+	       FIELD_PREP(APOLLO_PARAM_RAMP, ramp),
+	       regs + APOLLO_REG_PARAM);
+}
+
+#endif /* _APOLLO_REGS_H */
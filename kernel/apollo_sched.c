@@ -0,0 +1,377 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Twin Parameter Automation
+ *
+ * A level written straight from a control put changes whenever the MMIO
+ * write lands, which is random relative to the audio, so automated rides
+ * jitter and can click. Here each change carries a target frame on the
+ * playback timeline (frames since the stream started, the count behind
+ * the PCM hw_ptr). It is staged from the period interrupt for the
+ * boundary at or before that frame. The device latches staged values at
+ * its next period boundary, so a change lands on that boundary however
+ * late the interrupt ran. Ramps are left to the device when it can do
+ * them (param_hw_ramp); otherwise they are stepped once per period.
+ *
+ * The queue and ramp logic only reach the device through the stage
+ * callback; the KUnit suite drives them with a software stand-in.
+ */
+
+#include <linux/module.h>
+#include <linux/bitfield.h>
+#include <linux/math64.h>
+#include <sound/core.h>
+#include <sound/control.h>
+#include "apollo.h"
+
+static bool param_hw_ramp;
+module_param(param_hw_ramp, bool, 0444);
+MODULE_PARM_DESC(param_hw_ramp,
+		 "Let the device ramp scheduled parameter changes (default: false, step once per period)");
+
+/* Heap order: target frame, then submission order */
+static bool apollo_sched_before(const struct apollo_sched_event *a,
+				const struct apollo_sched_event *b)
+{
+	if (a->frame != b->frame)
+		return a->frame < b->frame;
+	return (s32)(a->seq - b->seq) < 0;
+}
+
+static void apollo_sched_push(struct apollo_sched *sched, const struct apollo_sched_event *ev)
+{
+	unsigned int i = sched->count++;
+
+	while (i) {
+		unsigned int parent = (i - 1) / 2;
+
+		if (!apollo_sched_before(ev, &sched->heap[parent]))
+			break;
+		sched->heap[i] = sched->heap[parent];
+		i = parent;
+	}
+	sched->heap[i] = *ev;
+}
+
+static void apollo_sched_pop(struct apollo_sched *sched)
+{
+	struct apollo_sched_event last = sched->heap[--sched->count];
+	unsigned int i = 0, child;
+
+	while ((child = 2 * i + 1) < sched->count) {
+		if (child + 1 < sched->count &&
+		    apollo_sched_before(&sched->heap[child + 1], &sched->heap[child]))
+			child++;
+		if (!apollo_sched_before(&sched->heap[child], &last))
+			break;
+		sched->heap[i] = sched->heap[child];
+		i = child;
+	}
+	sched->heap[i] = last;
+}
+
+static void apollo_sched_set(struct apollo_sched *sched, u32 param, u32 value, u32 ramp)
+{
+	sched->stage(sched, param, value, ramp);
+	sched->value[param] = value;
+}
+
+static u32 apollo_sched_ramp_value(const struct apollo_sched_ramp *ramp, u64 at)
+{
+	s64 span = (s64)ramp->to - ramp->from;
+
+	if (at >= ramp->end)
+		return ramp->to;
+	return ramp->from + div64_s64(span * (s64)(at - ramp->start), ramp->end - ramp->start);
+}
+
+/* Stage one due change for the boundary at 'at' */
+static void apollo_sched_apply(struct apollo_sched *sched,
+			       const struct apollo_sched_event *ev, u64 at)
+{
+	struct apollo_sched_ramp *ramp = &sched->ramps[ev->param];
+
+	ramp->active = false;
+	if (!ev->ramp || sched->hw_ramp) {
+		apollo_sched_set(sched, ev->param, ev->value, sched->hw_ramp ? ev->ramp : 0);
+		return;
+	}
+
+	/* The period starting at 'at' still plays the old value */
+	ramp->active = true;
+	ramp->start = at;
+	ramp->end = at + ev->ramp;
+	ramp->from = sched->value[ev->param];
+	ramp->to = ev->value;
+}
+
+/*
+ * Stage everything for the period starting at boundary: the next step of
+ * each running ramp, then the changes targeting a frame before the
+ * following boundary, in (frame, seq) order.
+ */
+static void apollo_sched_stage_locked(struct apollo_sched *sched, u64 boundary, u32 period)
+{
+	struct apollo_sched_event ev;
+	unsigned int i;
+
+	for (i = 0; i < APOLLO_PARAM_COUNT; i++) {
+		struct apollo_sched_ramp *ramp = &sched->ramps[i];
+		u32 value;
+
+		if (!ramp->active)
+			continue;
+
+		value = apollo_sched_ramp_value(ramp, boundary);
+		if (value != sched->value[i])
+			apollo_sched_set(sched, i, value, 0);
+		if (boundary >= ramp->end)
+			ramp->active = false;
+	}
+
+	while (sched->count && sched->heap[0].frame < boundary + period) {
+		ev = sched->heap[0];
+		apollo_sched_pop(sched);
+
+		if (ev.frame < boundary)
+			sched->late++;
+		apollo_sched_apply(sched, &ev, boundary);
+		sched->applied++;
+	}
+
+	sched->next = boundary + period;
+}
+
+void apollo_sched_init(struct apollo_sched *sched,
+		       void (*stage)(struct apollo_sched *sched, u32 param, u32 value, u32 ramp),
+		       bool hw_ramp)
+{
+	memset(sched, 0, sizeof(*sched));
+	spin_lock_init(&sched->lock);
+	sched->stage = stage;
+	sched->hw_ramp = hw_ramp;
+}
+
+/*
+ * Queue n changes for the same frame, optionally ramping to them over
+ * ramp frames. APOLLO_SCHED_ASAP takes the next boundary still open, or
+ * writes at once when no stream is running. All of them are queued under
+ * one lock, so they land on the same boundary, or none is and -ENOSPC is
+ * returned. May be called from any context.
+ */
+int apollo_sched_add_group(struct apollo_sched *sched, const struct apollo_sched_change *changes,
+			   unsigned int n, u64 frame, u32 ramp)
+{
+	struct apollo_sched_event ev = {
+		.frame = frame,
+		.ramp = ramp,
+	};
+	unsigned long flags;
+	unsigned int i;
+	int err = 0;
+
+	if (ramp > FIELD_MAX(APOLLO_PARAM_RAMP))
+		return -EINVAL;
+	for (i = 0; i < n; i++)
+		if (changes[i].param >= APOLLO_PARAM_COUNT)
+			return -EINVAL;
+
+	spin_lock_irqsave(&sched->lock, flags);
+
+	if (frame == APOLLO_SCHED_ASAP && !sched->running) {
+		/* Nothing playing to line up with */
+		for (i = 0; i < n; i++) {
+			sched->ramps[changes[i].param].active = false;
+			apollo_sched_set(sched, changes[i].param, changes[i].value, 0);
+		}
+	} else if (sched->count + n > APOLLO_SCHED_DEPTH) {
+		err = -ENOSPC;
+	} else {
+		if (frame == APOLLO_SCHED_ASAP)
+			ev.frame = sched->next;
+		for (i = 0; i < n; i++) {
+			ev.param = changes[i].param;
+			ev.value = changes[i].value;
+			ev.seq = sched->seq++;
+			apollo_sched_push(sched, &ev);
+		}
+	}
+
+	spin_unlock_irqrestore(&sched->lock, flags);
+	return err;
+}
+
+int apollo_sched_add(struct apollo_sched *sched, u32 param, u32 value, u64 frame, u32 ramp)
+{
+	const struct apollo_sched_change change = { .param = param, .value = value };
+
+	return apollo_sched_add_group(sched, &change, 1, frame, ramp);
+}
+
+/*
+ * Stream start, before the DMA engine: changes for the first period are
+ * staged now and latched as the engine starts.
+ */
+void apollo_sched_start(struct apollo_sched *sched, u32 period)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sched->lock, flags);
+	sched->running = true;
+	apollo_sched_stage_locked(sched, 0, period);
+	spin_unlock_irqrestore(&sched->lock, flags);
+}
+
+/*
+ * Right after the DMA engine started: it is in the first period, so what
+ * is staged now latches at the boundary ending it. The first interrupt
+ * comes at that boundary and stages the one after.
+ */
+void apollo_sched_started(struct apollo_sched *sched, u32 period)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sched->lock, flags);
+	if (sched->running)
+		apollo_sched_stage_locked(sched, period, period);
+	spin_unlock_irqrestore(&sched->lock, flags);
+}
+
+/*
+ * Stream stop. Pending changes refer to the stopped stream's timeline and
+ * are dropped; ramps jump to their final value.
+ */
+void apollo_sched_stop(struct apollo_sched *sched)
+{
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&sched->lock, flags);
+	sched->running = false;
+	sched->count = 0;
+	sched->next = 0;
+	for (i = 0; i < APOLLO_PARAM_COUNT; i++) {
+		if (sched->ramps[i].active)
+			apollo_sched_set(sched, i, sched->ramps[i].to, 0);
+		sched->ramps[i].active = false;
+	}
+	spin_unlock_irqrestore(&sched->lock, flags);
+}
+
+/* Stage the period starting at boundary; from the period interrupt */
+void apollo_sched_boundary(struct apollo_sched *sched, u64 boundary, u32 period)
+{
+	spin_lock(&sched->lock);
+	if (sched->running)
+		apollo_sched_stage_locked(sched, boundary, period);
+	spin_unlock(&sched->lock);
+}
+
+/* Device side */
+
+static void apollo_sched_stage_regs(struct apollo_sched *sched, u32 param, u32 value, u32 ramp)
+{
+	struct apollo_device *apollo = container_of(sched, struct apollo_device, sched);
+
+	apollo_write_param(apollo->regs, param, ramp);
+	apollo_write_reg(apollo, APOLLO_REG_PARAM_VALUE, value);
+	apollo_flight_log(&apollo->flight, APOLLO_FLIGHT_PARAM, 0, param, value);
+}
+
+/*
+ * Playback period interrupt: crossed boundaries since the last one. The
+ * device is playing the period after the last boundary crossed, so stage
+ * the one after that.
+ */
+void apollo_sched_period(struct apollo_device *apollo, unsigned int crossed, u32 period)
+{
+	struct apollo_stream *stream = &apollo->streams[SNDRV_PCM_STREAM_PLAYBACK];
+	struct apollo_sched *sched = &apollo->sched;
+
+	spin_lock(&sched->lock);
+	stream->frames += (u64)crossed * period;
+	if (sched->running)
+		apollo_sched_stage_locked(sched, stream->frames + period, period);
+	spin_unlock(&sched->lock);
+}
+
+/* ALSA controls: { param, value, frame or -1 for ASAP, ramp frames } */
+static int apollo_sched_ctl_info(struct snd_kcontrol *kcontrol,
+				 struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER64;
+	uinfo->count = 4;
+	uinfo->value.integer64.min = -1;
+	uinfo->value.integer64.max = LLONG_MAX;
+	return 0;
+}
+
+static int apollo_sched_ctl_put(struct snd_kcontrol *kcontrol,
+				struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+	long long *v = uvalue->value.integer64.value;
+
+	if (v[0] < 0 || v[0] >= APOLLO_PARAM_COUNT || v[1] < 0 || v[1] > U32_MAX ||
+	    v[3] < 0 || v[3] > U32_MAX)
+		return -EINVAL;
+
+	return apollo_sched_add(&apollo->sched, v[0], v[1],
+				v[2] < 0 ? APOLLO_SCHED_ASAP : v[2], v[3]);
+}
+
+static int apollo_sched_pos_info(struct snd_kcontrol *kcontrol,
+				 struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER64;
+	uinfo->count = 1;
+	uinfo->value.integer64.min = 0;
+	uinfo->value.integer64.max = LLONG_MAX;
+	return 0;
+}
+
+static int apollo_sched_pos_get(struct snd_kcontrol *kcontrol,
+				struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+	unsigned long flags;
+
+	spin_lock_irqsave(&apollo->sched.lock, flags);
+	uvalue->value.integer64.value[0] = apollo->streams[SNDRV_PCM_STREAM_PLAYBACK].frames;
+	spin_unlock_irqrestore(&apollo->sched.lock, flags);
+	return 0;
+}
+
+static const struct snd_kcontrol_new apollo_sched_controls[] = {
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "Parameter Schedule",
+		.access = SNDRV_CTL_ELEM_ACCESS_WRITE,
+		.info = apollo_sched_ctl_info,
+		.put = apollo_sched_ctl_put,
+	},
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "Playback Frame Position",
+		.access = SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE,
+		.info = apollo_sched_pos_info,
+		.get = apollo_sched_pos_get,
+	},
+};
+
+int apollo_sched_new(struct apollo_device *apollo)
+{
+	int i, err;
+
+	apollo_sched_init(&apollo->sched, apollo_sched_stage_regs, param_hw_ramp);
+
+	for (i = 0; i < ARRAY_SIZE(apollo_sched_controls); i++) {
+		err = snd_ctl_add(apollo->card, snd_ctl_new1(&apollo_sched_controls[i], apollo));
+		if (err < 0) {
+			dev_err(&apollo->pci->dev, "Failed to add control %s\n",
+				apollo_sched_controls[i].name);
+			return err;
+		}
+	}
+
+	return 0;
+}
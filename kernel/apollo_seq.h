@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Apollo Twin Register Sequences
+ *
+ * Device reset, stream configuration and DMA engine programming, written
+ * once and used by both the driver and the VFIO engine
+ * (userspace/apollo_vfio.c), so the two program the device identically.
+ * Nothing here depends on the kernel; the includer provides, before
+ * including this file and after apollo_regs.h:
+ *
+ *   APOLLO_SEQ_CTX                handle type passed to the accessors
+ *   apollo_seq_read(ctx, reg)     32-bit register read
+ *   apollo_seq_write(ctx, reg, v) 32-bit register write, ordered after
+ *                                 earlier memory writes (writel())
+ *   apollo_seq_msleep(ms)         sleep, may be called during reset only
+ */
+
+#ifndef _APOLLO_SEQ_H
+#define _APOLLO_SEQ_H
+
+#ifndef APOLLO_SEQ_CTX
+#error "define APOLLO_SEQ_CTX and the apollo_seq_* accessors first"
+#endif
+
+#define APOLLO_SEQ_RESET_DELAY_MS	10
+#define APOLLO_SEQ_READY_TIMEOUT_MS	100
+
+/*
+ * Byte offset of a 32-bit hardware address inside a ring starting at base.
+ * The subtraction is done modulo 2^32 so a ring straddling a 4GB boundary
+ * still yields the right offset. Returns -ERANGE for addresses outside the
+ * ring instead of a bogus position.
+ */
+static inline long apollo_ring_offset(uint32_t hw_addr, uint64_t base, size_t ring_bytes)
+{
+	uint32_t ofs = hw_addr - (uint32_t)base;
+
+	if (ofs >= ring_bytes)
+		return -ERANGE;
+	return ofs;
+}
+
+/* Reset the device and wait for it to report ready */
+static inline int apollo_seq_reset(APOLLO_SEQ_CTX *ctx)
+{
+	int timeout = APOLLO_SEQ_READY_TIMEOUT_MS;
+	uint32_t status;
+
+	apollo_seq_write(ctx, APOLLO_REG_CONTROL, APOLLO_CMD_RESET);
+	apollo_seq_msleep(APOLLO_SEQ_RESET_DELAY_MS);
+
+	while (timeout--) {
+		status = apollo_seq_read(ctx, APOLLO_REG_STATUS);
+		if (status & APOLLO_STATUS_READY)
+			return 0;
+		apollo_seq_msleep(1);
+	}
+
+	return -ETIMEDOUT;
+}
+
+/* Stream parameters; rate in Hz, format APOLLO_FORMAT_* */
+static inline void apollo_seq_configure(APOLLO_SEQ_CTX *ctx, uint32_t rate, uint32_t format)
+{
+	apollo_seq_write(ctx, APOLLO_REG_SAMPLE_RATE, rate);
+	apollo_seq_write(ctx, APOLLO_REG_FORMAT, format);
+}
+
+/*
+ * Point the engine at a ring. addr is the bus address of the ring itself
+ * in contiguous mode, or of its descriptor table in scatter-gather mode.
+ */
+static inline void apollo_seq_dma_ring(APOLLO_SEQ_CTX *ctx, uint64_t addr, uint32_t bytes)
+{
+	apollo_seq_write(ctx, APOLLO_REG_DMA_ADDR_HI, (uint32_t)(addr >> 32));
+	apollo_seq_write(ctx, APOLLO_REG_DMA_ADDR, (uint32_t)addr);
+	apollo_seq_write(ctx, APOLLO_REG_DMA_SIZE, bytes);
+}
+
+static inline void apollo_seq_start(APOLLO_SEQ_CTX *ctx, bool sg)
+{
+	apollo_seq_write(ctx, APOLLO_REG_DMA_CONTROL,
+			 APOLLO_CMD_START | (sg ? APOLLO_DMA_CONTROL_SG : 0));
+}
+
+static inline void apollo_seq_stop(APOLLO_SEQ_CTX *ctx)
+{
+	apollo_seq_write(ctx, APOLLO_REG_DMA_CONTROL, APOLLO_CMD_STOP);
+}
+
+/* Byte offset of the engine inside a ring at base, or -ERANGE */
+static inline long apollo_seq_ring_pos(APOLLO_SEQ_CTX *ctx, bool sg, uint64_t base,
+				       size_t bytes)
+{
+	/* The descriptor chain has no linear address; use the ring offset */
+	if (sg)
+		return apollo_ring_offset(apollo_seq_read(ctx, APOLLO_REG_DMA_POS), 0, bytes);
+
+	return apollo_ring_offset(apollo_seq_read(ctx, APOLLO_REG_DMA_ADDR), base, bytes);
+}
+
+#endif /* _APOLLO_SEQ_H */
@@ -0,0 +1,179 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Twin Stream Health Counters
+ *
+ * The interrupt handler records how late it ran after each period
+ * boundary, from how far the hardware position had moved past it, and
+ * counts engine errors. It is the only writer of those, so they are plain
+ * words updated with WRITE_ONCE, a few nanoseconds per period.
+ *
+ * Xruns are counted in the prepare callback instead: the interrupt only
+ * sees the ones it detects itself, not those the core finds when an
+ * application's pointer update or a late write/read runs into the
+ * hardware position. Either way the application has to prepare the stream
+ * again, and it is still in SNDRV_PCM_STATE_XRUN when it does. Several
+ * substreams may prepare at once, so these counters are atomic.
+ *
+ * Read-only controls expose the counters to monitoring (apollod's metrics
+ * endpoint); xruns are also announced as control events.
+ */
+
+#include <linux/module.h>
+#include <sound/core.h>
+#include <sound/control.h>
+#include <sound/pcm.h>
+#include "apollo.h"
+
+static void apollo_stats_inc(unsigned long *counter)
+{
+	WRITE_ONCE(*counter, *counter + 1);
+}
+
+/* A stream crossed a period boundary; late is the position past it */
+void apollo_stats_period(struct apollo_device *apollo, int dir, snd_pcm_uframes_t late,
+			 unsigned int rate)
+{
+	apollo_stats_inc(&apollo->stats.irq_latency[dir][apollo_latency_bucket(late, rate)]);
+}
+
+/*
+ * Prepare callback: a stream recovering from an xrun is still in XRUN.
+ * Also freezes the flight recorder on the first one.
+ */
+void apollo_stats_prepare(struct apollo_device *apollo, struct snd_pcm_substream *substream)
+{
+	struct apollo_stats *stats = &apollo->stats;
+
+	if (substream->runtime->status->state != SNDRV_PCM_STATE_XRUN)
+		return;
+
+	atomic_long_inc(&stats->xruns[substream->stream]);
+	apollo_flight_freeze(&apollo->flight, APOLLO_FLIGHT_XRUN, substream);
+	if (stats->xrun_ctl)
+		snd_ctl_notify(apollo->card, SNDRV_CTL_EVENT_MASK_VALUE, &stats->xrun_ctl->id);
+}
+
+void apollo_stats_error(struct apollo_device *apollo)
+{
+	apollo_stats_inc(&apollo->stats.engine_errors);
+}
+
+static int apollo_stats_info(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = kcontrol->private_value;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = LONG_MAX;
+	return 0;
+}
+
+/* Playback buckets, then capture */
+static int apollo_stats_latency_get(struct snd_kcontrol *kcontrol,
+				    struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+	int dir, i;
+
+	for (dir = 0; dir < 2; dir++)
+		for (i = 0; i < APOLLO_LATENCY_BUCKETS; i++)
+			uvalue->value.integer.value[dir * APOLLO_LATENCY_BUCKETS + i] =
+				READ_ONCE(apollo->stats.irq_latency[dir][i]);
+	return 0;
+}
+
+static int apollo_stats_xruns_get(struct snd_kcontrol *kcontrol,
+				  struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+
+	uvalue->value.integer.value[0] = atomic_long_read(&apollo->stats.xruns[SNDRV_PCM_STREAM_PLAYBACK]);
+	uvalue->value.integer.value[1] = atomic_long_read(&apollo->stats.xruns[SNDRV_PCM_STREAM_CAPTURE]);
+	return 0;
+}
+
+static int apollo_stats_errors_get(struct snd_kcontrol *kcontrol,
+				   struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+
+	uvalue->value.integer.value[0] = READ_ONCE(apollo->stats.engine_errors);
+	return 0;
+}
+
+static int apollo_stats_running_info(struct snd_kcontrol *kcontrol,
+				     struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_BOOLEAN;
+	uinfo->count = 2;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = 1;
+	return 0;
+}
+
+static int apollo_stats_running_get(struct snd_kcontrol *kcontrol,
+				    struct snd_ctl_elem_value *uvalue)
+{
+	struct apollo_device *apollo = snd_kcontrol_chip(kcontrol);
+	int dir;
+
+	for (dir = 0; dir < 2; dir++)
+		uvalue->value.integer.value[dir] = READ_ONCE(apollo->streams[dir].running);
+	return 0;
+}
+
+#define APOLLO_STATS_ACCESS \
+	(SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE)
+
+static const struct snd_kcontrol_new apollo_stats_controls[] = {
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "IRQ Latency Histogram",
+		.access = APOLLO_STATS_ACCESS,
+		.info = apollo_stats_info,
+		.get = apollo_stats_latency_get,
+		.private_value = 2 * APOLLO_LATENCY_BUCKETS,
+	},
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "Xrun Count",
+		.access = APOLLO_STATS_ACCESS,
+		.info = apollo_stats_info,
+		.get = apollo_stats_xruns_get,
+		.private_value = 2,
+	},
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "Engine Error Count",
+		.access = APOLLO_STATS_ACCESS,
+		.info = apollo_stats_info,
+		.get = apollo_stats_errors_get,
+		.private_value = 1,
+	},
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "Stream Running",
+		.access = APOLLO_STATS_ACCESS,
+		.info = apollo_stats_running_info,
+		.get = apollo_stats_running_get,
+	},
+};
+
+int apollo_stats_new(struct apollo_device *apollo)
+{
+	struct snd_kcontrol *kctl;
+	int i, err;
+
+	for (i = 0; i < ARRAY_SIZE(apollo_stats_controls); i++) {
+		kctl = snd_ctl_new1(&apollo_stats_controls[i], apollo);
+		err = snd_ctl_add(apollo->card, kctl);
+		if (err < 0) {
+			dev_err(&apollo->pci->dev, "Failed to add control %s\n",
+				apollo_stats_controls[i].name);
+			return err;
+		}
+		if (apollo_stats_controls[i].get == apollo_stats_xruns_get)
+			apollo->stats.xrun_ctl = kctl;
+	}
+
+	return 0;
+}
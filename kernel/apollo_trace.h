@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Apollo Twin Tracepoints
+ *
+ * Consumed by tools/apollo_trace. Field names and layout are read from the
+ * tracefs format files, so fields may be added but not renamed.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM apollo
+
+#if !defined(_APOLLO_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _APOLLO_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <sound/pcm.h>
+
+TRACE_EVENT(apollo_irq,
+	TP_PROTO(u32 status),
+	TP_ARGS(status),
+	TP_STRUCT__entry(
+		__field(u32, status)
+	),
+	TP_fast_assign(
+		__entry->status = status;
+	),
+	TP_printk("status=0x%08x", __entry->status)
+);
+
+DECLARE_EVENT_CLASS(apollo_position,
+	TP_PROTO(struct snd_pcm_substream *substream, snd_pcm_uframes_t hw_pos),
+	TP_ARGS(substream, hw_pos),
+	TP_STRUCT__entry(
+		__field(int, stream)
+		__field(u32, hw_pos)
+		__field(u32, period_size)
+		__field(u32, buffer_size)
+		__field(u32, rate)
+	),
+	TP_fast_assign(
+		__entry->stream = substream->stream;
+		__entry->hw_pos = hw_pos;
+		__entry->period_size = substream->runtime->period_size;
+		__entry->buffer_size = substream->runtime->buffer_size;
+		__entry->rate = substream->runtime->rate;
+	),
+	TP_printk("stream=%d hw_pos=%u period=%u buffer=%u rate=%u",
+		  __entry->stream, __entry->hw_pos, __entry->period_size,
+		  __entry->buffer_size, __entry->rate)
+);
+
+/* Hardware position sampled in the IRQ, before snd_pcm_period_elapsed() */
+DEFINE_EVENT(apollo_position, apollo_period,
+	TP_PROTO(struct snd_pcm_substream *substream, snd_pcm_uframes_t hw_pos),
+	TP_ARGS(substream, hw_pos)
+);
+
+/* Hardware position reported to ALSA from the .pointer callback */
+DEFINE_EVENT(apollo_position, apollo_pointer,
+	TP_PROTO(struct snd_pcm_substream *substream, snd_pcm_uframes_t hw_pos),
+	TP_ARGS(substream, hw_pos)
+);
+
+TRACE_EVENT(apollo_trigger,
+	TP_PROTO(struct snd_pcm_substream *substream, int cmd),
+	TP_ARGS(substream, cmd),
+	TP_STRUCT__entry(
+		__field(int, stream)
+		__field(int, cmd)
+	),
+	TP_fast_assign(
+		__entry->stream = substream->stream;
+		__entry->cmd = cmd;
+	),
+	TP_printk("stream=%d cmd=%d", __entry->stream, __entry->cmd)
+);
+
+/* CLOCK_STATUS latched in the IRQ, before the control notifications */
+TRACE_EVENT(apollo_clock,
+	TP_PROTO(u32 status, int lock_losses),
+	TP_ARGS(status, lock_losses),
+	TP_STRUCT__entry(
+		__field(u32, status)
+		__field(int, lock_losses)
+	),
+	TP_fast_assign(
+		__entry->status = status;
+		__entry->lock_losses = lock_losses;
+	),
+	TP_printk("clock_status=0x%08x lock_losses=%d",
+		  __entry->status, __entry->lock_losses)
+);
+
+#endif /* _APOLLO_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE apollo_trace
+#include <trace/define_trace.h>
@@ -17,11 +17,22 @@
 #include <errno.h>
 #include <stdint.h>
 
+#include "apollo_regs.h"
+
 #define MAX_DUMP_SIZE (1024 * 1024)  // 1MB max dump
+#define MAX_DUMP_WORDS (MAX_DUMP_SIZE / 4)
+
+// A saved word dump ("0xOFFSET: 0xVALUE" per line)
+struct dump_file {
+    const char *path;
+    uint32_t *words;
+    uint8_t *valid;
+};
 
 static void print_usage(const char *program_name) {
     printf("Apollo Register Dump Tool\n");
-    printf("Usage: %s [options] <device> <offset> [size]\n\n", program_name);
+    printf("Usage: %s [options] <device> <offset> [size]\n", program_name);
+    printf("       %s -D <dump> [-D <dump>]\n\n", program_name);
     printf("Arguments:\n");
     printf("  device    PCI device (e.g., 0000:01:00.0) or resource file\n");
     printf("  offset    Register offset in hex (e.g., 0x00)\n");
@@ -32,11 +43,14 @@ static void print_usage(const char *program_name) {
     printf("  -b, --binary    Binary output (default: hex)\n");
     printf("  -w, --word      32-bit word format\n");
     printf("  -d, --dword     64-bit word format\n");
+    printf("  -n, --names     Name registers and fields (with -w)\n");
+    printf("  -D <dump>       Decode a saved word dump; twice to diff two dumps\n");
     printf("  -h, --help      Show this help\n\n");
     printf("Examples:\n");
     printf("  %s /sys/bus/pci/devices/0000:01:00.0/resource0 0x00 256\n", program_name);
     printf("  %s -m 0xfebf1000 0x00 1024\n", program_name);
-    printf("  %s -w /dev/apollo 0x10\n\n", program_name);
+    printf("  %s -w /dev/apollo 0x10\n", program_name);
+    printf("  %s -D baseline.txt -D phantom_on.txt\n\n", program_name);
     printf("WARNING: Direct hardware access can be dangerous!\n");
 }
 
@@ -161,12 +175,227 @@ static void dump_dwords(const uint64_t *data, size_t size, uintptr_t base_addr)
     }
 }
 
+static const struct apollo_reg_desc *find_reg(uint32_t offset, int placeholder) {
+    size_t i;
+
+    for (i = 0; i < APOLLO_NUM_REGS; i++) {
+        if (apollo_regs[i].offset == offset &&
+            !!(apollo_regs[i].flags & APOLLO_REGF_PLACEHOLDER) == placeholder) {
+            return &apollo_regs[i];
+        }
+    }
+
+    return NULL;
+}
+
+static uint32_t field_value(const struct apollo_field_desc *field, uint32_t value) {
+    uint32_t mask = field->width >= 32 ? 0xffffffffu : (1u << field->width) - 1;
+
+    return (value >> field->lsb) & mask;
+}
+
+static void print_fields(const struct apollo_reg_desc *reg, uint32_t value) {
+    size_t i;
+
+    if (reg->flags & APOLLO_REGF_ASCII) {
+        // Little endian: the first character is the low byte
+        printf(" \"");
+        for (i = 0; i < 4; i++) {
+            uint8_t c = value >> (i * 8);
+            if (c) {
+                printf("%c", (c >= 32 && c <= 126) ? c : '.');
+            }
+        }
+        printf("\"");
+        return;
+    }
+
+    for (i = 0; i < reg->nfields; i++) {
+        printf(" %s=0x%x", reg->fields[i].name, field_value(&reg->fields[i], value));
+    }
+}
+
+// Observed register first; the driver's placeholder model as the alternative
+static void describe_word(uint32_t offset, uint32_t value) {
+    const struct apollo_reg_desc *reg = find_reg(offset, 0);
+    const struct apollo_reg_desc *alt = find_reg(offset, 1);
+
+    if (reg) {
+        printf("  %s", reg->name);
+        print_fields(reg, value);
+    }
+    if (alt) {
+        printf("  (placeholder %s", alt->name);
+        print_fields(alt, value);
+        printf(")");
+    }
+}
+
+static void describe_field_changes(const struct apollo_reg_desc *reg, uint32_t a, uint32_t b) {
+    size_t i;
+
+    for (i = 0; i < reg->nfields; i++) {
+        uint32_t fa = field_value(&reg->fields[i], a);
+        uint32_t fb = field_value(&reg->fields[i], b);
+
+        if (fa != fb) {
+            printf("      %s.%s: 0x%x -> 0x%x\n", reg->name, reg->fields[i].name, fa, fb);
+        }
+    }
+}
+
+static void dump_words_named(const uint32_t *data, size_t size, uintptr_t base_addr) {
+    size_t i;
+
+    for (i = 0; i < size / 4; i++) {
+        printf("%08lx: %08x", base_addr + i * 4, data[i]);
+        describe_word(base_addr + i * 4, data[i]);
+        printf("\n");
+    }
+}
+
+static int load_dump(const char *path, struct dump_file *dump) {
+    char line[256];
+    unsigned long offset, value;
+    size_t count = 0;
+    FILE *fp;
+
+    dump->path = path;
+    dump->words = calloc(MAX_DUMP_WORDS, sizeof(*dump->words));
+    dump->valid = calloc(MAX_DUMP_WORDS, sizeof(*dump->valid));
+    if (!dump->words || !dump->valid) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Header and anything else that is not "offset: value" is skipped
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%lx: %lx", &offset, &value) != 2) {
+            continue;
+        }
+        if (offset % 4 || offset >= MAX_DUMP_SIZE) {
+            fprintf(stderr, "%s: ignoring offset 0x%lx\n", path, offset);
+            continue;
+        }
+        dump->words[offset / 4] = value;
+        dump->valid[offset / 4] = 1;
+        count++;
+    }
+
+    fclose(fp);
+
+    if (!count) {
+        fprintf(stderr, "%s: no register words found\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void free_dump(struct dump_file *dump) {
+    free(dump->words);
+    free(dump->valid);
+}
+
+// Every named register, plus any other word that is not zero
+static void decode_dump(const struct dump_file *dump) {
+    size_t i;
+
+    printf("Decoding %s\n", dump->path);
+
+    for (i = 0; i < MAX_DUMP_WORDS; i++) {
+        uint32_t offset = i * 4;
+
+        if (!dump->valid[i]) {
+            continue;
+        }
+        if (!dump->words[i] && !find_reg(offset, 0) && !find_reg(offset, 1)) {
+            continue;
+        }
+        printf("0x%04x: 0x%08x", offset, dump->words[i]);
+        describe_word(offset, dump->words[i]);
+        printf("\n");
+    }
+}
+
+static void diff_dumps(const struct dump_file *a, const struct dump_file *b) {
+    size_t i, changed = 0;
+
+    printf("--- %s\n+++ %s\n", a->path, b->path);
+
+    for (i = 0; i < MAX_DUMP_WORDS; i++) {
+        uint32_t offset = i * 4;
+        const struct apollo_reg_desc *reg, *alt;
+
+        if (!a->valid[i] && !b->valid[i]) {
+            continue;
+        }
+        if (a->valid[i] != b->valid[i]) {
+            printf("0x%04x: only in %s\n", offset, a->valid[i] ? a->path : b->path);
+            continue;
+        }
+        if (a->words[i] == b->words[i]) {
+            continue;
+        }
+
+        changed++;
+        printf("0x%04x: 0x%08x -> 0x%08x", offset, a->words[i], b->words[i]);
+        describe_word(offset, b->words[i]);
+        printf("\n");
+
+        reg = find_reg(offset, 0);
+        alt = find_reg(offset, 1);
+        if (reg) {
+            describe_field_changes(reg, a->words[i], b->words[i]);
+        }
+        if (alt) {
+            describe_field_changes(alt, a->words[i], b->words[i]);
+        }
+    }
+
+    printf("%zu word%s differ\n", changed, changed == 1 ? "" : "s");
+}
+
+static int run_decode(const char **paths, int npaths) {
+    struct dump_file dumps[2] = { 0 };
+    int ret = EXIT_FAILURE;
+    int i;
+
+    for (i = 0; i < npaths; i++) {
+        if (load_dump(paths[i], &dumps[i]) < 0) {
+            goto out;
+        }
+    }
+
+    if (npaths == 1) {
+        decode_dump(&dumps[0]);
+    } else {
+        diff_dumps(&dumps[0], &dumps[1]);
+    }
+    ret = EXIT_SUCCESS;
+
+out:
+    for (i = 0; i < npaths; i++) {
+        free_dump(&dumps[i]);
+    }
+    return ret;
+}
+
 int main(int argc, char *argv[]) {
     int opt;
     int use_mem = 0;
     int binary_output = 0;
     int word_format = 0;
     int dword_format = 0;
+    int named = 0;
+    const char *dump_paths[2];
+    int ndumps = 0;
     char *device;
     uintptr_t offset = 0;
     size_t size = 256;
@@ -175,7 +404,7 @@ int main(int argc, char *argv[]) {
     int fd;
 
     // Parse command line arguments
-    while ((opt = getopt(argc, argv, "rmbwdh")) != -1) {
+    while ((opt = getopt(argc, argv, "rmbwdnD:h")) != -1) {
         switch (opt) {
             case 'r':
                 use_mem = 0;
@@ -192,6 +421,16 @@ int main(int argc, char *argv[]) {
             case 'd':
                 dword_format = 1;
                 break;
+            case 'n':
+                named = 1;
+                break;
+            case 'D':
+                if (ndumps == 2) {
+                    fprintf(stderr, "At most two dumps can be compared\n");
+                    return EXIT_FAILURE;
+                }
+                dump_paths[ndumps++] = optarg;
+                break;
             case 'h':
             default:
                 print_usage(argv[0]);
@@ -199,6 +438,10 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    if (ndumps) {
+        return run_decode(dump_paths, ndumps);
+    }
+
     if (argc - optind < 2) {
         print_usage(argv[0]);
         return EXIT_FAILURE;
@@ -259,6 +502,8 @@ int main(int argc, char *argv[]) {
     // Dump the data
     if (binary_output) {
         fwrite((uint8_t *)map + offset, 1, size, stdout);
+    } else if (word_format && named && (size % 4 == 0)) {
+        dump_words_named((uint32_t *)((uint8_t *)map + offset), size, offset);
     } else if (word_format && (size % 4 == 0)) {
         dump_words((uint32_t *)((uint8_t *)map + offset), size, offset);
     } else if (dword_format && (size % 8 == 0)) {
@@ -0,0 +1,480 @@
+#!/usr/bin/awk -f
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Apollo Register Map Generator
+#
+# Reads kernel/apollo_regs.map and writes a C header to stdout:
+#
+#   awk -v mode=kernel -f apollo_regmap.awk apollo_regs.map > apollo_regs.h
+#   awk -v mode=tools  -f apollo_regmap.awk apollo_regs.map > apollo_regs.h
+#   awk -v mode=user   -f apollo_regmap.awk apollo_regs.map > apollo_regs.h
+#
+# kernel: offsets, field masks, typed inline accessors and the shadow
+#         register cache policy. Every accessor is one readl()/writel()
+#         with constant masks; nothing is looked up at run time.
+# tools:  plain decode tables for apollo_dump.
+# user:   offsets, masks and values only, for the VFIO engine.
+
+function fail(msg) {
+    printf("%s:%d: %s\n", FILENAME, FNR, msg) > "/dev/stderr"
+    failed = 1
+    exit 1
+}
+
+function rest(first,    s, i) {
+    s = $first
+    for (i = first + 1; i <= NF; i++) {
+        s = s " " $i
+    }
+    return s
+}
+
+function cstr(s) {
+    gsub(/\\/, "\\\\", s)
+    gsub(/"/, "\\\"", s)
+    return "\"" s "\""
+}
+
+function has_flag(r, f) {
+    return index("," rflags[r] ",", "," f ",") > 0
+}
+
+function readable(r) {
+    return racc[r] != "wo"
+}
+
+function writable(r) {
+    return racc[r] != "ro"
+}
+
+function policy(r) {
+    if (has_flag(r, "volatile")) {
+        return ""
+    }
+    if (racc[r] == "ro") {
+        return "APOLLO_CACHE_ONCE"
+    }
+    if (racc[r] == "wo") {
+        return "APOLLO_CACHE_WRITE_ONLY"
+    }
+    return "APOLLO_CACHE_WRITE_THROUGH"
+}
+
+/^[ \t]*(#|$)/ {
+    next
+}
+
+$1 == "reg" {
+    if (NF < 6) {
+        fail("reg needs NAME OFFSET ACCESS FLAGS DESCRIPTION")
+    }
+    if ($4 !~ /^(ro|wo|rw|w1c)$/) {
+        fail("bad access type " $4)
+    }
+    if ($3 !~ /^0x[0-9a-fA-F]+$/) {
+        fail("bad offset " $3)
+    }
+    nregs++
+    rname[nregs] = $2
+    roff[nregs] = $3
+    roffv[nregs] = strtonum_hex($3)
+    racc[nregs] = $4
+    rflags[nregs] = ($5 == "-") ? "" : $5
+    rdesc[nregs] = rest(6)
+    rnfields[nregs] = 0
+    if (rname[nregs] in seen) {
+        fail("duplicate register " rname[nregs])
+    }
+    seen[rname[nregs]] = 1
+    next
+}
+
+$1 == "field" {
+    if (!nregs) {
+        fail("field before any reg")
+    }
+    if (NF < 4) {
+        fail("field needs NAME BITS DESCRIPTION")
+    }
+    if ($3 ~ /^[0-9]+$/) {
+        hi = lo = $3 + 0
+    } else if ($3 ~ /^[0-9]+:[0-9]+$/) {
+        split($3, b, ":")
+        hi = b[1] + 0
+        lo = b[2] + 0
+    } else {
+        fail("bad bit range " $3)
+    }
+    if (hi < lo || hi > 31) {
+        fail("bad bit range " $3)
+    }
+    n = ++rnfields[nregs]
+    fname[nregs, n] = $2
+    fhi[nregs, n] = hi
+    flo[nregs, n] = lo
+    fdesc[nregs, n] = rest(4)
+    next
+}
+
+$1 == "const" {
+    if (NF < 3) {
+        fail("const needs NAME VALUE")
+    }
+    nconsts++
+    cname[nconsts] = $2
+    cval[nconsts] = $3
+    cdesc[nconsts] = (NF > 3) ? rest(4) : ""
+    next
+}
+
+{
+    fail("unknown directive " $1)
+}
+
+function strtonum_hex(s,    v, i, c) {
+    v = 0
+    s = tolower(substr(s, 3))
+    for (i = 1; i <= length(s); i++) {
+        c = index("0123456789abcdef", substr(s, i, 1)) - 1
+        v = v * 16 + c
+    }
+    return v
+}
+
+function mask(r, f) {
+    if (fhi[r, f] == flo[r, f]) {
+        return "BIT(" flo[r, f] ")"
+    }
+    return "GENMASK(" fhi[r, f] ", " flo[r, f] ")"
+}
+
+function hexmask(r, f,    v, s, i, d) {
+    v = 2 ^ (fhi[r, f] + 1) - 2 ^ flo[r, f]
+    s = ""
+    for (i = 0; i < 8; i++) {
+        d = v % 16
+        s = substr("0123456789abcdef", d + 1, 1) s
+        v = (v - d) / 16
+    }
+    return "0x" s "u"
+}
+
+# Register offsets and field masks; kernel masks use GENMASK()/BIT()
+function emit_registers(kernel,    r, f) {
+    for (r = 1; r <= nregs; r++) {
+        printf("/* %s%s */\n", rdesc[r], has_flag(r, "placeholder") ? " (placeholder)" : "")
+        define("APOLLO_REG_" rname[r], roff[r])
+        for (f = 1; f <= rnfields[r]; f++) {
+            define("APOLLO_" rname[r] "_" fname[r, f], kernel ? mask(r, f) : hexmask(r, f))
+        }
+        print ""
+    }
+}
+
+# Values, a blank line between groups (CMD_, FORMAT_, ...)
+function emit_consts(    c, group, last) {
+    if (!nconsts) {
+        return
+    }
+    print "/* Register values */"
+    last = ""
+    for (c = 1; c <= nconsts; c++) {
+        group = cname[c]
+        sub(/_.*/, "", group)
+        if (last != "" && group != last) {
+            print ""
+        }
+        last = group
+        if (cdesc[c] != "") {
+            printf("#define %s%s%s\t/* %s */\n", "APOLLO_" cname[c],
+                   tabs("APOLLO_" cname[c]), cval[c], cdesc[c])
+        } else {
+            define("APOLLO_" cname[c], cval[c])
+        }
+    }
+    print ""
+}
+
+function define(name, value) {
+    printf("#define %s%s%s\n", name, tabs(name), value)
+}
+
+function tabs(name,    n, s) {
+    n = int((length(name) + 8) / 8)
+    s = ""
+    while (n < 5) {
+        s = s "\t"
+        n++
+    }
+    return s == "" ? " " : s
+}
+
+# List offsets claimed by both an observed and a read-only placeholder
+# register; writable ones are refused by check_overlaps()
+function overlaps(prefix,    r, q, any) {
+    any = 0
+    for (r = 1; r <= nregs; r++) {
+        if (has_flag(r, "placeholder")) {
+            continue
+        }
+        for (q = 1; q <= nregs; q++) {
+            if (q != r && has_flag(q, "placeholder") && roffv[q] == roffv[r]) {
+                if (!any) {
+                    print prefix
+                    printf("%s Placeholder registers overlapping observed ones:\n", prefix)
+                    any = 1
+                }
+                printf("%s   0x%02x %s (observed) / %s (placeholder)\n",
+                       prefix, roffv[r], rname[r], rname[q])
+            }
+        }
+    }
+    return any
+}
+
+function kernel_accessors(r, f,    reg, fld, m, lc) {
+    reg = "APOLLO_REG_" rname[r]
+    m = "APOLLO_" rname[r] "_" fname[r, f]
+    lc = tolower(rname[r] "_" fname[r, f])
+
+    if (readable(r)) {
+        printf("static inline u32 apollo_%s(u32 val)\n{\n", lc)
+        printf("\treturn FIELD_GET(%s, val);\n}\n\n", m)
+        printf("static inline u32 apollo_read_%s(const void __iomem *regs)\n{\n", lc)
+        printf("\treturn FIELD_GET(%s, readl(regs + %s));\n}\n\n", m, reg)
+    }
+
+    # Write-only registers with several fields get one combined writer
+    if (!writable(r) || (racc[r] == "wo" && rnfields[r] > 1)) {
+        return
+    }
+
+    if (racc[r] == "rw" && rnfields[r] > 1) {
+        # Other fields must survive; one read and one write
+        printf("static inline void apollo_update_%s(void __iomem *regs, u32 val)\n{\n", lc)
+        printf("\tu32 old = readl(regs + %s);\n\n", reg)
+        printf("\twritel((old & ~%s) | FIELD_PREP(%s, val), regs + %s);\n}\n\n", m, m, reg)
+    } else {
+        printf("static inline void apollo_write_%s(void __iomem *regs, u32 val)\n{\n", lc)
+        printf("\twritel(FIELD_PREP(%s, val), regs + %s);\n}\n\n", m, reg)
+    }
+}
+
+function kernel_writer(r,    f, reg, sep) {
+    reg = "APOLLO_REG_" rname[r]
+    printf("static inline void apollo_write_%s(void __iomem *regs", tolower(rname[r]))
+    for (f = 1; f <= rnfields[r]; f++) {
+        printf(", u32 %s", tolower(fname[r, f]))
+    }
+    printf(")\n{\n\twritel(")
+    sep = ""
+    for (f = 1; f <= rnfields[r]; f++) {
+        printf("%sFIELD_PREP(APOLLO_%s_%s, %s)", sep, rname[r], fname[r, f], tolower(fname[r, f]))
+        sep = " |\n\t       "
+    }
+    printf(",\n\t       regs + %s);\n}\n\n", reg)
+}
+
+function emit_kernel(    r, f, p, done, first) {
+    print "/* SPDX-License-Identifier: GPL-2.0-only */"
+    print "/*"
+    print " * Apollo Twin Register Map"
+    print " *"
+    print " * Generated from apollo_regs.map by tools/apollo_regmap.awk. Do not edit;"
+    print " * change the map and run \"make -C tools regs\"."
+    if (overlaps(" *")) {
+        print " *"
+        print " * The cache policy below follows the placeholder (driver) registers."
+    }
+    print " */"
+    print ""
+    print "#ifndef _APOLLO_REGS_H"
+    print "#define _APOLLO_REGS_H"
+    print ""
+    print "#include <linux/types.h>"
+    print "#include <linux/bits.h>"
+    print "#include <linux/bitfield.h>"
+    print "#include <linux/io.h>"
+    print ""
+
+    emit_registers(1)
+    emit_consts()
+
+    print "/* How a shadow register layer may cache each register */"
+    print "enum apollo_reg_cache {"
+    print "\tAPOLLO_CACHE_NONE,\t\t/* volatile: always access the device */"
+    print "\tAPOLLO_CACHE_ONCE,\t\t/* read-only constant: read it once */"
+    print "\tAPOLLO_CACHE_WRITE_THROUGH,\t/* write through, serve reads from the cache */"
+    print "\tAPOLLO_CACHE_WRITE_ONLY,\t/* unreadable: the cache holds the last write */"
+    print "};"
+    print ""
+    print "static inline enum apollo_reg_cache apollo_reg_cache_policy(u32 offset)"
+    print "{"
+    print "\tswitch (offset) {"
+    # Placeholders first so they win where offsets overlap
+    for (p = 0; p < 2; p++) {
+        for (r = 1; r <= nregs; r++) {
+            if (has_flag(r, "placeholder") != (p == 0) || (roffv[r] in done)) {
+                continue
+            }
+            done[roffv[r]] = 1
+            if (policy(r) == "") {
+                continue
+            }
+            printf("\tcase APOLLO_REG_%s:\n\t\treturn %s;\n", rname[r], policy(r))
+        }
+    }
+    print "\tdefault:"
+    print "\t\treturn APOLLO_CACHE_NONE;"
+    print "\t}"
+    print "}"
+    print ""
+
+    print "/*"
+    print " * Field accessors. apollo_<reg>_<field>() decodes a value already read,"
+    print " * apollo_read_/write_ access the device directly. apollo_update_ is used"
+    print " * for read-write registers with several fields and costs a read; a"
+    print " * write-only register with several fields is written whole."
+    print " */"
+    print ""
+    for (r = 1; r <= nregs; r++) {
+        for (f = 1; f <= rnfields[r]; f++) {
+            kernel_accessors(r, f)
+        }
+        if (racc[r] == "wo" && rnfields[r] > 1) {
+            kernel_writer(r)
+        }
+    }
+
+    print "#endif /* _APOLLO_REGS_H */"
+}
+
+function emit_tools(    r, f, flags) {
+    print "// SPDX-License-Identifier: GPL-2.0-only"
+    print "/*"
+    print " * Apollo Register Decode Tables"
+    print " *"
+    print " * Generated from kernel/apollo_regs.map by apollo_regmap.awk. Do not edit;"
+    print " * change the map and run \"make regs\"."
+    overlaps(" *")
+    print " */"
+    print ""
+    print "#ifndef APOLLO_REGS_H"
+    print "#define APOLLO_REGS_H"
+    print ""
+    print "#include <stdint.h>"
+    print "#include <stddef.h>"
+    print ""
+    print "#define APOLLO_REGF_VOLATILE     (1u << 0)"
+    print "#define APOLLO_REGF_PLACEHOLDER  (1u << 1)"
+    print "#define APOLLO_REGF_ASCII        (1u << 2)"
+    print ""
+    print "struct apollo_field_desc {"
+    print "    const char *name;"
+    print "    uint8_t lsb;"
+    print "    uint8_t width;"
+    print "    const char *desc;"
+    print "};"
+    print ""
+    print "struct apollo_reg_desc {"
+    print "    const char *name;"
+    print "    uint32_t offset;"
+    print "    const char *access;"
+    print "    uint32_t flags;"
+    print "    const struct apollo_field_desc *fields;"
+    print "    size_t nfields;"
+    print "    const char *desc;"
+    print "};"
+    print ""
+
+    for (r = 1; r <= nregs; r++) {
+        if (!rnfields[r]) {
+            continue
+        }
+        printf("static const struct apollo_field_desc apollo_fields_%s[] = {\n", rname[r])
+        for (f = 1; f <= rnfields[r]; f++) {
+            printf("    { \"%s\", %d, %d, %s },\n", fname[r, f], flo[r, f],
+                   fhi[r, f] - flo[r, f] + 1, cstr(fdesc[r, f]))
+        }
+        print "};"
+        print ""
+    }
+
+    print "static const struct apollo_reg_desc apollo_regs[] = {"
+    for (r = 1; r <= nregs; r++) {
+        flags = ""
+        if (has_flag(r, "volatile")) {
+            flags = flags " | APOLLO_REGF_VOLATILE"
+        }
+        if (has_flag(r, "placeholder")) {
+            flags = flags " | APOLLO_REGF_PLACEHOLDER"
+        }
+        if (has_flag(r, "ascii")) {
+            flags = flags " | APOLLO_REGF_ASCII"
+        }
+        flags = (flags == "") ? "0" : substr(flags, 4)
+        if (rnfields[r]) {
+            printf("    { \"%s\", %s, \"%s\", %s, apollo_fields_%s, %d, %s },\n",
+                   rname[r], roff[r], racc[r], flags, rname[r], rnfields[r], cstr(rdesc[r]))
+        } else {
+            printf("    { \"%s\", %s, \"%s\", %s, NULL, 0, %s },\n",
+                   rname[r], roff[r], racc[r], flags, cstr(rdesc[r]))
+        }
+    }
+    print "};"
+    print ""
+    print "#define APOLLO_NUM_REGS (sizeof(apollo_regs) / sizeof(apollo_regs[0]))"
+    print ""
+    print "#endif // APOLLO_REGS_H"
+}
+
+function emit_user() {
+    print "// SPDX-License-Identifier: GPL-2.0-only"
+    print "/*"
+    print " * Apollo Register Definitions"
+    print " *"
+    print " * Generated from kernel/apollo_regs.map by tools/apollo_regmap.awk. Do not"
+    print " * edit; change the map and run \"make -C tools regs\"."
+    print " */"
+    print ""
+    print "#ifndef APOLLO_REGS_H"
+    print "#define APOLLO_REGS_H"
+    print ""
+    emit_registers(0)
+    emit_consts()
+    print "#endif // APOLLO_REGS_H"
+}
+
+# A driver write there would land on a live device register
+function check_overlaps(    r, q, bad) {
+    bad = 0
+    for (r = 1; r <= nregs; r++) {
+        if (has_flag(r, "placeholder")) {
+            continue
+        }
+        for (q = 1; q <= nregs; q++) {
+            if (has_flag(q, "placeholder") && writable(q) && roffv[q] == roffv[r]) {
+                printf("%s: writable placeholder %s at 0x%02x overlaps observed register %s\n",
+                       FILENAME, rname[q], roffv[q], rname[r]) > "/dev/stderr"
+                bad = 1
+            }
+        }
+    }
+    return bad
+}
+
+END {
+    if (failed || check_overlaps()) {
+        exit 1
+    }
+    if (mode == "kernel") {
+        emit_kernel()
+    } else if (mode == "tools") {
+        emit_tools()
+    } else if (mode == "user") {
+        emit_user()
+    } else {
+        print "apollo_regmap.awk: set -v mode=kernel, tools or user" > "/dev/stderr"
+        exit 1
+    }
+}
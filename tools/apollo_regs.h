@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Register Decode Tables
+ *
+ * Generated from kernel/apollo_regs.map by apollo_regmap.awk. Do not edit;
+ * change the map and run "make regs".
+ */
+
+#ifndef APOLLO_REGS_H
+#define APOLLO_REGS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define APOLLO_REGF_VOLATILE     (1u << 0)
+#define APOLLO_REGF_PLACEHOLDER  (1u << 1)
+#define APOLLO_REGF_ASCII        (1u << 2)
+
+struct apollo_field_desc {
+    const char *name;
+    uint8_t lsb;
+    uint8_t width;
+    const char *desc;
+};
+
+struct apollo_reg_desc {
+    const char *name;
+    uint32_t offset;
+    const char *access;
+    uint32_t flags;
+    const struct apollo_field_desc *fields;
+    size_t nfields;
+    const char *desc;
+};
+
+static const struct apollo_field_desc apollo_fields_CONTROL[] = {
+    { "CMD", 0, 8, "Command code" },
+};
+
+static const struct apollo_field_desc apollo_fields_STATUS[] = {
+    { "READY", 0, 1, "Command done or DMA period elapsed" },
+    { "RUNNING", 1, 1, "DMA engine running" },
+    { "ERROR", 2, 1, "Engine error, streams stopped" },
+    { "CLOCK", 3, 1, "CLOCK_STATUS changed" },
+};
+
+static const struct apollo_field_desc apollo_fields_SAMPLE_RATE[] = {
+    { "RATE", 0, 32, "Rate" },
+};
+
+static const struct apollo_field_desc apollo_fields_FORMAT[] = {
+    { "FORMAT", 0, 2, "Format code" },
+};
+
+static const struct apollo_field_desc apollo_fields_DMA_CONTROL[] = {
+    { "CMD", 0, 4, "APOLLO_CMD_START or APOLLO_CMD_STOP" },
+    { "SG", 4, 1, "DMA_ADDR points at a descriptor table" },
+};
+
+static const struct apollo_field_desc apollo_fields_CLOCK_SOURCE[] = {
+    { "SOURCE", 0, 2, "Clock source" },
+};
+
+static const struct apollo_field_desc apollo_fields_CLOCK_STATUS[] = {
+    { "LOCKED", 0, 1, "Locked to the selected source" },
+    { "RATE", 8, 24, "Detected rate in Hz, 0 when none" },
+};
+
+static const struct apollo_field_desc apollo_fields_PARAM[] = {
+    { "ID", 0, 8, "Parameter (APOLLO_PARAM_*)" },
+    { "RAMP", 8, 24, "Ramp length in frames, 0 for a step" },
+};
+
+static const struct apollo_reg_desc apollo_regs[] = {
+    { "ID", 0x00, "ro", 0, NULL, 0, "Device identification, reads 0x00000100" },
+    { "SERIAL0", 0x20, "ro", APOLLO_REGF_ASCII, NULL, 0, "Serial number, characters 1-4" },
+    { "SERIAL1", 0x24, "ro", APOLLO_REGF_ASCII, NULL, 0, "Serial number, characters 5-8" },
+    { "SERIAL2", 0x28, "ro", APOLLO_REGF_ASCII, NULL, 0, "Serial number, characters 9-12" },
+    { "SERIAL3", 0x2c, "ro", APOLLO_REGF_ASCII, NULL, 0, "Serial number, characters 13-14" },
+    { "CONTROL", 0x40, "wo", APOLLO_REGF_VOLATILE | APOLLO_REGF_PLACEHOLDER, apollo_fields_CONTROL, 1, "Device command (APOLLO_CMD_*)" },
+    { "STATUS", 0x44, "w1c", APOLLO_REGF_VOLATILE | APOLLO_REGF_PLACEHOLDER, apollo_fields_STATUS, 4, "Interrupt status, write back to clear" },
+    { "SAMPLE_RATE", 0x48, "rw", APOLLO_REGF_PLACEHOLDER, apollo_fields_SAMPLE_RATE, 1, "Sample rate in Hz" },
+    { "FORMAT", 0x4c, "rw", APOLLO_REGF_PLACEHOLDER, apollo_fields_FORMAT, 1, "Sample format (APOLLO_FORMAT_*)" },
+    { "DMA_ADDR", 0x50, "rw", APOLLO_REGF_VOLATILE | APOLLO_REGF_PLACEHOLDER, NULL, 0, "Ring or descriptor table address, low word; live address in contiguous mode" },
+    { "DMA_SIZE", 0x54, "rw", APOLLO_REGF_PLACEHOLDER, NULL, 0, "Ring size in bytes" },
+    { "DMA_CONTROL", 0x58, "wo", APOLLO_REGF_VOLATILE | APOLLO_REGF_PLACEHOLDER, apollo_fields_DMA_CONTROL, 2, "DMA engine command" },
+    { "DMA_POS", 0x5c, "ro", APOLLO_REGF_VOLATILE | APOLLO_REGF_PLACEHOLDER, NULL, 0, "Byte offset of the engine inside the ring (scatter-gather)" },
+    { "DMA_ADDR_HI", 0x60, "rw", APOLLO_REGF_PLACEHOLDER, NULL, 0, "Ring or descriptor table address, high word" },
+    { "FW_ADDR", 0x64, "wo", APOLLO_REGF_PLACEHOLDER, NULL, 0, "Firmware chunk destination offset" },
+    { "FW_LEN", 0x68, "wo", APOLLO_REGF_PLACEHOLDER, NULL, 0, "Firmware chunk length" },
+    { "CLOCK_SOURCE", 0x6c, "rw", APOLLO_REGF_PLACEHOLDER, apollo_fields_CLOCK_SOURCE, 1, "Sample clock source (APOLLO_CLOCK_*)" },
+    { "CLOCK_STATUS", 0x70, "ro", APOLLO_REGF_VOLATILE | APOLLO_REGF_PLACEHOLDER, apollo_fields_CLOCK_STATUS, 2, "Clock lock state" },
+    { "PARAM", 0x74, "wo", APOLLO_REGF_PLACEHOLDER, apollo_fields_PARAM, 2, "Stage a parameter change for the next period boundary" },
+    { "PARAM_VALUE", 0x78, "wo", APOLLO_REGF_PLACEHOLDER, NULL, 0, "Value of the staged parameter; writing it commits the change" },
+};
+
+#define APOLLO_NUM_REGS (sizeof(apollo_regs) / sizeof(apollo_regs[0]))
+
+#endif // APOLLO_REGS_H
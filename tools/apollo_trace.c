@@ -0,0 +1,1205 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Driver Latency Tracer
+ *
+ * Enables the apollo tracepoints in a tracefs instance of its own
+ * (instances/apollo), so the global trace buffer and other users of it
+ * are left alone, pulls the instance's per-CPU binary ring buffers with
+ * splice() and builds histograms of IRQ latency,
+ * period jitter and pointer drift. Worst outliers are reported with the
+ * kernel stack captured at the time. Traces can be recorded to disk and
+ * analysed later.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define MAX_CPUS 256
+#define MAX_FIELDS 16
+#define MAX_STACK 16
+#define MAX_OUTLIERS_LIMIT 64
+#define HIST_BUCKETS 20000      // 1us buckets, 20ms range
+#define FORMAT_SIZE 8192
+
+#define NSEC_PER_SEC 1000000000ULL
+
+static const char *tracefs_candidates[] = {
+    "/sys/kernel/tracing",
+    "/sys/kernel/debug/tracing",
+};
+
+// Ring buffer event header type_len values
+#define RB_TYPE_PADDING 29
+#define RB_TYPE_TIME_EXTEND 30
+#define RB_TYPE_TIME_STAMP 31
+
+// Commit word flags in the page header
+#define RB_MISSED_FLAGS (3UL << 30)
+
+enum event_kind {
+    EV_IRQ,
+    EV_PERIOD,
+    EV_POINTER,
+    EV_TRIGGER,
+    EV_STACK,
+    EV_COUNT
+};
+
+static const struct {
+    const char *name;
+    const char *path;
+} event_sources[EV_COUNT] = {
+    [EV_IRQ]     = { "apollo_irq", "events/apollo/apollo_irq/format" },
+    [EV_PERIOD]  = { "apollo_period", "events/apollo/apollo_period/format" },
+    [EV_POINTER] = { "apollo_pointer", "events/apollo/apollo_pointer/format" },
+    [EV_TRIGGER] = { "apollo_trigger", "events/apollo/apollo_trigger/format" },
+    [EV_STACK]   = { "kernel_stack", "events/ftrace/kernel_stack/format" },
+};
+
+typedef struct {
+    char name[32];
+    int offset;
+    int size;
+} field_t;
+
+typedef struct {
+    int id;
+    int nfields;
+    field_t fields[MAX_FIELDS];
+} event_format_t;
+
+typedef struct {
+    uint64_t ts;
+    int cpu;
+    int kind;
+    int stream;
+    uint32_t value;             // status, hw_pos or trigger cmd
+    uint32_t period_size;
+    uint32_t buffer_size;
+    uint32_t rate;
+    int nstack;
+    uint64_t stack[MAX_STACK];
+} record_t;
+
+typedef struct {
+    uint64_t count[HIST_BUCKETS + 1];
+    uint64_t total;
+    uint64_t max_ns;
+} hist_t;
+
+typedef struct {
+    uint64_t lat_ns;
+    uint64_t ts;
+    int cpu;
+    int stream;
+    int nstack;
+    uint64_t stack[MAX_STACK];
+} outlier_t;
+
+typedef struct {
+    int active;
+    uint64_t last_period_ts;
+    int ptr_valid;
+    uint32_t last_pos;
+    uint64_t frames;
+    uint64_t start_ts;
+} stream_state_t;
+
+typedef struct {
+    uint64_t addr;
+    char name[64];
+} ksym_t;
+
+static const char *tracefs;
+static char instance[512];      // tracefs/instances/apollo while capturing
+static const char *trace_dir;   // offline directory, NULL when live
+static event_format_t formats[EV_COUNT];
+static size_t commit_offset = 8, data_offset = 16, commit_size = 8;
+static long page_size;
+
+static hist_t hist_lat, hist_jitter, hist_drift;            // whole run
+static hist_t roll_lat, roll_jitter, roll_drift;            // live interval
+static stream_state_t streams[2];
+static outlier_t outliers[MAX_OUTLIERS_LIMIT];
+static int max_outliers = 10;
+static int n_outliers;
+static uint64_t lost_pages;
+
+static ksym_t *ksyms;
+static size_t n_ksyms;
+
+static volatile sig_atomic_t stop;
+
+static void print_usage(const char *program_name) {
+    printf("Apollo Driver Latency Tracer\n");
+    printf("Usage: %s [options]\n\n", program_name);
+    printf("Options:\n");
+    printf("  -r, --record DIR   Record raw per-CPU traces to DIR (no analysis)\n");
+    printf("  -a, --analyze DIR  Analyse traces previously recorded to DIR\n");
+    printf("  -t SECONDS         Stop after SECONDS (default: until Ctrl-C)\n");
+    printf("  -i SECONDS         Live report interval (default: 1)\n");
+    printf("  -n COUNT           Number of outliers to report (default: 10)\n");
+    printf("  -s                 Capture kernel stacks on period events\n");
+    printf("  -h, --help         Show this help\n\n");
+    printf("Without -r or -a, traces are analysed live with rolling percentiles.\n");
+    printf("Requires root and a kernel with the apollo module loaded.\n");
+}
+
+static void signal_handler(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// ---------------------------------------------------------------------------
+// tracefs helpers
+// ---------------------------------------------------------------------------
+
+static const char *find_tracefs(void) {
+    size_t i;
+    char path[256];
+
+    for (i = 0; i < sizeof(tracefs_candidates) / sizeof(tracefs_candidates[0]); i++) {
+        snprintf(path, sizeof(path), "%s/trace_pipe", tracefs_candidates[i]);
+        if (access(path, R_OK) == 0) {
+            return tracefs_candidates[i];
+        }
+    }
+    return NULL;
+}
+
+// Writes go to our instance; event formats are read from the top level
+static int tracefs_write(const char *file, const char *value) {
+    char path[1024];
+    int fd;
+    ssize_t len = strlen(value);
+
+    snprintf(path, sizeof(path), "%s/%s", instance, file);
+    fd = open(path, O_WRONLY | O_TRUNC);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (write(fd, value, len) != len) {
+        fprintf(stderr, "Failed to write '%s' to %s: %s\n", value, path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+static ssize_t read_file(const char *path, char *buf, size_t size) {
+    int fd = open(path, O_RDONLY);
+    ssize_t n, total = 0;
+
+    if (fd < 0) {
+        return -1;
+    }
+    while ((size_t)total < size - 1 && (n = read(fd, buf + total, size - 1 - total)) > 0) {
+        total += n;
+    }
+    close(fd);
+    buf[total] = '\0';
+    return total;
+}
+
+static int write_file(const char *path, const char *buf, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0 || write(fd, buf, len) != (ssize_t)len) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+// Read a format description, from the recording directory if analysing
+// offline, otherwise from tracefs.
+static ssize_t load_format_text(const char *name, const char *relpath, char *buf, size_t size) {
+    char path[512];
+
+    if (trace_dir) {
+        snprintf(path, sizeof(path), "%s/%s.format", trace_dir, name);
+    } else {
+        snprintf(path, sizeof(path), "%s/%s", tracefs, relpath);
+    }
+    return read_file(path, buf, size);
+}
+
+// Parse lines of the form "field:u32 hw_pos;  offset:12;  size:4;  signed:0;"
+static void parse_fields(const char *text, field_t *fields, int *nfields, int max) {
+    const char *p = text;
+
+    *nfields = 0;
+    while ((p = strstr(p, "field:")) != NULL && *nfields < max) {
+        const char *semi = strchr(p, ';');
+        const char *name_end, *name_start;
+        const char *off = strstr(p, "offset:");
+        const char *sz = strstr(p, "size:");
+        field_t *f = &fields[*nfields];
+        size_t len;
+
+        if (!semi || !off || !sz) {
+            break;
+        }
+
+        // Field name is the last word before ';', minus any array suffix
+        name_end = semi;
+        if (name_end > p && name_end[-1] == ']') {
+            while (name_end > p && *name_end != '[') {
+                name_end--;
+            }
+        }
+        name_start = name_end;
+        while (name_start > p && name_start[-1] != ' ' && name_start[-1] != '\t') {
+            name_start--;
+        }
+        len = name_end - name_start;
+        if (len >= sizeof(f->name)) {
+            len = sizeof(f->name) - 1;
+        }
+        memcpy(f->name, name_start, len);
+        f->name[len] = '\0';
+        f->offset = atoi(off + 7);
+        f->size = atoi(sz + 5);
+        (*nfields)++;
+        p = semi + 1;
+    }
+}
+
+static const field_t *find_field(const event_format_t *fmt, const char *name) {
+    int i;
+
+    for (i = 0; i < fmt->nfields; i++) {
+        if (strcmp(fmt->fields[i].name, name) == 0) {
+            return &fmt->fields[i];
+        }
+    }
+    return NULL;
+}
+
+static int load_formats(int need_stack) {
+    char *text = malloc(FORMAT_SIZE);
+    field_t hdr[MAX_FIELDS];
+    int i, n;
+
+    if (!text) {
+        return -1;
+    }
+
+    if (load_format_text("header_page", "events/header_page", text, FORMAT_SIZE) > 0) {
+        parse_fields(text, hdr, &n, MAX_FIELDS);
+        for (i = 0; i < n; i++) {
+            if (strcmp(hdr[i].name, "commit") == 0) {
+                commit_offset = hdr[i].offset;
+                commit_size = hdr[i].size;
+            } else if (strcmp(hdr[i].name, "data") == 0) {
+                data_offset = hdr[i].offset;
+            }
+        }
+    }
+
+    for (i = 0; i < EV_COUNT; i++) {
+        const char *id;
+
+        formats[i].id = -1;
+        if (load_format_text(event_sources[i].name, event_sources[i].path, text, FORMAT_SIZE) <= 0) {
+            if (i == EV_STACK && !need_stack) {
+                continue;
+            }
+            fprintf(stderr, "Missing format for %s (is the apollo module loaded?)\n",
+                    event_sources[i].name);
+            free(text);
+            return -1;
+        }
+        id = strstr(text, "ID:");
+        formats[i].id = id ? atoi(id + 3) : -1;
+        parse_fields(text, formats[i].fields, &formats[i].nfields, MAX_FIELDS);
+    }
+
+    free(text);
+    return 0;
+}
+
+static int save_formats(const char *dir) {
+    char *text = malloc(FORMAT_SIZE);
+    char path[512];
+    ssize_t n;
+    int i;
+
+    if (!text) {
+        return -1;
+    }
+
+    n = load_format_text("header_page", "events/header_page", text, FORMAT_SIZE);
+    snprintf(path, sizeof(path), "%s/header_page.format", dir);
+    if (n > 0) {
+        write_file(path, text, n);
+    }
+
+    for (i = 0; i < EV_COUNT; i++) {
+        n = load_format_text(event_sources[i].name, event_sources[i].path, text, FORMAT_SIZE);
+        if (n <= 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s.format", dir, event_sources[i].name);
+        write_file(path, text, n);
+    }
+
+    free(text);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Kernel symbols
+// ---------------------------------------------------------------------------
+
+static int ksym_cmp(const void *a, const void *b) {
+    const ksym_t *x = a, *y = b;
+
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static void load_kallsyms(void) {
+    FILE *fp = fopen("/proc/kallsyms", "r");
+    char line[256], type, name[64];
+    unsigned long long addr;
+    size_t cap = 0;
+
+    if (!fp) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%llx %c %63s", &addr, &type, name) != 3 || !addr) {
+            continue;
+        }
+        if (type != 't' && type != 'T') {
+            continue;
+        }
+        if (n_ksyms == cap) {
+            ksym_t *tmp;
+
+            cap = cap ? cap * 2 : 65536;
+            tmp = realloc(ksyms, cap * sizeof(*ksyms));
+            if (!tmp) {
+                break;
+            }
+            ksyms = tmp;
+        }
+        ksyms[n_ksyms].addr = addr;
+        snprintf(ksyms[n_ksyms].name, sizeof(ksyms[n_ksyms].name), "%s", name);
+        n_ksyms++;
+    }
+    fclose(fp);
+
+    qsort(ksyms, n_ksyms, sizeof(*ksyms), ksym_cmp);
+}
+
+static void print_symbol(uint64_t addr) {
+    size_t lo = 0, hi = n_ksyms;
+
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+
+        if (ksyms[mid].addr <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        printf("        0x%016llx\n", (unsigned long long)addr);
+    } else {
+        printf("        %s+0x%llx\n", ksyms[lo - 1].name,
+               (unsigned long long)(addr - ksyms[lo - 1].addr));
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Histograms
+// ---------------------------------------------------------------------------
+
+static void hist_add(hist_t *h, uint64_t ns) {
+    uint64_t bucket = ns / 1000;
+
+    h->count[bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS]++;
+    h->total++;
+    if (ns > h->max_ns) {
+        h->max_ns = ns;
+    }
+}
+
+static void hist_reset(hist_t *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+// Upper bound of the bucket holding the p-th percentile, in ns
+static uint64_t hist_percentile(const hist_t *h, double p) {
+    uint64_t target, seen = 0;
+    int i;
+
+    if (!h->total) {
+        return 0;
+    }
+    target = (uint64_t)(p / 100.0 * h->total);
+    if (target >= h->total) {
+        target = h->total - 1;
+    }
+    for (i = 0; i <= HIST_BUCKETS; i++) {
+        seen += h->count[i];
+        if (seen > target) {
+            uint64_t bound = (uint64_t)(i + 1) * 1000;
+
+            return i == HIST_BUCKETS || bound > h->max_ns ? h->max_ns : bound;
+        }
+    }
+    return h->max_ns;
+}
+
+static void print_percentiles(const char *label, const hist_t *h) {
+    printf("%s p50 %7.1fus p99 %7.1fus p99.9 %7.1fus max %7.1fus",
+           label,
+           hist_percentile(h, 50.0) / 1000.0,
+           hist_percentile(h, 99.0) / 1000.0,
+           hist_percentile(h, 99.9) / 1000.0,
+           h->max_ns / 1000.0);
+}
+
+static void print_histogram(const char *title, const hist_t *h) {
+    static const uint64_t edges_us[] = { 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000 };
+    size_t nedges = sizeof(edges_us) / sizeof(edges_us[0]);
+    uint64_t counts[sizeof(edges_us) / sizeof(edges_us[0]) + 1] = { 0 };
+    uint64_t peak = 0;
+    size_t e;
+    int i;
+
+    for (i = 0, e = 0; i <= HIST_BUCKETS; i++) {
+        while (e < nedges && (uint64_t)i >= edges_us[e]) {
+            e++;
+        }
+        counts[e] += h->count[i];
+    }
+    for (e = 0; e <= nedges; e++) {
+        if (counts[e] > peak) {
+            peak = counts[e];
+        }
+    }
+
+    printf("\n%s (%llu samples)\n", title, (unsigned long long)h->total);
+    if (!h->total) {
+        return;
+    }
+    for (e = 0; e <= nedges; e++) {
+        int bar = peak ? (int)(counts[e] * 50 / peak) : 0;
+
+        if (e < nedges) {
+            printf("  < %6lluus %10llu |", (unsigned long long)edges_us[e],
+                   (unsigned long long)counts[e]);
+        } else {
+            printf("  >=%6lluus %10llu |", (unsigned long long)edges_us[nedges - 1],
+                   (unsigned long long)counts[e]);
+        }
+        for (i = 0; i < bar; i++) {
+            putchar('#');
+        }
+        putchar('\n');
+    }
+    printf("  ");
+    print_percentiles("", h);
+    printf("\n");
+}
+
+// ---------------------------------------------------------------------------
+// Analysis
+// ---------------------------------------------------------------------------
+
+static void add_outlier(const record_t *r, uint64_t lat_ns) {
+    int i, slot = -1;
+
+    if (n_outliers < max_outliers) {
+        slot = n_outliers++;
+    } else {
+        for (i = 0; i < n_outliers; i++) {
+            if (slot < 0 || outliers[i].lat_ns < outliers[slot].lat_ns) {
+                slot = i;
+            }
+        }
+        if (outliers[slot].lat_ns >= lat_ns) {
+            return;
+        }
+    }
+
+    outliers[slot].lat_ns = lat_ns;
+    outliers[slot].ts = r->ts;
+    outliers[slot].cpu = r->cpu;
+    outliers[slot].stream = r->stream;
+    outliers[slot].nstack = r->nstack;
+    memcpy(outliers[slot].stack, r->stack, sizeof(r->stack));
+}
+
+static uint64_t frames_to_ns(uint64_t frames, uint32_t rate) {
+    return rate ? frames * NSEC_PER_SEC / rate : 0;
+}
+
+static void process_record(const record_t *r) {
+    stream_state_t *s;
+
+    if (r->stream < 0 || r->stream > 1) {
+        return;
+    }
+    s = &streams[r->stream];
+
+    switch (r->kind) {
+    case EV_TRIGGER:
+        // Restart all per-stream tracking on START (1) and STOP (0)
+        memset(s, 0, sizeof(*s));
+        s->active = r->value == 1;
+        break;
+
+    case EV_PERIOD: {
+        // How far the hardware had moved past the period boundary by the
+        // time the IRQ handler sampled it
+        uint64_t lat_ns = r->period_size ?
+            frames_to_ns(r->value % r->period_size, r->rate) : 0;
+
+        hist_add(&hist_lat, lat_ns);
+        hist_add(&roll_lat, lat_ns);
+        add_outlier(r, lat_ns);
+
+        if (s->last_period_ts && r->ts > s->last_period_ts) {
+            uint64_t interval = r->ts - s->last_period_ts;
+            uint64_t expected = frames_to_ns(r->period_size, r->rate);
+            uint64_t jitter = interval > expected ? interval - expected : expected - interval;
+
+            hist_add(&hist_jitter, jitter);
+            hist_add(&roll_jitter, jitter);
+        }
+        s->last_period_ts = r->ts;
+        break;
+    }
+
+    case EV_POINTER: {
+        uint64_t elapsed, expected_frames, drift_frames;
+
+        if (!r->buffer_size || !r->rate) {
+            break;
+        }
+        if (!s->ptr_valid) {
+            s->ptr_valid = 1;
+            s->last_pos = r->value;
+            s->frames = 0;
+            s->start_ts = r->ts;
+            break;
+        }
+        if (r->ts < s->start_ts) {
+            break;
+        }
+
+        // Unwrap the ring position into a running frame count
+        s->frames += (r->value + r->buffer_size - s->last_pos) % r->buffer_size;
+        s->last_pos = r->value;
+
+        elapsed = r->ts - s->start_ts;
+        expected_frames = elapsed * r->rate / NSEC_PER_SEC;
+        drift_frames = s->frames > expected_frames ?
+            s->frames - expected_frames : expected_frames - s->frames;
+
+        hist_add(&hist_drift, frames_to_ns(drift_frames, r->rate));
+        hist_add(&roll_drift, frames_to_ns(drift_frames, r->rate));
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+static int record_cmp(const void *a, const void *b) {
+    const record_t *x = a, *y = b;
+
+    if (x->ts != y->ts) {
+        return x->ts < y->ts ? -1 : 1;
+    }
+    return x->cpu - y->cpu;
+}
+
+static uint64_t read_uint(const uint8_t *data, size_t len, const field_t *f) {
+    uint64_t v = 0;
+
+    if (!f || (size_t)(f->offset + f->size) > len) {
+        return 0;
+    }
+    switch (f->size) {
+    case 1: v = *(const uint8_t *)(data + f->offset); break;
+    case 2: { uint16_t t; memcpy(&t, data + f->offset, 2); v = t; break; }
+    case 4: { uint32_t t; memcpy(&t, data + f->offset, 4); v = t; break; }
+    case 8: memcpy(&v, data + f->offset, 8); break;
+    }
+    return v;
+}
+
+static void decode_event(const uint8_t *data, size_t len, uint64_t ts, int cpu,
+                         record_t **recs, size_t *n, size_t *cap, record_t **last) {
+    uint16_t type;
+    record_t *r;
+    int kind;
+
+    if (len < 2) {
+        return;
+    }
+    memcpy(&type, data, 2);
+
+    for (kind = 0; kind < EV_COUNT; kind++) {
+        if (formats[kind].id == type) {
+            break;
+        }
+    }
+    if (kind == EV_COUNT) {
+        return;
+    }
+
+    // Stack events describe the event logged just before on the same CPU
+    if (kind == EV_STACK) {
+        const event_format_t *fmt = &formats[EV_STACK];
+        const field_t *caller = find_field(fmt, "caller");
+        const field_t *size = find_field(fmt, "size");
+        int depth, i;
+
+        if (!*last || !caller) {
+            return;
+        }
+        depth = size ? (int)read_uint(data, len, size) : MAX_STACK;
+        for (i = 0; i < depth && i < MAX_STACK; i++) {
+            size_t off = caller->offset + i * sizeof(uint64_t);
+            uint64_t addr;
+
+            if (off + sizeof(addr) > len) {
+                break;
+            }
+            memcpy(&addr, data + off, sizeof(addr));
+            if (!addr || addr == ~0ULL) {
+                break;
+            }
+            (*last)->stack[i] = addr;
+        }
+        (*last)->nstack = i;
+        return;
+    }
+
+    if (*n == *cap) {
+        record_t *tmp;
+
+        *cap = *cap ? *cap * 2 : 4096;
+        tmp = realloc(*recs, *cap * sizeof(**recs));
+        if (!tmp) {
+            return;
+        }
+        *recs = tmp;
+    }
+    r = &(*recs)[(*n)++];
+    memset(r, 0, sizeof(*r));
+    r->ts = ts;
+    r->cpu = cpu;
+    r->kind = kind;
+
+    switch (kind) {
+    case EV_IRQ:
+        r->stream = -1;
+        r->value = read_uint(data, len, find_field(&formats[kind], "status"));
+        break;
+    case EV_PERIOD:
+    case EV_POINTER:
+        r->stream = (int)read_uint(data, len, find_field(&formats[kind], "stream"));
+        r->value = read_uint(data, len, find_field(&formats[kind], "hw_pos"));
+        r->period_size = read_uint(data, len, find_field(&formats[kind], "period_size"));
+        r->buffer_size = read_uint(data, len, find_field(&formats[kind], "buffer_size"));
+        r->rate = read_uint(data, len, find_field(&formats[kind], "rate"));
+        break;
+    case EV_TRIGGER:
+        r->stream = (int)read_uint(data, len, find_field(&formats[kind], "stream"));
+        r->value = read_uint(data, len, find_field(&formats[kind], "cmd"));
+        break;
+    }
+    // Pointer must be re-derived: realloc may have moved the array
+    *last = &(*recs)[*n - 1];
+}
+
+// Walk one ring buffer page and append its events to recs
+static void decode_page(const uint8_t *page, int cpu, record_t **recs, size_t *n, size_t *cap) {
+    uint64_t ts, commit = 0;
+    size_t pos, end;
+    record_t *last = NULL;
+
+    memcpy(&ts, page, sizeof(ts));
+    memcpy(&commit, page + commit_offset, commit_size < 8 ? commit_size : 8);
+    if (commit & RB_MISSED_FLAGS) {
+        lost_pages++;
+    }
+    end = data_offset + (commit & ~RB_MISSED_FLAGS & 0xffffffffULL);
+    if (end > (size_t)page_size) {
+        end = page_size;
+    }
+
+    pos = data_offset;
+    while (pos + 4 <= end) {
+        uint32_t hdr, type_len, delta, array0 = 0;
+
+        memcpy(&hdr, page + pos, 4);
+        type_len = hdr & 0x1f;
+        delta = hdr >> 5;
+        if (pos + 8 <= end) {
+            memcpy(&array0, page + pos + 4, 4);
+        }
+
+        switch (type_len) {
+        case RB_TYPE_PADDING:
+            if (!delta) {
+                return;     // rest of the page is empty
+            }
+            pos += 4 + array0;
+            continue;
+        case RB_TYPE_TIME_EXTEND:
+            ts += delta + ((uint64_t)array0 << 27);
+            pos += 8;
+            continue;
+        case RB_TYPE_TIME_STAMP:
+            ts = (ts & ~((1ULL << 59) - 1)) | (delta + ((uint64_t)array0 << 27));
+            pos += 8;
+            continue;
+        case 0:
+            ts += delta;
+            if (array0 < 4 || pos + 4 + array0 > end) {
+                return;
+            }
+            decode_event(page + pos + 8, array0 - 4, ts, cpu, recs, n, cap, &last);
+            pos += 4 + array0;
+            continue;
+        default:
+            ts += delta;
+            if (pos + 4 + type_len * 4 > end) {
+                return;
+            }
+            decode_event(page + pos + 4, type_len * 4, ts, cpu, recs, n, cap, &last);
+            pos += 4 + type_len * 4;
+            continue;
+        }
+    }
+}
+
+static void process_batch(record_t *recs, size_t n) {
+    size_t i;
+
+    qsort(recs, n, sizeof(*recs), record_cmp);
+    for (i = 0; i < n; i++) {
+        process_record(&recs[i]);
+    }
+}
+
+static void print_report(void) {
+    int i, j;
+
+    printf("\nApollo Latency Report\n");
+    printf("=====================\n");
+    if (lost_pages) {
+        printf("WARNING: %llu ring buffer pages reported lost events\n",
+               (unsigned long long)lost_pages);
+    }
+
+    print_histogram("IRQ latency (hardware position past period boundary)", &hist_lat);
+    print_histogram("Period jitter (|interval - period|)", &hist_jitter);
+    print_histogram("Pointer drift (|position - elapsed time|)", &hist_drift);
+
+    if (!n_outliers) {
+        return;
+    }
+
+    // Sort worst first
+    for (i = 0; i < n_outliers; i++) {
+        for (j = i + 1; j < n_outliers; j++) {
+            if (outliers[j].lat_ns > outliers[i].lat_ns) {
+                outlier_t tmp = outliers[i];
+
+                outliers[i] = outliers[j];
+                outliers[j] = tmp;
+            }
+        }
+    }
+
+    printf("\nWorst IRQ latencies\n");
+    for (i = 0; i < n_outliers; i++) {
+        printf("  #%d %8.1fus  %s  cpu %d  t=%llu.%09llu\n", i + 1,
+               outliers[i].lat_ns / 1000.0,
+               outliers[i].stream ? "capture " : "playback",
+               outliers[i].cpu,
+               (unsigned long long)(outliers[i].ts / NSEC_PER_SEC),
+               (unsigned long long)(outliers[i].ts % NSEC_PER_SEC));
+        for (j = 0; j < outliers[i].nstack; j++) {
+            print_symbol(outliers[i].stack[j]);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Capture
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int cpu;
+    int raw_fd;
+    int pipe_fd[2];
+    int out_fd;     // record mode only
+} cpu_stream_t;
+
+static cpu_stream_t cpus[MAX_CPUS];
+static int n_cpus;
+static int stacks_enabled;
+
+// An instance left behind by an interrupted run is reused
+static int instance_create(void) {
+    snprintf(instance, sizeof(instance), "%s/instances/apollo", tracefs);
+    if (mkdir(instance, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Failed to create %s: %s\n", instance, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Frees the instance buffers; the per-CPU streams must be closed first
+static void instance_remove(void) {
+    if (rmdir(instance) < 0) {
+        fprintf(stderr, "Failed to remove %s: %s\n", instance, strerror(errno));
+    }
+}
+
+static void trace_setup(int capture_stacks) {
+    // Monotonic clock keeps timestamps comparable across CPUs
+    tracefs_write("trace_clock", "mono");
+    tracefs_write("trace", "");
+    if (capture_stacks &&
+        tracefs_write("events/apollo/apollo_period/trigger", "stacktrace") == 0) {
+        stacks_enabled = 1;
+    }
+    tracefs_write("events/apollo/enable", "1");
+}
+
+static void trace_teardown(void) {
+    tracefs_write("events/apollo/enable", "0");
+    if (stacks_enabled) {
+        tracefs_write("events/apollo/apollo_period/trigger", "!stacktrace");
+    }
+}
+
+static int open_cpu_streams(const char *record_dir) {
+    long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+    char path[1024];
+    int cpu;
+
+    if (ncpu > MAX_CPUS) {
+        ncpu = MAX_CPUS;
+    }
+
+    for (cpu = 0; cpu < ncpu; cpu++) {
+        cpu_stream_t *c = &cpus[n_cpus];
+
+        snprintf(path, sizeof(path), "%s/per_cpu/cpu%d/trace_pipe_raw", instance, cpu);
+        c->raw_fd = open(path, O_RDONLY | O_NONBLOCK);
+        if (c->raw_fd < 0) {
+            continue;
+        }
+        if (pipe(c->pipe_fd) < 0) {
+            close(c->raw_fd);
+            continue;
+        }
+        c->cpu = cpu;
+        c->out_fd = -1;
+        if (record_dir) {
+            snprintf(path, sizeof(path), "%s/cpu%d.raw", record_dir, cpu);
+            c->out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (c->out_fd < 0) {
+                fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+                return -1;
+            }
+        }
+        n_cpus++;
+    }
+
+    return n_cpus ? 0 : -1;
+}
+
+static void close_cpu_streams(void) {
+    int i;
+
+    for (i = 0; i < n_cpus; i++) {
+        close(cpus[i].raw_fd);
+        close(cpus[i].pipe_fd[0]);
+        close(cpus[i].pipe_fd[1]);
+        if (cpus[i].out_fd >= 0) {
+            close(cpus[i].out_fd);
+        }
+    }
+}
+
+// Move all full pages currently available on each CPU. In record mode the
+// pages go from the ring buffer to the output file without passing through
+// user space; in live mode they are pulled from the pipe for decoding.
+static uint64_t drain_cpus(uint8_t *page, record_t **recs, size_t *n, size_t *cap) {
+    uint64_t pages = 0;
+    int i;
+
+    for (i = 0; i < n_cpus; i++) {
+        cpu_stream_t *c = &cpus[i];
+
+        for (;;) {
+            ssize_t in = splice(c->raw_fd, NULL, c->pipe_fd[1], NULL, page_size,
+                                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+            if (in <= 0) {
+                break;
+            }
+            pages++;
+
+            if (c->out_fd >= 0) {
+                while (in > 0) {
+                    ssize_t out = splice(c->pipe_fd[0], NULL, c->out_fd, NULL, in, SPLICE_F_MOVE);
+
+                    if (out <= 0) {
+                        break;
+                    }
+                    in -= out;
+                }
+            } else {
+                ssize_t got = 0, r;
+
+                while (got < in && (r = read(c->pipe_fd[0], page + got, in - got)) > 0) {
+                    got += r;
+                }
+                if (got == page_size) {
+                    decode_page(page, c->cpu, recs, n, cap);
+                }
+            }
+        }
+    }
+
+    return pages;
+}
+
+static void print_rolling(uint64_t elapsed_ns) {
+    printf("[%7.1fs] ", elapsed_ns / 1e9);
+    print_percentiles("irq", &roll_lat);
+    printf(" | ");
+    print_percentiles("jitter", &roll_jitter);
+    printf(" | drift max %7.1fus (n=%llu)\n", roll_drift.max_ns / 1000.0,
+           (unsigned long long)roll_lat.total);
+    fflush(stdout);
+
+    hist_reset(&roll_lat);
+    hist_reset(&roll_jitter);
+    hist_reset(&roll_drift);
+}
+
+static int run_capture(const char *record_dir, double duration, double interval, int capture_stacks) {
+    uint8_t *page = malloc(page_size);
+    record_t *recs = NULL;
+    size_t n = 0, cap = 0;
+    uint64_t start, last_report, total_pages = 0;
+    struct pollfd pfds[MAX_CPUS];
+    int i;
+
+    if (!page) {
+        return EXIT_FAILURE;
+    }
+
+    if (record_dir) {
+        mkdir(record_dir, 0755);
+        save_formats(record_dir);
+    } else if (load_formats(capture_stacks) < 0) {
+        free(page);
+        return EXIT_FAILURE;
+    }
+
+    if (instance_create() < 0) {
+        free(page);
+        return EXIT_FAILURE;
+    }
+    if (open_cpu_streams(record_dir) < 0) {
+        fprintf(stderr, "Failed to open per-CPU trace buffers\n");
+        close_cpu_streams();
+        instance_remove();
+        free(page);
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < n_cpus; i++) {
+        pfds[i].fd = cpus[i].raw_fd;
+        pfds[i].events = POLLIN;
+    }
+
+    trace_setup(capture_stacks);
+    printf("Tracing on %d CPUs%s, Ctrl-C to stop\n", n_cpus,
+           record_dir ? " (recording)" : "");
+
+    start = last_report = now_ns();
+    while (!stop) {
+        uint64_t t;
+
+        poll(pfds, n_cpus, 100);
+        total_pages += drain_cpus(page, &recs, &n, &cap);
+
+        if (!record_dir && n) {
+            process_batch(recs, n);
+            n = 0;
+        }
+
+        t = now_ns();
+        if (!record_dir && t - last_report >= (uint64_t)(interval * 1e9)) {
+            print_rolling(t - start);
+            last_report = t;
+        }
+        if (duration > 0 && t - start >= (uint64_t)(duration * 1e9)) {
+            break;
+        }
+    }
+
+    trace_teardown();
+
+    // Pick up whatever was flushed while disabling
+    total_pages += drain_cpus(page, &recs, &n, &cap);
+    if (!record_dir) {
+        process_batch(recs, n);
+        print_report();
+    } else {
+        printf("Recorded %llu pages to %s\n", (unsigned long long)total_pages, record_dir);
+    }
+
+    close_cpu_streams();
+    instance_remove();
+    free(recs);
+    free(page);
+    return EXIT_SUCCESS;
+}
+
+static int run_analyze(const char *dir) {
+    uint8_t *page = malloc(page_size);
+    record_t *recs = NULL;
+    size_t n = 0, cap = 0;
+    char path[512];
+    int cpu, files = 0;
+
+    if (!page) {
+        return EXIT_FAILURE;
+    }
+
+    trace_dir = dir;
+    if (load_formats(0) < 0) {
+        free(page);
+        return EXIT_FAILURE;
+    }
+
+    for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+        int fd;
+
+        snprintf(path, sizeof(path), "%s/cpu%d.raw", dir, cpu);
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        files++;
+        while (read(fd, page, page_size) == page_size) {
+            decode_page(page, cpu, &recs, &n, &cap);
+        }
+        close(fd);
+    }
+
+    if (!files) {
+        fprintf(stderr, "No cpu*.raw files in %s\n", dir);
+        free(page);
+        return EXIT_FAILURE;
+    }
+
+    process_batch(recs, n);
+    print_report();
+
+    free(recs);
+    free(page);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    const char *record_dir = NULL;
+    const char *analyze_dir = NULL;
+    double duration = 0, interval = 1.0;
+    int capture_stacks = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--record") == 0) && i + 1 < argc) {
+            record_dir = argv[++i];
+        } else if ((strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--analyze") == 0) && i + 1 < argc) {
+            analyze_dir = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            interval = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            max_outliers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            capture_stacks = 1;
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (max_outliers < 0) {
+        max_outliers = 0;
+    } else if (max_outliers > MAX_OUTLIERS_LIMIT) {
+        max_outliers = MAX_OUTLIERS_LIMIT;
+    }
+    if (interval <= 0) {
+        interval = 1.0;
+    }
+
+    page_size = sysconf(_SC_PAGESIZE);
+    load_kallsyms();
+
+    if (analyze_dir) {
+        return run_analyze(analyze_dir);
+    }
+
+    tracefs = find_tracefs();
+    if (!tracefs) {
+        fprintf(stderr, "tracefs not found (mount -t tracefs nodev /sys/kernel/tracing)\n");
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    return run_capture(record_dir, duration, interval, capture_stacks);
+}
@@ -1,15 +1,29 @@
 // SPDX-License-Identifier: GPL-2.0-only
 /*
  * Apollo Control Library Implementation
+ *
+ * The ALSA ctl (or simple-mixer) handle is not thread-safe, so it belongs
+ * to one I/O thread per control handle. Setters from any thread go through a
+ * multi-producer, single-consumer request queue to that thread; after
+ * each change, and after mixer events from other applications, it
+ * publishes a new snapshot of the device state that getters copy without
+ * locking.
  */
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <errno.h>
 #include <alsa/asoundlib.h>
 #include "apollo_control.h"
@@ -17,97 +31,1145 @@
 #define APOLLO_MIXER_NAME "hw:apollo"
 #define APOLLO_DEVICE_FILE "/dev/apollo0"  /* Placeholder */
 
+#define APOLLO_MAX_GAIN_DB	65.0f
+#define APOLLO_MIXER_FDS	8
+
+/* How often a lazy handle retries the card while it is absent */
+#define APOLLO_ATTACH_RETRY_MS	1000
+
+/*
+ * Snapshot slots. The I/O thread fills the slot after the published one,
+ * so a reader only has to retry if two more snapshots were published
+ * while it was copying.
+ */
+#define APOLLO_SNAPSHOTS	4
+
+#define CACHELINE		64
+#define ARRAY_SIZE(arr)		(sizeof(arr) / sizeof((arr)[0]))
+
+/* Preallocated requests for the async calls, which must not allocate */
+#define APOLLO_ASYNC_REQUESTS	256
+
+enum apollo_request_op {
+	APOLLO_REQ_SET_ANALOG_GAIN,
+	APOLLO_REQ_GET_ANALOG_GAIN,
+	APOLLO_REQ_APPLY_CONFIG,
+};
+
+/*
+ * Queued by a setter, applied by the I/O thread. Synchronous requests
+ * live on the caller's stack and are completed through done; async ones
+ * come from the pool and go back to the caller on the completion queue.
+ */
+struct apollo_request {
+	struct apollo_request *next;
+	enum apollo_request_op op;
+	int channel;
+	float value;
+	int result;
+	bool async;
+	uint64_t applied_ns;
+
+	/* APOLLO_REQ_APPLY_CONFIG */
+	struct apollo_config config;
+	uint64_t fields;
+
+	/* Synchronous */
+	sem_t done;
+
+	/* Async */
+	uint64_t id;
+	apollo_control_cb cb;
+	void *data;
+	uint32_t busy;
+};
+
+/*
+ * Intrusive MPSC list, after Vyukov. Producers swap themselves in as the
+ * head and then link the previous head to themselves; one consumer pops
+ * from the tail.
+ */
+struct apollo_queue {
+	struct apollo_request *head __attribute__((aligned(CACHELINE)));
+	struct apollo_request *tail __attribute__((aligned(CACHELINE)));
+	struct apollo_request stub;
+};
+
+/* Copied word by word with atomic accesses, so readers never race the writer */
+union apollo_snapshot {
+	struct apollo_config config;
+	uint32_t words[sizeof(struct apollo_config) / sizeof(uint32_t)];
+};
+
+_Static_assert(sizeof(struct apollo_config) % sizeof(uint32_t) == 0,
+	       "apollo_config must be a whole number of words");
+
+/* Counters are single words, stored and loaded atomically one by one */
+union apollo_stats {
+	struct apollo_control_stats stats;
+	uint64_t words[sizeof(struct apollo_control_stats) / sizeof(uint64_t)];
+};
+
+/* Bytes for a gain element's dB TLV; a scale is a few words */
+#define APOLLO_TLV_SIZE		256
+
+/* A control resolved once at attach; numid 0 if the card does not have it */
+struct apollo_ctl_elem {
+	unsigned int numid;
+	unsigned int count;
+	long min, max;
+	unsigned int *tlv;		/* NULL: no dB scale */
+	snd_ctl_elem_value_t *value;	/* addressed by numid, reused for every access */
+};
+
+struct apollo_backend;
+
+/* A change subscription; what it last reported, field by field */
+struct apollo_subscription {
+	apollo_control_change_cb cb;	/* NULL: free slot */
+	void *data;
+	uint64_t fields;
+	uint64_t interval_ns;
+	struct apollo_config reported;
+	uint64_t reported_ns[APOLLO_FIELD_COUNT];
+};
+
 struct apollo_control {
-	int mixer_fd;
+	/* Owned by the I/O thread once it runs; NULL while the card is absent */
+	const struct apollo_backend *backend;
 	snd_mixer_t *mixer;
+	snd_ctl_t *ctl;
+	struct apollo_ctl_elem gain[4];
+	bool present;		/* I/O thread's view of attached */
 	struct apollo_config current_config;
+	pthread_t io_thread;
+	int wake_fd;
+	bool stop;
+	bool attached;		/* mirrors mixer != NULL for other threads */
+
+	/* Callers to the I/O thread */
+	struct apollo_queue requests;
+
+	/* I/O thread to apollo_control_dispatch(), signalled through done_fd */
+	struct apollo_queue completions;
+	int done_fd;
+
+	/*
+	 * Subscriptions, owned by the dispatching thread. While watch is set
+	 * the I/O thread signals done_fd once on the next snapshot; while a
+	 * field is held back by its interval, timer_fd fires when it is due.
+	 */
+	struct apollo_subscription subs[APOLLO_CONTROL_SUBSCRIPTIONS];
+	unsigned int nsubs;
+	int timer_fd;
+	uint64_t timer_ns;		/* deadline armed, 0 if none */
+	bool watch;
+
+	/* Written by the I/O thread, except rejected */
+	union apollo_stats stats __attribute__((aligned(CACHELINE)));
+
+	uint64_t next_id __attribute__((aligned(CACHELINE)));
+	uint32_t pool_hint;
+	struct apollo_request pool[APOLLO_ASYNC_REQUESTS];
+
+	/* Readers: the generation whose slot is complete */
+	uint64_t generation __attribute__((aligned(CACHELINE)));
+	union apollo_snapshot snapshot[APOLLO_SNAPSHOTS];
 };
 
-/* Initialize control interface */
-struct apollo_control *apollo_control_init(void)
+static void queue_init(struct apollo_queue *queue)
 {
-	struct apollo_control *control;
-	int err;
+	queue->stub.next = NULL;
+	queue->head = &queue->stub;
+	queue->tail = &queue->stub;
+}
 
-	control = calloc(1, sizeof(*control));
-	if (!control)
-		return NULL;
+static void queue_push(struct apollo_queue *queue, struct apollo_request *req)
+{
+	struct apollo_request *prev;
 
-	/* Initialize ALSA mixer interface */
-	err = snd_mixer_open(&control->mixer, 0);
-	if (err < 0) {
-		free(control);
-		return NULL;
+	__atomic_store_n(&req->next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&queue->head, req, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, req, __ATOMIC_RELEASE);
+}
+
+/*
+ * NULL when empty, or when a producer has swapped the head but not linked
+ * it yet; every producer signals an eventfd afterwards, so the consumer
+ * comes back for it.
+ */
+static struct apollo_request *queue_pop(struct apollo_queue *queue)
+{
+	struct apollo_request *tail = queue->tail;
+	struct apollo_request *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (tail == &queue->stub) {
+		if (!next)
+			return NULL;
+		queue->tail = next;
+		tail = next;
+		next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
 	}
 
-	err = snd_mixer_attach(control->mixer, APOLLO_MIXER_NAME);
-	if (err < 0) {
-		snd_mixer_close(control->mixer);
-		free(control);
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+
+	if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
 		return NULL;
+
+	/* Last request: put the stub behind it so it can be detached */
+	queue_push(queue, &queue->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		queue->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/* Claim a pool slot without locking; NULL when all are in flight */
+static struct apollo_request *request_alloc(struct apollo_control *control)
+{
+	uint32_t start = __atomic_fetch_add(&control->pool_hint, 1, __ATOMIC_RELAXED);
+	uint32_t i, expected;
+
+	for (i = 0; i < APOLLO_ASYNC_REQUESTS; i++) {
+		struct apollo_request *req = &control->pool[(start + i) % APOLLO_ASYNC_REQUESTS];
+
+		expected = 0;
+		if (__atomic_compare_exchange_n(&req->busy, &expected, 1, false,
+						__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return req;
 	}
 
-	err = snd_mixer_selem_register(control->mixer, NULL, NULL);
+	return NULL;
+}
+
+static void request_free(struct apollo_request *req)
+{
+	__atomic_store_n(&req->busy, 0, __ATOMIC_RELEASE);
+}
+
+/* Only fails once the counter is saturated, i.e. with a wakeup pending anyway */
+static void signal_fd(int fd)
+{
+	uint64_t one = 1;
+	ssize_t ret;
+
+	ret = write(fd, &one, sizeof(one));
+	(void)ret;
+}
+
+static void drain_fd(int fd)
+{
+	uint64_t count;
+	ssize_t ret;
+
+	ret = read(fd, &count, sizeof(count));
+	(void)ret;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* I/O thread only; it is the single writer, so no read-modify-write is needed */
+static void stat_add(uint64_t *counter, uint64_t n)
+{
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+			 __ATOMIC_RELAXED);
+}
+
+static unsigned int stat_bucket(uint64_t ns)
+{
+	uint64_t us = (ns + 999) / 1000;
+	unsigned int bucket;
+
+	if (us <= 1)
+		return 0;
+	bucket = 64 - __builtin_clzll(us - 1);
+	return bucket < APOLLO_STATS_BUCKETS ? bucket : APOLLO_STATS_BUCKETS - 1;
+}
+
+static void stat_request(struct apollo_control *control, const struct apollo_request *req,
+			 uint64_t ns)
+{
+	struct apollo_control_stats *stats = &control->stats.stats;
+
+	switch (req->op) {
+	case APOLLO_REQ_SET_ANALOG_GAIN:
+		stat_add(&stats->sets, 1);
+		break;
+	case APOLLO_REQ_GET_ANALOG_GAIN:
+		stat_add(&stats->gets, 1);
+		break;
+	case APOLLO_REQ_APPLY_CONFIG:
+		stat_add(&stats->applies, 1);
+		break;
+	}
+
+	if (req->result < 0)
+		stat_add(&stats->errors, 1);
+
+	if (req->op != APOLLO_REQ_GET_ANALOG_GAIN) {
+		stat_add(&stats->apply_ns, ns);
+		stat_add(&stats->apply_hist[stat_bucket(ns)], 1);
+	}
+}
+
+/* I/O thread only: publish current_config as the next snapshot */
+static void snapshot_publish(struct apollo_control *control)
+{
+	uint64_t gen = control->generation + 1;
+	union apollo_snapshot *slot = &control->snapshot[gen % APOLLO_SNAPSHOTS];
+	union apollo_snapshot src;
+	size_t i;
+
+	src.config = control->current_config;
+
+	/* Readers that see any of these stores also see the last publication */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (i = 0; i < ARRAY_SIZE(src.words); i++)
+		__atomic_store_n(&slot->words[i], src.words[i], __ATOMIC_RELAXED);
+	__atomic_store_n(&control->generation, gen, __ATOMIC_RELEASE);
+
+	/* Pairs with the fence in notify_subscribers(): one of us sees the other */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&control->watch, false, __ATOMIC_RELAXED))
+		signal_fd(control->done_fd);
+}
+
+static void snapshot_read(struct apollo_control *control, struct apollo_config *config)
+{
+	union apollo_snapshot dst;
+	uint64_t gen, now;
+	size_t i;
+
+	do {
+		gen = __atomic_load_n(&control->generation, __ATOMIC_ACQUIRE);
+		for (i = 0; i < ARRAY_SIZE(dst.words); i++)
+			dst.words[i] = __atomic_load_n(&control->snapshot[gen % APOLLO_SNAPSHOTS].words[i],
+						       __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		now = __atomic_load_n(&control->generation, __ATOMIC_RELAXED);
+		/* The slot is rewritten only once gen + APOLLO_SNAPSHOTS - 1 is out */
+	} while (now - gen > APOLLO_SNAPSHOTS - 2);
+
+	*config = dst.config;
+}
+
+/*
+ * Where the analog gains live on the card. The ctl backend is the
+ * default; the simple-mixer one is kept for comparison and for cards
+ * whose controls it knows how to classify.
+ */
+struct apollo_backend {
+	const char *name;
+	int (*attach)(struct apollo_control *control);
+	void (*detach)(struct apollo_control *control);
+	int (*poll_descriptors)(struct apollo_control *control, struct pollfd *fds,
+				unsigned int space);
+	/* > 0 if values changed, < 0 if the card is gone */
+	int (*handle_events)(struct apollo_control *control, struct pollfd *fds,
+			     unsigned int nfds);
+	int (*read_gain)(struct apollo_control *control, int channel, float *gain_db);
+	int (*write_gain)(struct apollo_control *control, int channel, float gain_db);
+};
+
+static void gain_elem_name(char *name, size_t size, int channel)
+{
+	snprintf(name, size, "Analog %d Gain", channel);
+}
+
+/* Placeholder mapping for gain controls without a dB scale */
+static float linear_to_db(long value, long min, long max)
+{
+	return (float)(value - min) / (max - min) * APOLLO_MAX_GAIN_DB;
+}
+
+static long db_to_linear(float gain_db, long min, long max)
+{
+	return (long)((gain_db / APOLLO_MAX_GAIN_DB) * (max - min) + min);
+}
+
+/* Simple-mixer backend */
+
+static snd_mixer_elem_t *find_gain_elem(snd_mixer_t *mixer, int channel)
+{
+	snd_mixer_selem_id_t *sid;
+	char name[32];
+
+	snd_mixer_selem_id_alloca(&sid);
+	gain_elem_name(name, sizeof(name), channel);
+	snd_mixer_selem_id_set_name(sid, name);
+
+	return snd_mixer_find_selem(mixer, sid);
+}
+
+static int selem_attach(struct apollo_control *control)
+{
+	snd_mixer_t *mixer;
+	int err;
+
+	err = snd_mixer_open(&mixer, 0);
+	if (err < 0)
+		return err;
+
+	err = snd_mixer_attach(mixer, APOLLO_MIXER_NAME);
+	if (err >= 0)
+		err = snd_mixer_selem_register(mixer, NULL, NULL);
+	if (err >= 0)
+		err = snd_mixer_load(mixer);
 	if (err < 0) {
-		snd_mixer_close(control->mixer);
-		free(control);
-		return NULL;
+		snd_mixer_close(mixer);
+		return err;
 	}
 
-	err = snd_mixer_load(control->mixer);
+	control->mixer = mixer;
+	return 0;
+}
+
+static void selem_detach(struct apollo_control *control)
+{
+	snd_mixer_close(control->mixer);
+	control->mixer = NULL;
+}
+
+static int selem_poll_descriptors(struct apollo_control *control, struct pollfd *fds,
+				  unsigned int space)
+{
+	return snd_mixer_poll_descriptors(control->mixer, fds, space);
+}
+
+static int selem_handle_events(struct apollo_control *control, struct pollfd *fds,
+			       unsigned int nfds)
+{
+	unsigned short revents;
+
+	if (snd_mixer_poll_descriptors_revents(control->mixer, fds, nfds, &revents) < 0 ||
+	    !revents)
+		return 0;
+	if (snd_mixer_handle_events(control->mixer) < 0)
+		return -ENODEV;
+	return 1;
+}
+
+static int selem_read_gain(struct apollo_control *control, int channel, float *gain_db)
+{
+	snd_mixer_elem_t *elem;
+	long min, max, value;
+
+	elem = find_gain_elem(control->mixer, channel);
+	if (!elem)
+		return -ENOENT;
+
+	snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
+	if (max <= min ||
+	    snd_mixer_selem_get_playback_volume(elem, SND_MIXER_SCHN_FRONT_LEFT, &value) < 0)
+		return -EIO;
+
+	*gain_db = linear_to_db(value, min, max);
+	return 0;
+}
+
+static int selem_write_gain(struct apollo_control *control, int channel, float gain_db)
+{
+	snd_mixer_elem_t *elem;
+	long min, max;
+
+	elem = find_gain_elem(control->mixer, channel);
+	if (!elem)
+		return -ENOENT;
+
+	snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
+	return snd_mixer_selem_set_playback_volume_all(elem, db_to_linear(gain_db, min, max));
+}
+
+static const struct apollo_backend selem_backend = {
+	.name = "selem",
+	.attach = selem_attach,
+	.detach = selem_detach,
+	.poll_descriptors = selem_poll_descriptors,
+	.handle_events = selem_handle_events,
+	.read_gain = selem_read_gain,
+	.write_gain = selem_write_gain,
+};
+
+/*
+ * Ctl backend: each gain element is looked up by name once at attach,
+ * and a value container addressed by its numid is kept, so a read or a
+ * write is one ioctl with no name matching. Raw values are converted
+ * through the element's dB TLV when it has one.
+ */
+
+static void ctl_elem_clear(struct apollo_ctl_elem *elem)
+{
+	snd_ctl_elem_value_free(elem->value);
+	free(elem->tlv);
+	memset(elem, 0, sizeof(*elem));
+}
+
+/* (Re)read the dB scale; without one the placeholder mapping is used */
+static void ctl_elem_read_tlv(snd_ctl_t *ctl, struct apollo_ctl_elem *elem,
+			      const snd_ctl_elem_id_t *id)
+{
+	long min_db, max_db;
+
+	if (!elem->tlv)
+		elem->tlv = malloc(APOLLO_TLV_SIZE);
+	if (!elem->tlv)
+		return;
+
+	if (snd_ctl_elem_tlv_read(ctl, id, elem->tlv, APOLLO_TLV_SIZE) < 0 ||
+	    snd_tlv_get_dB_range(elem->tlv, elem->min, elem->max, &min_db, &max_db) < 0) {
+		free(elem->tlv);
+		elem->tlv = NULL;
+	}
+}
+
+static int ctl_elem_resolve(snd_ctl_t *ctl, struct apollo_ctl_elem *elem, int channel)
+{
+	snd_ctl_elem_info_t *info;
+	snd_ctl_elem_id_t *id;
+	char name[32];
+	int err;
+
+	snd_ctl_elem_info_alloca(&info);
+	snd_ctl_elem_id_alloca(&id);
+
+	gain_elem_name(name, sizeof(name), channel);
+	snd_ctl_elem_info_set_interface(info, SND_CTL_ELEM_IFACE_MIXER);
+	snd_ctl_elem_info_set_name(info, name);
+	err = snd_ctl_elem_info(ctl, info);
+	if (err < 0)
+		return err;
+
+	if (snd_ctl_elem_info_get_type(info) != SND_CTL_ELEM_TYPE_INTEGER ||
+	    snd_ctl_elem_info_get_max(info) <= snd_ctl_elem_info_get_min(info))
+		return -EINVAL;
+
+	err = snd_ctl_elem_value_malloc(&elem->value);
+	if (err < 0)
+		return err;
+
+	elem->numid = snd_ctl_elem_info_get_numid(info);
+	elem->count = snd_ctl_elem_info_get_count(info);
+	elem->min = snd_ctl_elem_info_get_min(info);
+	elem->max = snd_ctl_elem_info_get_max(info);
+	snd_ctl_elem_value_set_numid(elem->value, elem->numid);
+
+	if (snd_ctl_elem_info_is_tlv_readable(info)) {
+		snd_ctl_elem_info_get_id(info, id);
+		ctl_elem_read_tlv(ctl, elem, id);
+	}
+	return 0;
+}
+
+static int ctl_attach(struct apollo_control *control)
+{
+	snd_ctl_t *ctl;
+	int err, i;
+
+	err = snd_ctl_open(&ctl, APOLLO_MIXER_NAME, SND_CTL_NONBLOCK);
+	if (err < 0)
+		return err;
+
+	err = snd_ctl_subscribe_events(ctl, 1);
 	if (err < 0) {
-		snd_mixer_close(control->mixer);
+		snd_ctl_close(ctl);
+		return err;
+	}
+
+	/* Gains the card does not have fail with -ENOENT, as with selem */
+	for (i = 0; i < 4; i++)
+		if (ctl_elem_resolve(ctl, &control->gain[i], i + 1) < 0)
+			ctl_elem_clear(&control->gain[i]);
+
+	control->ctl = ctl;
+	return 0;
+}
+
+static void ctl_detach(struct apollo_control *control)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		ctl_elem_clear(&control->gain[i]);
+	snd_ctl_close(control->ctl);
+	control->ctl = NULL;
+}
+
+static int ctl_poll_descriptors(struct apollo_control *control, struct pollfd *fds,
+				unsigned int space)
+{
+	return snd_ctl_poll_descriptors(control->ctl, fds, space);
+}
+
+static struct apollo_ctl_elem *ctl_find_numid(struct apollo_control *control,
+					      unsigned int numid)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (control->gain[i].numid && control->gain[i].numid == numid)
+			return &control->gain[i];
+	return NULL;
+}
+
+static int ctl_handle_events(struct apollo_control *control, struct pollfd *fds,
+			     unsigned int nfds)
+{
+	struct apollo_ctl_elem *elem;
+	snd_ctl_elem_id_t *id;
+	snd_ctl_event_t *event;
+	unsigned short revents;
+	unsigned int mask;
+	int err, changed = 0;
+
+	if (snd_ctl_poll_descriptors_revents(control->ctl, fds, nfds, &revents) < 0)
+		return 0;
+	if (revents & (POLLERR | POLLHUP | POLLNVAL))
+		return -ENODEV;
+	if (!(revents & POLLIN))
+		return 0;
+
+	snd_ctl_event_alloca(&event);
+	snd_ctl_elem_id_alloca(&id);
+
+	while ((err = snd_ctl_read(control->ctl, event)) > 0) {
+		if (snd_ctl_event_get_type(event) != SND_CTL_EVENT_ELEM)
+			continue;
+
+		elem = ctl_find_numid(control, snd_ctl_event_elem_get_numid(event));
+		if (!elem)
+			continue;
+
+		mask = snd_ctl_event_elem_get_mask(event);
+		if (mask == SND_CTL_EVENT_MASK_REMOVE)
+			return -ENODEV;
+		if (mask & SND_CTL_EVENT_MASK_TLV) {
+			snd_ctl_event_elem_get_id(event, id);
+			ctl_elem_read_tlv(control->ctl, elem, id);
+		}
+		changed = 1;
+	}
+
+	return err < 0 && err != -EAGAIN ? err : changed;
+}
+
+/* Nearest raw value: the TLV only rounds up or down */
+static long ctl_db_to_raw(const struct apollo_ctl_elem *elem, float gain_db)
+{
+	long cdb = (long)(gain_db * 100.0f + (gain_db < 0.0f ? -0.5f : 0.5f));
+	long down, up, down_cdb, up_cdb;
+
+	if (!elem->tlv)
+		return db_to_linear(gain_db, elem->min, elem->max);
+
+	if (snd_tlv_convert_from_dB(elem->tlv, elem->min, elem->max, cdb, &down, 0) < 0 ||
+	    snd_tlv_convert_from_dB(elem->tlv, elem->min, elem->max, cdb, &up, 1) < 0 ||
+	    snd_tlv_convert_to_dB(elem->tlv, elem->min, elem->max, down, &down_cdb) < 0 ||
+	    snd_tlv_convert_to_dB(elem->tlv, elem->min, elem->max, up, &up_cdb) < 0)
+		return db_to_linear(gain_db, elem->min, elem->max);
+
+	return labs(up_cdb - cdb) < labs(cdb - down_cdb) ? up : down;
+}
+
+static float ctl_raw_to_db(const struct apollo_ctl_elem *elem, long raw)
+{
+	long cdb;
+
+	if (!elem->tlv || snd_tlv_convert_to_dB(elem->tlv, elem->min, elem->max, raw, &cdb) < 0)
+		return linear_to_db(raw, elem->min, elem->max);
+	return cdb / 100.0f;
+}
+
+static int ctl_read_gain(struct apollo_control *control, int channel, float *gain_db)
+{
+	struct apollo_ctl_elem *elem = &control->gain[channel - 1];
+	int err;
+
+	if (!elem->numid)
+		return -ENOENT;
+
+	err = snd_ctl_elem_read(control->ctl, elem->value);
+	if (err < 0)
+		return err;
+
+	*gain_db = ctl_raw_to_db(elem, snd_ctl_elem_value_get_integer(elem->value, 0));
+	return 0;
+}
+
+static int ctl_write_gain(struct apollo_control *control, int channel, float gain_db)
+{
+	struct apollo_ctl_elem *elem = &control->gain[channel - 1];
+	long raw;
+	unsigned int i;
+
+	if (!elem->numid)
+		return -ENOENT;
+
+	raw = ctl_db_to_raw(elem, gain_db);
+	for (i = 0; i < elem->count; i++)
+		snd_ctl_elem_value_set_integer(elem->value, i, raw);
+
+	return snd_ctl_elem_write(control->ctl, elem->value);
+}
+
+static const struct apollo_backend ctl_backend = {
+	.name = "ctl",
+	.attach = ctl_attach,
+	.detach = ctl_detach,
+	.poll_descriptors = ctl_poll_descriptors,
+	.handle_events = ctl_handle_events,
+	.read_gain = ctl_read_gain,
+	.write_gain = ctl_write_gain,
+};
+
+/* Read the analog gains back from the card into current_config */
+static void refresh_gains(struct apollo_control *control)
+{
+	float gain_db;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (control->backend->read_gain(control, i + 1, &gain_db) == 0)
+			control->current_config.analog_gain[i] = gain_db;
+}
+
+static int apply_analog_gain(struct apollo_control *control, int channel, float gain_db)
+{
+	float applied;
+	int err;
+
+	err = control->backend->write_gain(control, channel, gain_db);
+	if (err < 0)
+		return err;
+
+	/* The card may round to its own steps */
+	if (control->backend->read_gain(control, channel, &applied) == 0)
+		control->current_config.analog_gain[channel - 1] = applied;
+	return 0;
+}
+
+/* Write the selected fields that differ; returns the first error */
+static int apply_config(struct apollo_control *control, const struct apollo_config *config,
+			uint64_t fields)
+{
+	unsigned int i;
+	float value;
+	int err, ret = 0;
+
+	for (i = 0; i < APOLLO_FIELD_COUNT; i++) {
+		if (!(fields & APOLLO_FIELD_BIT(i)))
+			continue;
+
+		value = apollo_config_get_field(config, i);
+		if (value == apollo_config_get_field(&control->current_config, i))
+			continue;
+
+		if (i < APOLLO_FIELD_ANALOG_GAIN + 4) {
+			if (value < 0.0f)
+				value = 0.0f;
+			else if (value > APOLLO_MAX_GAIN_DB)
+				value = APOLLO_MAX_GAIN_DB;
+			err = apply_analog_gain(control, i - APOLLO_FIELD_ANALOG_GAIN + 1, value);
+		} else {
+			/* Placeholder - requires reverse engineering */
+			err = -ENOSYS;
+		}
+
+		if (err && !ret)
+			ret = err;
+	}
+
+	return ret;
+}
+
+static int apply_request(struct apollo_control *control, struct apollo_request *req)
+{
+	if (!control->present)
+		return -ENODEV;
+
+	switch (req->op) {
+	case APOLLO_REQ_SET_ANALOG_GAIN:
+		return apply_analog_gain(control, req->channel, req->value);
+	case APOLLO_REQ_GET_ANALOG_GAIN:
+		/* Fresh from the card rather than the snapshot */
+		refresh_gains(control);
+		req->value = control->current_config.analog_gain[req->channel - 1];
+		return 0;
+	case APOLLO_REQ_APPLY_CONFIG:
+		return apply_config(control, &req->config, req->fields);
+	}
+	return -EINVAL;
+}
+
+/* Drain the queue; one snapshot and one completion wakeup for the batch */
+static void handle_requests(struct apollo_control *control)
+{
+	struct apollo_request *req;
+	bool changed = false, completed = false;
+	uint64_t start;
+
+	while ((req = queue_pop(&control->requests))) {
+		start = now_ns();
+		req->result = apply_request(control, req);
+		/* A partly applied config still changed the device */
+		changed |= (req->result == 0 && req->op == APOLLO_REQ_SET_ANALOG_GAIN) ||
+			   req->op == APOLLO_REQ_APPLY_CONFIG;
+
+		req->applied_ns = now_ns();
+		stat_request(control, req, req->applied_ns - start);
+
+		if (req->async) {
+			queue_push(&control->completions, req);
+			completed = true;
+		} else {
+			sem_post(&req->done);
+		}
+	}
+
+	if (changed)
+		snapshot_publish(control);
+	if (completed)
+		signal_fd(control->done_fd);
+}
+
+/* Open the card's controls and publish its state; -errno if it is not there */
+static int mixer_attach(struct apollo_control *control)
+{
+	int err;
+
+	err = control->backend->attach(control);
+	if (err < 0)
+		return err;
+
+	control->present = true;
+	refresh_gains(control);
+	snapshot_publish(control);
+	__atomic_store_n(&control->attached, true, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* The card went away; requests fail with -ENODEV until it is back */
+static void mixer_detach(struct apollo_control *control)
+{
+	__atomic_store_n(&control->attached, false, __ATOMIC_RELEASE);
+	control->backend->detach(control);
+	control->present = false;
+}
+
+static void *io_thread(void *arg)
+{
+	struct apollo_control *control = arg;
+	struct pollfd fds[1 + APOLLO_MIXER_FDS];
+	int nfds, i, ret;
+
+	while (!__atomic_load_n(&control->stop, __ATOMIC_ACQUIRE)) {
+		if (!control->present)
+			mixer_attach(control);
+
+		fds[0].fd = control->wake_fd;
+		fds[0].events = POLLIN;
+		nfds = 0;
+		if (control->present) {
+			nfds = control->backend->poll_descriptors(control, fds + 1,
+								  APOLLO_MIXER_FDS);
+			if (nfds < 0)
+				nfds = 0;
+		}
+
+		if (poll(fds, 1 + nfds, control->present ? -1 : APOLLO_ATTACH_RETRY_MS) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			drain_fd(control->wake_fd);
+			stat_add(&control->stats.stats.batches, 1);
+			handle_requests(control);
+		}
+
+		/* Card removed: stop polling its dead descriptors */
+		for (i = 1; i <= nfds; i++) {
+			if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+				mixer_detach(control);
+				nfds = 0;
+				break;
+			}
+		}
+
+		/* Changes made by other applications */
+		if (!nfds)
+			continue;
+		ret = control->backend->handle_events(control, fds + 1, nfds);
+		if (ret < 0) {
+			mixer_detach(control);
+		} else if (ret > 0) {
+			stat_add(&control->stats.stats.mixer_events, 1);
+			refresh_gains(control);
+			snapshot_publish(control);
+		}
+	}
+
+	/* Nobody may be left waiting */
+	handle_requests(control);
+	return NULL;
+}
+
+/* Queue a request and wait for the I/O thread to apply it */
+static int submit(struct apollo_control *control, struct apollo_request *req)
+{
+	int ret;
+
+	if (sem_init(&req->done, 0, 0) < 0)
+		return -errno;
+
+	queue_push(&control->requests, req);
+	signal_fd(control->wake_fd);
+
+	while (sem_wait(&req->done) < 0 && errno == EINTR)
+		;
+
+	ret = req->result;
+	sem_destroy(&req->done);
+	return ret;
+}
+
+/* Claim a pool slot for an async call, counting refusals */
+static struct apollo_request *request_get(struct apollo_control *control)
+{
+	struct apollo_request *req = request_alloc(control);
+
+	if (!req)
+		__atomic_fetch_add(&control->stats.stats.rejected, 1, __ATOMIC_RELAXED);
+	return req;
+}
+
+/* Queue a pool request; returns its ID without waiting */
+static int64_t submit_async(struct apollo_control *control, struct apollo_request *req,
+			    enum apollo_request_op op, int channel, float value,
+			    apollo_control_cb cb, void *data)
+{
+	uint64_t id;
+
+	req->op = op;
+	req->channel = channel;
+	req->value = value;
+	req->result = 0;
+	req->async = true;
+	req->cb = cb;
+	req->data = data;
+	req->id = id = __atomic_fetch_add(&control->next_id, 1, __ATOMIC_RELAXED);
+
+	/* req may be completed and reused as soon as it is queued */
+	queue_push(&control->requests, req);
+	signal_fd(control->wake_fd);
+	return id;
+}
+
+/*
+ * Open a control handle. Without APOLLO_CONTROL_LAZY the card must be
+ * present and its state is loaded before this returns. With it, the I/O
+ * thread attaches the card in the background, and again whenever it comes
+ * back; until then the getters return defaults and requests -ENODEV.
+ */
+struct apollo_control *apollo_control_open(unsigned int flags)
+{
+	struct apollo_control *control;
+
+	control = aligned_alloc(CACHELINE, sizeof(*control));
+	if (!control)
+		return NULL;
+	memset(control, 0, sizeof(*control));
+	queue_init(&control->requests);
+	queue_init(&control->completions);
+	control->next_id = 1;
+	control->backend = (flags & APOLLO_CONTROL_SELEM) ? &selem_backend : &ctl_backend;
+
+	/* Initial snapshot, before any reader can see the handle */
+	apollo_control_default_config(&control->current_config);
+	snapshot_publish(control);
+
+	if (!(flags & APOLLO_CONTROL_LAZY) && mixer_attach(control) < 0) {
 		free(control);
 		return NULL;
 	}
 
+	control->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (control->wake_fd < 0)
+		goto err_mixer;
+
+	control->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (control->done_fd < 0)
+		goto err_wake;
+
+	control->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (control->timer_fd < 0)
+		goto err_done;
+
+	if (pthread_create(&control->io_thread, NULL, io_thread, control))
+		goto err_timer;
+
 	return control;
+
+err_timer:
+	close(control->timer_fd);
+err_done:
+	close(control->done_fd);
+err_wake:
+	close(control->wake_fd);
+err_mixer:
+	if (control->present)
+		control->backend->detach(control);
+	free(control);
+	return NULL;
+}
+
+/* Initialize control interface; fails if the card is not there */
+struct apollo_control *apollo_control_init(void)
+{
+	return apollo_control_open(0);
+}
+
+/* Whether the I/O thread currently has the card */
+int apollo_control_attached(struct apollo_control *control)
+{
+	return __atomic_load_n(&control->attached, __ATOMIC_ACQUIRE);
 }
 
-/* Cleanup control interface */
+/*
+ * Cleanup control interface; no other thread may use the handle any more.
+ * Completions not dispatched yet are dropped without their callbacks.
+ */
 void apollo_control_cleanup(struct apollo_control *control)
 {
 	if (!control)
 		return;
 
-	if (control->mixer)
-		snd_mixer_close(control->mixer);
+	__atomic_store_n(&control->stop, true, __ATOMIC_RELEASE);
+	signal_fd(control->wake_fd);
+	pthread_join(control->io_thread, NULL);
+	close(control->wake_fd);
+	close(control->done_fd);
+	close(control->timer_fd);
+
+	if (control->present)
+		control->backend->detach(control);
 
 	free(control);
 }
 
-/* Load configuration from file */
-int apollo_control_load_config(struct apollo_control *control, struct apollo_config *config)
+/*
+ * Config file keys: "<name><n>" for the n-th (1-based) field of a run,
+ * or the bare name for a single field.
+ */
+static const struct {
+	const char *name;
+	unsigned int field;
+	unsigned int count;		/* 0: single field */
+} config_keys[] = {
+	{ "analog_gain", APOLLO_FIELD_ANALOG_GAIN, 4 },
+	{ "output_gain_l", APOLLO_FIELD_OUTPUT_GAIN, 0 },
+	{ "output_gain_r", APOLLO_FIELD_OUTPUT_GAIN + 1, 0 },
+	{ "input_source", APOLLO_FIELD_INPUT_SOURCE, APOLLO_MAX_CHANNELS },
+	{ "phantom_power", APOLLO_FIELD_PHANTOM_POWER, 4 },
+	{ "hpf_enabled", APOLLO_FIELD_HPF_ENABLED, APOLLO_MAX_CHANNELS },
+	{ "hpf_freq", APOLLO_FIELD_HPF_FREQ, APOLLO_MAX_CHANNELS },
+	{ "pad_enabled", APOLLO_FIELD_PAD_ENABLED, 4 },
+	{ "monitor_source", APOLLO_FIELD_MONITOR_SOURCE, 0 },
+	{ "monitor_gain", APOLLO_FIELD_MONITOR_GAIN, 0 },
+};
+
+static int config_key_field(const char *key)
+{
+	unsigned int i, n;
+	size_t len;
+	char *end;
+
+	for (i = 0; i < ARRAY_SIZE(config_keys); i++) {
+		len = strlen(config_keys[i].name);
+		if (strncmp(key, config_keys[i].name, len) != 0)
+			continue;
+		if (!config_keys[i].count) {
+			if (key[len] == '\0')
+				return config_keys[i].field;
+			continue;
+		}
+		n = strtoul(key + len, &end, 10);
+		if (end != key + len && *end == '\0' && n >= 1 && n <= config_keys[i].count)
+			return config_keys[i].field + n - 1;
+	}
+
+	return -1;
+}
+
+int apollo_config_field_name(unsigned int field, char *name, size_t size)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(config_keys); i++) {
+		if (!config_keys[i].count && field == config_keys[i].field) {
+			snprintf(name, size, "%s", config_keys[i].name);
+			return 0;
+		}
+		if (config_keys[i].count && field >= config_keys[i].field &&
+		    field < config_keys[i].field + config_keys[i].count) {
+			snprintf(name, size, "%s%u", config_keys[i].name,
+				 field - config_keys[i].field + 1);
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+/* Parse a config file over config; keys missing from the file keep their value */
+int apollo_config_load_file(const char *path, struct apollo_config *config)
 {
 	FILE *fp;
 	char line[256];
-	int ret = 0;
 
-	fp = fopen(APOLLO_CONFIG_FILE, "r");
+	fp = fopen(path, "r");
 	if (!fp)
 		return -errno;
 
-	/* Parse configuration file */
-	/* Placeholder - implement INI-style parsing */
 	while (fgets(line, sizeof(line), fp)) {
-		/* Parse key=value pairs */
-		char *key = strtok(line, "=");
-		char *value = strtok(NULL, "\n");
+		char *key, *value, *end;
+		int field;
+		float v;
 
+		line[strcspn(line, "#\n")] = '\0';
+		key = strtok(line, "= \t");
+		value = strtok(NULL, "= \t");
 		if (!key || !value)
 			continue;
 
-		/* Parse configuration options */
-		if (strcmp(key, "analog_gain1") == 0) {
-			config->analog_gain[0] = atof(value);
-		} else if (strcmp(key, "analog_gain2") == 0) {
-			config->analog_gain[1] = atof(value);
-		}
-		/* Add more configuration options */
+		field = config_key_field(key);
+		v = strtof(value, &end);
+		if (field < 0 || end == value)
+			continue;
+
+		apollo_config_set_field(config, field, v);
 	}
 
 	fclose(fp);
-	return ret;
+	return 0;
+}
+
+/* Load configuration from file */
+int apollo_control_load_config(struct apollo_control *control, struct apollo_config *config)
+{
+	apollo_control_default_config(config);
+	return apollo_config_load_file(APOLLO_CONFIG_FILE, config);
 }
 
 /* Save configuration to file */
@@ -137,6 +1199,15 @@ int apollo_control_save_config(struct apollo_control *control, const struct apol
 		fprintf(fp, "phantom_power%d=%d\n", i + 1, config->phantom_power[i]);
 	}
 
+	/* High-pass filters and pads */
+	for (i = 0; i < APOLLO_MAX_CHANNELS; i++) {
+		fprintf(fp, "hpf_enabled%d=%d\n", i + 1, config->hpf_enabled[i]);
+		fprintf(fp, "hpf_freq%d=%.1f\n", i + 1, config->hpf_freq[i]);
+	}
+	for (i = 0; i < 4; i++) {
+		fprintf(fp, "pad_enabled%d=%d\n", i + 1, config->pad_enabled[i]);
+	}
+
 	/* Monitor settings */
 	fprintf(fp, "monitor_source=%d\n", config->monitor_source);
 	fprintf(fp, "monitor_gain=%.1f\n", config->monitor_gain);
@@ -183,13 +1254,68 @@ void apollo_control_default_config(struct apollo_config *config)
 	config->monitor_gain = 0.0f;
 }
 
+float apollo_config_get_field(const struct apollo_config *config, unsigned int field)
+{
+	if (field < APOLLO_FIELD_OUTPUT_GAIN)
+		return config->analog_gain[field - APOLLO_FIELD_ANALOG_GAIN];
+	if (field < APOLLO_FIELD_INPUT_SOURCE)
+		return config->output_gain[field - APOLLO_FIELD_OUTPUT_GAIN];
+	if (field < APOLLO_FIELD_PHANTOM_POWER)
+		return config->input_source[field - APOLLO_FIELD_INPUT_SOURCE];
+	if (field < APOLLO_FIELD_HPF_ENABLED)
+		return config->phantom_power[field - APOLLO_FIELD_PHANTOM_POWER];
+	if (field < APOLLO_FIELD_HPF_FREQ)
+		return config->hpf_enabled[field - APOLLO_FIELD_HPF_ENABLED];
+	if (field < APOLLO_FIELD_PAD_ENABLED)
+		return config->hpf_freq[field - APOLLO_FIELD_HPF_FREQ];
+	if (field < APOLLO_FIELD_MONITOR_SOURCE)
+		return config->pad_enabled[field - APOLLO_FIELD_PAD_ENABLED];
+	if (field == APOLLO_FIELD_MONITOR_SOURCE)
+		return config->monitor_source;
+	if (field == APOLLO_FIELD_MONITOR_GAIN)
+		return config->monitor_gain;
+	return 0.0f;
+}
+
+void apollo_config_set_field(struct apollo_config *config, unsigned int field, float value)
+{
+	if (field < APOLLO_FIELD_OUTPUT_GAIN)
+		config->analog_gain[field - APOLLO_FIELD_ANALOG_GAIN] = value;
+	else if (field < APOLLO_FIELD_INPUT_SOURCE)
+		config->output_gain[field - APOLLO_FIELD_OUTPUT_GAIN] = value;
+	else if (field < APOLLO_FIELD_PHANTOM_POWER)
+		config->input_source[field - APOLLO_FIELD_INPUT_SOURCE] = (enum apollo_input_source)value;
+	else if (field < APOLLO_FIELD_HPF_ENABLED)
+		config->phantom_power[field - APOLLO_FIELD_PHANTOM_POWER] = value != 0.0f;
+	else if (field < APOLLO_FIELD_HPF_FREQ)
+		config->hpf_enabled[field - APOLLO_FIELD_HPF_ENABLED] = value != 0.0f;
+	else if (field < APOLLO_FIELD_PAD_ENABLED)
+		config->hpf_freq[field - APOLLO_FIELD_HPF_FREQ] = value;
+	else if (field < APOLLO_FIELD_MONITOR_SOURCE)
+		config->pad_enabled[field - APOLLO_FIELD_PAD_ENABLED] = value != 0.0f;
+	else if (field == APOLLO_FIELD_MONITOR_SOURCE)
+		config->monitor_source = (enum apollo_monitor_source)value;
+	else if (field == APOLLO_FIELD_MONITOR_GAIN)
+		config->monitor_gain = value;
+}
+
+void apollo_control_get_stats(struct apollo_control *control, struct apollo_control_stats *stats)
+{
+	union apollo_stats dst;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(dst.words); i++)
+		dst.words[i] = __atomic_load_n(&control->stats.words[i], __ATOMIC_RELAXED);
+	*stats = dst.stats;
+}
+
 /* Set analog gain */
 int apollo_control_set_analog_gain(struct apollo_control *control, int channel, float gain_db)
 {
-	snd_mixer_elem_t *elem;
-	snd_mixer_selem_id_t *sid;
-	char name[32];
-	long min, max, value;
+	struct apollo_request req = {
+		.op = APOLLO_REQ_SET_ANALOG_GAIN,
+		.channel = channel,
+	};
 
 	if (channel < 1 || channel > 4)
 		return -EINVAL;
@@ -197,56 +1323,23 @@ int apollo_control_set_analog_gain(struct apollo_control *control, int channel,
 	/* Clamp gain to valid range */
 	if (gain_db < 0.0f)
 		gain_db = 0.0f;
-	else if (gain_db > 65.0f)
-		gain_db = 65.0f;
-
-	/* Find mixer element */
-	snd_mixer_selem_id_alloca(&sid);
-	sprintf(name, "Analog %d Gain", channel);
-	snd_mixer_selem_id_set_name(sid, name);
+	else if (gain_db > APOLLO_MAX_GAIN_DB)
+		gain_db = APOLLO_MAX_GAIN_DB;
 
-	elem = snd_mixer_find_selem(control->mixer, sid);
-	if (!elem)
-		return -ENOENT;
-
-	/* Get volume range */
-	snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
-
-	/* Convert dB to linear scale (placeholder conversion) */
-	value = (long)((gain_db / 65.0f) * (max - min) + min);
-
-	/* Set volume */
-	return snd_mixer_selem_set_playback_volume_all(elem, value);
+	req.value = gain_db;
+	return submit(control, &req);
 }
 
 /* Get analog gain */
 int apollo_control_get_analog_gain(struct apollo_control *control, int channel, float *gain_db)
 {
-	snd_mixer_elem_t *elem;
-	snd_mixer_selem_id_t *sid;
-	char name[32];
-	long min, max, value;
+	struct apollo_config config;
 
 	if (channel < 1 || channel > 4 || !gain_db)
 		return -EINVAL;
 
-	/* Find mixer element */
-	snd_mixer_selem_id_alloca(&sid);
-	sprintf(name, "Analog %d Gain", channel);
-	snd_mixer_selem_id_set_name(sid, name);
-
-	elem = snd_mixer_find_selem(control->mixer, sid);
-	if (!elem)
-		return -ENOENT;
-
-	/* Get volume range */
-	snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
-
-	/* Get current volume */
-	snd_mixer_selem_get_playback_volume(elem, SND_MIXER_SCHN_FRONT_LEFT, &value);
-
-	/* Convert linear scale to dB (placeholder conversion) */
-	*gain_db = (float)(value - min) / (max - min) * 65.0f;
+	snapshot_read(control, &config);
+	*gain_db = config.analog_gain[channel - 1];
 
 	return 0;
 }
@@ -284,29 +1377,240 @@ int apollo_control_get_input_source(struct apollo_control *control, int channel,
 	return -ENOSYS;
 }
 
-/* Process control events */
-int apollo_control_process_events(struct apollo_control *control)
+/* Get the whole device state */
+int apollo_control_get_config(struct apollo_control *control, struct apollo_config *config)
+{
+	if (!config)
+		return -EINVAL;
+
+	snapshot_read(control, config);
+	return 0;
+}
+
+/* Set analog gain without waiting; the callback gets the applied value */
+int64_t apollo_control_set_analog_gain_async(struct apollo_control *control, int channel,
+					     float gain_db, apollo_control_cb cb, void *data)
+{
+	struct apollo_request *req;
+
+	if (channel < 1 || channel > 4)
+		return -EINVAL;
+
+	/* Clamp gain to valid range */
+	if (gain_db < 0.0f)
+		gain_db = 0.0f;
+	else if (gain_db > APOLLO_MAX_GAIN_DB)
+		gain_db = APOLLO_MAX_GAIN_DB;
+
+	req = request_get(control);
+	if (!req)
+		return -EAGAIN;
+
+	return submit_async(control, req, APOLLO_REQ_SET_ANALOG_GAIN, channel, gain_db, cb, data);
+}
+
+/* Read analog gain from the mixer without waiting */
+int64_t apollo_control_get_analog_gain_async(struct apollo_control *control, int channel,
+					     apollo_control_cb cb, void *data)
 {
-	int count;
+	struct apollo_request *req;
 
-	/* Handle any pending mixer events */
-	count = snd_mixer_poll_descriptors_count(control->mixer);
-	if (count > 0) {
-		struct pollfd *fds;
-		int i;
+	if (channel < 1 || channel > 4)
+		return -EINVAL;
+
+	req = request_get(control);
+	if (!req)
+		return -EAGAIN;
+
+	return submit_async(control, req, APOLLO_REQ_GET_ANALOG_GAIN, channel, 0.0f, cb, data);
+}
+
+/* Apply several fields as one update without waiting */
+int64_t apollo_control_apply_config_async(struct apollo_control *control,
+					  const struct apollo_config *config, uint64_t fields,
+					  apollo_control_cb cb, void *data)
+{
+	struct apollo_request *req;
 
-		fds = calloc(count, sizeof(*fds));
-		if (!fds)
-			return -ENOMEM;
+	if (!config || (fields & ~(APOLLO_FIELD_BIT(APOLLO_FIELD_COUNT) - 1)))
+		return -EINVAL;
+
+	req = request_get(control);
+	if (!req)
+		return -EAGAIN;
+
+	req->config = *config;
+	req->fields = fields;
+	return submit_async(control, req, APOLLO_REQ_APPLY_CONFIG, 0, 0.0f, cb, data);
+}
+
+/* Descriptors that become readable when completions are ready */
+int apollo_control_get_fds(struct apollo_control *control, struct pollfd *fds,
+			   unsigned int space)
+{
+	int fd[] = { control->done_fd, control->timer_fd };
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(fd) && i < space; i++) {
+		fds[i].fd = fd[i];
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+	return i;
+}
 
-		snd_mixer_poll_descriptors(control->mixer, fds, count);
+/* Fire timer_fd at deadline (CLOCK_MONOTONIC ns), or never for 0 */
+static void timer_arm(struct apollo_control *control, uint64_t deadline)
+{
+	struct itimerspec its = {
+		.it_value = {
+			.tv_sec = deadline / 1000000000ull,
+			.tv_nsec = deadline % 1000000000ull,
+		},
+	};
+
+	if (deadline == control->timer_ns)
+		return;
+	control->timer_ns = deadline;
+	timerfd_settime(control->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
 
-		/* In a real implementation, this would be integrated with */
-		/* the main event loop using poll() or epoll() */
+/*
+ * Report the fields that changed since each subscription last saw them,
+ * unless one was reported less than an interval ago; those are held
+ * back, with the timer set for the first to come due, and reported then
+ * with whatever value they have by that time.
+ */
+static int notify_subscribers(struct apollo_control *control)
+{
+	struct apollo_subscription *sub;
+	struct apollo_config config;
+	uint64_t now, due, next = 0;
+	unsigned int i, field;
+	float value;
+	int count = 0;
+
+	if (!control->nsubs) {
+		timer_arm(control, 0);
+		return 0;
+	}
 
-		free(fds);
+	/* Before the read: a snapshot published after it signals again */
+	__atomic_store_n(&control->watch, true, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	snapshot_read(control, &config);
+	now = now_ns();
+
+	for (i = 0; i < APOLLO_CONTROL_SUBSCRIPTIONS; i++) {
+		sub = &control->subs[i];
+
+		for (field = 0; field < APOLLO_FIELD_COUNT; field++) {
+			/* The callback may have unsubscribed */
+			if (!sub->cb)
+				break;
+			if (!(sub->fields & APOLLO_FIELD_BIT(field)))
+				continue;
+
+			value = apollo_config_get_field(&config, field);
+			if (value == apollo_config_get_field(&sub->reported, field))
+				continue;
+
+			due = sub->reported_ns[field] + sub->interval_ns;
+			if (now < due) {
+				if (!next || due < next)
+					next = due;
+				continue;
+			}
+
+			apollo_config_set_field(&sub->reported, field, value);
+			sub->reported_ns[field] = now;
+			sub->cb(control, field, value, sub->data);
+			count++;
+		}
 	}
 
+	/* watch stays set: only the fields held back wait for the timer */
+	timer_arm(control, next);
+	return count;
+}
+
+int apollo_control_subscribe(struct apollo_control *control, uint64_t fields,
+			     unsigned int interval_ms, apollo_control_change_cb cb, void *data)
+{
+	struct apollo_subscription *sub;
+	unsigned int i;
+
+	if (!cb || !fields || (fields >> APOLLO_FIELD_COUNT))
+		return -EINVAL;
+
+	for (i = 0; i < APOLLO_CONTROL_SUBSCRIPTIONS; i++)
+		if (!control->subs[i].cb)
+			break;
+	if (i == APOLLO_CONTROL_SUBSCRIPTIONS)
+		return -ENOSPC;
+
+	sub = &control->subs[i];
+	memset(sub, 0, sizeof(*sub));
+	sub->fields = fields;
+	sub->interval_ns = interval_ms * 1000000ull;
+	sub->data = data;
+	sub->cb = cb;
+
+	/* Changes from here on; the current state is the caller's to read */
+	snapshot_read(control, &sub->reported);
+	control->nsubs++;
+	__atomic_store_n(&control->watch, true, __ATOMIC_RELAXED);
+	return i + 1;
+}
+
+int apollo_control_unsubscribe(struct apollo_control *control, int id)
+{
+	if (id < 1 || id > APOLLO_CONTROL_SUBSCRIPTIONS || !control->subs[id - 1].cb)
+		return -EINVAL;
+
+	control->subs[id - 1].cb = NULL;
+	if (!--control->nsubs) {
+		__atomic_store_n(&control->watch, false, __ATOMIC_RELAXED);
+		timer_arm(control, 0);
+	}
 	return 0;
 }
 
+/* Run the callbacks of completed async requests and of subscriptions; never blocks */
+int apollo_control_dispatch(struct apollo_control *control)
+{
+	struct apollo_control_completion done;
+	struct apollo_request *req;
+	apollo_control_cb cb;
+	void *data;
+	int count = 0;
+
+	/* Reset first: anything completed after this signals again */
+	drain_fd(control->done_fd);
+	drain_fd(control->timer_fd);
+
+	while ((req = queue_pop(&control->completions))) {
+		done.id = req->id;
+		done.result = req->result;
+		done.channel = req->channel;
+		done.gain_db = req->value;
+		done.applied_ns = req->applied_ns;
+		cb = req->cb;
+		data = req->data;
+
+		/* Free first, so the callback can queue the next request */
+		request_free(req);
+		if (cb)
+			cb(control, &done, data);
+		count++;
+	}
+
+	return count + notify_subscribers(control);
+}
+
+/* Process control events */
+int apollo_control_process_events(struct apollo_control *control)
+{
+	return apollo_control_dispatch(control);
+}
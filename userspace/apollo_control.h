@@ -1,11 +1,25 @@
 // SPDX-License-Identifier: GPL-2.0-only
 /*
  * Apollo Control Library Header
+ *
+ * Threading: one handle may be shared by any number of threads. The
+ * getters copy from a published snapshot of the device state and never
+ * block or take a lock; the setters queue a request to the handle's I/O
+ * thread, which is the only thread touching the ALSA mixer, and wait for
+ * its result. See "Control Library Threading" in docs/HACKING.md.
+ *
+ * Real-time and UI threads should not wait for the I/O thread. They use the
+ * snapshot getters and the *_async calls, which return a request ID at
+ * once. Completions are delivered by apollo_control_dispatch(); poll the
+ * descriptors from apollo_control_get_fds() in the caller's own loop to
+ * know when to call it.
  */
 
 #ifndef _APOLLO_CONTROL_H
 #define _APOLLO_CONTROL_H
 
+#include <poll.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define APOLLO_MAX_CHANNELS 8
@@ -60,17 +74,94 @@ struct apollo_config {
 	float monitor_gain;
 };
 
+/*
+ * Every scalar of struct apollo_config by index, for partial updates such
+ * as network clients send: each array is a run of consecutive fields.
+ * APOLLO_FIELD_BIT() of the fields to change makes the mask for
+ * apollo_control_apply_config_async().
+ */
+enum apollo_config_field {
+	APOLLO_FIELD_ANALOG_GAIN = 0,
+	APOLLO_FIELD_OUTPUT_GAIN = APOLLO_FIELD_ANALOG_GAIN + 4,
+	APOLLO_FIELD_INPUT_SOURCE = APOLLO_FIELD_OUTPUT_GAIN + 2,
+	APOLLO_FIELD_PHANTOM_POWER = APOLLO_FIELD_INPUT_SOURCE + APOLLO_MAX_CHANNELS,
+	APOLLO_FIELD_HPF_ENABLED = APOLLO_FIELD_PHANTOM_POWER + 4,
+	APOLLO_FIELD_HPF_FREQ = APOLLO_FIELD_HPF_ENABLED + APOLLO_MAX_CHANNELS,
+	APOLLO_FIELD_PAD_ENABLED = APOLLO_FIELD_HPF_FREQ + APOLLO_MAX_CHANNELS,
+	APOLLO_FIELD_MONITOR_SOURCE = APOLLO_FIELD_PAD_ENABLED + 4,
+	APOLLO_FIELD_MONITOR_GAIN,
+	APOLLO_FIELD_COUNT,
+};
+
+#define APOLLO_FIELD_BIT(field)	(1ULL << (field))
+
 /* Control interface handle */
 struct apollo_control;
 
+/* Result of an async request */
+struct apollo_control_completion {
+	uint64_t id;		/* as returned when the request was queued */
+	int result;		/* 0 or a negative errno */
+	int channel;
+	float gain_db;		/* gain applied or read */
+	uint64_t applied_ns;	/* CLOCK_MONOTONIC when the I/O thread finished it */
+};
+
+/* Bucket i of a duration histogram counts durations up to 2^i us */
+#define APOLLO_STATS_BUCKETS	16
+
+/*
+ * Counters since apollo_control_init(). The I/O thread updates them with
+ * plain atomic stores and readers copy them without locking, so
+ * monitoring never slows the control path.
+ */
+struct apollo_control_stats {
+	uint64_t sets;			/* analog gain writes */
+	uint64_t gets;			/* mixer reads through the I/O thread */
+	uint64_t applies;		/* apollo_control_apply_config_async() */
+	uint64_t errors;		/* requests that failed */
+	uint64_t rejected;		/* async calls refused with -EAGAIN */
+	uint64_t batches;		/* I/O thread wakeups with requests */
+	uint64_t mixer_events;		/* changes made by other applications */
+	uint64_t apply_ns;		/* total time spent in sets and applies */
+	uint64_t apply_hist[APOLLO_STATS_BUCKETS];
+};
+
+typedef void (*apollo_control_cb)(struct apollo_control *control,
+				  const struct apollo_control_completion *done, void *data);
+
+/* A subscribed field (enum apollo_config_field) changed to value */
+typedef void (*apollo_control_change_cb)(struct apollo_control *control, unsigned int field,
+					 float value, void *data);
+
+#define APOLLO_CONTROL_SUBSCRIPTIONS	16	/* per handle */
+
+/* apollo_control_open() flags */
+#define APOLLO_CONTROL_LAZY	(1 << 0)	/* return at once, attach the card when it appears */
+#define APOLLO_CONTROL_SELEM	(1 << 1)	/* snd_mixer_selem instead of numid-addressed ctls */
+
 /* API Functions */
 struct apollo_control *apollo_control_init(void);
+struct apollo_control *apollo_control_open(unsigned int flags);
 void apollo_control_cleanup(struct apollo_control *control);
 
+/* Nonzero while the card is attached; lazy handles may not be yet */
+int apollo_control_attached(struct apollo_control *control);
+
 int apollo_control_load_config(struct apollo_control *control, struct apollo_config *config);
 int apollo_control_save_config(struct apollo_control *control, const struct apollo_config *config);
 void apollo_control_default_config(struct apollo_config *config);
 
+/* Parse a config file over config; keys missing from the file keep their value */
+int apollo_config_load_file(const char *path, struct apollo_config *config);
+
+/* Field access by enum apollo_config_field; integers are converted */
+float apollo_config_get_field(const struct apollo_config *config, unsigned int field);
+void apollo_config_set_field(struct apollo_config *config, unsigned int field, float value);
+
+/* The field's config file key, e.g. "analog_gain1"; -EINVAL if there is none */
+int apollo_config_field_name(unsigned int field, char *name, size_t size);
+
 int apollo_control_set_analog_gain(struct apollo_control *control, int channel, float gain_db);
 int apollo_control_get_analog_gain(struct apollo_control *control, int channel, float *gain_db);
 
@@ -82,7 +173,58 @@ int apollo_control_set_input_source(struct apollo_control *control, int channel,
 int apollo_control_get_input_source(struct apollo_control *control, int channel,
 				   enum apollo_input_source *source);
 
+/* Consistent copy of the whole device state, lock-free */
+int apollo_control_get_config(struct apollo_control *control, struct apollo_config *config);
+
+/* Copy of the counters; each is exact, though not all from the same instant */
+void apollo_control_get_stats(struct apollo_control *control, struct apollo_control_stats *stats);
+
+/*
+ * Async calls: queue the request and return its ID (> 0) without waiting,
+ * or -EAGAIN with too many requests in flight. cb runs from
+ * apollo_control_dispatch() and may be NULL.
+ */
+int64_t apollo_control_set_analog_gain_async(struct apollo_control *control, int channel,
+					     float gain_db, apollo_control_cb cb, void *data);
+int64_t apollo_control_get_analog_gain_async(struct apollo_control *control, int channel,
+					     apollo_control_cb cb, void *data);
+
+/*
+ * Apply the fields of config selected by the mask as one update: the I/O
+ * thread writes the ones that differ from the device and publishes a
+ * single snapshot. The result is the first error; fields the device
+ * cannot set yet fail with -ENOSYS when they differ.
+ */
+int64_t apollo_control_apply_config_async(struct apollo_control *control,
+					  const struct apollo_config *config, uint64_t fields,
+					  apollo_control_cb cb, void *data);
+
+/*
+ * Event loop integration: add the descriptors (POLLIN) to the caller's
+ * poll/epoll set and call apollo_control_dispatch() when one is readable.
+ * get_fds returns the number filled in, at most 2. dispatch runs the
+ * callbacks of completed requests and subscriptions and returns how many
+ * it ran; it never blocks, and must be called from one thread at a time.
+ */
+int apollo_control_get_fds(struct apollo_control *control, struct pollfd *fds,
+			   unsigned int space);
+int apollo_control_dispatch(struct apollo_control *control);
+
+/* Same as apollo_control_dispatch() */
 int apollo_control_process_events(struct apollo_control *control);
 
+/*
+ * Change subscriptions: cb runs from apollo_control_dispatch() when one of
+ * the fields (APOLLO_FIELD_BIT() mask) changes, by this handle or by any
+ * other application. Bursts are coalesced: a field is reported at most
+ * once per interval_ms, with its latest value, and a change held back is
+ * reported when its interval ends. subscribe returns an ID (> 0), or
+ * -ENOSPC with APOLLO_CONTROL_SUBSCRIPTIONS in use. Both calls belong to
+ * the thread that dispatches.
+ */
+int apollo_control_subscribe(struct apollo_control *control, uint64_t fields,
+			     unsigned int interval_ms, apollo_control_change_cb cb, void *data);
+int apollo_control_unsubscribe(struct apollo_control *control, int id);
+
 #endif /* _APOLLO_CONTROL_H */
 
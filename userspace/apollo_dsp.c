@@ -0,0 +1,190 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Software Input Processing
+ *
+ * Samples are converted to float a block at a time into a frame-major
+ * buffer of APOLLO_DSP_LANES floats per frame. The filter then runs one
+ * frame after another with all channels side by side, so each step of the
+ * biquad is one vector operation across the channels; the loops rely on
+ * the auto-vectorizer (this file is built with -O3). Coefficients are
+ * only computed in apollo_dsp_configure(), never per period.
+ *
+ * Filters are RBJ second-order Butterworth high-passes in transposed
+ * direct form II. A -300 dB offset on the input keeps the state away
+ * from denormals; the high-pass removes it again.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include "apollo_dsp.h"
+
+#define APOLLO_DSP_DENORMAL	1e-15f
+#define APOLLO_DSP_HPF_MIN	10.0
+
+static void set_copy(struct apollo_dsp *dsp, unsigned int c, double gain)
+{
+	dsp->b0[c] = gain;
+	dsp->b1[c] = 0.0f;
+	dsp->b2[c] = 0.0f;
+	dsp->a1[c] = 0.0f;
+	dsp->a2[c] = 0.0f;
+}
+
+static void set_hpf(struct apollo_dsp *dsp, unsigned int c, double freq, double gain)
+{
+	double w0, cosw, alpha, a0;
+
+	if (freq < APOLLO_DSP_HPF_MIN)
+		freq = APOLLO_DSP_HPF_MIN;
+	if (freq > dsp->rate * 0.45)
+		freq = dsp->rate * 0.45;
+
+	w0 = 2.0 * M_PI * freq / dsp->rate;
+	cosw = cos(w0);
+	alpha = sin(w0) / (2.0 * M_SQRT1_2);
+	a0 = 1.0 + alpha;
+
+	dsp->b0[c] = gain * (1.0 + cosw) / 2.0 / a0;
+	dsp->b1[c] = gain * -(1.0 + cosw) / a0;
+	dsp->b2[c] = gain * (1.0 + cosw) / 2.0 / a0;
+	dsp->a1[c] = -2.0 * cosw / a0;
+	dsp->a2[c] = (1.0 - alpha) / a0;
+}
+
+int apollo_dsp_init(struct apollo_dsp *dsp, unsigned int rate, unsigned int channels)
+{
+	unsigned int c;
+
+	if (!rate || !channels || channels > APOLLO_DSP_LANES)
+		return -EINVAL;
+
+	memset(dsp, 0, sizeof(*dsp));
+	dsp->rate = rate;
+	dsp->channels = channels;
+	for (c = 0; c < channels; c++)
+		set_copy(dsp, c, 1.0);
+	return 0;
+}
+
+void apollo_dsp_configure(struct apollo_dsp *dsp, const struct apollo_config *config,
+			  bool gain)
+{
+	unsigned int c;
+
+	dsp->active = false;
+	for (c = 0; c < dsp->channels; c++) {
+		int input = config->input_source[c] - APOLLO_INPUT_ANALOG1;
+		float db = 0.0f;
+		double lin;
+
+		if (input >= 0 && input < 4) {
+			if (config->pad_enabled[input])
+				db += APOLLO_DSP_PAD_DB;
+			if (gain)
+				db += config->analog_gain[input];
+		}
+		lin = pow(10.0, db / 20.0);
+
+		if (config->hpf_enabled[c])
+			set_hpf(dsp, c, config->hpf_freq[c], lin);
+		else
+			set_copy(dsp, c, lin);
+
+		if (config->hpf_enabled[c] || db != 0.0f)
+			dsp->active = true;
+	}
+}
+
+void apollo_dsp_take_coefficients(struct apollo_dsp *dsp, const struct apollo_dsp *from)
+{
+	memcpy(dsp->b0, from->b0, sizeof(dsp->b0));
+	memcpy(dsp->b1, from->b1, sizeof(dsp->b1));
+	memcpy(dsp->b2, from->b2, sizeof(dsp->b2));
+	memcpy(dsp->a1, from->a1, sizeof(dsp->a1));
+	memcpy(dsp->a2, from->a2, sizeof(dsp->a2));
+	dsp->active = from->active;
+}
+
+void apollo_dsp_reset(struct apollo_dsp *dsp)
+{
+	memset(dsp->z1, 0, sizeof(dsp->z1));
+	memset(dsp->z2, 0, sizeof(dsp->z2));
+}
+
+/* Filter the first frames of dsp->buf in place, all lanes at once */
+static void filter_block(struct apollo_dsp *dsp, unsigned int frames)
+{
+	float z1[APOLLO_DSP_LANES] __attribute__((aligned(32)));
+	float z2[APOLLO_DSP_LANES] __attribute__((aligned(32)));
+	unsigned int f, c;
+
+	memcpy(z1, dsp->z1, sizeof(z1));
+	memcpy(z2, dsp->z2, sizeof(z2));
+
+	for (f = 0; f < frames; f++) {
+		float *restrict v = dsp->buf[f];
+
+		for (c = 0; c < APOLLO_DSP_LANES; c++) {
+			float x = v[c] + APOLLO_DSP_DENORMAL;
+			float y = dsp->b0[c] * x + z1[c];
+
+			z1[c] = dsp->b1[c] * x - dsp->a1[c] * y + z2[c];
+			z2[c] = dsp->b2[c] * x - dsp->a2[c] * y;
+			v[c] = y;
+		}
+	}
+
+	memcpy(dsp->z1, z1, sizeof(z1));
+	memcpy(dsp->z2, z2, sizeof(z2));
+}
+
+/* Scale to the integer range and saturate; the bounds are exact floats */
+static inline float clip(float v, float max)
+{
+	return v < -max ? -max : v > max ? max : v;
+}
+
+void apollo_dsp_process_s32(struct apollo_dsp *dsp, int32_t *dst, const int32_t *src,
+			    unsigned int frames)
+{
+	const unsigned int ch = dsp->channels;
+	unsigned int n, f, c;
+
+	for (; frames; frames -= n, src += n * ch, dst += n * ch) {
+		n = frames < APOLLO_DSP_BLOCK ? frames : APOLLO_DSP_BLOCK;
+
+		for (f = 0; f < n; f++)
+			for (c = 0; c < ch; c++)
+				dsp->buf[f][c] = src[f * ch + c] * (1.0f / 2147483648.0f);
+
+		filter_block(dsp, n);
+
+		/* 2147483520 is the largest float below 2^31 */
+		for (f = 0; f < n; f++)
+			for (c = 0; c < ch; c++)
+				dst[f * ch + c] = (int32_t)clip(dsp->buf[f][c] * 2147483648.0f,
+								2147483520.0f);
+	}
+}
+
+void apollo_dsp_process_s16(struct apollo_dsp *dsp, int16_t *dst, const int16_t *src,
+			    unsigned int frames)
+{
+	const unsigned int ch = dsp->channels;
+	unsigned int n, f, c;
+
+	for (; frames; frames -= n, src += n * ch, dst += n * ch) {
+		n = frames < APOLLO_DSP_BLOCK ? frames : APOLLO_DSP_BLOCK;
+
+		for (f = 0; f < n; f++)
+			for (c = 0; c < ch; c++)
+				dsp->buf[f][c] = src[f * ch + c] * (1.0f / 32768.0f);
+
+		filter_block(dsp, n);
+
+		for (f = 0; f < n; f++)
+			for (c = 0; c < ch; c++)
+				dst[f * ch + c] = (int16_t)clip(dsp->buf[f][c] * 32768.0f, 32767.0f);
+	}
+}
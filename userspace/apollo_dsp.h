@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Software Input Processing
+ *
+ * Applies the high-pass filter, pad and gain settings of struct
+ * apollo_config to captured audio, for as long as the device's own
+ * controls for them are not understood. Used by the apollo_dsp ALSA
+ * plugin; no ALSA dependency of its own.
+ */
+
+#ifndef _APOLLO_DSP_H
+#define _APOLLO_DSP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "apollo_control.h"
+
+/* Channels are filtered side by side in this many SIMD lanes */
+#define APOLLO_DSP_LANES	8
+#define APOLLO_DSP_BLOCK	64	/* frames converted to float at a time */
+
+#define APOLLO_DSP_PAD_DB	-20.0f
+
+/*
+ * One biquad per channel with its gain folded into b0-b2. Lanes past the
+ * channel count have all-zero coefficients and stay silent.
+ */
+struct apollo_dsp {
+	float b0[APOLLO_DSP_LANES] __attribute__((aligned(32)));
+	float b1[APOLLO_DSP_LANES] __attribute__((aligned(32)));
+	float b2[APOLLO_DSP_LANES] __attribute__((aligned(32)));
+	float a1[APOLLO_DSP_LANES] __attribute__((aligned(32)));
+	float a2[APOLLO_DSP_LANES] __attribute__((aligned(32)));
+	float z1[APOLLO_DSP_LANES] __attribute__((aligned(32)));
+	float z2[APOLLO_DSP_LANES] __attribute__((aligned(32)));
+	float buf[APOLLO_DSP_BLOCK][APOLLO_DSP_LANES] __attribute__((aligned(32)));
+
+	unsigned int rate;
+	unsigned int channels;
+	bool active;			/* any channel not a plain copy */
+};
+
+/* Pass-through until configured; -EINVAL for more than APOLLO_DSP_LANES channels */
+int apollo_dsp_init(struct apollo_dsp *dsp, unsigned int rate, unsigned int channels);
+
+/*
+ * Recompute the coefficients from config, keeping the filter state so a
+ * change does not click. Capture channel c carries config->input_source[c];
+ * pad, and analog_gain when gain is set, follow that input.
+ */
+void apollo_dsp_configure(struct apollo_dsp *dsp, const struct apollo_config *config,
+			  bool gain);
+
+/*
+ * Take the coefficients of from, configured elsewhere for the same rate
+ * and channels, keeping the filter state of dsp. No allocation or I/O,
+ * so the audio thread can switch without computing them itself.
+ */
+void apollo_dsp_take_coefficients(struct apollo_dsp *dsp, const struct apollo_dsp *from);
+
+/* Clear the filter state, e.g. when the stream restarts */
+void apollo_dsp_reset(struct apollo_dsp *dsp);
+
+/* Interleaved frames; dst may equal src */
+void apollo_dsp_process_s32(struct apollo_dsp *dsp, int32_t *dst, const int32_t *src,
+			    unsigned int frames);
+void apollo_dsp_process_s16(struct apollo_dsp *dsp, int16_t *dst, const int16_t *src,
+			    unsigned int frames);
+
+#endif /* _APOLLO_DSP_H */
@@ -0,0 +1,354 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo DSP ALSA Plugin
+ *
+ * Capture filter plugin applying the HPF, pad and (optionally) gain
+ * settings of the Apollo config file in software:
+ *
+ *   pcm.apollo_dsp {
+ *       type apollo_dsp
+ *       slave.pcm "hw:Apollo"
+ *       config "/etc/apollo.conf"	# the default
+ *       gain false				# also apply analog_gain
+ *   }
+ *
+ * A helper thread checks the config file for changes four times a second
+ * with one stat(). When it changed, the thread parses it and computes the
+ * coefficients; the audio thread only copies them in at its next transfer,
+ * so no file I/O or parsing happens in the audio path.
+ * Gain is off by default because apollo_control already sends it to the
+ * device. Interleaved areas are filtered directly; other layouts, e.g.
+ * a non-interleaved client, go through a small bounce buffer.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_external.h>
+#include "apollo_dsp.h"
+
+#define ARRAY_SIZE(arr)		(sizeof(arr) / sizeof((arr)[0]))
+
+struct apollo_dsp_plugin {
+	snd_pcm_extplug_t ext;
+	char *config_path;
+	bool gain;
+
+	/* Owned by the watcher thread and plugin_init(), under lock */
+	pthread_mutex_t lock;
+	struct apollo_config config;
+	struct timespec mtime;		/* of the config file last loaded */
+	pthread_t watcher;
+	bool watching;
+	int stop_fd;			/* eventfd that ends the watcher */
+
+	struct apollo_dsp *dsp;		/* aligned for the vector loops */
+	struct apollo_dsp *next;	/* coefficients waiting for the audio thread */
+	int pending;			/* next is complete and not taken yet */
+
+	/* Interleaved bounce buffer for non-interleaved areas */
+	snd_pcm_channel_area_t bounce_areas[APOLLO_DSP_LANES];
+	int32_t bounce[APOLLO_DSP_BLOCK * APOLLO_DSP_LANES];
+};
+
+static void *area_addr(const snd_pcm_channel_area_t *area, snd_pcm_uframes_t offset)
+{
+	return (char *)area->addr + (area->first + area->step * offset) / 8;
+}
+
+/* Channel c of every frame right after channel c - 1, frames back to back */
+static bool areas_interleaved(const snd_pcm_channel_area_t *areas, unsigned int channels,
+			      unsigned int bits)
+{
+	unsigned int c;
+
+	if (areas[0].first % 8)
+		return false;
+	for (c = 0; c < channels; c++)
+		if (areas[c].addr != areas[0].addr ||
+		    areas[c].first != areas[0].first + c * bits ||
+		    areas[c].step != channels * bits)
+			return false;
+	return true;
+}
+
+static void plugin_process(struct apollo_dsp_plugin *plug, snd_pcm_format_t format,
+			   void *dst, const void *src, snd_pcm_uframes_t frames)
+{
+	if (format == SND_PCM_FORMAT_S32_LE)
+		apollo_dsp_process_s32(plug->dsp, dst, src, frames);
+	else
+		apollo_dsp_process_s16(plug->dsp, dst, src, frames);
+}
+
+/*
+ * Reload the config if the file changed since the last look, with lock
+ * held. Forced from plugin_init(), while no transfer runs, it configures
+ * the filters directly; otherwise it prepares next and hands it over. A
+ * change that arrives before the audio thread took the previous one is
+ * picked up on the following check.
+ */
+static void plugin_check_config(struct apollo_dsp_plugin *plug, bool force)
+{
+	struct stat st;
+
+	if (stat(plug->config_path, &st) < 0) {
+		if (force) {
+			apollo_control_default_config(&plug->config);
+			apollo_dsp_configure(plug->dsp, &plug->config, plug->gain);
+		}
+		return;
+	}
+
+	if (!force) {
+		if (!plug->next->channels ||
+		    __atomic_load_n(&plug->pending, __ATOMIC_ACQUIRE))
+			return;
+		if (st.st_mtim.tv_sec == plug->mtime.tv_sec &&
+		    st.st_mtim.tv_nsec == plug->mtime.tv_nsec)
+			return;
+	}
+
+	plug->mtime = st.st_mtim;
+	apollo_control_default_config(&plug->config);
+	if (apollo_config_load_file(plug->config_path, &plug->config) < 0)
+		SNDERR("apollo_dsp: cannot read %s", plug->config_path);
+
+	if (force) {
+		apollo_dsp_configure(plug->dsp, &plug->config, plug->gain);
+	} else {
+		apollo_dsp_configure(plug->next, &plug->config, plug->gain);
+		__atomic_store_n(&plug->pending, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void *plugin_watch(void *arg)
+{
+	struct apollo_dsp_plugin *plug = arg;
+	struct pollfd pfd = { .fd = plug->stop_fd, .events = POLLIN };
+	int ret;
+
+	/* Four times a second until plugin_close() signals stop_fd */
+	for (;;) {
+		ret = poll(&pfd, 1, 250);
+		if (ret > 0 || (ret < 0 && errno != EINTR))
+			break;
+		pthread_mutex_lock(&plug->lock);
+		plugin_check_config(plug, false);
+		pthread_mutex_unlock(&plug->lock);
+	}
+	return NULL;
+}
+
+static snd_pcm_sframes_t plugin_transfer(snd_pcm_extplug_t *ext,
+					 const snd_pcm_channel_area_t *dst_areas,
+					 snd_pcm_uframes_t dst_offset,
+					 const snd_pcm_channel_area_t *src_areas,
+					 snd_pcm_uframes_t src_offset,
+					 snd_pcm_uframes_t size)
+{
+	struct apollo_dsp_plugin *plug = ext->private_data;
+	unsigned int bits = snd_pcm_format_physical_width(ext->format);
+	snd_pcm_uframes_t done, n;
+
+	if (__atomic_load_n(&plug->pending, __ATOMIC_ACQUIRE)) {
+		apollo_dsp_take_coefficients(plug->dsp, plug->next);
+		__atomic_store_n(&plug->pending, 0, __ATOMIC_RELEASE);
+	}
+
+	if (!plug->dsp->active) {
+		snd_pcm_areas_copy(dst_areas, dst_offset, src_areas, src_offset,
+				   ext->channels, size, ext->format);
+		return size;
+	}
+
+	if (areas_interleaved(dst_areas, ext->channels, bits) &&
+	    areas_interleaved(src_areas, ext->channels, bits)) {
+		plugin_process(plug, ext->format, area_addr(dst_areas, dst_offset),
+			       area_addr(src_areas, src_offset), size);
+		return size;
+	}
+
+	/* Any other layout goes through the bounce buffer a block at a time */
+	for (done = 0; done < size; done += n) {
+		n = size - done < APOLLO_DSP_BLOCK ? size - done : APOLLO_DSP_BLOCK;
+		snd_pcm_areas_copy(plug->bounce_areas, 0, src_areas, src_offset + done,
+				   ext->channels, n, ext->format);
+		plugin_process(plug, ext->format, plug->bounce, plug->bounce, n);
+		snd_pcm_areas_copy(dst_areas, dst_offset + done, plug->bounce_areas, 0,
+				   ext->channels, n, ext->format);
+	}
+
+	return size;
+}
+
+/* hw_params are known: rebuild the filters for the new rate and channels */
+static int plugin_init(snd_pcm_extplug_t *ext)
+{
+	struct apollo_dsp_plugin *plug = ext->private_data;
+	unsigned int bits = snd_pcm_format_physical_width(ext->format);
+	unsigned int c;
+	int err;
+
+	for (c = 0; c < ext->channels && c < APOLLO_DSP_LANES; c++) {
+		plug->bounce_areas[c].addr = plug->bounce;
+		plug->bounce_areas[c].first = c * bits;
+		plug->bounce_areas[c].step = ext->channels * bits;
+	}
+
+	pthread_mutex_lock(&plug->lock);
+	if (plug->dsp->rate != ext->rate || plug->dsp->channels != ext->channels) {
+		err = apollo_dsp_init(plug->dsp, ext->rate, ext->channels);
+		if (err == 0)
+			err = apollo_dsp_init(plug->next, ext->rate, ext->channels);
+		if (err < 0) {
+			pthread_mutex_unlock(&plug->lock);
+			return err;
+		}
+		__atomic_store_n(&plug->pending, 0, __ATOMIC_RELAXED);
+		plugin_check_config(plug, true);
+	}
+	pthread_mutex_unlock(&plug->lock);
+
+	apollo_dsp_reset(plug->dsp);
+	return 0;
+}
+
+static void plugin_free(struct apollo_dsp_plugin *plug)
+{
+	if (plug->stop_fd >= 0)
+		close(plug->stop_fd);
+	pthread_mutex_destroy(&plug->lock);
+	free(plug->next);
+	free(plug->dsp);
+	free(plug->config_path);
+	free(plug);
+}
+
+static int plugin_close(snd_pcm_extplug_t *ext)
+{
+	struct apollo_dsp_plugin *plug = ext->private_data;
+
+	if (plug->watching) {
+		eventfd_write(plug->stop_fd, 1);
+		pthread_join(plug->watcher, NULL);
+	}
+	plugin_free(plug);
+	return 0;
+}
+
+static const snd_pcm_extplug_callback_t plugin_callback = {
+	.transfer = plugin_transfer,
+	.init = plugin_init,
+	.close = plugin_close,
+};
+
+SND_PCM_PLUGIN_DEFINE_FUNC(apollo_dsp)
+{
+	static const unsigned int formats[] = { SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S32_LE };
+	struct apollo_dsp_plugin *plug;
+	snd_config_iterator_t i, next;
+	snd_config_t *sconf = NULL;
+	const char *config_path = APOLLO_CONFIG_FILE;
+	int gain = 0;
+	int err;
+
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		const char *id;
+
+		if (snd_config_get_id(n, &id) < 0)
+			continue;
+		if (strcmp(id, "comment") == 0 || strcmp(id, "type") == 0 ||
+		    strcmp(id, "hint") == 0)
+			continue;
+		if (strcmp(id, "slave") == 0) {
+			sconf = n;
+			continue;
+		}
+		if (strcmp(id, "config") == 0) {
+			if (snd_config_get_string(n, &config_path) < 0) {
+				SNDERR("apollo_dsp: config must be a path");
+				return -EINVAL;
+			}
+			continue;
+		}
+		if (strcmp(id, "gain") == 0) {
+			gain = snd_config_get_bool(n);
+			if (gain < 0) {
+				SNDERR("apollo_dsp: gain must be a boolean");
+				return -EINVAL;
+			}
+			continue;
+		}
+		SNDERR("apollo_dsp: unknown field %s", id);
+		return -EINVAL;
+	}
+
+	if (!sconf) {
+		SNDERR("apollo_dsp: no slave defined");
+		return -EINVAL;
+	}
+	if (stream != SND_PCM_STREAM_CAPTURE) {
+		SNDERR("apollo_dsp: capture only");
+		return -EINVAL;
+	}
+
+	plug = calloc(1, sizeof(*plug));
+	if (!plug)
+		return -ENOMEM;
+
+	pthread_mutex_init(&plug->lock, NULL);
+	plug->config_path = strdup(config_path);
+	plug->gain = gain;
+	plug->stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (!plug->config_path || plug->stop_fd < 0 ||
+	    posix_memalign((void **)&plug->dsp, 32, sizeof(*plug->dsp)) != 0 ||
+	    posix_memalign((void **)&plug->next, 32, sizeof(*plug->next)) != 0) {
+		plugin_free(plug);
+		return -ENOMEM;
+	}
+	memset(plug->dsp, 0, sizeof(*plug->dsp));
+	memset(plug->next, 0, sizeof(*plug->next));
+
+	plug->ext.version = SND_PCM_EXTPLUG_VERSION;
+	plug->ext.name = "Apollo software HPF, pad and gain";
+	plug->ext.callback = &plugin_callback;
+	plug->ext.private_data = plug;
+
+	err = snd_pcm_extplug_create(&plug->ext, name, root, sconf, stream, mode);
+	if (err < 0) {
+		plugin_free(plug);
+		return err;
+	}
+
+	/* From here on plugin_close() frees everything */
+	err = -pthread_create(&plug->watcher, NULL, plugin_watch, plug);
+	if (err < 0) {
+		snd_pcm_extplug_delete(&plug->ext);
+		return err;
+	}
+	plug->watching = true;
+
+	/* Same format on both sides, converted in place through float */
+	snd_pcm_extplug_set_param_list(&plug->ext, SND_PCM_EXTPLUG_HW_FORMAT,
+				       ARRAY_SIZE(formats), formats);
+	snd_pcm_extplug_set_slave_param_list(&plug->ext, SND_PCM_EXTPLUG_HW_FORMAT,
+					     ARRAY_SIZE(formats), formats);
+	snd_pcm_extplug_set_param_link(&plug->ext, SND_PCM_EXTPLUG_HW_FORMAT, 1);
+	snd_pcm_extplug_set_param_minmax(&plug->ext, SND_PCM_EXTPLUG_HW_CHANNELS,
+					 1, APOLLO_DSP_LANES);
+	snd_pcm_extplug_set_param_link(&plug->ext, SND_PCM_EXTPLUG_HW_CHANNELS, 1);
+
+	*pcmp = plug->ext.pcm;
+	return 0;
+}
+
+SND_PCM_PLUGIN_SYMBOL(apollo_dsp);
@@ -0,0 +1,390 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Flight Recorder Reports
+ *
+ * Reads the driver's flight_recorder sysfs file (format in
+ * kernel/apollo_flight.h) and turns it into a text report: what froze the
+ * ring, the state of the card and of the daemon at collection time, then
+ * every event with its time before the freeze. The driver keeps the ring
+ * frozen until the report is written, so a burst of xruns costs one
+ * report, about the first of them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include "apollo_regs.h"
+#include "apollo_flight_report.h"
+#include "../kernel/apollo_flight.h"
+
+#define ARRAY_SIZE(arr)		(sizeof(arr) / sizeof((arr)[0]))
+
+#ifndef APOLLO_FLIGHT_SYSFS
+#define APOLLO_FLIGHT_SYSFS	"/sys/class/sound/card%d/device/flight_recorder"
+#endif
+
+/* Must match APOLLO_LATENCY_BUCKETS in the driver */
+#define APOLLO_LATENCY_BUCKETS	16
+
+/* What ALSA hands back for a position it cannot trust */
+#define APOLLO_FLIGHT_POS_XRUN	0xffffffffu
+
+static const char *const stream_names[] = { "playback", "capture" };
+
+static const char *const type_names[] = {
+	[APOLLO_FLIGHT_IRQ] = "irq",
+	[APOLLO_FLIGHT_PERIOD] = "period",
+	[APOLLO_FLIGHT_POINTER] = "pointer",
+	[APOLLO_FLIGHT_TRIGGER] = "trigger",
+	[APOLLO_FLIGHT_CONTROL] = "control",
+	[APOLLO_FLIGHT_PARAM] = "param",
+	[APOLLO_FLIGHT_XRUN] = "xrun",
+	[APOLLO_FLIGHT_ERROR] = "error",
+};
+
+/* SNDRV_PCM_TRIGGER_* */
+static const char *const trigger_names[] = {
+	"STOP", "START", NULL, "PAUSE_PUSH", "PAUSE_RELEASE", "SUSPEND", "RESUME", "DRAIN",
+};
+
+static const char *const param_names[] = {
+	[APOLLO_PARAM_MASTER_L] = "master_l",
+	[APOLLO_PARAM_MASTER_R] = "master_r",
+	[APOLLO_PARAM_MONITOR] = "monitor",
+};
+
+struct flight_snapshot {
+	struct apollo_flight_header hdr;
+	const uint8_t *events;		/* hdr.count of hdr.event_size bytes */
+};
+
+static const char *stream_name(unsigned int stream)
+{
+	return stream < ARRAY_SIZE(stream_names) ? stream_names[stream] : "?";
+}
+
+/* sysfs hands a binary attribute out a page at a time */
+static int read_file(int fd, uint8_t **data, size_t *len)
+{
+	size_t size = 16384, n = 0;
+	uint8_t *buf = malloc(size), *tmp;
+	ssize_t r;
+
+	if (!buf)
+		return -ENOMEM;
+
+	for (;;) {
+		if (n == size) {
+			tmp = realloc(buf, size * 2);
+			if (!tmp) {
+				free(buf);
+				return -ENOMEM;
+			}
+			buf = tmp;
+			size *= 2;
+		}
+
+		r = read(fd, buf + n, size - n);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0) {
+			r = -errno;
+			free(buf);
+			return r;
+		}
+		if (r == 0)
+			break;
+		n += r;
+	}
+
+	*data = buf;
+	*len = n;
+	return 0;
+}
+
+/* The header may grow, so its size is what is left before the events */
+static int parse_snapshot(struct flight_snapshot *snap, const uint8_t *data, size_t len)
+{
+	struct apollo_flight_header *hdr = &snap->hdr;
+	size_t events;
+
+	if (len < sizeof(*hdr))
+		return -EPROTO;
+	memcpy(hdr, data, sizeof(*hdr));
+
+	if (hdr->magic != APOLLO_FLIGHT_MAGIC ||
+	    hdr->event_size < sizeof(struct apollo_flight_event))
+		return -EPROTO;
+
+	events = (size_t)hdr->count * hdr->event_size;
+	if (events > len - sizeof(*hdr))
+		return -EPROTO;
+
+	snap->events = data + len - events;
+	return 0;
+}
+
+static int read_ctl(snd_ctl_t *ctl, const char *name, long *values, unsigned int count)
+{
+	snd_ctl_elem_value_t *val;
+	unsigned int i;
+	int err;
+
+	snd_ctl_elem_value_alloca(&val);
+	snd_ctl_elem_value_set_interface(val, SND_CTL_ELEM_IFACE_MIXER);
+	snd_ctl_elem_value_set_name(val, name);
+
+	err = snd_ctl_elem_read(ctl, val);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < count; i++)
+		values[i] = snd_ctl_elem_value_get_integer(val, i);
+	return 0;
+}
+
+static void report_header(FILE *fp, const struct apollo_flight_header *hdr)
+{
+	time_t sec = hdr->real_ns / 1000000000ull;
+	struct utsname uts;
+	struct tm tm;
+	char when[64];
+
+	localtime_r(&sec, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+	if (hdr->reason == APOLLO_FLIGHT_XRUN)
+		fprintf(fp, "Apollo flight recorder: xrun on %s\n\n", stream_name(hdr->stream));
+	else
+		fprintf(fp, "Apollo flight recorder: engine error\n\n");
+
+	fprintf(fp, "Time:    %s.%06u\n", when, (unsigned int)(hdr->real_ns % 1000000000ull / 1000));
+	if (uname(&uts) == 0)
+		fprintf(fp, "Kernel:  %s %s\n", uts.release, uts.machine);
+	if (hdr->stream >= 0)
+		fprintf(fp, "Stream:  %s, %u Hz, period %u, buffer %u frames\n",
+			stream_name(hdr->stream), hdr->rate, hdr->period_size, hdr->buffer_size);
+	fprintf(fp, "Events:  last %u of %u logged since armed (ring of %u)\n",
+		hdr->count, hdr->total, hdr->size);
+}
+
+/* The card as it is now, some milliseconds after the freeze */
+static void report_driver(FILE *fp, snd_ctl_t *ctl)
+{
+	long xruns[2], errors, locked, rate, losses, running[2];
+	long latency[2 * APOLLO_LATENCY_BUCKETS];
+	unsigned int dir, i;
+
+	fprintf(fp, "\nDriver:\n");
+	if (read_ctl(ctl, "Stream Running", running, 2) == 0)
+		fprintf(fp, "  running:  playback %ld, capture %ld\n", running[0], running[1]);
+	if (read_ctl(ctl, "Xrun Count", xruns, 2) == 0)
+		fprintf(fp, "  xruns:    playback %ld, capture %ld since load\n", xruns[0], xruns[1]);
+	if (read_ctl(ctl, "Engine Error Count", &errors, 1) == 0)
+		fprintf(fp, "  errors:   %ld since load\n", errors);
+	if (read_ctl(ctl, "Clock Lock Status", &locked, 1) == 0 &&
+	    read_ctl(ctl, "Clock Detected Rate", &rate, 1) == 0 &&
+	    read_ctl(ctl, "Clock Lock Losses", &losses, 1) == 0)
+		fprintf(fp, "  clock:    %s, %ld Hz, %ld lock losses\n",
+			locked ? "locked" : "not locked", rate, losses);
+
+	if (read_ctl(ctl, "IRQ Latency Histogram", latency, ARRAY_SIZE(latency)) < 0)
+		return;
+
+	/* Bucket i holds latencies up to 2^i us */
+	for (dir = 0; dir < 2; dir++) {
+		long total = 0;
+
+		fprintf(fp, "  irq latency %s:", stream_names[dir]);
+		for (i = 0; i < APOLLO_LATENCY_BUCKETS; i++) {
+			long n = latency[dir * APOLLO_LATENCY_BUCKETS + i];
+
+			total += n;
+			if (!n)
+				continue;
+			if (i == APOLLO_LATENCY_BUCKETS - 1)
+				fprintf(fp, " >%uus:%ld", 1u << (i - 1), n);
+			else
+				fprintf(fp, " <=%uus:%ld", 1u << i, n);
+		}
+		fprintf(fp, "%s\n", total ? "" : " none");
+	}
+}
+
+static void report_daemon(FILE *fp, struct apollo_control *control)
+{
+	struct apollo_control_stats stats;
+	struct apollo_config config;
+	int i;
+
+	apollo_control_get_stats(control, &stats);
+	fprintf(fp, "\nDaemon:\n");
+	fprintf(fp, "  requests: %" PRIu64 " set, %" PRIu64 " get, %" PRIu64 " apply, "
+		"%" PRIu64 " errors, %" PRIu64 " rejected\n",
+		stats.sets, stats.gets, stats.applies, stats.errors, stats.rejected);
+	/* apply_ns covers sets and applies only; gets never reach the device */
+	if (stats.sets + stats.applies)
+		fprintf(fp, "  apply:    %.1f us average\n",
+			stats.apply_ns / 1000.0 / (stats.sets + stats.applies));
+
+	if (apollo_control_get_config(control, &config) < 0)
+		return;
+
+	fprintf(fp, "  gain:    ");
+	for (i = 0; i < 4; i++)
+		fprintf(fp, " %.1f%s%s", config.analog_gain[i],
+			config.phantom_power[i] ? " +48V" : "", config.pad_enabled[i] ? " pad" : "");
+	fprintf(fp, " dB, outputs %.1f %.1f dB\n", config.output_gain[0], config.output_gain[1]);
+	fprintf(fp, "  monitor:  source %d, %.1f dB\n", config.monitor_source, config.monitor_gain);
+}
+
+static void report_event(FILE *fp, const struct apollo_flight_event *ev, uint64_t frozen_ns)
+{
+	double ms = ((int64_t)(ev->ns - frozen_ns)) / 1e6;
+	const char *name = ev->type < ARRAY_SIZE(type_names) && type_names[ev->type] ?
+			   type_names[ev->type] : "?";
+
+	fprintf(fp, "%14.6f  %-8s", ms, name);
+
+	switch (ev->type) {
+	case APOLLO_FLIGHT_IRQ:
+		fprintf(fp, "status=0x%08x%s%s%s%s", ev->value,
+			ev->value & APOLLO_STATUS_READY ? " ready" : "",
+			ev->value & APOLLO_STATUS_RUNNING ? " running" : "",
+			ev->value & APOLLO_STATUS_ERROR ? " error" : "",
+			ev->value & APOLLO_STATUS_CLOCK ? " clock" : "");
+		break;
+	case APOLLO_FLIGHT_PERIOD:
+		if (ev->value == APOLLO_FLIGHT_POS_XRUN)
+			fprintf(fp, "%s pos=invalid", stream_name(ev->stream));
+		else
+			fprintf(fp, "%s pos=%u crossed=%u", stream_name(ev->stream), ev->value,
+				ev->arg);
+		break;
+	case APOLLO_FLIGHT_POINTER:
+		fprintf(fp, "%s/%u pos=%u", stream_name(ev->stream), ev->arg, ev->value);
+		break;
+	case APOLLO_FLIGHT_TRIGGER:
+		if (ev->arg < ARRAY_SIZE(trigger_names) && trigger_names[ev->arg])
+			fprintf(fp, "%s/%u %s", stream_name(ev->stream), ev->value,
+				trigger_names[ev->arg]);
+		else
+			fprintf(fp, "%s/%u cmd=%u", stream_name(ev->stream), ev->value, ev->arg);
+		break;
+	case APOLLO_FLIGHT_CONTROL:
+		fprintf(fp, "cmd=0x%08x", ev->value);
+		break;
+	case APOLLO_FLIGHT_PARAM:
+		if (ev->arg < ARRAY_SIZE(param_names))
+			fprintf(fp, "%s=%u", param_names[ev->arg], ev->value);
+		else
+			fprintf(fp, "param%u=%u", ev->arg, ev->value);
+		break;
+	case APOLLO_FLIGHT_XRUN:
+		fprintf(fp, "%s hw_ptr=%u", stream_name(ev->stream), ev->value);
+		break;
+	default:
+		fprintf(fp, "stream=%u arg=%u value=0x%08x", ev->stream, ev->arg, ev->value);
+		break;
+	}
+	fprintf(fp, "\n");
+}
+
+static int write_report(const struct flight_snapshot *snap, snd_ctl_t *ctl,
+			struct apollo_control *control, const char *dir,
+			char *path, size_t path_len)
+{
+	const struct apollo_flight_header *hdr = &snap->hdr;
+	time_t sec = hdr->real_ns / 1000000000ull;
+	struct apollo_flight_event ev;
+	struct tm tm;
+	char stamp[32];
+	uint32_t i;
+	FILE *fp;
+	int fd;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+		return -errno;
+
+	/* Name after the time of the freeze; O_EXCL keeps an earlier one */
+	localtime_r(&sec, &tm);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+	snprintf(path, path_len, "%s/%s-%s-%03u.txt", dir,
+		 hdr->reason == APOLLO_FLIGHT_XRUN ? "xrun" : "error", stamp,
+		 (unsigned int)(hdr->real_ns % 1000000000ull / 1000000));
+
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		return -ENOMEM;
+	}
+
+	report_header(fp, hdr);
+	report_driver(fp, ctl);
+	if (control)
+		report_daemon(fp, control);
+
+	fprintf(fp, "\nEvents (ms relative to the freeze):\n");
+	for (i = 0; i < hdr->count; i++) {
+		memcpy(&ev, snap->events + (size_t)i * hdr->event_size, sizeof(ev));
+		report_event(fp, &ev, hdr->mono_ns);
+	}
+
+	if (fclose(fp) != 0)
+		return -errno;
+	return 0;
+}
+
+int apollo_flight_collect(snd_ctl_t *ctl, struct apollo_control *control, const char *dir,
+			  char *path, size_t path_len)
+{
+	struct flight_snapshot snap;
+	snd_ctl_card_info_t *info;
+	char sysfs[128];
+	uint8_t *data = NULL;
+	size_t len = 0;
+	int fd, err;
+
+	snd_ctl_card_info_alloca(&info);
+	err = snd_ctl_card_info(ctl, info);
+	if (err < 0)
+		return err;
+	snprintf(sysfs, sizeof(sysfs), APOLLO_FLIGHT_SYSFS, snd_ctl_card_info_get_card(info));
+
+	fd = open(sysfs, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	err = read_file(fd, &data, &len);
+	if (err < 0)
+		goto out;
+
+	/* Still armed: nothing to collect */
+	err = parse_snapshot(&snap, data, len);
+	if (err == 0 && !snap.hdr.reason)
+		goto out_free;
+	if (err == 0)
+		err = write_report(&snap, ctl, control, dir, path, path_len);
+
+	/* Re-arm even without a report, or nothing is recorded again */
+	if (pwrite(fd, "1", 1, 0) < 0 && err == 0)
+		err = -errno;
+	if (err == 0)
+		err = 1;
+out_free:
+	free(data);
+out:
+	close(fd);
+	return err;
+}
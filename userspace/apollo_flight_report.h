@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Flight Recorder Reports
+ *
+ * The driver freezes its event ring on the first xrun or engine error and
+ * raises the "Flight Recorder Frozen" control. apollod then collects the
+ * ring from sysfs, writes it out as a text report together with the
+ * device and daemon state, and re-arms the recorder.
+ */
+
+#ifndef _APOLLO_FLIGHT_REPORT_H
+#define _APOLLO_FLIGHT_REPORT_H
+
+#include <stddef.h>
+#include <alsa/asoundlib.h>
+#include "apollo_control.h"
+
+#define APOLLO_FLIGHT_DIR	"/var/log/apollo"
+
+/*
+ * Collect a frozen ring from the card behind ctl into a report in dir.
+ * Returns 1 with the report's path in path, 0 if nothing is frozen, or a
+ * negative errno; -ENOENT and -ENODEV mean the driver records nothing.
+ * control may be NULL.
+ */
+int apollo_flight_collect(snd_ctl_t *ctl, struct apollo_control *control, const char *dir,
+			  char *path, size_t path_len);
+
+#endif /* _APOLLO_FLIGHT_REPORT_H */
@@ -0,0 +1,556 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Metrics Endpoint
+ *
+ * A deliberately small HTTP/1.0 server: one request per connection, a
+ * handful of connections at a time, and every response built in one
+ * buffer and written at once. Everything it reports is a counter kept by
+ * someone else (the driver's controls, the control library's stats), so
+ * a scrape costs the control path nothing beyond relaxed loads.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "apollo_metrics.h"
+
+#define ARRAY_SIZE(arr)		(sizeof(arr) / sizeof((arr)[0]))
+
+#define APOLLO_METRICS_CLIENTS		4
+#define APOLLO_METRICS_REQUEST_SIZE	1024
+#define APOLLO_METRICS_TIMEOUT_NS	5000000000ull	/* to send the request */
+#define APOLLO_METRICS_RATE_NS		1000000000ull	/* ops/s averaging window */
+#define APOLLO_METRICS_OUT_SIZE		16384
+
+/* Must match APOLLO_LATENCY_BUCKETS in the driver */
+#define APOLLO_LATENCY_BUCKETS		16
+
+/* Must match the "Clock Drift" layout in apollo_drift.c */
+enum {
+	DRIFT_PPB,
+	DRIFT_TIME,
+	DRIFT_FRAME,
+	DRIFT_ERROR,
+	DRIFT_JITTER,
+	DRIFT_CONFIDENCE,
+	DRIFT_STREAM,
+	DRIFT_VALUES,
+};
+
+static const char *const stream_names[] = { "playback", "capture" };
+
+struct apollo_metrics_out {
+	char data[APOLLO_METRICS_OUT_SIZE];
+	size_t len;
+};
+
+struct apollo_metrics_client {
+	int fd;
+	size_t len;
+	uint64_t start_ns;
+	char request[APOLLO_METRICS_REQUEST_SIZE];
+};
+
+struct apollo_metrics {
+	struct apollo_control *control;
+	int sock;
+	struct apollo_metrics_client clients[APOLLO_METRICS_CLIENTS];
+
+	snd_ctl_t *ctl;
+	uint64_t attaches;
+	uint64_t detaches;
+	uint64_t scrapes;
+
+	/* Control requests per second over the last window */
+	uint64_t rate_start_ns;
+	uint64_t rate_start_ops;
+	double ops_per_second;
+
+	struct apollo_metrics_out out;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void out_printf(struct apollo_metrics_out *out, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/* Truncates silently; APOLLO_METRICS_OUT_SIZE leaves plenty of room */
+static void out_printf(struct apollo_metrics_out *out, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (out->len >= sizeof(out->data))
+		return;
+
+	va_start(ap, fmt);
+	n = vsnprintf(out->data + out->len, sizeof(out->data) - out->len, fmt, ap);
+	va_end(ap);
+
+	if (n > 0)
+		out->len += n;
+	if (out->len > sizeof(out->data))
+		out->len = sizeof(out->data);
+}
+
+static void out_header(struct apollo_metrics_out *out, const char *name, const char *type,
+		       const char *help)
+{
+	out_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Upper bound of bucket i, in seconds */
+static double bucket_bound(unsigned int i)
+{
+	return (double)(1ull << i) / 1e6;
+}
+
+/*
+ * Quantile estimated as the upper bound of the bucket it falls in. The
+ * last bucket is open, so its lower bound is reported instead.
+ */
+static double hist_quantile(const long *buckets, unsigned int n, double q)
+{
+	double total = 0, acc = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		total += buckets[i];
+	if (!total)
+		return 0;
+
+	for (i = 0; i < n - 1; i++) {
+		acc += buckets[i];
+		if (acc >= q * total)
+			return bucket_bound(i);
+	}
+	return bucket_bound(n - 2);
+}
+
+/* Buckets hold counts per bucket; Prometheus wants them cumulative */
+static void out_histogram(struct apollo_metrics_out *out, const char *name,
+			  const char *labels, const long *buckets, unsigned int n)
+{
+	const char *sep = *labels ? "," : "";
+	long acc = 0;
+	unsigned int i;
+
+	for (i = 0; i < n - 1; i++) {
+		acc += buckets[i];
+		out_printf(out, "%s_bucket{%s%sle=\"%g\"} %ld\n", name, labels, sep,
+			   bucket_bound(i), acc);
+	}
+	acc += buckets[n - 1];
+	out_printf(out, "%s_bucket{%s%sle=\"+Inf\"} %ld\n", name, labels, sep, acc);
+	if (*labels)
+		out_printf(out, "%s_count{%s} %ld\n", name, labels, acc);
+	else
+		out_printf(out, "%s_count %ld\n", name, acc);
+}
+
+/* Integer or boolean control of the card, by name */
+static int read_ctl(snd_ctl_t *ctl, const char *name, long *values, unsigned int count)
+{
+	snd_ctl_elem_value_t *val;
+	unsigned int i;
+	int err;
+
+	snd_ctl_elem_value_alloca(&val);
+	snd_ctl_elem_value_set_interface(val, SND_CTL_ELEM_IFACE_MIXER);
+	snd_ctl_elem_value_set_name(val, name);
+
+	err = snd_ctl_elem_read(ctl, val);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < count; i++)
+		values[i] = snd_ctl_elem_value_get_integer(val, i);
+	return 0;
+}
+
+static int read_ctl64(snd_ctl_t *ctl, const char *name, long long *values, unsigned int count)
+{
+	snd_ctl_elem_value_t *val;
+	unsigned int i;
+	int err;
+
+	snd_ctl_elem_value_alloca(&val);
+	snd_ctl_elem_value_set_interface(val, SND_CTL_ELEM_IFACE_MIXER);
+	snd_ctl_elem_value_set_name(val, name);
+
+	err = snd_ctl_elem_read(ctl, val);
+	if (err < 0)
+		return err;
+
+	for (i = 0; i < count; i++)
+		values[i] = snd_ctl_elem_value_get_integer64(val, i);
+	return 0;
+}
+
+/* Left out while no stream feeds the estimator */
+static void out_drift(struct apollo_metrics *metrics, struct apollo_metrics_out *out)
+{
+	long long drift[DRIFT_VALUES];
+
+	if (read_ctl64(metrics->ctl, "Clock Drift", drift, DRIFT_VALUES) < 0 ||
+	    drift[DRIFT_STREAM] < 0)
+		return;
+
+	out_header(out, "apollo_clock_drift_ppm", "gauge",
+		   "Sample clock rate against CLOCK_MONOTONIC, parts per million");
+	out_printf(out, "apollo_clock_drift_ppm %.3f\n", drift[DRIFT_PPB] / 1000.0);
+	out_header(out, "apollo_clock_drift_confidence", "gauge",
+		   "Confidence of the drift estimate, 0 to 1");
+	out_printf(out, "apollo_clock_drift_confidence %.3f\n", drift[DRIFT_CONFIDENCE] / 1000.0);
+	out_header(out, "apollo_clock_jitter_seconds", "gauge",
+		   "Average error of period boundaries against the drift estimate");
+	out_printf(out, "apollo_clock_jitter_seconds %g\n", drift[DRIFT_JITTER] / 1e9);
+}
+
+static void out_driver(struct apollo_metrics *metrics, struct apollo_metrics_out *out)
+{
+	long running[2], xruns[2], errors, latency[2 * APOLLO_LATENCY_BUCKETS];
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	char labels[64];
+	unsigned int dir, i;
+
+	out_header(out, "apollo_device_present", "gauge", "Whether the card is attached");
+	out_printf(out, "apollo_device_present %d\n", metrics->ctl != NULL);
+	out_header(out, "apollo_device_attach_total", "counter", "Card attach events seen");
+	out_printf(out, "apollo_device_attach_total %llu\n", (unsigned long long)metrics->attaches);
+	out_header(out, "apollo_device_detach_total", "counter", "Card detach events seen");
+	out_printf(out, "apollo_device_detach_total %llu\n", (unsigned long long)metrics->detaches);
+
+	/* A driver without the stats controls just leaves these out */
+	if (!metrics->ctl)
+		return;
+
+	if (read_ctl(metrics->ctl, "Stream Running", running, 2) == 0) {
+		out_header(out, "apollo_stream_running", "gauge", "Whether the stream is running");
+		for (dir = 0; dir < 2; dir++)
+			out_printf(out, "apollo_stream_running{stream=\"%s\"} %ld\n",
+				   stream_names[dir], running[dir]);
+	}
+
+	if (read_ctl(metrics->ctl, "Xrun Count", xruns, 2) == 0) {
+		out_header(out, "apollo_xruns_total", "counter", "Streams stopped by an xrun");
+		for (dir = 0; dir < 2; dir++)
+			out_printf(out, "apollo_xruns_total{stream=\"%s\"} %ld\n",
+				   stream_names[dir], xruns[dir]);
+	}
+
+	if (read_ctl(metrics->ctl, "Engine Error Count", &errors, 1) == 0) {
+		out_header(out, "apollo_engine_errors_total", "counter",
+			   "DMA engine errors reported by the device");
+		out_printf(out, "apollo_engine_errors_total %ld\n", errors);
+	}
+
+	out_drift(metrics, out);
+
+	if (read_ctl(metrics->ctl, "IRQ Latency Histogram", latency, ARRAY_SIZE(latency)) < 0)
+		return;
+
+	out_header(out, "apollo_irq_latency_seconds", "histogram",
+		   "Period interrupt latency, from the hardware position past the boundary");
+	for (dir = 0; dir < 2; dir++) {
+		snprintf(labels, sizeof(labels), "stream=\"%s\"", stream_names[dir]);
+		out_histogram(out, "apollo_irq_latency_seconds", labels,
+			      latency + dir * APOLLO_LATENCY_BUCKETS, APOLLO_LATENCY_BUCKETS);
+	}
+
+	out_header(out, "apollo_irq_latency_quantile_seconds", "gauge",
+		   "Period interrupt latency quantiles since load, bucket upper bounds");
+	for (dir = 0; dir < 2; dir++)
+		for (i = 0; i < ARRAY_SIZE(quantiles); i++)
+			out_printf(out, "apollo_irq_latency_quantile_seconds{stream=\"%s\",quantile=\"%g\"} %g\n",
+				   stream_names[dir], quantiles[i],
+				   hist_quantile(latency + dir * APOLLO_LATENCY_BUCKETS,
+						 APOLLO_LATENCY_BUCKETS, quantiles[i]));
+}
+
+static void out_control(struct apollo_metrics *metrics, struct apollo_metrics_out *out)
+{
+	struct apollo_control_stats stats;
+	long hist[APOLLO_STATS_BUCKETS];
+	unsigned int i;
+
+	apollo_control_get_stats(metrics->control, &stats);
+
+	out_header(out, "apollo_control_requests_total", "counter",
+		   "Requests applied by the control I/O thread");
+	out_printf(out, "apollo_control_requests_total{op=\"set\"} %llu\n",
+		   (unsigned long long)stats.sets);
+	out_printf(out, "apollo_control_requests_total{op=\"get\"} %llu\n",
+		   (unsigned long long)stats.gets);
+	out_printf(out, "apollo_control_requests_total{op=\"apply\"} %llu\n",
+		   (unsigned long long)stats.applies);
+
+	out_header(out, "apollo_control_ops_per_second", "gauge",
+		   "Control requests per second over the last second");
+	out_printf(out, "apollo_control_ops_per_second %.1f\n", metrics->ops_per_second);
+
+	out_header(out, "apollo_control_errors_total", "counter", "Control requests that failed");
+	out_printf(out, "apollo_control_errors_total %llu\n", (unsigned long long)stats.errors);
+	out_header(out, "apollo_control_rejected_total", "counter",
+		   "Async control calls refused with all requests in flight");
+	out_printf(out, "apollo_control_rejected_total %llu\n", (unsigned long long)stats.rejected);
+	out_header(out, "apollo_control_batches_total", "counter",
+		   "Control I/O thread wakeups with requests");
+	out_printf(out, "apollo_control_batches_total %llu\n", (unsigned long long)stats.batches);
+	out_header(out, "apollo_control_mixer_events_total", "counter",
+		   "Mixer changes made by other applications");
+	out_printf(out, "apollo_control_mixer_events_total %llu\n",
+		   (unsigned long long)stats.mixer_events);
+
+	for (i = 0; i < APOLLO_STATS_BUCKETS; i++)
+		hist[i] = stats.apply_hist[i];
+	out_header(out, "apollo_config_apply_seconds", "histogram",
+		   "Time to write a gain or a config update to the device");
+	out_histogram(out, "apollo_config_apply_seconds", "", hist, APOLLO_STATS_BUCKETS);
+	out_printf(out, "apollo_config_apply_seconds_sum %g\n", stats.apply_ns / 1e9);
+}
+
+static void respond(struct apollo_metrics *metrics, struct apollo_metrics_client *client)
+{
+	struct apollo_metrics_out *out = &metrics->out;
+	const char *status = "200 OK";
+	char header[256];
+	size_t hlen, off = 0;
+	ssize_t n;
+
+	out->len = 0;
+	if (strncmp(client->request, "GET ", 4) != 0) {
+		status = "405 Method Not Allowed";
+	} else if (strncmp(client->request + 4, "/metrics ", 9) != 0 &&
+		   strncmp(client->request + 4, "/ ", 2) != 0) {
+		status = "404 Not Found";
+	} else {
+		metrics->scrapes++;
+		out_driver(metrics, out);
+		out_control(metrics, out);
+		out_header(out, "apollo_metrics_scrapes_total", "counter", "Scrapes served");
+		out_printf(out, "apollo_metrics_scrapes_total %llu\n",
+			   (unsigned long long)metrics->scrapes);
+	}
+
+	hlen = snprintf(header, sizeof(header),
+			"HTTP/1.0 %s\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: close\r\n\r\n", status, out->len);
+
+	/* Fits the socket buffer of a fresh connection; a slow reader loses the rest */
+	if (send(client->fd, header, hlen, MSG_NOSIGNAL) != (ssize_t)hlen)
+		return;
+	while (off < out->len) {
+		n = send(client->fd, out->data + off, out->len - off, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		off += n;
+	}
+}
+
+static void client_close(struct apollo_metrics_client *client)
+{
+	close(client->fd);
+	client->fd = -1;
+}
+
+static void client_read(struct apollo_metrics *metrics, struct apollo_metrics_client *client)
+{
+	ssize_t n;
+
+	n = recv(client->fd, client->request + client->len,
+		 sizeof(client->request) - 1 - client->len, MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+		if (now_ns() - client->start_ns > APOLLO_METRICS_TIMEOUT_NS)
+			client_close(client);
+		return;
+	}
+	if (n <= 0) {
+		client_close(client);
+		return;
+	}
+
+	client->len += n;
+	client->request[client->len] = '\0';
+
+	/* Only the request line matters; answer once the headers are in */
+	if (strstr(client->request, "\r\n\r\n") || strstr(client->request, "\n\n") ||
+	    client->len == sizeof(client->request) - 1) {
+		respond(metrics, client);
+		client_close(client);
+	}
+}
+
+static void update_rate(struct apollo_metrics *metrics)
+{
+	struct apollo_control_stats stats;
+	uint64_t now = now_ns(), ops;
+
+	if (now - metrics->rate_start_ns < APOLLO_METRICS_RATE_NS)
+		return;
+
+	apollo_control_get_stats(metrics->control, &stats);
+	ops = stats.sets + stats.gets + stats.applies;
+	metrics->ops_per_second = (double)(ops - metrics->rate_start_ops) * 1e9 /
+				  (now - metrics->rate_start_ns);
+	metrics->rate_start_ns = now;
+	metrics->rate_start_ops = ops;
+}
+
+void apollo_metrics_handle(struct apollo_metrics *metrics)
+{
+	struct apollo_metrics_client *client;
+	unsigned int i;
+	int fd;
+
+	update_rate(metrics);
+
+	while ((fd = accept4(metrics->sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		client = NULL;
+		for (i = 0; i < APOLLO_METRICS_CLIENTS && !client; i++)
+			if (metrics->clients[i].fd < 0)
+				client = &metrics->clients[i];
+
+		if (!client) {
+			close(fd);
+			continue;
+		}
+
+		client->fd = fd;
+		client->len = 0;
+		client->start_ns = now_ns();
+	}
+
+	for (i = 0; i < APOLLO_METRICS_CLIENTS; i++)
+		if (metrics->clients[i].fd >= 0)
+			client_read(metrics, &metrics->clients[i]);
+}
+
+int apollo_metrics_get_fds(struct apollo_metrics *metrics, struct pollfd *fds,
+			   unsigned int space)
+{
+	unsigned int i, n = 0;
+
+	if (n < space) {
+		fds[n].fd = metrics->sock;
+		fds[n].events = POLLIN;
+		fds[n++].revents = 0;
+	}
+
+	for (i = 0; i < APOLLO_METRICS_CLIENTS && n < space; i++) {
+		if (metrics->clients[i].fd < 0)
+			continue;
+		fds[n].fd = metrics->clients[i].fd;
+		fds[n].events = POLLIN;
+		fds[n++].revents = 0;
+	}
+
+	return n;
+}
+
+void apollo_metrics_set_device(struct apollo_metrics *metrics, snd_ctl_t *ctl)
+{
+	if (ctl && !metrics->ctl)
+		metrics->attaches++;
+	else if (!ctl && metrics->ctl)
+		metrics->detaches++;
+	metrics->ctl = ctl;
+}
+
+struct apollo_metrics *apollo_metrics_open(struct apollo_control *control, const char *addr,
+					   unsigned short port)
+{
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+	};
+	int sock, one = 1;
+
+	if (!addr)
+		addr = APOLLO_METRICS_ADDR;
+	if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1) {
+		syslog(LOG_ERR, "Metrics: invalid address %s", addr);
+		return NULL;
+	}
+
+	sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return NULL;
+
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(sock, APOLLO_METRICS_CLIENTS) < 0) {
+		syslog(LOG_ERR, "Metrics: cannot listen on %s:%u: %s", addr, port,
+		       strerror(errno));
+		close(sock);
+		return NULL;
+	}
+
+	return apollo_metrics_open_fd(control, sock);
+}
+
+struct apollo_metrics *apollo_metrics_open_fd(struct apollo_control *control, int sock)
+{
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	socklen_t len = sizeof(sin);
+	struct apollo_metrics *metrics;
+	unsigned int i;
+
+	metrics = calloc(1, sizeof(*metrics));
+	if (!metrics) {
+		close(sock);
+		return NULL;
+	}
+
+	metrics->control = control;
+	metrics->sock = sock;
+	metrics->rate_start_ns = now_ns();
+	for (i = 0; i < APOLLO_METRICS_CLIENTS; i++)
+		metrics->clients[i].fd = -1;
+
+	/* Sockets passed in by systemd are blocking */
+	if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) < 0) {
+		close(sock);
+		free(metrics);
+		return NULL;
+	}
+
+	getsockname(sock, (struct sockaddr *)&sin, &len);
+	syslog(LOG_INFO, "Metrics: serving http://%s:%u/metrics", inet_ntoa(sin.sin_addr),
+	       ntohs(sin.sin_port));
+	return metrics;
+}
+
+void apollo_metrics_close(struct apollo_metrics *metrics)
+{
+	unsigned int i;
+
+	if (!metrics)
+		return;
+
+	for (i = 0; i < APOLLO_METRICS_CLIENTS; i++)
+		if (metrics->clients[i].fd >= 0)
+			close(metrics->clients[i].fd);
+	close(metrics->sock);
+	free(metrics);
+}
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Metrics Endpoint
+ *
+ * Serves Prometheus text format over HTTP on a local address: the
+ * driver's stream health controls, the control library counters and
+ * device attach/detach events. Scrapes only read counters, so they never
+ * wait on the control path. Driven from the caller's poll loop like
+ * apollo_osc.
+ */
+
+#ifndef _APOLLO_METRICS_H
+#define _APOLLO_METRICS_H
+
+#include <poll.h>
+#include <alsa/asoundlib.h>
+#include "apollo_control.h"
+
+#define APOLLO_METRICS_ADDR	"127.0.0.1"
+
+struct apollo_metrics;
+
+struct apollo_metrics *apollo_metrics_open(struct apollo_control *control, const char *addr,
+					   unsigned short port);
+/* On a listening TCP socket, such as one from systemd; takes sock */
+struct apollo_metrics *apollo_metrics_open_fd(struct apollo_control *control, int sock);
+void apollo_metrics_close(struct apollo_metrics *metrics);
+
+int apollo_metrics_get_fds(struct apollo_metrics *metrics, struct pollfd *fds,
+			   unsigned int space);
+void apollo_metrics_handle(struct apollo_metrics *metrics);
+
+/*
+ * Control handle of the card to read driver counters from, NULL while it
+ * is gone. Going from NULL to a handle counts as an attach, and back as
+ * a detach.
+ */
+void apollo_metrics_set_device(struct apollo_metrics *metrics, snd_ctl_t *ctl);
+
+#endif /* _APOLLO_METRICS_H */
@@ -0,0 +1,842 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo OSC Gateway
+ *
+ * A datagram is parsed completely before anything is applied, into a copy
+ * of the device state plus a mask of the fields it sets. The mask goes to
+ * the I/O thread as one apollo_control_apply_config_async() request, so a
+ * bundle costs one queue round trip and one snapshot however many
+ * messages it holds, and a later datagram can never be applied before an
+ * earlier one. /apollo/sync is answered from the completion, after the
+ * device write, which is what the latency benchmark measures.
+ *
+ * Pushes are paced by a timerfd: each tick compares the snapshot with the
+ * state last pushed and sends only the difference, so a fader moved by
+ * one client reaches the others at most once per interval however fast it
+ * moves.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <endian.h>
+#include <time.h>
+#include <syslog.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include "apollo_osc.h"
+
+#define ARRAY_SIZE(arr)		(sizeof(arr) / sizeof((arr)[0]))
+
+#define APOLLO_OSC_MAX_DEPTH	4	/* nested bundles */
+#define APOLLO_OSC_SUBSCRIBERS	16
+#define APOLLO_OSC_SUB_TIMEOUT	30	/* seconds without renewing /apollo/subscribe */
+#define APOLLO_OSC_PENDING	64	/* datagrams in flight to the I/O thread */
+#define APOLLO_OSC_SYNCS	4	/* /apollo/sync per datagram */
+#define APOLLO_OSC_RX_SIZE	65536
+#define APOLLO_OSC_NAME_SIZE	32
+
+/* Address patterns; %u is the 1-based channel */
+static const struct {
+	const char *pattern;
+	unsigned int field;
+	unsigned int count;
+} apollo_osc_params[] = {
+	{ "/apollo/analog/%u/gain",	APOLLO_FIELD_ANALOG_GAIN,	4 },
+	{ "/apollo/analog/%u/phantom",	APOLLO_FIELD_PHANTOM_POWER,	4 },
+	{ "/apollo/analog/%u/pad",	APOLLO_FIELD_PAD_ENABLED,	4 },
+	{ "/apollo/output/%u/gain",	APOLLO_FIELD_OUTPUT_GAIN,	2 },
+	{ "/apollo/input/%u/source",	APOLLO_FIELD_INPUT_SOURCE,	APOLLO_MAX_CHANNELS },
+	{ "/apollo/input/%u/hpf",	APOLLO_FIELD_HPF_ENABLED,	APOLLO_MAX_CHANNELS },
+	{ "/apollo/input/%u/hpf_freq",	APOLLO_FIELD_HPF_FREQ,		APOLLO_MAX_CHANNELS },
+	{ "/apollo/monitor/source",	APOLLO_FIELD_MONITOR_SOURCE,	1 },
+	{ "/apollo/monitor/gain",	APOLLO_FIELD_MONITOR_GAIN,	1 },
+};
+
+struct apollo_osc_subscriber {
+	struct sockaddr_in addr;
+	uint64_t seen_ns;
+};
+
+/* A datagram handed to the I/O thread, until its completion */
+struct apollo_osc_pending {
+	struct apollo_osc *osc;
+	struct sockaddr_in addr;
+	uint64_t recv_ns;
+	int32_t sync[APOLLO_OSC_SYNCS];
+	int nsync;
+	bool busy;
+};
+
+struct apollo_osc {
+	struct apollo_control *control;
+	int sock;
+	int timer_fd;
+	unsigned int push_ms;
+	char names[APOLLO_FIELD_COUNT][APOLLO_OSC_NAME_SIZE];
+
+	struct apollo_osc_subscriber subs[APOLLO_OSC_SUBSCRIBERS];
+	int nsubs;
+	struct apollo_config pushed;
+
+	struct apollo_osc_pending pending[APOLLO_OSC_PENDING];
+
+	/* Statistics, reported by /apollo/stats */
+	uint64_t packets;
+	uint64_t updates;
+	uint64_t dropped;
+	uint64_t malformed;
+	uint64_t latency_sum_ns;
+	uint64_t latency_max_ns;
+
+	uint8_t rx[APOLLO_OSC_RX_SIZE];
+};
+
+/* Parse state of one received datagram */
+struct apollo_osc_request {
+	struct apollo_osc *osc;
+	const struct sockaddr_in *addr;
+	struct apollo_config config;
+	uint64_t fields;
+	int32_t sync[APOLLO_OSC_SYNCS];
+	int nsync;
+	bool subscribed;
+	struct apollo_osc_buf reply;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return be32toh(v);
+}
+
+static uint64_t get_be64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return be64toh(v);
+}
+
+/* A NUL-terminated string padded to 4 bytes */
+static int osc_string(const uint8_t *p, size_t len, size_t *pos, const char **s)
+{
+	const uint8_t *nul = memchr(p + *pos, 0, len - *pos);
+	size_t end;
+
+	if (!nul)
+		return -EINVAL;
+
+	end = ((size_t)(nul - p) + 4) & ~(size_t)3;
+	if (end > len)
+		return -EINVAL;
+
+	*s = (const char *)p + *pos;
+	*pos = end;
+	return 0;
+}
+
+static int parse_message(const uint8_t *p, size_t len, apollo_osc_handler handler, void *ctx)
+{
+	struct apollo_osc_arg args[APOLLO_OSC_MAX_ARGS];
+	const char *address, *types = ",";
+	size_t pos = 0, size;
+	int nargs = 0;
+
+	if (osc_string(p, len, &pos, &address) || address[0] != '/')
+		return -EINVAL;
+
+	/* Very old senders omit the type tags when there are no arguments */
+	if (pos < len && (osc_string(p, len, &pos, &types) || types[0] != ','))
+		return -EINVAL;
+
+	for (types++; *types; types++) {
+		struct apollo_osc_arg arg = { .type = *types };
+		uint32_t bits;
+
+		switch (*types) {
+		case 'i':
+		case 'f':
+			if (len - pos < 4)
+				return -EINVAL;
+			bits = get_be32(p + pos);
+			arg.i = (int32_t)bits;
+			memcpy(&arg.f, &bits, sizeof(arg.f));
+			pos += 4;
+			break;
+		case 'h':
+		case 'd':
+		case 't':
+			if (len - pos < 8)
+				return -EINVAL;
+			arg.h = (int64_t)get_be64(p + pos);
+			memcpy(&arg.d, &arg.h, sizeof(arg.d));
+			pos += 8;
+			break;
+		case 's':
+		case 'S':
+			if (osc_string(p, len, &pos, &arg.s))
+				return -EINVAL;
+			break;
+		case 'b':
+			if (len - pos < 4)
+				return -EINVAL;
+			size = ((size_t)get_be32(p + pos) + 3) & ~(size_t)3;
+			pos += 4;
+			if (size > len - pos)
+				return -EINVAL;
+			pos += size;
+			break;
+		case 'T':
+		case 'F':
+		case 'N':
+		case 'I':
+			break;
+		default:
+			return -EINVAL;
+		}
+
+		/* Nothing we handle takes more; the rest is checked, not kept */
+		if (nargs < APOLLO_OSC_MAX_ARGS)
+			args[nargs++] = arg;
+	}
+
+	if (handler)
+		handler(ctx, address, args, nargs);
+	return 0;
+}
+
+static int parse_packet(const uint8_t *p, size_t len, int depth,
+			apollo_osc_handler handler, void *ctx)
+{
+	size_t pos, size;
+	int err;
+
+	if (!len || len % 4)
+		return -EINVAL;
+
+	if (len < 8 || memcmp(p, "#bundle", 8) != 0)
+		return parse_message(p, len, handler, ctx);
+
+	/* Timetags are ignored: everything is applied on arrival */
+	if (depth >= APOLLO_OSC_MAX_DEPTH || len < 16)
+		return -EINVAL;
+
+	for (pos = 16; pos < len; pos += size) {
+		if (len - pos < 4)
+			return -EINVAL;
+		size = get_be32(p + pos);
+		pos += 4;
+		if (size > len - pos)
+			return -EINVAL;
+
+		err = parse_packet(p + pos, size, depth + 1, handler, ctx);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+int apollo_osc_parse(const void *data, size_t len, apollo_osc_handler handler, void *ctx)
+{
+	int err;
+
+	/* Validate first, so a bad bundle is dropped whole */
+	err = parse_packet(data, len, 0, NULL, NULL);
+	if (err)
+		return err;
+
+	return parse_packet(data, len, 0, handler, ctx);
+}
+
+int apollo_osc_arg_float(const struct apollo_osc_arg *arg, float *value)
+{
+	switch (arg->type) {
+	case 'i':
+		*value = arg->i;
+		break;
+	case 'f':
+		*value = arg->f;
+		break;
+	case 'h':
+		*value = arg->h;
+		break;
+	case 'd':
+		*value = arg->d;
+		break;
+	case 'T':
+		*value = 1.0f;
+		break;
+	case 'F':
+		*value = 0.0f;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return isfinite(*value) ? 0 : -EINVAL;
+}
+
+static int put_bytes(struct apollo_osc_buf *buf, size_t *pos, const void *src, size_t n)
+{
+	if (n > sizeof(buf->data) - *pos)
+		return -ENOSPC;
+	memcpy(buf->data + *pos, src, n);
+	*pos += n;
+	return 0;
+}
+
+static int put_be32(struct apollo_osc_buf *buf, size_t *pos, uint32_t v)
+{
+	v = htobe32(v);
+	return put_bytes(buf, pos, &v, sizeof(v));
+}
+
+static int put_be64(struct apollo_osc_buf *buf, size_t *pos, uint64_t v)
+{
+	v = htobe64(v);
+	return put_bytes(buf, pos, &v, sizeof(v));
+}
+
+static int put_string(struct apollo_osc_buf *buf, size_t *pos, const char *s)
+{
+	static const uint8_t zeros[4];
+	size_t n = strlen(s);
+
+	if (put_bytes(buf, pos, s, n))
+		return -ENOSPC;
+	return put_bytes(buf, pos, zeros, 4 - n % 4);
+}
+
+void apollo_osc_buf_init(struct apollo_osc_buf *buf, int bundle)
+{
+	size_t pos = 0;
+
+	buf->len = 0;
+	buf->bundle = bundle;
+	if (bundle) {
+		put_bytes(buf, &pos, "#bundle", 8);
+		put_be64(buf, &pos, 1);
+		buf->len = pos;
+	}
+}
+
+int apollo_osc_buf_message(struct apollo_osc_buf *buf, const char *address,
+			   const char *types, ...)
+{
+	char tags[APOLLO_OSC_MAX_ARGS + 2] = ",";
+	size_t start = buf->len, pos = start;
+	va_list ap;
+	uint32_t bits;
+	uint64_t bits64;
+	float f;
+	double d;
+	int err = 0;
+
+	if ((!buf->bundle && buf->len) || strlen(types) > APOLLO_OSC_MAX_ARGS)
+		return -EINVAL;
+	strcat(tags, types);
+
+	/* Element size, filled in below */
+	if (buf->bundle)
+		err = put_be32(buf, &pos, 0);
+	if (!err)
+		err = put_string(buf, &pos, address);
+	if (!err)
+		err = put_string(buf, &pos, tags);
+
+	va_start(ap, types);
+	for (; !err && *types; types++) {
+		switch (*types) {
+		case 'i':
+			err = put_be32(buf, &pos, (uint32_t)va_arg(ap, int));
+			break;
+		case 'f':
+			f = (float)va_arg(ap, double);
+			memcpy(&bits, &f, sizeof(bits));
+			err = put_be32(buf, &pos, bits);
+			break;
+		case 'h':
+			err = put_be64(buf, &pos, (uint64_t)va_arg(ap, int64_t));
+			break;
+		case 'd':
+			d = va_arg(ap, double);
+			memcpy(&bits64, &d, sizeof(bits64));
+			err = put_be64(buf, &pos, bits64);
+			break;
+		case 's':
+			err = put_string(buf, &pos, va_arg(ap, const char *));
+			break;
+		case 'T':
+		case 'F':
+		case 'N':
+			break;
+		default:
+			err = -EINVAL;
+		}
+	}
+	va_end(ap);
+
+	if (err)
+		return err;
+
+	if (buf->bundle) {
+		bits = htobe32(pos - start - 4);
+		memcpy(buf->data + start, &bits, sizeof(bits));
+	}
+	buf->len = pos;
+	return 0;
+}
+
+static bool field_is_float(unsigned int field)
+{
+	return field < APOLLO_FIELD_INPUT_SOURCE ||
+	       (field >= APOLLO_FIELD_HPF_FREQ && field < APOLLO_FIELD_PAD_ENABLED) ||
+	       field == APOLLO_FIELD_MONITOR_GAIN;
+}
+
+static bool field_valid(unsigned int field, float value)
+{
+	if (field >= APOLLO_FIELD_INPUT_SOURCE && field < APOLLO_FIELD_PHANTOM_POWER)
+		return value >= APOLLO_INPUT_ANALOG1 && value <= APOLLO_INPUT_DIGITAL2;
+	if (field == APOLLO_FIELD_MONITOR_SOURCE)
+		return value >= APOLLO_MONITOR_MAIN && value <= APOLLO_MONITOR_CUE;
+	return true;
+}
+
+static int field_lookup(struct apollo_osc *osc, const char *address)
+{
+	int i;
+
+	for (i = 0; i < APOLLO_FIELD_COUNT; i++)
+		if (strcmp(osc->names[i], address) == 0)
+			return i;
+	return -1;
+}
+
+static int put_field(struct apollo_osc *osc, struct apollo_osc_buf *buf,
+		     const struct apollo_config *config, unsigned int field)
+{
+	float value = apollo_config_get_field(config, field);
+
+	if (field_is_float(field))
+		return apollo_osc_buf_message(buf, osc->names[field], "f", (double)value);
+	return apollo_osc_buf_message(buf, osc->names[field], "i", (int)value);
+}
+
+static void send_buf(struct apollo_osc *osc, const struct apollo_osc_buf *buf,
+		     const struct sockaddr_in *addr)
+{
+	/* Best effort, like everything on UDP */
+	if (sendto(osc->sock, buf->data, buf->len, MSG_DONTWAIT,
+		   (const struct sockaddr *)addr, sizeof(*addr)) < 0)
+		osc->dropped++;
+}
+
+/*
+ * Encode the fields of config that differ from base (all of them without
+ * base) as bundles, starting a new one whenever a packet is full.
+ */
+static int encode_state(struct apollo_osc *osc, const struct apollo_config *config,
+			const struct apollo_config *base, struct apollo_osc_buf *bufs, int max)
+{
+	unsigned int i;
+	int n = 0;
+
+	apollo_osc_buf_init(&bufs[0], 1);
+	for (i = 0; i < APOLLO_FIELD_COUNT; i++) {
+		if (base && apollo_config_get_field(config, i) == apollo_config_get_field(base, i))
+			continue;
+
+		if (put_field(osc, &bufs[n], config, i) == 0)
+			continue;
+		if (n + 1 == max)
+			break;
+		apollo_osc_buf_init(&bufs[++n], 1);
+		put_field(osc, &bufs[n], config, i);
+	}
+
+	/* An empty bundle is just the header */
+	return bufs[n].len > 16 ? n + 1 : n;
+}
+
+#define APOLLO_OSC_STATE_PACKETS	4
+
+static void send_state(struct apollo_osc *osc, const struct sockaddr_in *addr)
+{
+	struct apollo_osc_buf bufs[APOLLO_OSC_STATE_PACKETS];
+	struct apollo_config config;
+	int i, n;
+
+	apollo_control_get_config(osc->control, &config);
+	n = encode_state(osc, &config, NULL, bufs, APOLLO_OSC_STATE_PACKETS);
+	for (i = 0; i < n; i++)
+		send_buf(osc, &bufs[i], addr);
+}
+
+static void timer_arm(struct apollo_osc *osc, unsigned int ms)
+{
+	struct itimerspec its = {
+		.it_interval = { ms / 1000, (ms % 1000) * 1000000L },
+		.it_value = { ms / 1000, (ms % 1000) * 1000000L },
+	};
+
+	timerfd_settime(osc->timer_fd, 0, &its, NULL);
+}
+
+static bool same_peer(const struct sockaddr_in *a, const struct sockaddr_in *b)
+{
+	return a->sin_addr.s_addr == b->sin_addr.s_addr && a->sin_port == b->sin_port;
+}
+
+/* Returns true for a new subscriber, which still needs the full state */
+static bool subscribe(struct apollo_osc *osc, const struct sockaddr_in *addr)
+{
+	int i;
+
+	for (i = 0; i < osc->nsubs; i++) {
+		if (same_peer(&osc->subs[i].addr, addr)) {
+			osc->subs[i].seen_ns = now_ns();
+			return false;
+		}
+	}
+
+	if (osc->nsubs == APOLLO_OSC_SUBSCRIBERS) {
+		syslog(LOG_WARNING, "OSC: subscriber limit reached, ignoring %s:%u",
+		       inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+		return false;
+	}
+
+	/* The first one starts the push timer from the current state */
+	if (!osc->nsubs) {
+		apollo_control_get_config(osc->control, &osc->pushed);
+		timer_arm(osc, osc->push_ms);
+	}
+
+	osc->subs[osc->nsubs].addr = *addr;
+	osc->subs[osc->nsubs].seen_ns = now_ns();
+	osc->nsubs++;
+	return true;
+}
+
+static void unsubscribe_at(struct apollo_osc *osc, int i)
+{
+	osc->subs[i] = osc->subs[--osc->nsubs];
+	if (!osc->nsubs)
+		timer_arm(osc, 0);
+}
+
+static void unsubscribe(struct apollo_osc *osc, const struct sockaddr_in *addr)
+{
+	int i;
+
+	for (i = 0; i < osc->nsubs; i++) {
+		if (same_peer(&osc->subs[i].addr, addr)) {
+			unsubscribe_at(osc, i);
+			return;
+		}
+	}
+}
+
+static void put_stats(struct apollo_osc *osc, struct apollo_osc_buf *buf)
+{
+	uint64_t avg = osc->updates ? osc->latency_sum_ns / osc->updates : 0;
+
+	apollo_osc_buf_message(buf, "/apollo/stats", "hhhhiii",
+			       (int64_t)osc->packets, (int64_t)osc->updates,
+			       (int64_t)osc->dropped, (int64_t)osc->malformed,
+			       (int)(avg / 1000), (int)(osc->latency_max_ns / 1000), osc->nsubs);
+}
+
+static void on_message(void *ctx, const char *address, const struct apollo_osc_arg *args,
+		       int nargs)
+{
+	struct apollo_osc_request *req = ctx;
+	struct apollo_osc *osc = req->osc;
+	float value;
+	int field;
+
+	field = field_lookup(osc, address);
+	if (field >= 0) {
+		/* No argument: a query, answered with the current value */
+		if (!nargs) {
+			put_field(osc, &req->reply, &req->config, field);
+			return;
+		}
+		if (apollo_osc_arg_float(&args[0], &value) || !field_valid(field, value)) {
+			osc->malformed++;
+			return;
+		}
+		apollo_config_set_field(&req->config, field, value);
+		req->fields |= APOLLO_FIELD_BIT(field);
+		return;
+	}
+
+	if (strcmp(address, "/apollo/sync") == 0) {
+		if (nargs && args[0].type == 'i' && req->nsync < APOLLO_OSC_SYNCS)
+			req->sync[req->nsync++] = args[0].i;
+	} else if (strcmp(address, "/apollo/subscribe") == 0) {
+		req->subscribed |= subscribe(osc, req->addr);
+	} else if (strcmp(address, "/apollo/unsubscribe") == 0) {
+		unsubscribe(osc, req->addr);
+	} else if (strcmp(address, "/apollo/stats") == 0) {
+		put_stats(osc, &req->reply);
+	}
+	/* Anything else is not for us; OSC ignores unknown addresses */
+}
+
+/* Completion of a datagram's update, from apollo_control_dispatch() */
+static void on_applied(struct apollo_control *control,
+		       const struct apollo_control_completion *done, void *data)
+{
+	struct apollo_osc_pending *pending = data;
+	struct apollo_osc *osc = pending->osc;
+	uint64_t latency = done->applied_ns - pending->recv_ns;
+	struct apollo_osc_buf buf;
+	int i;
+
+	(void)control;
+
+	osc->updates++;
+	osc->latency_sum_ns += latency;
+	if (latency > osc->latency_max_ns)
+		osc->latency_max_ns = latency;
+
+	if (done->result < 0)
+		syslog(LOG_DEBUG, "OSC: update from %s:%u partly failed: %s",
+		       inet_ntoa(pending->addr.sin_addr), ntohs(pending->addr.sin_port),
+		       strerror(-done->result));
+
+	apollo_osc_buf_init(&buf, 1);
+	for (i = 0; i < pending->nsync; i++)
+		apollo_osc_buf_message(&buf, "/apollo/synced", "iii", pending->sync[i],
+				       (int)(latency / 1000), done->result);
+	if (pending->nsync)
+		send_buf(osc, &buf, &pending->addr);
+
+	pending->busy = false;
+}
+
+static struct apollo_osc_pending *pending_alloc(struct apollo_osc *osc)
+{
+	int i;
+
+	for (i = 0; i < APOLLO_OSC_PENDING; i++) {
+		if (!osc->pending[i].busy) {
+			osc->pending[i].busy = true;
+			return &osc->pending[i];
+		}
+	}
+	return NULL;
+}
+
+static void handle_datagram(struct apollo_osc *osc, size_t len,
+			    const struct sockaddr_in *addr, uint64_t recv_ns)
+{
+	struct apollo_osc_request req = {
+		.osc = osc,
+		.addr = addr,
+	};
+	struct apollo_osc_pending *pending;
+	int64_t id;
+
+	osc->packets++;
+	apollo_control_get_config(osc->control, &req.config);
+	apollo_osc_buf_init(&req.reply, 1);
+
+	if (apollo_osc_parse(osc->rx, len, on_message, &req) < 0) {
+		osc->malformed++;
+		return;
+	}
+
+	if (req.reply.len > 16)
+		send_buf(osc, &req.reply, addr);
+	if (req.subscribed)
+		send_state(osc, addr);
+
+	/* A sync alone still goes through the queue, behind earlier updates */
+	if (!req.fields && !req.nsync)
+		return;
+
+	pending = pending_alloc(osc);
+	if (!pending) {
+		osc->dropped++;
+		return;
+	}
+
+	pending->osc = osc;
+	pending->addr = *addr;
+	pending->recv_ns = recv_ns;
+	memcpy(pending->sync, req.sync, sizeof(req.sync));
+	pending->nsync = req.nsync;
+
+	id = apollo_control_apply_config_async(osc->control, &req.config, req.fields,
+					       on_applied, pending);
+	if (id < 0) {
+		pending->busy = false;
+		osc->dropped++;
+	}
+}
+
+/* Timer tick: drop stale subscribers, then push what changed */
+static void push(struct apollo_osc *osc)
+{
+	struct apollo_osc_buf bufs[APOLLO_OSC_STATE_PACKETS];
+	struct apollo_config config;
+	uint64_t now = now_ns();
+	int i, j, n;
+
+	for (i = osc->nsubs - 1; i >= 0; i--)
+		if (now - osc->subs[i].seen_ns > APOLLO_OSC_SUB_TIMEOUT * 1000000000ull)
+			unsubscribe_at(osc, i);
+
+	apollo_control_get_config(osc->control, &config);
+	n = encode_state(osc, &config, &osc->pushed, bufs, APOLLO_OSC_STATE_PACKETS);
+	for (i = 0; i < osc->nsubs; i++)
+		for (j = 0; j < n; j++)
+			send_buf(osc, &bufs[j], &osc->subs[i].addr);
+	osc->pushed = config;
+}
+
+void apollo_osc_handle(struct apollo_osc *osc)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len;
+	uint64_t ticks;
+	ssize_t len;
+
+	for (;;) {
+		addr_len = sizeof(addr);
+		len = recvfrom(osc->sock, osc->rx, sizeof(osc->rx), MSG_DONTWAIT,
+			       (struct sockaddr *)&addr, &addr_len);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		handle_datagram(osc, len, &addr, now_ns());
+	}
+
+	if (read(osc->timer_fd, &ticks, sizeof(ticks)) == sizeof(ticks) && osc->nsubs)
+		push(osc);
+}
+
+int apollo_osc_get_fds(struct apollo_osc *osc, struct pollfd *fds, unsigned int space)
+{
+	int fd[] = { osc->sock, osc->timer_fd };
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(fd) && i < space; i++) {
+		fds[i].fd = fd[i];
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+	return i;
+}
+
+struct apollo_osc *apollo_osc_open(struct apollo_control *control, const char *addr,
+				   unsigned short port, unsigned int push_ms)
+{
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	int sock;
+
+	if (addr && inet_pton(AF_INET, addr, &sin.sin_addr) != 1) {
+		syslog(LOG_ERR, "OSC: invalid address %s", addr);
+		return NULL;
+	}
+
+	sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return NULL;
+
+	if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		syslog(LOG_ERR, "OSC: cannot bind port %u: %s", port, strerror(errno));
+		close(sock);
+		return NULL;
+	}
+
+	return apollo_osc_open_fd(control, sock, push_ms);
+}
+
+struct apollo_osc *apollo_osc_open_fd(struct apollo_control *control, int sock,
+				      unsigned int push_ms)
+{
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	socklen_t len = sizeof(sin);
+	struct apollo_osc *osc;
+	unsigned int i, j, n = 0;
+
+	osc = calloc(1, sizeof(*osc));
+	if (!osc) {
+		close(sock);
+		return NULL;
+	}
+
+	osc->control = control;
+	osc->sock = sock;
+	osc->push_ms = push_ms ? push_ms : APOLLO_OSC_PUSH_MS;
+
+	for (i = 0; i < ARRAY_SIZE(apollo_osc_params); i++) {
+		for (j = 0; j < apollo_osc_params[i].count; j++, n++)
+			snprintf(osc->names[apollo_osc_params[i].field + j], APOLLO_OSC_NAME_SIZE,
+				 apollo_osc_params[i].pattern, j + 1);
+	}
+	if (n != APOLLO_FIELD_COUNT)
+		syslog(LOG_WARNING, "OSC: %u of %d fields have an address", n, APOLLO_FIELD_COUNT);
+
+	/* Sockets passed in by systemd are blocking */
+	if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) < 0)
+		goto err_sock;
+
+	osc->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (osc->timer_fd < 0)
+		goto err_sock;
+
+	getsockname(sock, (struct sockaddr *)&sin, &len);
+	syslog(LOG_INFO, "OSC: listening on %s:%u, push interval %u ms",
+	       inet_ntoa(sin.sin_addr), ntohs(sin.sin_port), osc->push_ms);
+	return osc;
+
+err_sock:
+	close(sock);
+	free(osc);
+	return NULL;
+}
+
+/*
+ * Updates still in flight are abandoned; their completions must not be
+ * dispatched afterwards, so close before apollo_control_cleanup() and
+ * without dispatching in between.
+ */
+void apollo_osc_close(struct apollo_osc *osc)
+{
+	if (!osc)
+		return;
+
+	close(osc->timer_fd);
+	close(osc->sock);
+	free(osc);
+}
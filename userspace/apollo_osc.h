@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo OSC Gateway
+ *
+ * Open Sound Control over UDP for tablets and control surfaces. Each
+ * parameter of struct apollo_config has an address (see docs/USAGE.md);
+ * everything in one datagram, a message or a whole bundle, is applied as
+ * a single device update. Subscribers get the changes pushed back as
+ * bundles, at most once per push interval.
+ *
+ * The gateway is driven from the caller's poll loop, like the async
+ * control API: poll the descriptors from apollo_osc_get_fds() together
+ * with those of the control handle, then call apollo_osc_handle() and
+ * apollo_control_dispatch().
+ */
+
+#ifndef _APOLLO_OSC_H
+#define _APOLLO_OSC_H
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "apollo_control.h"
+
+#define APOLLO_OSC_PORT		9000
+#define APOLLO_OSC_PUSH_MS	50
+#define APOLLO_OSC_MAX_ARGS	8
+
+/* Keeps pushed bundles within one Ethernet frame */
+#define APOLLO_OSC_MAX_PACKET	1472
+
+struct apollo_osc;
+
+struct apollo_osc *apollo_osc_open(struct apollo_control *control, const char *addr,
+				   unsigned short port, unsigned int push_ms);
+/* On a UDP socket that is already bound, such as one from systemd; takes sock */
+struct apollo_osc *apollo_osc_open_fd(struct apollo_control *control, int sock,
+				      unsigned int push_ms);
+void apollo_osc_close(struct apollo_osc *osc);
+
+/* Same contract as apollo_control_get_fds(); apollo_osc_handle() never blocks */
+int apollo_osc_get_fds(struct apollo_osc *osc, struct pollfd *fds, unsigned int space);
+void apollo_osc_handle(struct apollo_osc *osc);
+
+/* Codec, shared with the benchmark in apolloctl */
+
+struct apollo_osc_arg {
+	char type;		/* OSC type tag: i f s h d T F N */
+	int32_t i;
+	float f;
+	int64_t h;
+	double d;
+	const char *s;		/* points into the packet */
+};
+
+typedef void (*apollo_osc_handler)(void *ctx, const char *address,
+				   const struct apollo_osc_arg *args, int nargs);
+
+/* Calls handler for each message in order; a malformed packet gets -EINVAL and no calls */
+int apollo_osc_parse(const void *data, size_t len, apollo_osc_handler handler, void *ctx);
+
+/* Numeric argument as float; T and F are 1 and 0 */
+int apollo_osc_arg_float(const struct apollo_osc_arg *arg, float *value);
+
+struct apollo_osc_buf {
+	uint8_t data[APOLLO_OSC_MAX_PACKET];
+	size_t len;
+	int bundle;
+};
+
+/*
+ * Build a packet: optionally start a bundle (timetag "immediately"), then
+ * add messages. types holds the tags of the arguments that follow, with
+ * f taking a double as varargs do. -ENOSPC leaves buf unchanged.
+ */
+void apollo_osc_buf_init(struct apollo_osc_buf *buf, int bundle);
+int apollo_osc_buf_message(struct apollo_osc_buf *buf, const char *address,
+			   const char *types, ...);
+
+#endif /* _APOLLO_OSC_H */
@@ -0,0 +1,675 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Twin Gapless Player
+ *
+ * Plays a list of WAV/RF64 files back to back at the smallest periods
+ * the driver allows. Every file is mapped at startup. A prefetch thread
+ * keeps the next few seconds of the playlist resident with
+ * madvise(MADV_WILLNEED), and touches each page so the audio thread
+ * never takes a major fault. The audio thread converts straight from the
+ * mapped files into the driver's mmap area, in batches through kernels
+ * the compiler vectorizes. It moves on to the next file inside the same
+ * period, so there is no gap. The CPU time spent per period is measured
+ * on the audio thread itself, so the tool doubles as a throughput
+ * benchmark for the PCM path.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <alsa/asoundlib.h>
+#include "apollo_wav.h"
+
+#define DEFAULT_DEVICE		"hw:Apollo"
+#define CACHELINE		64
+
+/* Frames converted per kernel call; bounds the scratch buffer */
+#define BATCH_FRAMES		512
+#define MAX_CHANNELS		32
+
+#define PAGE_BYTES		4096
+#define PREFETCH_INTERVAL_MS	20
+
+static volatile sig_atomic_t running = 1;
+
+struct track {
+	const char *path;
+	const uint8_t *map;
+	uint64_t map_bytes;
+	struct apollo_wav_info info;
+	unsigned int frame_bytes;
+	uint64_t frames;
+	uint64_t prefetched;		/* bytes of audio made resident, prefetch thread */
+};
+
+/* Sample decoder: n samples from the file into 32-bit integers */
+typedef void (*decode_fn)(int32_t *restrict dst, const uint8_t *restrict src, size_t n);
+
+struct player {
+	snd_pcm_t *pcm;
+	snd_pcm_uframes_t period_frames;
+	snd_pcm_uframes_t buffer_frames;
+	snd_pcm_format_t format;
+	unsigned int rate;
+	unsigned int channels;
+	unsigned int sample_bytes;
+	int cpu;
+	int rt_priority;
+	double ahead_seconds;
+
+	struct track *tracks;
+	unsigned int ntracks;
+	int32_t scratch[BATCH_FRAMES * MAX_CHANNELS] __attribute__((aligned(CACHELINE)));
+
+	/* Play position, written by the audio thread */
+	unsigned int track __attribute__((aligned(CACHELINE)));
+	uint64_t pos;			/* frames into that track */
+	bool done;
+
+	/* Audio thread counters, one writer each */
+	uint64_t periods __attribute__((aligned(CACHELINE)));
+	uint64_t frames;
+	uint64_t xruns;
+	uint64_t cpu_ns;		/* thread CPU time spent filling */
+	uint64_t cpu_max_ns;		/* most spent on one period */
+	uint64_t major_faults;
+};
+
+static void signal_handler(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+static uint64_t thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stat_set(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static uint64_t stat_get(const uint64_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void print_usage(const char *prog)
+{
+	printf("Usage: %s [options] <file.wav>...\n\n", prog);
+	printf("Options:\n");
+	printf("  -D NAME    ALSA playback device (default %s)\n", DEFAULT_DEVICE);
+	printf("  -f BITS    Device format: 16, 24 or 32 (default 32)\n");
+	printf("  -c N       Device channels (default: those of the first file)\n");
+	printf("  -p FRAMES  Period size (default 32)\n");
+	printf("  -n N       Periods in the ALSA buffer (default 2)\n");
+	printf("  -a SECS    Read ahead this much of the playlist (default 2)\n");
+	printf("  -C CPU     Pin the audio thread to CPU\n");
+	printf("  -P PRIO    SCHED_FIFO priority for the audio thread (default none)\n");
+	printf("  -h         Show this help\n");
+	printf("\nAll files must have the same rate. Missing channels play silence.\n");
+}
+
+/*
+ * Decoders. Plain loops over restrict pointers with memcpy loads, which
+ * the compiler turns into vector code at -O3 whatever the alignment of
+ * the audio in the file.
+ */
+static void decode_s16(int32_t *restrict dst, const uint8_t *restrict src, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		int16_t v;
+
+		memcpy(&v, src + 2 * i, sizeof(v));
+		dst[i] = (int32_t)((uint32_t)v << 16);
+	}
+}
+
+static void decode_s24(int32_t *restrict dst, const uint8_t *restrict src, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = (int32_t)((uint32_t)src[3 * i] << 8 | (uint32_t)src[3 * i + 1] << 16 |
+				   (uint32_t)src[3 * i + 2] << 24);
+}
+
+static void decode_s32(int32_t *restrict dst, const uint8_t *restrict src, size_t n)
+{
+	memcpy(dst, src, n * sizeof(*dst));
+}
+
+static void decode_f32(int32_t *restrict dst, const uint8_t *restrict src, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		float v;
+
+		memcpy(&v, src + 4 * i, sizeof(v));
+		/* NaN becomes silence; the clamps below would make it full scale */
+		v = v == v ? v : 0.0f;
+		v *= 2147483648.0f;
+		/* Largest float below 2^31 */
+		v = v < 2147483520.0f ? v : 2147483520.0f;
+		v = v > -2147483648.0f ? v : -2147483648.0f;
+		dst[i] = (int32_t)v;
+	}
+}
+
+static decode_fn track_decoder(const struct track *t)
+{
+	if (t->info.fmt.is_float)
+		return decode_f32;
+	switch (t->info.fmt.bits) {
+	case 16:
+		return decode_s16;
+	case 24:
+		return decode_s24;
+	}
+	return decode_s32;
+}
+
+/* Write n frames of src_ch 32-bit samples as device frames */
+static void encode(const struct player *pl, uint8_t *restrict dst, const int32_t *restrict src,
+		   size_t n, unsigned int src_ch)
+{
+	unsigned int c, ch = pl->channels;
+	size_t f;
+
+	if (src_ch == ch && pl->sample_bytes == 4) {
+		memcpy(dst, src, n * ch * 4);
+		return;
+	}
+
+	for (f = 0; f < n; f++, src += src_ch) {
+		for (c = 0; c < ch; c++) {
+			uint32_t v = c < src_ch ? (uint32_t)src[c] : 0;
+
+			switch (pl->sample_bytes) {
+			case 2:
+				dst[0] = v >> 16;
+				dst[1] = v >> 24;
+				break;
+			case 3:
+				dst[0] = v >> 8;
+				dst[1] = v >> 16;
+				dst[2] = v >> 24;
+				break;
+			default:
+				memcpy(dst, &v, 4);
+				break;
+			}
+			dst += pl->sample_bytes;
+		}
+	}
+}
+
+/*
+ * Fill frames of the mmap area at dst from the playlist, crossing into
+ * the next file without a gap. Silence after the last one.
+ */
+static void fill(struct player *pl, uint8_t *dst, snd_pcm_uframes_t frames)
+{
+	const unsigned int frame_bytes = pl->channels * pl->sample_bytes;
+
+	while (frames) {
+		struct track *t = pl->track < pl->ntracks ? &pl->tracks[pl->track] : NULL;
+		unsigned int src_ch;
+		uint64_t n;
+
+		if (!t) {
+			memset(dst, 0, frames * frame_bytes);
+			return;
+		}
+		if (pl->pos == t->frames) {
+			__atomic_store_n(&pl->track, pl->track + 1, __ATOMIC_RELAXED);
+			__atomic_store_n(&pl->pos, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		src_ch = t->info.fmt.channels;
+		n = t->frames - pl->pos;
+		if (n > frames)
+			n = frames;
+
+		/* Same layout: straight into the device's buffer */
+		if (src_ch == pl->channels && pl->sample_bytes == 4) {
+			track_decoder(t)((int32_t *)dst, t->map + t->info.data_offset +
+					 pl->pos * t->frame_bytes, n * src_ch);
+		} else {
+			if (n > BATCH_FRAMES)
+				n = BATCH_FRAMES;
+			track_decoder(t)(pl->scratch, t->map + t->info.data_offset +
+					 pl->pos * t->frame_bytes, n * src_ch);
+			encode(pl, dst, pl->scratch, n, src_ch);
+		}
+
+		__atomic_store_n(&pl->pos, pl->pos + n, __ATOMIC_RELAXED);
+		dst += n * frame_bytes;
+		frames -= n;
+	}
+}
+
+/* Fill everything the device will take; returns frames written or -errno */
+static snd_pcm_sframes_t fill_avail(struct player *pl)
+{
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset, frames;
+	snd_pcm_sframes_t avail, done, total = 0;
+	int err;
+
+	avail = snd_pcm_avail_update(pl->pcm);
+	if (avail < 0)
+		return avail;
+
+	while (avail > 0) {
+		frames = avail;
+		err = snd_pcm_mmap_begin(pl->pcm, &areas, &offset, &frames);
+		if (err < 0)
+			return err;
+
+		fill(pl, (uint8_t *)areas[0].addr + areas[0].first / 8 +
+		     offset * pl->channels * pl->sample_bytes, frames);
+
+		done = snd_pcm_mmap_commit(pl->pcm, offset, frames);
+		if (done < 0)
+			return done;
+		if ((snd_pcm_uframes_t)done != frames)
+			return -EPIPE;
+		avail -= frames;
+		total += frames;
+	}
+	return total;
+}
+
+static int pcm_restart(struct player *pl)
+{
+	snd_pcm_sframes_t n = fill_avail(pl);
+
+	return n < 0 ? n : snd_pcm_start(pl->pcm);
+}
+
+static bool finished(const struct player *pl)
+{
+	return pl->track >= pl->ntracks;
+}
+
+static void *audio_thread(void *arg)
+{
+	struct player *pl = arg;
+	struct rusage ru;
+	uint64_t start, ns, faults;
+	snd_pcm_sframes_t n;
+	int err;
+
+	getrusage(RUSAGE_THREAD, &ru);
+	faults = ru.ru_majflt;
+
+	err = pcm_restart(pl);
+
+	while (running && err >= 0 && !finished(pl)) {
+		err = snd_pcm_wait(pl->pcm, 1000);
+		if (err < 0) {
+			stat_set(&pl->xruns, pl->xruns + 1);
+			err = snd_pcm_recover(pl->pcm, err, 1);
+			if (err >= 0)
+				err = pcm_restart(pl);
+			continue;
+		}
+
+		start = thread_cpu_ns();
+		n = fill_avail(pl);
+		ns = thread_cpu_ns() - start;
+		if (n < 0) {
+			stat_set(&pl->xruns, pl->xruns + 1);
+			err = snd_pcm_recover(pl->pcm, n, 1);
+			if (err >= 0)
+				err = pcm_restart(pl);
+			continue;
+		}
+		if (!n)
+			continue;
+
+		/* Per period, whatever the number of periods this wakeup filled */
+		stat_set(&pl->periods, pl->periods + (n + pl->period_frames - 1) / pl->period_frames);
+		stat_set(&pl->frames, pl->frames + n);
+		stat_set(&pl->cpu_ns, pl->cpu_ns + ns);
+		ns = ns * pl->period_frames / n;
+		if (ns > pl->cpu_max_ns)
+			stat_set(&pl->cpu_max_ns, ns);
+
+		getrusage(RUSAGE_THREAD, &ru);
+		stat_set(&pl->major_faults, ru.ru_majflt - faults);
+	}
+
+	/* Let the tail play out */
+	if (running && err >= 0)
+		snd_pcm_drain(pl->pcm);
+	else
+		snd_pcm_drop(pl->pcm);
+
+	__atomic_store_n(&pl->done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/*
+ * Make the audio from the play position to ahead_seconds past it
+ * resident and mapped, across file boundaries. Reading one byte per page
+ * faults it in here instead of on the audio thread.
+ */
+static void prefetch(struct player *pl)
+{
+	unsigned int i = __atomic_load_n(&pl->track, __ATOMIC_RELAXED);
+	uint64_t pos = __atomic_load_n(&pl->pos, __ATOMIC_RELAXED);
+	uint64_t want = pl->ahead_seconds * pl->rate;
+	volatile uint8_t sink;
+
+	for (; i < pl->ntracks && want; i++, pos = 0) {
+		struct track *t = &pl->tracks[i];
+		uint64_t end = pos + want < t->frames ? pos + want : t->frames;
+		uint64_t from = t->info.data_offset + t->prefetched;
+		uint64_t to = t->info.data_offset + end * t->frame_bytes;
+		uint64_t p;
+
+		want -= end - pos;
+		if (from >= to)
+			continue;
+
+		from &= ~(uint64_t)(PAGE_BYTES - 1);
+		madvise((void *)(t->map + from), to - from, MADV_WILLNEED);
+		for (p = from; p < to; p += PAGE_BYTES)
+			sink = t->map[p];
+		(void)sink;
+		t->prefetched = end * t->frame_bytes;
+	}
+}
+
+static void *prefetch_thread(void *arg)
+{
+	struct player *pl = arg;
+	struct timespec nap = { 0, PREFETCH_INTERVAL_MS * 1000000L };
+
+	while (!__atomic_load_n(&pl->done, __ATOMIC_ACQUIRE)) {
+		prefetch(pl);
+		nanosleep(&nap, NULL);
+	}
+	return NULL;
+}
+
+static int track_open(struct track *t)
+{
+	struct stat st;
+	void *map;
+	int fd, err;
+
+	fd = open(t->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", t->path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -errno;
+	}
+
+	map = st.st_size ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Cannot map %s\n", t->path);
+		return -EINVAL;
+	}
+	t->map = map;
+	t->map_bytes = st.st_size;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	err = apollo_wav_parse(map, st.st_size, &t->info);
+	if (err) {
+		fprintf(stderr, "%s: %s\n", t->path,
+			err == -EOPNOTSUPP ? "unsupported encoding" : "not a WAV or RF64 file");
+		return err;
+	}
+	if (t->info.fmt.channels > MAX_CHANNELS) {
+		fprintf(stderr, "%s: more than %d channels\n", t->path, MAX_CHANNELS);
+		return -EOPNOTSUPP;
+	}
+
+	t->frame_bytes = t->info.fmt.channels * t->info.fmt.bits / 8;
+	t->frames = t->info.data_bytes / t->frame_bytes;
+	return 0;
+}
+
+static int pcm_setup(struct player *pl, const char *device, unsigned int periods)
+{
+	snd_pcm_hw_params_t *hw;
+	int err;
+
+	err = snd_pcm_open(&pl->pcm, device, SND_PCM_STREAM_PLAYBACK, 0);
+	if (err < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", device, snd_strerror(err));
+		return err;
+	}
+
+	snd_pcm_hw_params_alloca(&hw);
+	snd_pcm_hw_params_any(pl->pcm, hw);
+	if ((err = snd_pcm_hw_params_set_access(pl->pcm, hw,
+						SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0 ||
+	    (err = snd_pcm_hw_params_set_format(pl->pcm, hw, pl->format)) < 0 ||
+	    (err = snd_pcm_hw_params_set_channels(pl->pcm, hw, pl->channels)) < 0 ||
+	    (err = snd_pcm_hw_params_set_rate(pl->pcm, hw, pl->rate, 0)) < 0 ||
+	    (err = snd_pcm_hw_params_set_period_size_near(pl->pcm, hw, &pl->period_frames,
+							   NULL)) < 0 ||
+	    (err = snd_pcm_hw_params_set_periods_near(pl->pcm, hw, &periods, NULL)) < 0 ||
+	    (err = snd_pcm_hw_params(pl->pcm, hw)) < 0) {
+		fprintf(stderr, "Cannot set up %s: %s\n", device, snd_strerror(err));
+		snd_pcm_close(pl->pcm);
+		return err;
+	}
+	pl->buffer_frames = pl->period_frames * periods;
+
+	return 0;
+}
+
+static int spawn(pthread_t *thread, void *(*fn)(void *), struct player *pl, bool rt)
+{
+	struct sched_param param = { .sched_priority = pl->rt_priority };
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int err;
+
+	pthread_attr_init(&attr);
+	if (rt && pl->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(pl->cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+	if (rt && pl->rt_priority > 0) {
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+
+	err = pthread_create(thread, &attr, fn, pl);
+	pthread_attr_destroy(&attr);
+	return -err;
+}
+
+static void report(struct player *pl, double elapsed)
+{
+	unsigned int i = __atomic_load_n(&pl->track, __ATOMIC_RELAXED);
+	uint64_t periods = stat_get(&pl->periods);
+	double period_us = pl->period_frames * 1e6 / pl->rate;
+	double avg_us = periods ? stat_get(&pl->cpu_ns) / 1e3 / periods : 0;
+
+	printf("%7.1fs  track %u/%u  cpu/period avg %6.2f us max %7.2f us (%.1f%% of %.0f us)"
+	       "  xruns %llu  major faults %llu\n",
+	       elapsed, i < pl->ntracks ? i + 1 : pl->ntracks, pl->ntracks, avg_us,
+	       stat_get(&pl->cpu_max_ns) / 1e3, 100.0 * avg_us / period_us, period_us,
+	       (unsigned long long)stat_get(&pl->xruns),
+	       (unsigned long long)stat_get(&pl->major_faults));
+	fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+	struct player *pl;
+	const char *device = DEFAULT_DEVICE;
+	unsigned int periods = 2, i;
+	pthread_t audio_tid, prefetch_tid;
+	struct timespec t0, now;
+	double elapsed = 0;
+	int opt, ret = EXIT_SUCCESS;
+
+	pl = aligned_alloc(CACHELINE, sizeof(*pl));
+	if (!pl)
+		return EXIT_FAILURE;
+	memset(pl, 0, sizeof(*pl));
+	pl->format = SND_PCM_FORMAT_S32_LE;
+	pl->sample_bytes = 4;
+	pl->period_frames = 32;
+	pl->ahead_seconds = 2;
+	pl->cpu = -1;
+
+	while ((opt = getopt(argc, argv, "D:f:c:p:n:a:C:P:h")) != -1) {
+		switch (opt) {
+		case 'D':
+			device = optarg;
+			break;
+		case 'f':
+			switch (atoi(optarg)) {
+			case 16:
+				pl->format = SND_PCM_FORMAT_S16_LE;
+				break;
+			case 24:
+				pl->format = SND_PCM_FORMAT_S24_3LE;
+				break;
+			case 32:
+				pl->format = SND_PCM_FORMAT_S32_LE;
+				break;
+			default:
+				fprintf(stderr, "Unknown format %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			pl->sample_bytes = atoi(optarg) / 8;
+			break;
+		case 'c':
+			pl->channels = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			pl->period_frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			periods = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			pl->ahead_seconds = strtod(optarg, NULL);
+			break;
+		case 'C':
+			pl->cpu = atoi(optarg);
+			break;
+		case 'P':
+			pl->rt_priority = atoi(optarg);
+			break;
+		case 'h':
+			print_usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc || pl->channels > MAX_CHANNELS) {
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* Not MCL_FUTURE, which would pin the whole of every file mapped below */
+	if (mlockall(MCL_CURRENT) < 0)
+		fprintf(stderr, "mlockall: %s (continuing)\n", strerror(errno));
+
+	/* Every file is checked before anything plays */
+	pl->ntracks = argc - optind;
+	pl->tracks = calloc(pl->ntracks, sizeof(*pl->tracks));
+	if (!pl->tracks)
+		return EXIT_FAILURE;
+	for (i = 0; i < pl->ntracks; i++) {
+		pl->tracks[i].path = argv[optind + i];
+		if (track_open(&pl->tracks[i]) < 0)
+			return EXIT_FAILURE;
+		if (pl->tracks[i].info.fmt.rate != pl->tracks[0].info.fmt.rate) {
+			fprintf(stderr, "%s: %u Hz, the playlist is at %u Hz\n", pl->tracks[i].path,
+				pl->tracks[i].info.fmt.rate, pl->tracks[0].info.fmt.rate);
+			return EXIT_FAILURE;
+		}
+	}
+	pl->rate = pl->tracks[0].info.fmt.rate;
+	if (!pl->channels)
+		pl->channels = pl->tracks[0].info.fmt.channels;
+
+	if (pcm_setup(pl, device, periods) < 0)
+		return EXIT_FAILURE;
+
+	/* The start of the playlist is resident before the first period */
+	prefetch(pl);
+
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	printf("Playing %u file%s on %s: %u Hz, %u ch, %u-bit, %u x %lu frames (%.2f ms)\n",
+	       pl->ntracks, pl->ntracks > 1 ? "s" : "", device, pl->rate, pl->channels,
+	       pl->sample_bytes * 8, periods, pl->period_frames,
+	       pl->period_frames * 1000.0 / pl->rate);
+
+	if (spawn(&prefetch_tid, prefetch_thread, pl, false) ||
+	    spawn(&audio_tid, audio_thread, pl, true)) {
+		fprintf(stderr, "Cannot start threads\n");
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (running && !__atomic_load_n(&pl->done, __ATOMIC_ACQUIRE)) {
+		sleep(1);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - t0.tv_sec) + (now.tv_nsec - t0.tv_nsec) / 1e9;
+		report(pl, elapsed);
+	}
+	running = 0;
+
+	pthread_join(audio_tid, NULL);
+	pthread_join(prefetch_tid, NULL);
+	snd_pcm_close(pl->pcm);
+
+	if (pl->frames)
+		printf("Played %.1f s; fill cost %.1f ns per frame, %.0fx real time on one core\n",
+		       (double)pl->frames / pl->rate, (double)pl->cpu_ns / pl->frames,
+		       pl->cpu_ns ? 1e9 * pl->frames / pl->rate / pl->cpu_ns : 0.0);
+
+	if (pl->xruns || pl->major_faults) {
+		fprintf(stderr, "%llu underruns, %llu major faults on the audio thread\n",
+			(unsigned long long)pl->xruns, (unsigned long long)pl->major_faults);
+		ret = pl->xruns ? EXIT_FAILURE : ret;
+	}
+
+	for (i = 0; i < pl->ntracks; i++)
+		munmap((void *)pl->tracks[i].map, pl->tracks[i].map_bytes);
+	free(pl->tracks);
+	free(pl);
+	return ret;
+}
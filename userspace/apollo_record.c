@@ -0,0 +1,663 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Twin Multitrack Recorder
+ *
+ * Records long sessions without letting the filesystem reach the audio
+ * path. The capture thread, SCHED_FIFO on its own core if asked, copies
+ * each period out of the ALSA mmap area into a single-producer,
+ * single-consumer ring and makes no blocking call but snd_pcm_wait().
+ * A writer thread drains the ring in large blocks with O_DIRECT into
+ * preallocated WAV files, one per channel with -s, which turn into RF64
+ * past 4 GiB. The report every second shows how full the ring got and
+ * how long the writes took, which is the headroom left before an
+ * overflow.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <alsa/asoundlib.h>
+#include "apollo_wav.h"
+
+#define DEFAULT_DEVICE		"hw:Apollo"
+#define CACHELINE		64
+
+/* O_DIRECT wants the buffer, offset and length aligned to this */
+#define DIRECT_ALIGN		4096
+
+/* Writer unit; a multiple of DIRECT_ALIGN frames keeps every write aligned */
+#define BLOCK_FRAMES		16384
+
+/* Without -t, files grow by this much audio at a time */
+#define PREALLOC_SECONDS	60
+
+static volatile sig_atomic_t running = 1;
+
+/*
+ * Byte ring between the two threads. head is only written by the capture
+ * thread and tail only by the writer, each with a release store after
+ * the data, so neither side takes a lock or waits for the other. size is
+ * a whole number of blocks, so a block never wraps.
+ */
+struct ring {
+	uint64_t head __attribute__((aligned(CACHELINE)));
+	uint64_t tail __attribute__((aligned(CACHELINE)));
+	uint8_t *data;
+	uint64_t size;
+};
+
+struct output {
+	int fd;
+	bool direct;			/* opened with O_DIRECT */
+	uint64_t data_bytes;		/* audio written so far */
+	uint64_t allocated;		/* audio bytes fallocate()d */
+	char path[PATH_MAX];
+};
+
+struct recorder {
+	snd_pcm_t *pcm;
+	snd_pcm_uframes_t period_frames;
+	unsigned int rate;
+	unsigned int channels;
+	unsigned int sample_bytes;
+	unsigned int frame_bytes;
+	uint64_t block_bytes;
+	int cpu;
+	int rt_priority;
+	bool split;
+	double seconds;
+	uint64_t max_frames;		/* from -t, 0 for no limit */
+
+	struct ring ring;
+	struct output *out;
+	unsigned int nout;
+	uint8_t *split_buf;		/* one block, deinterleaved */
+	uint8_t *header;
+	bool capture_done;
+	int capture_err;
+
+	/* Capture thread counters; one writer each, read with relaxed loads */
+	uint64_t frames __attribute__((aligned(CACHELINE)));
+	uint64_t xruns;
+	uint64_t dropped;		/* frames lost to a full ring */
+	uint64_t fill_max;
+
+	/* Writer thread counters */
+	uint64_t writes __attribute__((aligned(CACHELINE)));
+	uint64_t write_ns;
+	uint64_t write_max_ns;
+	uint64_t written;
+};
+
+static void signal_handler(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stat_set(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static uint64_t stat_get(const uint64_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void print_usage(const char *prog)
+{
+	printf("Usage: %s [options] <file.wav>\n\n", prog);
+	printf("Options:\n");
+	printf("  -D NAME    ALSA capture device (default %s)\n", DEFAULT_DEVICE);
+	printf("  -r RATE    Sample rate (default 48000)\n");
+	printf("  -f BITS    Sample format: 16, 24 or 32 (default 32)\n");
+	printf("  -c N       Channels (default 2)\n");
+	printf("  -p FRAMES  Period size (default 256)\n");
+	printf("  -n N       Periods in the ALSA buffer (default 4)\n");
+	printf("  -b SECS    Audio the ring can hold while the disk stalls (default 4)\n");
+	printf("  -s         One mono file per channel: file-01.wav, file-02.wav, ...\n");
+	printf("  -C CPU     Pin the capture thread to CPU\n");
+	printf("  -P PRIO    SCHED_FIFO priority for the capture thread (default none)\n");
+	printf("  -t SECS    Stop after SECS seconds and preallocate the whole take\n");
+	printf("  -h         Show this help\n");
+}
+
+static int parse_format(const char *arg, snd_pcm_format_t *format, unsigned int *bytes)
+{
+	switch (atoi(arg)) {
+	case 16:
+		*format = SND_PCM_FORMAT_S16_LE;
+		*bytes = 2;
+		return 0;
+	case 24:
+		*format = SND_PCM_FORMAT_S24_3LE;
+		*bytes = 3;
+		return 0;
+	case 32:
+		*format = SND_PCM_FORMAT_S32_LE;
+		*bytes = 4;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+static int pcm_setup(struct recorder *rec, const char *device, snd_pcm_format_t format,
+		     unsigned int periods)
+{
+	snd_pcm_hw_params_t *hw;
+	int err;
+
+	err = snd_pcm_open(&rec->pcm, device, SND_PCM_STREAM_CAPTURE, 0);
+	if (err < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", device, snd_strerror(err));
+		return err;
+	}
+
+	snd_pcm_hw_params_alloca(&hw);
+	snd_pcm_hw_params_any(rec->pcm, hw);
+	if ((err = snd_pcm_hw_params_set_access(rec->pcm, hw,
+						SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0 ||
+	    (err = snd_pcm_hw_params_set_format(rec->pcm, hw, format)) < 0 ||
+	    (err = snd_pcm_hw_params_set_channels(rec->pcm, hw, rec->channels)) < 0 ||
+	    (err = snd_pcm_hw_params_set_rate(rec->pcm, hw, rec->rate, 0)) < 0 ||
+	    (err = snd_pcm_hw_params_set_period_size_near(rec->pcm, hw, &rec->period_frames,
+							   NULL)) < 0 ||
+	    (err = snd_pcm_hw_params_set_periods_near(rec->pcm, hw, &periods, NULL)) < 0 ||
+	    (err = snd_pcm_hw_params(rec->pcm, hw)) < 0) {
+		fprintf(stderr, "Cannot set up %s: %s\n", device, snd_strerror(err));
+		snd_pcm_close(rec->pcm);
+		return err;
+	}
+
+	return 0;
+}
+
+/* Called on the capture thread only; never blocks on the writer */
+static void ring_put(struct recorder *rec, const uint8_t *src, uint64_t len)
+{
+	struct ring *ring = &rec->ring;
+	uint64_t head = ring->head;
+	uint64_t fill = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	uint64_t pos, n;
+
+	if (fill + len > ring->size) {
+		stat_set(&rec->dropped, rec->dropped + len / rec->frame_bytes);
+		return;
+	}
+
+	pos = head % ring->size;
+	n = len < ring->size - pos ? len : ring->size - pos;
+	memcpy(ring->data + pos, src, n);
+	memcpy(ring->data, src + n, len - n);
+	__atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+
+	if (fill + len > rec->fill_max)
+		stat_set(&rec->fill_max, fill + len);
+}
+
+/* Overrun or suspend: count it and restart the stream */
+static int capture_recover(struct recorder *rec, int err)
+{
+	stat_set(&rec->xruns, rec->xruns + 1);
+	err = snd_pcm_recover(rec->pcm, err, 1);
+	if (err < 0)
+		return err;
+	return snd_pcm_start(rec->pcm);
+}
+
+static void *capture_thread(void *arg)
+{
+	struct recorder *rec = arg;
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset, frames;
+	snd_pcm_sframes_t avail, done;
+	int err;
+
+	err = snd_pcm_start(rec->pcm);
+
+	while (running && err >= 0 && (!rec->max_frames || rec->frames < rec->max_frames)) {
+		avail = snd_pcm_avail_update(rec->pcm);
+		if (avail < 0) {
+			err = capture_recover(rec, avail);
+			continue;
+		}
+		if ((snd_pcm_uframes_t)avail < rec->period_frames) {
+			err = snd_pcm_wait(rec->pcm, 1000);
+			if (err < 0)
+				err = capture_recover(rec, err);
+			continue;
+		}
+
+		while (avail > 0 && (!rec->max_frames || rec->frames < rec->max_frames)) {
+			frames = avail;
+			/* -t gives an exact length */
+			if (rec->max_frames && frames > rec->max_frames - rec->frames)
+				frames = rec->max_frames - rec->frames;
+			err = snd_pcm_mmap_begin(rec->pcm, &areas, &offset, &frames);
+			if (err < 0)
+				break;
+
+			ring_put(rec, (const uint8_t *)areas[0].addr + areas[0].first / 8 +
+				 offset * rec->frame_bytes, (uint64_t)frames * rec->frame_bytes);
+
+			done = snd_pcm_mmap_commit(rec->pcm, offset, frames);
+			if (done < 0 || (snd_pcm_uframes_t)done != frames) {
+				err = done < 0 ? done : -EPIPE;
+				break;
+			}
+			stat_set(&rec->frames, rec->frames + frames);
+			avail -= frames;
+		}
+		if (err < 0)
+			err = capture_recover(rec, err);
+	}
+
+	snd_pcm_drop(rec->pcm);
+	rec->capture_err = err < 0 ? err : 0;
+	__atomic_store_n(&rec->capture_done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static int output_header(struct recorder *rec, struct output *out)
+{
+	struct apollo_wav_format fmt = {
+		.rate = rec->rate,
+		.channels = rec->split ? 1 : rec->channels,
+		.bits = rec->sample_bytes * 8,
+	};
+
+	apollo_wav_header(rec->header, &fmt, out->data_bytes);
+	if (pwrite(out->fd, rec->header, APOLLO_WAV_HEADER_BYTES, 0) != APOLLO_WAV_HEADER_BYTES) {
+		fprintf(stderr, "Cannot write the header of %s: %s\n", out->path,
+			strerror(errno));
+		return -EIO;
+	}
+	return 0;
+}
+
+static int output_open(struct recorder *rec, struct output *out, uint64_t prealloc)
+{
+	const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+	out->fd = open(out->path, flags | O_DIRECT, 0644);
+	out->direct = out->fd >= 0;
+	/* tmpfs and some network filesystems refuse O_DIRECT */
+	if (out->fd < 0 && errno == EINVAL)
+		out->fd = open(out->path, flags, 0644);
+	if (out->fd < 0) {
+		fprintf(stderr, "Cannot create %s: %s\n", out->path, strerror(errno));
+		return -errno;
+	}
+
+	if (prealloc && fallocate(out->fd, 0, 0, APOLLO_WAV_HEADER_BYTES + prealloc) == 0)
+		out->allocated = prealloc;
+
+	return output_header(rec, out);
+}
+
+/*
+ * Write len bytes from an aligned buffer. Only the last write of a take
+ * is short; it is padded to the alignment and the file cut back at close.
+ */
+static int output_write(struct recorder *rec, struct output *out, uint8_t *buf, uint64_t len)
+{
+	uint64_t padded = (len + DIRECT_ALIGN - 1) & ~(uint64_t)(DIRECT_ALIGN - 1);
+	uint64_t start, ns;
+	ssize_t n;
+
+	/* Extend ahead of the audio; the header then covers what is on disk */
+	if (out->data_bytes + padded > out->allocated) {
+		uint64_t step = (uint64_t)PREALLOC_SECONDS * rec->rate * rec->frame_bytes /
+				(rec->split ? rec->channels : 1);
+
+		step = (step + DIRECT_ALIGN - 1) & ~(uint64_t)(DIRECT_ALIGN - 1);
+		if (fallocate(out->fd, 0, APOLLO_WAV_HEADER_BYTES + out->allocated, step) == 0)
+			out->allocated += step;
+		else
+			out->allocated = UINT64_MAX;
+		output_header(rec, out);
+	}
+
+	memset(buf + len, 0, padded - len);
+
+	start = now_ns();
+	n = pwrite(out->fd, buf, padded, APOLLO_WAV_HEADER_BYTES + out->data_bytes);
+	ns = now_ns() - start;
+	if (n != (ssize_t)padded) {
+		fprintf(stderr, "Write to %s failed: %s\n", out->path,
+			n < 0 ? strerror(errno) : "short write");
+		return -EIO;
+	}
+	out->data_bytes += len;
+
+	stat_set(&rec->writes, rec->writes + 1);
+	stat_set(&rec->write_ns, rec->write_ns + ns);
+	if (ns > rec->write_max_ns)
+		stat_set(&rec->write_max_ns, ns);
+	stat_set(&rec->written, rec->written + len);
+	return 0;
+}
+
+static int write_block(struct recorder *rec, uint8_t *buf, uint64_t len)
+{
+	uint64_t frames = len / rec->frame_bytes;
+	uint64_t chan_bytes = rec->block_bytes / rec->channels;
+	unsigned int c, s = rec->sample_bytes;
+	uint64_t f;
+	int err;
+
+	if (!rec->split)
+		return output_write(rec, &rec->out[0], buf, len);
+
+	for (c = 0; c < rec->channels; c++) {
+		const uint8_t *src = buf + c * s;
+		uint8_t *dst = rec->split_buf + c * chan_bytes;
+
+		for (f = 0; f < frames; f++, src += rec->frame_bytes, dst += s)
+			memcpy(dst, src, s);
+	}
+
+	for (c = 0; c < rec->channels; c++) {
+		err = output_write(rec, &rec->out[c], rec->split_buf + c * chan_bytes, frames * s);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct recorder *rec = arg;
+	struct ring *ring = &rec->ring;
+	uint64_t block_ns = BLOCK_FRAMES * 1000000000ULL / rec->rate;
+	struct timespec nap = { 0, block_ns / 4 };
+	uint64_t head, avail, len;
+	bool done;
+
+	for (;;) {
+		/* done first: once it is set, head is final */
+		done = __atomic_load_n(&rec->capture_done, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		avail = head - ring->tail;
+
+		if (avail < rec->block_bytes && !done) {
+			nanosleep(&nap, NULL);
+			continue;
+		}
+		if (!avail)
+			break;
+
+		len = avail < rec->block_bytes ? avail : rec->block_bytes;
+		if (write_block(rec, ring->data + ring->tail % ring->size, len) < 0) {
+			running = 0;
+			break;
+		}
+		__atomic_store_n(&ring->tail, ring->tail + len, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+static int spawn(pthread_t *thread, void *(*fn)(void *), struct recorder *rec, bool rt)
+{
+	struct sched_param param = { .sched_priority = rec->rt_priority };
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int err;
+
+	pthread_attr_init(&attr);
+	if (rt && rec->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(rec->cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+	if (rt && rec->rt_priority > 0) {
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+
+	err = pthread_create(thread, &attr, fn, rec);
+	pthread_attr_destroy(&attr);
+	return -err;
+}
+
+static void report(struct recorder *rec, double elapsed)
+{
+	uint64_t fill = __atomic_load_n(&rec->ring.head, __ATOMIC_RELAXED) -
+			__atomic_load_n(&rec->ring.tail, __ATOMIC_RELAXED);
+	uint64_t writes = stat_get(&rec->writes);
+
+	printf("%7.1fs  %9.1f MB  ring %3.0f%% max %3.0f%%  write avg %6.2f ms max %7.2f ms"
+	       "  xruns %llu  dropped %llu\n",
+	       elapsed, stat_get(&rec->written) / 1e6,
+	       100.0 * fill / rec->ring.size, 100.0 * stat_get(&rec->fill_max) / rec->ring.size,
+	       writes ? stat_get(&rec->write_ns) / 1e6 / writes : 0.0,
+	       stat_get(&rec->write_max_ns) / 1e6,
+	       (unsigned long long)stat_get(&rec->xruns),
+	       (unsigned long long)stat_get(&rec->dropped));
+	fflush(stdout);
+}
+
+/* file.wav -> file-01.wav */
+static void split_path(char *path, size_t size, const char *base, unsigned int channel)
+{
+	const char *dot = strrchr(base, '.');
+	int len = dot && !strchr(dot, '/') ? (int)(dot - base) : (int)strlen(base);
+
+	snprintf(path, size, "%.*s-%02u%s", len, base, channel + 1,
+		 dot && !strchr(dot, '/') ? dot : ".wav");
+}
+
+static int outputs_open(struct recorder *rec, const char *path)
+{
+	uint64_t prealloc = 0;
+	unsigned int i;
+
+	rec->nout = rec->split ? rec->channels : 1;
+	rec->out = calloc(rec->nout, sizeof(*rec->out));
+	if (!rec->out)
+		return -ENOMEM;
+
+	/* With a length given, allocate the whole take up front */
+	if (rec->seconds > 0)
+		prealloc = ((uint64_t)(rec->seconds * rec->rate) * rec->frame_bytes / rec->nout +
+			    DIRECT_ALIGN - 1) & ~(uint64_t)(DIRECT_ALIGN - 1);
+
+	for (i = 0; i < rec->nout; i++) {
+		if (rec->split)
+			split_path(rec->out[i].path, sizeof(rec->out[i].path), path, i);
+		else
+			snprintf(rec->out[i].path, sizeof(rec->out[i].path), "%s", path);
+		if (output_open(rec, &rec->out[i], prealloc) < 0)
+			return -EIO;
+	}
+
+	if (!rec->out[0].direct)
+		fprintf(stderr, "O_DIRECT not supported here, using buffered writes\n");
+	return 0;
+}
+
+/* Final sizes in the headers, preallocated space beyond the audio released */
+static void outputs_close(struct recorder *rec)
+{
+	unsigned int i;
+
+	for (i = 0; i < rec->nout; i++) {
+		struct output *out = &rec->out[i];
+
+		if (out->fd < 0)
+			continue;
+		output_header(rec, out);
+		if (ftruncate(out->fd, APOLLO_WAV_HEADER_BYTES + out->data_bytes) < 0)
+			fprintf(stderr, "Cannot trim %s: %s\n", out->path, strerror(errno));
+		fdatasync(out->fd);
+		close(out->fd);
+	}
+	free(rec->out);
+}
+
+int main(int argc, char *argv[])
+{
+	struct recorder rec = {
+		.rate = 48000,
+		.channels = 2,
+		.sample_bytes = 4,
+		.period_frames = 256,
+		.cpu = -1,
+	};
+	snd_pcm_format_t format = SND_PCM_FORMAT_S32_LE;
+	const char *device = DEFAULT_DEVICE;
+	unsigned int periods = 4;
+	double ring_seconds = 4, elapsed = 0;
+	pthread_t capture_tid, writer_tid;
+	struct timespec t0, now;
+	uint64_t blocks;
+	int opt, err, ret = EXIT_SUCCESS;
+
+	while ((opt = getopt(argc, argv, "D:r:f:c:p:n:b:sC:P:t:h")) != -1) {
+		switch (opt) {
+		case 'D':
+			device = optarg;
+			break;
+		case 'r':
+			rec.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			if (parse_format(optarg, &format, &rec.sample_bytes) < 0) {
+				fprintf(stderr, "Unknown format %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			rec.channels = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			rec.period_frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			periods = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			ring_seconds = strtod(optarg, NULL);
+			break;
+		case 's':
+			rec.split = true;
+			break;
+		case 'C':
+			rec.cpu = atoi(optarg);
+			break;
+		case 'P':
+			rec.rt_priority = atoi(optarg);
+			break;
+		case 't':
+			rec.seconds = strtod(optarg, NULL);
+			break;
+		case 'h':
+			print_usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1 || !rec.rate || !rec.channels || ring_seconds <= 0) {
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	rec.max_frames = rec.seconds > 0 ? rec.seconds * rec.rate : 0;
+
+	if (pcm_setup(&rec, device, format, periods) < 0)
+		return EXIT_FAILURE;
+
+	rec.frame_bytes = rec.channels * rec.sample_bytes;
+	rec.block_bytes = (uint64_t)BLOCK_FRAMES * rec.frame_bytes;
+	blocks = (uint64_t)(ring_seconds * rec.rate + BLOCK_FRAMES - 1) / BLOCK_FRAMES;
+	rec.ring.size = (blocks < 2 ? 2 : blocks) * rec.block_bytes;
+	rec.ring.data = aligned_alloc(DIRECT_ALIGN, rec.ring.size);
+	rec.split_buf = rec.split ? aligned_alloc(DIRECT_ALIGN, rec.block_bytes) : NULL;
+	rec.header = aligned_alloc(DIRECT_ALIGN, APOLLO_WAV_HEADER_BYTES);
+	if (!rec.ring.data || (rec.split && !rec.split_buf) || !rec.header) {
+		fprintf(stderr, "Out of memory for a %.1f s ring\n", ring_seconds);
+		return EXIT_FAILURE;
+	}
+
+	/* The capture thread must not fault on the ring */
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		fprintf(stderr, "mlockall: %s (continuing)\n", strerror(errno));
+	memset(rec.ring.data, 0, rec.ring.size);
+
+	if (outputs_open(&rec, argv[optind]) < 0) {
+		rec.nout = 0;
+		return EXIT_FAILURE;
+	}
+
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	printf("Recording %s: %u Hz, %u ch, %u-bit, period %lu, ring %.1f s, %u file%s%s\n",
+	       device, rec.rate, rec.channels, rec.sample_bytes * 8, rec.period_frames,
+	       (double)rec.ring.size / rec.frame_bytes / rec.rate, rec.nout,
+	       rec.nout > 1 ? "s" : "", rec.out[0].direct ? ", O_DIRECT" : "");
+
+	err = spawn(&writer_tid, writer_thread, &rec, false);
+	if (!err)
+		err = spawn(&capture_tid, capture_thread, &rec, true);
+	if (err) {
+		fprintf(stderr, "Cannot start threads: %s\n", strerror(-err));
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while (running && !__atomic_load_n(&rec.capture_done, __ATOMIC_ACQUIRE)) {
+		sleep(1);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - t0.tv_sec) + (now.tv_nsec - t0.tv_nsec) / 1e9;
+		report(&rec, elapsed);
+	}
+	running = 0;
+
+	pthread_join(capture_tid, NULL);
+	pthread_join(writer_tid, NULL);
+	outputs_close(&rec);
+	snd_pcm_close(rec.pcm);
+
+	printf("Recorded %.1f s; ring peak %.0f%% of %.1f s; slowest write %.2f ms\n",
+	       (double)rec.frames / rec.rate, 100.0 * rec.fill_max / rec.ring.size,
+	       (double)rec.ring.size / rec.frame_bytes / rec.rate, rec.write_max_ns / 1e6);
+
+	if (rec.capture_err) {
+		fprintf(stderr, "Capture stopped: %s\n", snd_strerror(rec.capture_err));
+		ret = EXIT_FAILURE;
+	}
+	if (rec.xruns || rec.dropped) {
+		fprintf(stderr, "%llu xruns, %llu frames dropped on a full ring\n",
+			(unsigned long long)rec.xruns, (unsigned long long)rec.dropped);
+		ret = EXIT_FAILURE;
+	}
+
+	free(rec.header);
+	free(rec.split_buf);
+	free(rec.ring.data);
+	return ret;
+}
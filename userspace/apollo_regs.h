@@ -0,0 +1,105 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo Register Definitions
+ *
+ * Generated from kernel/apollo_regs.map by tools/apollo_regmap.awk. Do not
+ * edit; change the map and run "make -C tools regs".
+ */
+
+#ifndef APOLLO_REGS_H
+#define APOLLO_REGS_H
+
+/* Device identification, reads 0x00000100 */
+#define APOLLO_REG_ID			0x00
+
+/* Serial number, characters 1-4 */
+#define APOLLO_REG_SERIAL0		0x20
+
+/* Serial number, characters 5-8 */
+#define APOLLO_REG_SERIAL1		0x24
+
+/* Serial number, characters 9-12 */
+#define APOLLO_REG_SERIAL2		0x28
+
+/* Serial number, characters 13-14 */
+#define APOLLO_REG_SERIAL3		0x2c
+
+/* Device command (APOLLO_CMD_*) (placeholder) */
+#define APOLLO_REG_CONTROL		0x40
+#define APOLLO_CONTROL_CMD		0x000000ffu
+
+/* Interrupt status, write back to clear (placeholder) */
+#define APOLLO_REG_STATUS		0x44
+#define APOLLO_STATUS_READY		0x00000001u
+#define APOLLO_STATUS_RUNNING		0x00000002u
+#define APOLLO_STATUS_ERROR		0x00000004u
+#define APOLLO_STATUS_CLOCK		0x00000008u
+
+/* Sample rate in Hz (placeholder) */
+#define APOLLO_REG_SAMPLE_RATE		0x48
+#define APOLLO_SAMPLE_RATE_RATE		0xffffffffu
+
+/* Sample format (APOLLO_FORMAT_*) (placeholder) */
+#define APOLLO_REG_FORMAT		0x4c
+#define APOLLO_FORMAT_FORMAT		0x00000003u
+
+/* Ring or descriptor table address, low word; live address in contiguous mode (placeholder) */
+#define APOLLO_REG_DMA_ADDR		0x50
+
+/* Ring size in bytes (placeholder) */
+#define APOLLO_REG_DMA_SIZE		0x54
+
+/* DMA engine command (placeholder) */
+#define APOLLO_REG_DMA_CONTROL		0x58
+#define APOLLO_DMA_CONTROL_CMD		0x0000000fu
+#define APOLLO_DMA_CONTROL_SG		0x00000010u
+
+/* Byte offset of the engine inside the ring (scatter-gather) (placeholder) */
+#define APOLLO_REG_DMA_POS		0x5c
+
+/* Ring or descriptor table address, high word (placeholder) */
+#define APOLLO_REG_DMA_ADDR_HI		0x60
+
+/* Firmware chunk destination offset (placeholder) */
+#define APOLLO_REG_FW_ADDR		0x64
+
+/* Firmware chunk length (placeholder) */
+#define APOLLO_REG_FW_LEN		0x68
+
+/* Sample clock source (APOLLO_CLOCK_*) (placeholder) */
+#define APOLLO_REG_CLOCK_SOURCE		0x6c
+#define APOLLO_CLOCK_SOURCE_SOURCE	0x00000003u
+
+/* Clock lock state (placeholder) */
+#define APOLLO_REG_CLOCK_STATUS		0x70
+#define APOLLO_CLOCK_STATUS_LOCKED	0x00000001u
+#define APOLLO_CLOCK_STATUS_RATE	0xffffff00u
+
+/* Stage a parameter change for the next period boundary (placeholder) */
+#define APOLLO_REG_PARAM		0x74
+#define APOLLO_PARAM_ID			0x000000ffu
+#define APOLLO_PARAM_RAMP		0xffffff00u
+
+/* Value of the staged parameter; writing it commits the change (placeholder) */
+#define APOLLO_REG_PARAM_VALUE		0x78
+
+/* Register values */
+#define APOLLO_CMD_START		0x01
+#define APOLLO_CMD_STOP			0x02
+#define APOLLO_CMD_RESET		0x03
+#define APOLLO_CMD_FW_CHUNK		0x04	/* consume chunk staged in the bulk window */
+#define APOLLO_CMD_FW_BOOT		0x05	/* start the uploaded firmware */
+
+#define APOLLO_FORMAT_S16_LE		0
+#define APOLLO_FORMAT_S24_3LE		1
+#define APOLLO_FORMAT_S32_LE		2
+
+#define APOLLO_CLOCK_INTERNAL		0
+#define APOLLO_CLOCK_SPDIF		1
+#define APOLLO_CLOCK_ADAT		2
+
+#define APOLLO_PARAM_MASTER_L		0	/* main output left level, 0-100 */
+#define APOLLO_PARAM_MASTER_R		1	/* main output right level, 0-100 */
+#define APOLLO_PARAM_MONITOR		2	/* monitor level, 0-100 */
+
+#endif // APOLLO_REGS_H
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo systemd Integration
+ *
+ * sd_notify(3) and sd_listen_fds(3) as documented by systemd: a datagram
+ * to the AF_UNIX socket in $NOTIFY_SOCKET, where a leading '@' means the
+ * abstract namespace, and $LISTEN_FDS descriptors from 3 on, meant for us
+ * if $LISTEN_PID is our PID.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "apollo_systemd.h"
+
+int apollo_sd_notify(const char *state)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	const char *path = getenv("NOTIFY_SOCKET");
+	size_t len;
+	socklen_t alen;
+	int fd, ret = 1;
+
+	if (!path || !*path)
+		return 0;
+
+	len = strlen(path);
+	if ((path[0] != '/' && path[0] != '@') || len >= sizeof(sun.sun_path))
+		return -EAFNOSUPPORT;
+
+	memcpy(sun.sun_path, path, len);
+	if (sun.sun_path[0] == '@')
+		sun.sun_path[0] = '\0';
+	alen = offsetof(struct sockaddr_un, sun_path) + len;
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *)&sun, alen) < 0)
+		ret = -errno;
+
+	close(fd);
+	return ret;
+}
+
+int apollo_sd_listen_fds(void)
+{
+	const char *pid = getenv("LISTEN_PID");
+	const char *fds = getenv("LISTEN_FDS");
+	int n = 0, fd;
+
+	if (pid && fds && strtol(pid, NULL, 10) == getpid())
+		n = strtol(fds, NULL, 10);
+	if (n < 0)
+		n = 0;
+
+	for (fd = APOLLO_SD_LISTEN_FDS_START; fd < APOLLO_SD_LISTEN_FDS_START + n; fd++)
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+	return n;
+}
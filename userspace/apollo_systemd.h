@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo systemd Integration
+ *
+ * The two pieces of the systemd protocol apollod uses, readiness
+ * notification and socket activation, without linking libsystemd. Both
+ * do nothing when not started by systemd.
+ */
+
+#ifndef _APOLLO_SYSTEMD_H
+#define _APOLLO_SYSTEMD_H
+
+/* First descriptor passed by socket activation */
+#define APOLLO_SD_LISTEN_FDS_START	3
+
+/*
+ * Send a state string such as "READY=1" to the service manager. Returns 1
+ * if sent, 0 if there is no manager to tell, or a negative errno.
+ */
+int apollo_sd_notify(const char *state);
+
+/*
+ * Number of sockets passed to this process, starting at
+ * APOLLO_SD_LISTEN_FDS_START, or 0 for none. They are made close-on-exec
+ * and the environment is cleared, so children do not inherit them.
+ */
+int apollo_sd_listen_fds(void);
+
+#endif /* _APOLLO_SYSTEMD_H */
@@ -0,0 +1,821 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo VFIO Streaming Engine
+ *
+ * The device is programmed with the same register sequences as the kernel
+ * driver (kernel/apollo_seq.h). The IOMMU makes the ring contiguous in
+ * IOVA space, so the engine always runs in contiguous mode and reads the
+ * position from DMA_ADDR, with no descriptor table.
+ *
+ * The engine thread owns the position: it polls the DMA position, keeps a
+ * 64-bit frame count in the shared ring and checks at every period boundary
+ * that the client has written the whole period being played.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/vfio.h>
+#include "apollo_regs.h"
+#include "apollo_vfio.h"
+
+#define APOLLO_VFIO_IOVA	0x10000000ULL	/* where the ring is mapped for the device */
+#define APOLLO_VFIO_BAR_MAP	0x1000		/* control window, see APOLLO_CTRL_WINDOW_SIZE */
+#define APOLLO_VFIO_MAX_BUFFER	(8 * 1024 * 1024)
+#define APOLLO_VFIO_MAX_PERIOD	(512 * 1024)
+#define APOLLO_MOCK_REGS	(APOLLO_VFIO_BAR_MAP / 4)
+
+#define PCI_COMMAND_OFFSET	0x04
+#define PCI_COMMAND_MASTER	0x4
+
+static void apollo_vfio_msleep(unsigned int ms)
+{
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+/* Register sequences shared with the kernel driver */
+#define APOLLO_SEQ_CTX				struct apollo_vfio_backend
+#define apollo_seq_read(be, reg)		((be)->read32((be), (reg)))
+#define apollo_seq_write(be, reg, val)		((be)->write32((be), (reg), (val)))
+#define apollo_seq_msleep(ms)			apollo_vfio_msleep(ms)
+#include "../kernel/apollo_seq.h"
+
+/* writel() ordering: ring stores reach memory before the register write */
+static inline void apollo_vfio_wmb(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ __volatile__("" ::: "memory");
+#elif defined(__aarch64__)
+	__asm__ __volatile__("dmb oshst" ::: "memory");
+#else
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void apollo_vfio_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static uint64_t apollo_vfio_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int apollo_vfio_frame_bytes(uint32_t format, unsigned int channels)
+{
+	static const unsigned int sample_bytes[] = {
+		[APOLLO_FORMAT_S16_LE] = 2,
+		[APOLLO_FORMAT_S24_3LE] = 3,
+		[APOLLO_FORMAT_S32_LE] = 4,
+	};
+
+	if (format > APOLLO_FORMAT_S32_LE)
+		return 0;
+	return sample_bytes[format] * channels;
+}
+
+/* VFIO backend */
+
+struct apollo_vfio_dev {
+	struct apollo_vfio_backend be;
+	int container;
+	int group;
+	int device;
+	volatile uint8_t *bar;
+	size_t bar_size;
+};
+
+static uint32_t apollo_vfio_dev_read32(struct apollo_vfio_backend *be, uint32_t reg)
+{
+	struct apollo_vfio_dev *dev = (struct apollo_vfio_dev *)be;
+
+	return *(volatile uint32_t *)(dev->bar + reg);
+}
+
+static void apollo_vfio_dev_write32(struct apollo_vfio_backend *be, uint32_t reg, uint32_t val)
+{
+	struct apollo_vfio_dev *dev = (struct apollo_vfio_dev *)be;
+
+	apollo_vfio_wmb();
+	*(volatile uint32_t *)(dev->bar + reg) = val;
+}
+
+static int apollo_vfio_dev_map_dma(struct apollo_vfio_backend *be, void *vaddr, size_t size,
+				   uint64_t iova)
+{
+	struct apollo_vfio_dev *dev = (struct apollo_vfio_dev *)be;
+	struct vfio_iommu_type1_dma_map map = {
+		.argsz = sizeof(map),
+		.flags = VFIO_DMA_MAP_FLAG_READ | VFIO_DMA_MAP_FLAG_WRITE,
+		.vaddr = (uintptr_t)vaddr,
+		.iova = iova,
+		.size = size,
+	};
+
+	if (ioctl(dev->container, VFIO_IOMMU_MAP_DMA, &map) < 0)
+		return -errno;
+	return 0;
+}
+
+static void apollo_vfio_dev_unmap_dma(struct apollo_vfio_backend *be, uint64_t iova, size_t size)
+{
+	struct apollo_vfio_dev *dev = (struct apollo_vfio_dev *)be;
+	struct vfio_iommu_type1_dma_unmap unmap = {
+		.argsz = sizeof(unmap),
+		.iova = iova,
+		.size = size,
+	};
+
+	ioctl(dev->container, VFIO_IOMMU_UNMAP_DMA, &unmap);
+}
+
+static void apollo_vfio_dev_close(struct apollo_vfio_backend *be)
+{
+	struct apollo_vfio_dev *dev = (struct apollo_vfio_dev *)be;
+
+	if (dev->bar)
+		munmap((void *)dev->bar, dev->bar_size);
+	if (dev->device >= 0)
+		close(dev->device);
+	if (dev->group >= 0)
+		close(dev->group);
+	if (dev->container >= 0)
+		close(dev->container);
+	free(dev);
+}
+
+/* /dev/vfio/<group> for a PCI address */
+static int apollo_vfio_group_path(const char *bdf, char *path, size_t len)
+{
+	char link[128], target[PATH_MAX];
+	const char *group;
+	ssize_t n;
+
+	snprintf(link, sizeof(link), "/sys/bus/pci/devices/%s/iommu_group", bdf);
+	n = readlink(link, target, sizeof(target) - 1);
+	if (n < 0)
+		return -errno;
+	target[n] = '\0';
+
+	group = strrchr(target, '/');
+	if (snprintf(path, len, "/dev/vfio/%s", group ? group + 1 : target) >= (int)len)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+static int apollo_vfio_enable_master(struct apollo_vfio_dev *dev)
+{
+	struct vfio_region_info cfg = {
+		.argsz = sizeof(cfg),
+		.index = VFIO_PCI_CONFIG_REGION_INDEX,
+	};
+	uint16_t cmd;
+
+	if (ioctl(dev->device, VFIO_DEVICE_GET_REGION_INFO, &cfg) < 0)
+		return -errno;
+	if (pread(dev->device, &cmd, sizeof(cmd), cfg.offset + PCI_COMMAND_OFFSET) != sizeof(cmd))
+		return -EIO;
+	cmd |= PCI_COMMAND_MASTER;
+	if (pwrite(dev->device, &cmd, sizeof(cmd), cfg.offset + PCI_COMMAND_OFFSET) != sizeof(cmd))
+		return -EIO;
+	return 0;
+}
+
+struct apollo_vfio_backend *apollo_vfio_open(const char *bdf)
+{
+	struct vfio_group_status status = { .argsz = sizeof(status) };
+	struct vfio_region_info bar = {
+		.argsz = sizeof(bar),
+		.index = VFIO_PCI_BAR0_REGION_INDEX,
+	};
+	struct apollo_vfio_dev *dev;
+	char path[PATH_MAX];
+	void *map;
+	int err;
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev)
+		return NULL;
+	dev->container = dev->group = dev->device = -1;
+	dev->be.name = "vfio";
+	dev->be.read32 = apollo_vfio_dev_read32;
+	dev->be.write32 = apollo_vfio_dev_write32;
+	dev->be.map_dma = apollo_vfio_dev_map_dma;
+	dev->be.unmap_dma = apollo_vfio_dev_unmap_dma;
+	dev->be.close = apollo_vfio_dev_close;
+
+	dev->container = open("/dev/vfio/vfio", O_RDWR);
+	if (dev->container < 0) {
+		fprintf(stderr, "apollo_vfio: /dev/vfio/vfio: %s\n", strerror(errno));
+		goto fail;
+	}
+	if (ioctl(dev->container, VFIO_GET_API_VERSION) != VFIO_API_VERSION ||
+	    !ioctl(dev->container, VFIO_CHECK_EXTENSION, VFIO_TYPE1_IOMMU)) {
+		fprintf(stderr, "apollo_vfio: type1 IOMMU not supported\n");
+		goto fail;
+	}
+
+	err = apollo_vfio_group_path(bdf, path, sizeof(path));
+	if (err) {
+		fprintf(stderr, "apollo_vfio: no IOMMU group for %s: %s\n", bdf, strerror(-err));
+		goto fail;
+	}
+	dev->group = open(path, O_RDWR);
+	if (dev->group < 0) {
+		fprintf(stderr, "apollo_vfio: %s: %s (is %s bound to vfio-pci?)\n",
+			path, strerror(errno), bdf);
+		goto fail;
+	}
+	if (ioctl(dev->group, VFIO_GROUP_GET_STATUS, &status) < 0 ||
+	    !(status.flags & VFIO_GROUP_FLAGS_VIABLE)) {
+		fprintf(stderr, "apollo_vfio: group %s not viable; bind all its devices to vfio-pci\n",
+			path);
+		goto fail;
+	}
+	if (ioctl(dev->group, VFIO_GROUP_SET_CONTAINER, &dev->container) < 0 ||
+	    ioctl(dev->container, VFIO_SET_IOMMU, VFIO_TYPE1_IOMMU) < 0) {
+		fprintf(stderr, "apollo_vfio: IOMMU setup: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	dev->device = ioctl(dev->group, VFIO_GROUP_GET_DEVICE_FD, bdf);
+	if (dev->device < 0) {
+		fprintf(stderr, "apollo_vfio: %s: %s\n", bdf, strerror(errno));
+		goto fail;
+	}
+
+	if (ioctl(dev->device, VFIO_DEVICE_GET_REGION_INFO, &bar) < 0 ||
+	    !(bar.flags & VFIO_REGION_INFO_FLAG_MMAP)) {
+		fprintf(stderr, "apollo_vfio: BAR0 cannot be mapped\n");
+		goto fail;
+	}
+
+	/* Only the strictly ordered control window; nothing else is used */
+	dev->bar_size = bar.size < APOLLO_VFIO_BAR_MAP ? bar.size : APOLLO_VFIO_BAR_MAP;
+	map = mmap(NULL, dev->bar_size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->device,
+		   bar.offset);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "apollo_vfio: BAR0 mmap: %s\n", strerror(errno));
+		goto fail;
+	}
+	dev->bar = map;
+
+	err = apollo_vfio_enable_master(dev);
+	if (err) {
+		fprintf(stderr, "apollo_vfio: enabling bus mastering: %s\n", strerror(-err));
+		goto fail;
+	}
+
+	return &dev->be;
+
+fail:
+	apollo_vfio_dev_close(&dev->be);
+	return NULL;
+}
+
+/* Mock backend */
+
+struct apollo_mock {
+	struct apollo_vfio_backend be;
+	uint32_t regs[APOLLO_MOCK_REGS];
+	unsigned int channels;
+	bool running;
+	uint64_t start_ns;
+};
+
+/* Bytes the emulated engine has played since START */
+static uint64_t apollo_mock_played(struct apollo_mock *mock)
+{
+	uint32_t rate = mock->regs[APOLLO_REG_SAMPLE_RATE / 4];
+	uint32_t format = mock->regs[APOLLO_REG_FORMAT / 4] & APOLLO_FORMAT_FORMAT;
+	uint64_t ns = apollo_vfio_now_ns() - mock->start_ns;
+	uint64_t frames;
+
+	frames = ns / 1000000000ULL * rate + ns % 1000000000ULL * rate / 1000000000ULL;
+	return frames * apollo_vfio_frame_bytes(format, mock->channels);
+}
+
+static uint32_t apollo_mock_read32(struct apollo_vfio_backend *be, uint32_t reg)
+{
+	struct apollo_mock *mock = (struct apollo_mock *)be;
+	uint32_t size = mock->regs[APOLLO_REG_DMA_SIZE / 4];
+
+	if (reg / 4 >= APOLLO_MOCK_REGS)
+		return 0xffffffff;
+
+	switch (reg) {
+	case APOLLO_REG_STATUS:
+		return mock->regs[reg / 4] | (mock->running ? APOLLO_STATUS_RUNNING : 0);
+	case APOLLO_REG_DMA_ADDR:
+		if (!mock->running || !size)
+			break;
+		return mock->regs[reg / 4] + apollo_mock_played(mock) % size;
+	case APOLLO_REG_DMA_POS:
+		return mock->running && size ? apollo_mock_played(mock) % size : 0;
+	case APOLLO_REG_CLOCK_STATUS:
+		return APOLLO_CLOCK_STATUS_LOCKED |
+		       (mock->regs[APOLLO_REG_SAMPLE_RATE / 4] << 8);
+	}
+
+	return mock->regs[reg / 4];
+}
+
+static void apollo_mock_write32(struct apollo_vfio_backend *be, uint32_t reg, uint32_t val)
+{
+	struct apollo_mock *mock = (struct apollo_mock *)be;
+
+	if (reg / 4 >= APOLLO_MOCK_REGS)
+		return;
+
+	switch (reg) {
+	case APOLLO_REG_CONTROL:
+		if ((val & APOLLO_CONTROL_CMD) == APOLLO_CMD_RESET) {
+			memset(mock->regs, 0, sizeof(mock->regs));
+			mock->running = false;
+			mock->regs[APOLLO_REG_STATUS / 4] = APOLLO_STATUS_READY;
+		}
+		return;
+	case APOLLO_REG_STATUS:
+		mock->regs[reg / 4] &= ~val;
+		return;
+	case APOLLO_REG_DMA_CONTROL:
+		switch (val & APOLLO_DMA_CONTROL_CMD) {
+		case APOLLO_CMD_START:
+			mock->start_ns = apollo_vfio_now_ns();
+			mock->running = true;
+			break;
+		case APOLLO_CMD_STOP:
+			mock->running = false;
+			break;
+		}
+		return;
+	}
+
+	mock->regs[reg / 4] = val;
+}
+
+/* The mock has no IOMMU; the ring is never read */
+static int apollo_mock_map_dma(struct apollo_vfio_backend *be, void *vaddr, size_t size,
+			       uint64_t iova)
+{
+	(void)be;
+	(void)vaddr;
+	(void)size;
+	(void)iova;
+	return 0;
+}
+
+static void apollo_mock_unmap_dma(struct apollo_vfio_backend *be, uint64_t iova, size_t size)
+{
+	(void)be;
+	(void)iova;
+	(void)size;
+}
+
+static void apollo_mock_close(struct apollo_vfio_backend *be)
+{
+	free(be);
+}
+
+struct apollo_vfio_backend *apollo_vfio_mock_open(unsigned int channels)
+{
+	struct apollo_mock *mock = calloc(1, sizeof(*mock));
+
+	if (!mock)
+		return NULL;
+
+	mock->channels = channels;
+	mock->be.name = "mock";
+	mock->be.read32 = apollo_mock_read32;
+	mock->be.write32 = apollo_mock_write32;
+	mock->be.map_dma = apollo_mock_map_dma;
+	mock->be.unmap_dma = apollo_mock_unmap_dma;
+	mock->be.close = apollo_mock_close;
+	return &mock->be;
+}
+
+/* Engine */
+
+struct apollo_vfio_engine {
+	struct apollo_vfio_backend *be;
+	struct apollo_vfio_config config;
+	struct apollo_vfio_shm *shm;
+	size_t shm_bytes;
+	uint8_t *data;
+	size_t ring_bytes;
+	size_t map_bytes;
+	uint64_t iova;
+	bool mapped;
+	bool started;
+	int stop;
+	pthread_t thread;
+	struct apollo_vfio_stats stats;
+};
+
+void apollo_vfio_default_config(struct apollo_vfio_config *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->rate = 48000;
+	config->format = APOLLO_FORMAT_S32_LE;
+	config->channels = 2;
+	config->period_frames = 32;
+	config->periods = 4;
+	config->cpu = -1;
+	config->busy_poll = true;
+	config->shm_name = APOLLO_VFIO_SHM_NAME;
+}
+
+/* The layout rules the DMA engine relies on, as in apollo_check_period_layout() */
+static int apollo_vfio_check_config(const struct apollo_vfio_config *config)
+{
+	unsigned int frame_bytes = apollo_vfio_frame_bytes(config->format, config->channels);
+	uint64_t period_bytes = (uint64_t)config->period_frames * frame_bytes;
+
+	if (!frame_bytes || !config->rate || config->channels > 8)
+		return -EINVAL;
+	if (period_bytes < 64 || period_bytes > APOLLO_VFIO_MAX_PERIOD)
+		return -EINVAL;
+	if (config->periods < 2 || period_bytes * config->periods > APOLLO_VFIO_MAX_BUFFER)
+		return -EINVAL;
+	return 0;
+}
+
+static void *apollo_vfio_shm_create(const char *name, size_t bytes)
+{
+	void *map;
+	int fd;
+
+	if (!name)
+		map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	else {
+		fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0660);
+		if (fd < 0)
+			return NULL;
+		if (ftruncate(fd, bytes) < 0) {
+			close(fd);
+			shm_unlink(name);
+			return NULL;
+		}
+		map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED)
+			shm_unlink(name);
+	}
+
+	return map == MAP_FAILED ? NULL : map;
+}
+
+int apollo_vfio_engine_create(struct apollo_vfio_engine **enginep,
+			      struct apollo_vfio_backend *be,
+			      const struct apollo_vfio_config *config)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	struct apollo_vfio_engine *engine;
+	unsigned int frame_bytes;
+	int err;
+
+	err = apollo_vfio_check_config(config);
+	if (err)
+		return err;
+
+	engine = calloc(1, sizeof(*engine));
+	if (!engine)
+		return -ENOMEM;
+
+	engine->be = be;
+	engine->config = *config;
+	engine->iova = APOLLO_VFIO_IOVA;
+	frame_bytes = apollo_vfio_frame_bytes(config->format, config->channels);
+	engine->ring_bytes = (size_t)config->period_frames * config->periods * frame_bytes;
+	engine->map_bytes = (engine->ring_bytes + page - 1) / page * page;
+
+	/* Header page, then the ring; the ring alone is mapped for the device */
+	engine->shm_bytes = page + engine->map_bytes;
+	engine->shm = apollo_vfio_shm_create(config->shm_name, engine->shm_bytes);
+	if (!engine->shm) {
+		err = -errno;
+		free(engine);
+		return err;
+	}
+	engine->data = (uint8_t *)engine->shm + page;
+
+	/* Page faults in the engine thread would cost whole periods */
+	mlock(engine->shm, engine->shm_bytes);
+
+	engine->shm->magic = APOLLO_VFIO_SHM_MAGIC;
+	engine->shm->version = APOLLO_VFIO_SHM_VERSION;
+	engine->shm->rate = config->rate;
+	engine->shm->format = config->format;
+	engine->shm->channels = config->channels;
+	engine->shm->frame_bytes = frame_bytes;
+	engine->shm->period_frames = config->period_frames;
+	engine->shm->buffer_frames = config->period_frames * config->periods;
+	engine->shm->data_offset = page;
+
+	err = be->map_dma(be, engine->data, engine->map_bytes, engine->iova);
+	if (err) {
+		apollo_vfio_engine_destroy(engine);
+		return err;
+	}
+	engine->mapped = true;
+
+	*enginep = engine;
+	return 0;
+}
+
+/* A period boundary was crossed; hw is the new frame count */
+static void apollo_vfio_period(struct apollo_vfio_engine *engine, uint64_t hw, uint64_t period,
+			       uint64_t polls)
+{
+	struct apollo_vfio_shm *shm = engine->shm;
+	struct apollo_vfio_stats *stats = &engine->stats;
+	uint64_t late_ns, appl;
+
+	/* Frames already past the boundary when the poll saw it */
+	late_ns = (hw % shm->period_frames) * 1000000000ULL / shm->rate;
+
+	__atomic_store_n(&shm->periods, period, __ATOMIC_RELEASE);
+
+	/* The period now playing must have been written in full */
+	appl = __atomic_load_n(&shm->appl_frames, __ATOMIC_ACQUIRE);
+	if (appl && appl < (period + 1) * shm->period_frames) {
+		memset(engine->data, 0, engine->ring_bytes);
+		__atomic_store_n(&shm->appl_frames, 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&shm->xruns, shm->xruns + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&stats->xruns, stats->xruns + 1, __ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&stats->periods, period, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->polls, polls, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->wake_total_ns, stats->wake_total_ns + late_ns, __ATOMIC_RELAXED);
+	if (late_ns > stats->wake_max_ns)
+		__atomic_store_n(&stats->wake_max_ns, late_ns, __ATOMIC_RELAXED);
+}
+
+static void *apollo_vfio_engine_thread(void *arg)
+{
+	struct apollo_vfio_engine *engine = arg;
+	struct apollo_vfio_shm *shm = engine->shm;
+	uint32_t buffer = shm->buffer_frames;
+	uint64_t period_ns = shm->period_frames * 1000000000ULL / shm->rate;
+	struct timespec nap = { 0, period_ns / 4 };
+	uint64_t hw = 0, period = 0, polls = 0;
+	uint32_t last = 0;
+
+	while (!__atomic_load_n(&engine->stop, __ATOMIC_ACQUIRE)) {
+		long ofs = apollo_seq_ring_pos(engine->be, false, engine->iova, engine->ring_bytes);
+		uint32_t cur, delta;
+
+		polls++;
+		if (ofs < 0) {
+			__atomic_store_n(&engine->stats.bad_pos, engine->stats.bad_pos + 1,
+					 __ATOMIC_RELAXED);
+		} else {
+			cur = ofs / shm->frame_bytes;
+			delta = cur >= last ? cur - last : cur + buffer - last;
+			last = cur;
+
+			if (delta) {
+				hw += delta;
+				__atomic_store_n(&shm->hw_frames, hw, __ATOMIC_RELEASE);
+				if (hw / shm->period_frames != period) {
+					period = hw / shm->period_frames;
+					apollo_vfio_period(engine, hw, period, polls);
+				}
+			}
+		}
+
+		if (engine->config.busy_poll)
+			apollo_vfio_cpu_relax();
+		else
+			nanosleep(&nap, NULL);
+	}
+
+	return NULL;
+}
+
+static int apollo_vfio_spawn(struct apollo_vfio_engine *engine, bool rt)
+{
+	struct sched_param param = { .sched_priority = engine->config.rt_priority };
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int err;
+
+	pthread_attr_init(&attr);
+	if (engine->config.cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(engine->config.cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+	if (rt) {
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &param);
+	}
+
+	err = pthread_create(&engine->thread, &attr, apollo_vfio_engine_thread, engine);
+	pthread_attr_destroy(&attr);
+	return -err;
+}
+
+int apollo_vfio_engine_start(struct apollo_vfio_engine *engine)
+{
+	struct apollo_vfio_backend *be = engine->be;
+	int err;
+
+	if (engine->started)
+		return -EBUSY;
+
+	/* Same order as apollo_hw_init(), apollo_pcm_prepare() and trigger */
+	err = apollo_seq_reset(be);
+	if (err)
+		return err;
+	apollo_seq_configure(be, engine->config.rate, engine->config.format);
+	apollo_seq_dma_ring(be, engine->iova, engine->ring_bytes);
+
+	memset(engine->data, 0, engine->ring_bytes);
+	memset(&engine->stats, 0, sizeof(engine->stats));
+	engine->shm->hw_frames = 0;
+	engine->shm->appl_frames = 0;
+	engine->shm->periods = 0;
+	engine->shm->xruns = 0;
+	__atomic_store_n(&engine->stop, 0, __ATOMIC_RELEASE);
+
+	apollo_seq_start(be, false);
+
+	err = apollo_vfio_spawn(engine, engine->config.rt_priority > 0);
+	if (err == -EPERM) {
+		fprintf(stderr, "apollo_vfio: no permission for SCHED_FIFO, running unprioritised\n");
+		err = apollo_vfio_spawn(engine, false);
+	}
+	if (err) {
+		apollo_seq_stop(be);
+		return err;
+	}
+
+	__atomic_store_n(&engine->shm->running, 1, __ATOMIC_RELEASE);
+	engine->started = true;
+	return 0;
+}
+
+void apollo_vfio_engine_stop(struct apollo_vfio_engine *engine)
+{
+	if (!engine->started)
+		return;
+
+	__atomic_store_n(&engine->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(engine->thread, NULL);
+	apollo_seq_stop(engine->be);
+	__atomic_store_n(&engine->shm->running, 0, __ATOMIC_RELEASE);
+	engine->started = false;
+}
+
+void apollo_vfio_engine_stats(struct apollo_vfio_engine *engine, struct apollo_vfio_stats *stats)
+{
+	stats->periods = __atomic_load_n(&engine->stats.periods, __ATOMIC_RELAXED);
+	stats->xruns = __atomic_load_n(&engine->stats.xruns, __ATOMIC_RELAXED);
+	stats->polls = __atomic_load_n(&engine->stats.polls, __ATOMIC_RELAXED);
+	stats->bad_pos = __atomic_load_n(&engine->stats.bad_pos, __ATOMIC_RELAXED);
+	stats->wake_max_ns = __atomic_load_n(&engine->stats.wake_max_ns, __ATOMIC_RELAXED);
+	stats->wake_total_ns = __atomic_load_n(&engine->stats.wake_total_ns, __ATOMIC_RELAXED);
+}
+
+struct apollo_vfio_shm *apollo_vfio_engine_shm(struct apollo_vfio_engine *engine)
+{
+	return engine->shm;
+}
+
+void apollo_vfio_engine_destroy(struct apollo_vfio_engine *engine)
+{
+	if (!engine)
+		return;
+
+	apollo_vfio_engine_stop(engine);
+	if (engine->mapped)
+		engine->be->unmap_dma(engine->be, engine->iova, engine->map_bytes);
+	munmap(engine->shm, engine->shm_bytes);
+	if (engine->config.shm_name)
+		shm_unlink(engine->config.shm_name);
+	free(engine);
+}
+
+/* Client side */
+
+struct apollo_vfio_shm *apollo_vfio_attach(const char *name, size_t *size)
+{
+	struct apollo_vfio_shm *shm;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = shm_open(name ? name : APOLLO_VFIO_SHM_NAME, O_RDWR, 0);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*shm)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	shm = map;
+	if (shm->magic != APOLLO_VFIO_SHM_MAGIC || shm->version != APOLLO_VFIO_SHM_VERSION) {
+		munmap(map, st.st_size);
+		errno = EPROTO;
+		return NULL;
+	}
+
+	*size = st.st_size;
+	return shm;
+}
+
+void apollo_vfio_detach(struct apollo_vfio_shm *shm, size_t size)
+{
+	munmap(shm, size);
+}
+
+/*
+ * Begin streaming one period after the next boundary. The period in
+ * between plays silence, so the client always has at least a full period
+ * to write its first one, however close to a boundary it starts. Fails
+ * with -EBUSY if a client is already streaming.
+ */
+int apollo_vfio_client_start(struct apollo_vfio_shm *shm)
+{
+	uint64_t hw = __atomic_load_n(&shm->hw_frames, __ATOMIC_ACQUIRE);
+	uint64_t start = (hw / shm->period_frames + 2) * shm->period_frames;
+	uint64_t idle = 0;
+
+	if (!__atomic_load_n(&shm->running, __ATOMIC_ACQUIRE))
+		return -ENODEV;
+	if (!__atomic_compare_exchange_n(&shm->appl_frames, &idle, start, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return -EBUSY;
+	return 0;
+}
+
+/* Frames that can be written without overwriting unplayed ones, or -EPIPE */
+long apollo_vfio_avail(struct apollo_vfio_shm *shm)
+{
+	uint64_t appl = __atomic_load_n(&shm->appl_frames, __ATOMIC_ACQUIRE);
+	uint64_t hw = __atomic_load_n(&shm->hw_frames, __ATOMIC_ACQUIRE);
+
+	if (!appl || appl < hw)
+		return -EPIPE;
+	return shm->buffer_frames - (long)(appl - hw);
+}
+
+/* Copy up to frames frames into the ring; returns frames written or -EPIPE */
+long apollo_vfio_write(struct apollo_vfio_shm *shm, const void *buf, uint32_t frames)
+{
+	uint8_t *data = (uint8_t *)shm + shm->data_offset;
+	uint64_t appl = __atomic_load_n(&shm->appl_frames, __ATOMIC_ACQUIRE);
+	long avail = apollo_vfio_avail(shm);
+	uint32_t ofs, first;
+
+	if (avail < 0)
+		return avail;
+	if (frames > avail)
+		frames = avail;
+	if (!frames)
+		return 0;
+
+	ofs = appl % shm->buffer_frames;
+	first = shm->buffer_frames - ofs < frames ? shm->buffer_frames - ofs : frames;
+	memcpy(data + (size_t)ofs * shm->frame_bytes, buf, (size_t)first * shm->frame_bytes);
+	memcpy(data, (const uint8_t *)buf + (size_t)first * shm->frame_bytes,
+	       (size_t)(frames - first) * shm->frame_bytes);
+
+	/* The engine resets appl_frames on an underrun; don't resurrect it */
+	if (!__atomic_compare_exchange_n(&shm->appl_frames, &appl, appl + frames, false,
+					 __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		return -EPIPE;
+	return frames;
+}
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo VFIO Streaming Engine Header
+ *
+ * A user-space alternative to the kernel driver for the lowest-latency
+ * setups: the device is bound to vfio-pci, BAR0 and an IOMMU-mapped ring
+ * are driven directly, and a period engine busy-polls the DMA position on
+ * an isolated core. Clients exchange audio through a shared-memory ring
+ * whose data area is the DMA buffer itself.
+ */
+
+#ifndef _APOLLO_VFIO_H
+#define _APOLLO_VFIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define APOLLO_VFIO_SHM_NAME	"/apollo-vfio"
+#define APOLLO_VFIO_SHM_MAGIC	0x46565041	/* "APVF" */
+#define APOLLO_VFIO_SHM_VERSION	1
+
+/* Register and DMA access, one implementation per backend */
+struct apollo_vfio_backend {
+	const char *name;
+	uint32_t (*read32)(struct apollo_vfio_backend *be, uint32_t reg);
+	void (*write32)(struct apollo_vfio_backend *be, uint32_t reg, uint32_t val);
+	int (*map_dma)(struct apollo_vfio_backend *be, void *vaddr, size_t size, uint64_t iova);
+	void (*unmap_dma)(struct apollo_vfio_backend *be, uint64_t iova, size_t size);
+	void (*close)(struct apollo_vfio_backend *be);
+};
+
+/* Device bound to vfio-pci, by PCI address (e.g. "0000:01:00.0") */
+struct apollo_vfio_backend *apollo_vfio_open(const char *bdf);
+
+/*
+ * Emulated register block: reset completes at once and the DMA position
+ * advances with the wall clock at the programmed rate. No hardware needed.
+ */
+struct apollo_vfio_backend *apollo_vfio_mock_open(unsigned int channels);
+
+/*
+ * Shared-memory ring, at the start of the shm object. The counters are
+ * read and written with __atomic builtins. appl_frames is 0 while no
+ * client is streaming; after an underrun the engine resets it to 0 and
+ * the client has to call apollo_vfio_client_start() again.
+ */
+struct apollo_vfio_shm {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t rate;
+	uint32_t format;		/* APOLLO_FORMAT_* */
+	uint32_t channels;
+	uint32_t frame_bytes;
+	uint32_t period_frames;
+	uint32_t buffer_frames;
+	uint64_t data_offset;		/* ring data, from the start of the object */
+	uint64_t hw_frames;		/* frames played by the device */
+	uint64_t appl_frames;		/* end of the frames written by the client */
+	uint64_t periods;
+	uint64_t xruns;
+	uint32_t running;
+};
+
+struct apollo_vfio_config {
+	uint32_t rate;
+	uint32_t format;		/* APOLLO_FORMAT_* */
+	uint32_t channels;
+	uint32_t period_frames;
+	uint32_t periods;
+	int cpu;			/* core to pin the engine to, -1 for any */
+	int rt_priority;		/* SCHED_FIFO priority, 0 to keep the policy */
+	bool busy_poll;			/* spin on the position instead of sleeping */
+	const char *shm_name;		/* NULL for a private ring */
+};
+
+struct apollo_vfio_stats {
+	uint64_t periods;
+	uint64_t xruns;
+	uint64_t polls;			/* position reads */
+	uint64_t bad_pos;		/* position reads outside the ring */
+	uint64_t wake_max_ns;		/* period boundary to detection */
+	uint64_t wake_total_ns;
+};
+
+struct apollo_vfio_engine;
+
+void apollo_vfio_default_config(struct apollo_vfio_config *config);
+
+int apollo_vfio_engine_create(struct apollo_vfio_engine **engine,
+			      struct apollo_vfio_backend *be,
+			      const struct apollo_vfio_config *config);
+int apollo_vfio_engine_start(struct apollo_vfio_engine *engine);
+void apollo_vfio_engine_stop(struct apollo_vfio_engine *engine);
+void apollo_vfio_engine_stats(struct apollo_vfio_engine *engine,
+			      struct apollo_vfio_stats *stats);
+struct apollo_vfio_shm *apollo_vfio_engine_shm(struct apollo_vfio_engine *engine);
+void apollo_vfio_engine_destroy(struct apollo_vfio_engine *engine);
+
+/* Client side */
+struct apollo_vfio_shm *apollo_vfio_attach(const char *name, size_t *size);
+void apollo_vfio_detach(struct apollo_vfio_shm *shm, size_t size);
+int apollo_vfio_client_start(struct apollo_vfio_shm *shm);
+long apollo_vfio_avail(struct apollo_vfio_shm *shm);
+long apollo_vfio_write(struct apollo_vfio_shm *shm, const void *buf, uint32_t frames);
+
+#endif /* _APOLLO_VFIO_H */
@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo WAV/RF64 Files
+ *
+ * Header layout, all chunks little-endian:
+ *
+ *	0	"RIFF" or "RF64", size, "WAVE"
+ *	12	"JUNK" or "ds64", 28 bytes: RIFF size, data size, frames, 0
+ *	48	"fmt ", 40 bytes of WAVEFORMATEXTENSIBLE
+ *	96	"JUNK", padding up to the data chunk
+ *	4088	"data", size
+ *	4096	audio
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include "apollo_wav.h"
+
+#define WAV_FORMAT_PCM		0x0001
+#define WAV_FORMAT_FLOAT	0x0003
+#define WAV_FORMAT_EXTENSIBLE	0xfffe
+#define WAV_DS64_OFFSET		12
+#define WAV_FMT_OFFSET		48
+#define WAV_PAD_OFFSET		96
+#define WAV_DATA_OFFSET		(APOLLO_WAV_HEADER_BYTES - 8)
+
+/* KSDATAFORMAT_SUBTYPE_PCM; the first two bytes are the format tag */
+static const uint8_t wav_subtype_pcm[16] = {
+	0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+	0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71,
+};
+
+static uint16_t get_le16(const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le16toh(v);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le32toh(v);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return le64toh(v);
+}
+
+static void put_id(uint8_t *p, const char *id)
+{
+	memcpy(p, id, 4);
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+	v = htole16(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	v = htole32(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+	v = htole64(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+void apollo_wav_header(void *buf, const struct apollo_wav_format *fmt, uint64_t data_bytes)
+{
+	uint32_t block_align = fmt->channels * (fmt->bits / 8);
+	uint64_t riff_bytes = APOLLO_WAV_HEADER_BYTES - 8 + data_bytes;
+	bool rf64 = riff_bytes > UINT32_MAX;
+	uint8_t *p = buf;
+
+	memset(p, 0, APOLLO_WAV_HEADER_BYTES);
+
+	put_id(p, rf64 ? "RF64" : "RIFF");
+	put_le32(p + 4, rf64 ? UINT32_MAX : riff_bytes);
+	put_id(p + 8, "WAVE");
+
+	p += WAV_DS64_OFFSET;
+	put_id(p, rf64 ? "ds64" : "JUNK");
+	put_le32(p + 4, 28);
+	if (rf64) {
+		put_le64(p + 8, riff_bytes);
+		put_le64(p + 16, data_bytes);
+		put_le64(p + 24, data_bytes / block_align);
+	}
+
+	p = (uint8_t *)buf + WAV_FMT_OFFSET;
+	put_id(p, "fmt ");
+	put_le32(p + 4, 40);
+	put_le16(p + 8, WAV_FORMAT_EXTENSIBLE);
+	put_le16(p + 10, fmt->channels);
+	put_le32(p + 12, fmt->rate);
+	put_le32(p + 16, fmt->rate * block_align);
+	put_le16(p + 20, block_align);
+	put_le16(p + 22, fmt->bits);
+	put_le16(p + 24, 22);		/* extension size */
+	put_le16(p + 26, fmt->bits);	/* valid bits */
+	put_le32(p + 28, 0);		/* no speaker positions */
+	memcpy(p + 32, wav_subtype_pcm, sizeof(wav_subtype_pcm));
+	put_le16(p + 32, fmt->is_float ? WAV_FORMAT_FLOAT : WAV_FORMAT_PCM);
+
+	p = (uint8_t *)buf + WAV_PAD_OFFSET;
+	put_id(p, "JUNK");
+	put_le32(p + 4, WAV_DATA_OFFSET - WAV_PAD_OFFSET - 8);
+
+	p = (uint8_t *)buf + WAV_DATA_OFFSET;
+	put_id(p, "data");
+	put_le32(p + 4, rf64 ? UINT32_MAX : data_bytes);
+}
+
+static int parse_fmt(const uint8_t *p, uint32_t len, struct apollo_wav_format *fmt)
+{
+	uint16_t tag;
+
+	if (len < 16)
+		return -EINVAL;
+
+	tag = get_le16(p);
+	fmt->channels = get_le16(p + 2);
+	fmt->rate = get_le32(p + 4);
+	fmt->bits = get_le16(p + 14);
+
+	/* The subformat's first two bytes are the plain format tag */
+	if (tag == WAV_FORMAT_EXTENSIBLE) {
+		if (len < 40)
+			return -EINVAL;
+		tag = get_le16(p + 24);
+	}
+
+	fmt->is_float = tag == WAV_FORMAT_FLOAT;
+	if (tag != WAV_FORMAT_PCM && tag != WAV_FORMAT_FLOAT)
+		return -EOPNOTSUPP;
+	if (fmt->is_float ? fmt->bits != 32 :
+	    fmt->bits != 16 && fmt->bits != 24 && fmt->bits != 32)
+		return -EOPNOTSUPP;
+	if (!fmt->channels || !fmt->rate || get_le16(p + 12) != fmt->channels * fmt->bits / 8)
+		return -EINVAL;
+	return 0;
+}
+
+int apollo_wav_parse(const void *file, uint64_t size, struct apollo_wav_info *info)
+{
+	const uint8_t *base = file, *p;
+	uint64_t pos = 12, len, data_bytes = 0, ds64_data = 0;
+	uint32_t frame;
+	bool rf64, have_fmt = false;
+	int err;
+
+	if (size < 12 || memcmp(base + 8, "WAVE", 4))
+		return -EINVAL;
+	rf64 = !memcmp(base, "RF64", 4);
+	if (!rf64 && memcmp(base, "RIFF", 4))
+		return -EINVAL;
+
+	while (pos + 8 <= size) {
+		p = base + pos;
+		len = get_le32(p + 4);
+
+		if (!memcmp(p, "ds64", 4) && len >= 24 && pos + 8 + 24 <= size) {
+			ds64_data = get_le64(p + 16);
+		} else if (!memcmp(p, "fmt ", 4) && pos + 8 + len <= size) {
+			err = parse_fmt(p + 8, len, &info->fmt);
+			if (err)
+				return err;
+			have_fmt = true;
+		} else if (!memcmp(p, "data", 4)) {
+			if (!have_fmt)
+				return -EINVAL;
+			/* RF64 keeps the real size in ds64; streams in progress say 0 */
+			data_bytes = rf64 && len == UINT32_MAX ? ds64_data : len;
+			if (!data_bytes || data_bytes > size - pos - 8)
+				data_bytes = size - pos - 8;
+
+			frame = info->fmt.channels * (info->fmt.bits / 8);
+			info->data_offset = pos + 8;
+			info->data_bytes = data_bytes - data_bytes % frame;
+			return 0;
+		}
+
+		/* Chunks are padded to an even length */
+		pos += 8 + len + (len & 1);
+	}
+
+	return -EINVAL;
+}
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Apollo WAV/RF64 Files
+ *
+ * The header apollo_record writes: WAVE_FORMAT_EXTENSIBLE, padded so the
+ * audio starts at APOLLO_WAV_HEADER_BYTES and every write after it stays
+ * aligned for O_DIRECT. Space for the RF64 ds64 chunk is reserved as
+ * JUNK (EBU Tech 3306), so a file becomes RF64 in place once it passes
+ * 4 GiB. apollo_play reads any PCM or float WAV/RF64 file.
+ */
+
+#ifndef _APOLLO_WAV_H
+#define _APOLLO_WAV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define APOLLO_WAV_HEADER_BYTES	4096
+
+struct apollo_wav_format {
+	uint32_t rate;
+	uint16_t channels;
+	uint16_t bits;			/* container size: 16, 24 or 32 */
+	bool is_float;			/* IEEE float, 32 bits only */
+};
+
+struct apollo_wav_info {
+	struct apollo_wav_format fmt;
+	uint64_t data_offset;		/* from the start of the file */
+	uint64_t data_bytes;		/* whole frames, within the file */
+};
+
+/* Fill buf, APOLLO_WAV_HEADER_BYTES long, for data_bytes of audio */
+void apollo_wav_header(void *buf, const struct apollo_wav_format *fmt, uint64_t data_bytes);
+
+/*
+ * Find the format and audio of a file of size bytes, mapped at file.
+ * -EINVAL if it is not WAV/RF64, -EOPNOTSUPP for other encodings.
+ */
+int apollo_wav_parse(const void *file, uint64_t size, struct apollo_wav_info *info);
+
+#endif /* _APOLLO_WAV_H */
@@ -10,7 +10,17 @@
 #include <string.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 #include "apollo_control.h"
+#include "apollo_osc.h"
+#include "apollo_dsp.h"
 
 #define VERSION "0.1.0"
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
@@ -31,6 +41,11 @@ static void print_usage(const char *program_name)
 	printf("  save <preset>                 Save current settings\n");
 	printf("  load <preset>                 Load settings from preset\n");
 	printf("  status                        Show device status\n");
+	printf("  watch [interval_ms]           Print parameter changes as they happen\n");
+	printf("  bench [seconds]               Measure control throughput, 1-16 threads\n");
+	printf("  osc-bench [host] [port] [n]   Measure OSC round trips to apollod\n");
+	printf("  dsp-bench [channels] [rate]   Measure the software HPF/pad per period\n");
+	printf("  backend-bench [n]             Compare ctl and selem open and set costs\n");
 	printf("  help                          Show this help\n\n");
 	printf("Channels: 1-4 (analog inputs)\n");
 	printf("Sources: analog1, analog2, analog3, analog4, digital1, digital2\n");
@@ -249,6 +264,392 @@ static int cmd_status(struct apollo_control *control, int argc, char *argv[])
 	return EXIT_SUCCESS;
 }
 
+static void watch_changed(struct apollo_control *control, unsigned int field, float value,
+			  void *data)
+{
+	char name[32];
+
+	(void)control;
+	(void)data;
+
+	if (apollo_config_field_name(field, name, sizeof(name)) < 0)
+		snprintf(name, sizeof(name), "field%u", field);
+	printf("%s=%g\n", name, value);
+	fflush(stdout);
+}
+
+/* Every field, each at most once per interval; runs until interrupted */
+static int cmd_watch(struct apollo_control *control, int argc, char *argv[])
+{
+	unsigned int interval_ms = argc >= 2 ? atoi(argv[1]) : 50;
+	struct pollfd fds[2];
+	int nfds;
+
+	if (apollo_control_subscribe(control, APOLLO_FIELD_BIT(APOLLO_FIELD_COUNT) - 1,
+				     interval_ms, watch_changed, NULL) < 0) {
+		fprintf(stderr, "Failed to subscribe\n");
+		return EXIT_FAILURE;
+	}
+
+	for (;;) {
+		nfds = apollo_control_get_fds(control, fds, ARRAY_SIZE(fds));
+		if (poll(fds, nfds, -1) < 0 && errno != EINTR) {
+			perror("poll");
+			return EXIT_FAILURE;
+		}
+		apollo_control_dispatch(control);
+	}
+}
+
+#define BENCH_SETS_EVERY 100	/* one write per this many reads */
+
+struct bench_thread {
+	pthread_t tid;
+	struct apollo_control *control;
+	const atomic_int *stop;
+	float gain;
+	unsigned long gets;
+	unsigned long sets;
+	int err;
+};
+
+/* Mostly reads, writing back the current value now and then */
+static void *bench_worker(void *arg)
+{
+	struct bench_thread *t = arg;
+	float gain;
+
+	while (!atomic_load_explicit(t->stop, memory_order_relaxed)) {
+		if (apollo_control_get_analog_gain(t->control, 1, &gain) < 0) {
+			t->err = 1;
+			break;
+		}
+		if (++t->gets % BENCH_SETS_EVERY == 0) {
+			if (apollo_control_set_analog_gain(t->control, 1, t->gain) < 0) {
+				t->err = 1;
+				break;
+			}
+			t->sets++;
+		}
+	}
+
+	return NULL;
+}
+
+static int cmd_bench(struct apollo_control *control, int argc, char *argv[])
+{
+	static const int thread_counts[] = { 1, 2, 4, 8, 16 };
+	struct bench_thread threads[16];
+	struct timespec duration = { 1, 0 };
+	atomic_int stop;
+	float gain;
+	size_t i;
+	int n, j;
+
+	if (argc >= 2)
+		duration.tv_sec = atoi(argv[1]) > 0 ? atoi(argv[1]) : 1;
+
+	if (apollo_control_get_analog_gain(control, 1, &gain) < 0) {
+		fprintf(stderr, "Failed to get gain\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%8s %16s %16s\n", "threads", "gets/s", "sets/s");
+	for (i = 0; i < ARRAY_SIZE(thread_counts); i++) {
+		unsigned long gets = 0, sets = 0;
+		int err = 0;
+
+		n = thread_counts[i];
+		atomic_store_explicit(&stop, 0, memory_order_relaxed);
+		for (j = 0; j < n; j++) {
+			threads[j] = (struct bench_thread) {
+				.control = control,
+				.stop = &stop,
+				.gain = gain,
+			};
+			if (pthread_create(&threads[j].tid, NULL, bench_worker, &threads[j])) {
+				fprintf(stderr, "Failed to start thread %d\n", j);
+				atomic_store_explicit(&stop, 1, memory_order_relaxed);
+				n = j;
+				err = 1;
+				break;
+			}
+		}
+
+		nanosleep(&duration, NULL);
+		atomic_store_explicit(&stop, 1, memory_order_relaxed);
+
+		for (j = 0; j < n; j++) {
+			pthread_join(threads[j].tid, NULL);
+			gets += threads[j].gets;
+			sets += threads[j].sets;
+			err |= threads[j].err;
+		}
+
+		if (err) {
+			fprintf(stderr, "Control access failed with %d threads\n", n);
+			return EXIT_FAILURE;
+		}
+
+		printf("%8d %16.0f %16.0f\n", n,
+		       (double)gets / duration.tv_sec, (double)sets / duration.tv_sec);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+#define OSC_BENCH_TIMEOUT_MS 1000
+
+struct osc_bench_reply {
+	int32_t seq;
+	int32_t apply_us;
+	int32_t result;
+	int found;
+};
+
+static void osc_bench_handler(void *ctx, const char *address,
+			      const struct apollo_osc_arg *args, int nargs)
+{
+	struct osc_bench_reply *reply = ctx;
+
+	if (strcmp(address, "/apollo/synced") != 0 || nargs < 3)
+		return;
+	reply->seq = args[0].i;
+	reply->apply_us = args[1].i;
+	reply->result = args[2].i;
+	reply->found = 1;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double elapsed_us(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e6 + (b->tv_nsec - a->tv_nsec) / 1e3;
+}
+
+/*
+ * One bundle at a time, each a gain change plus /apollo/sync: the reply
+ * comes after the device write, so this is message to device write and
+ * back. apollod reports its own share, receive to device write.
+ */
+static int cmd_osc_bench(int argc, char *argv[])
+{
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	const char *host = argc >= 2 ? argv[1] : "127.0.0.1";
+	int port = argc >= 3 ? atoi(argv[2]) : APOLLO_OSC_PORT;
+	int count = argc >= 4 && atoi(argv[3]) > 0 ? atoi(argv[3]) : 1000;
+	struct apollo_osc_buf buf;
+	double *rtt, apply_sum = 0, rtt_sum = 0;
+	uint8_t rx[APOLLO_OSC_MAX_PACKET];
+	int sock, i, done = 0, lost = 0, ret = EXIT_FAILURE;
+
+	if (inet_pton(AF_INET, host, &sin.sin_addr) != 1) {
+		fprintf(stderr, "Invalid IPv4 address: %s\n", host);
+		return EXIT_FAILURE;
+	}
+	sin.sin_port = htons(port);
+
+	rtt = calloc(count, sizeof(*rtt));
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (!rtt || sock < 0 || connect(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		perror("osc-bench");
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct osc_bench_reply reply = { 0 };
+		struct pollfd pfd = { .fd = sock, .events = POLLIN };
+		struct timespec t0, t1;
+		ssize_t len;
+
+		/* Alternate between two gains so every update writes the device */
+		apollo_osc_buf_init(&buf, 1);
+		apollo_osc_buf_message(&buf, "/apollo/analog/1/gain", "f", (i & 1) ? 10.0 : 20.0);
+		apollo_osc_buf_message(&buf, "/apollo/sync", "i", i);
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (send(sock, buf.data, buf.len, 0) < 0) {
+			perror("osc-bench: send");
+			goto out;
+		}
+
+		/* Skip stale replies to requests that timed out */
+		while (!reply.found || reply.seq != i) {
+			reply.found = 0;
+			if (poll(&pfd, 1, OSC_BENCH_TIMEOUT_MS) <= 0)
+				break;
+			len = recv(sock, rx, sizeof(rx), 0);
+			if (len < 0) {
+				if (errno == ECONNREFUSED) {
+					fprintf(stderr, "Nothing listening on %s:%d\n", host, port);
+					goto out;
+				}
+				continue;
+			}
+			apollo_osc_parse(rx, len, osc_bench_handler, &reply);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+
+		if (!reply.found) {
+			lost++;
+			continue;
+		}
+		if (reply.result < 0) {
+			fprintf(stderr, "Update failed: %s\n", strerror(-reply.result));
+			goto out;
+		}
+
+		rtt[done] = elapsed_us(&t0, &t1);
+		rtt_sum += rtt[done];
+		apply_sum += reply.apply_us;
+		done++;
+	}
+
+	if (!done) {
+		fprintf(stderr, "No replies from %s:%d\n", host, port);
+		goto out;
+	}
+
+	qsort(rtt, done, sizeof(*rtt), compare_double);
+	printf("%d round trips, %d lost\n", done, lost);
+	printf("round trip (us): min %.1f avg %.1f p50 %.1f p99 %.1f max %.1f\n",
+	       rtt[0], rtt_sum / done, rtt[done / 2], rtt[(int)(done * 0.99)], rtt[done - 1]);
+	printf("receive to device write in apollod (us): avg %.1f\n", apply_sum / done);
+	ret = EXIT_SUCCESS;
+
+out:
+	if (sock >= 0)
+		close(sock);
+	free(rtt);
+	return ret;
+}
+
+#define DSP_BENCH_PERIOD 32
+#define DSP_BENCH_PERIODS 200000
+
+/*
+ * Cost of the apollo_dsp capture plugin per 32-frame period with every
+ * channel filtered and padded, against the time such a period lasts.
+ */
+static int cmd_dsp_bench(int argc, char *argv[])
+{
+	unsigned int channels = argc >= 2 ? atoi(argv[1]) : APOLLO_DSP_LANES;
+	unsigned int rate = argc >= 3 ? atoi(argv[2]) : 48000;
+	static int32_t samples[DSP_BENCH_PERIOD * APOLLO_DSP_LANES];
+	static struct apollo_dsp dsp;
+	struct apollo_config config;
+	struct timespec t0, t1;
+	double ns, budget;
+	unsigned int i;
+
+	if (apollo_dsp_init(&dsp, rate, channels) < 0) {
+		fprintf(stderr, "Channels must be 1-%d\n", APOLLO_DSP_LANES);
+		return EXIT_FAILURE;
+	}
+
+	apollo_control_default_config(&config);
+	for (i = 0; i < APOLLO_DSP_LANES; i++) {
+		config.hpf_enabled[i] = true;
+		config.hpf_freq[i] = 80.0f;
+	}
+	for (i = 0; i < 4; i++)
+		config.pad_enabled[i] = true;
+	apollo_dsp_configure(&dsp, &config, true);
+
+	for (i = 0; i < ARRAY_SIZE(samples); i++)
+		samples[i] = (int32_t)(i * 2654435761u);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < DSP_BENCH_PERIODS; i++)
+		apollo_dsp_process_s32(&dsp, samples, samples, DSP_BENCH_PERIOD);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	ns = elapsed_us(&t0, &t1) * 1e3 / DSP_BENCH_PERIODS;
+	budget = 1e9 * DSP_BENCH_PERIOD / rate;
+	printf("%u channels at %u Hz, %d-frame periods\n", channels, rate, DSP_BENCH_PERIOD);
+	printf("%.0f ns per period (%.1f ns per sample), %.3f%% of the %.0f us budget\n",
+	       ns, ns / (DSP_BENCH_PERIOD * channels), 100.0 * ns / budget, budget / 1e3);
+	return EXIT_SUCCESS;
+}
+
+#define BACKEND_BENCH_OPENS 20
+
+/*
+ * Open time and per-set cost of the ctl backend against the simple-mixer
+ * one. The set cost is split into the backend's share, as the I/O thread
+ * measures it, and the whole synchronous call including the handoff.
+ */
+static int cmd_backend_bench(int argc, char *argv[])
+{
+	static const struct {
+		const char *name;
+		unsigned int flags;
+	} backends[] = {
+		{ "ctl", 0 },
+		{ "selem", APOLLO_CONTROL_SELEM },
+	};
+	int count = argc >= 2 && atoi(argv[1]) > 0 ? atoi(argv[1]) : 10000;
+	struct apollo_control_stats stats;
+	struct apollo_control *control;
+	struct timespec t0, t1;
+	double open_us, call_us;
+	float gain;
+	size_t b;
+	int i;
+
+	printf("%8s %12s %12s %16s\n", "backend", "open (us)", "set (us)", "in backend (us)");
+	for (b = 0; b < ARRAY_SIZE(backends); b++) {
+		/* Cold numbers would mostly measure the page cache */
+		control = apollo_control_open(backends[b].flags);
+		if (!control) {
+			fprintf(stderr, "Failed to open the %s backend\n", backends[b].name);
+			return EXIT_FAILURE;
+		}
+		apollo_control_cleanup(control);
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (i = 0; i < BACKEND_BENCH_OPENS; i++) {
+			control = apollo_control_open(backends[b].flags);
+			if (!control)
+				return EXIT_FAILURE;
+			if (i < BACKEND_BENCH_OPENS - 1)
+				apollo_control_cleanup(control);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		open_us = elapsed_us(&t0, &t1) / BACKEND_BENCH_OPENS;
+
+		if (apollo_control_get_analog_gain(control, 1, &gain) < 0)
+			gain = 0.0f;
+
+		/* Alternate between two in-range gains so every set writes the device */
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (i = 0; i < count; i++) {
+			if (apollo_control_set_analog_gain(control, 1, (i & 1) ? 10.0f : 20.0f) < 0) {
+				fprintf(stderr, "%s: failed to set gain\n", backends[b].name);
+				apollo_control_set_analog_gain(control, 1, gain);
+				apollo_control_cleanup(control);
+				return EXIT_FAILURE;
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		call_us = elapsed_us(&t0, &t1) / count;
+
+		apollo_control_set_analog_gain(control, 1, gain);
+		apollo_control_get_stats(control, &stats);
+		apollo_control_cleanup(control);
+
+		printf("%8s %12.1f %12.2f %16.2f\n", backends[b].name, open_us, call_us,
+		       stats.apply_ns / 1e3 / stats.sets);
+	}
+
+	return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
 	struct apollo_control *control;
@@ -259,6 +660,14 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	/* Talks to apollod over the network, not to the device */
+	if (strcmp(argv[1], "osc-bench") == 0)
+		return cmd_osc_bench(argc - 1, argv + 1);
+	if (strcmp(argv[1], "dsp-bench") == 0)
+		return cmd_dsp_bench(argc - 1, argv + 1);
+	if (strcmp(argv[1], "backend-bench") == 0)
+		return cmd_backend_bench(argc - 1, argv + 1);
+
 	/* Initialize control interface */
 	control = apollo_control_init();
 	if (!control) {
@@ -281,6 +690,10 @@ int main(int argc, char *argv[])
 		ret = cmd_load(control, argc - 1, argv + 1);
 	} else if (strcmp(argv[1], "status") == 0) {
 		ret = cmd_status(control, argc - 1, argv + 1);
+	} else if (strcmp(argv[1], "watch") == 0) {
+		ret = cmd_watch(control, argc - 1, argv + 1);
+	} else if (strcmp(argv[1], "bench") == 0) {
+		ret = cmd_bench(control, argc - 1, argv + 1);
 	} else if (strcmp(argv[1], "help") == 0 || strcmp(argv[1], "-h") == 0) {
 		print_usage(argv[0]);
 		ret = EXIT_SUCCESS;
@@ -14,18 +14,45 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <syslog.h>
 #include <signal.h>
 #include <errno.h>
+#include <limits.h>
 #include <pthread.h>
+#include <poll.h>
+#include <time.h>
 #include <alsa/asoundlib.h>
 #include "apollo_control.h"
+#include "apollo_osc.h"
+#include "apollo_metrics.h"
+#include "apollo_flight_report.h"
+#include "apollo_systemd.h"
 
 #define DAEMON_NAME "apollod"
 #define PID_FILE "/var/run/apollod.pid"
+#define CTL_NAME "hw:Apollo"
+#define LOOP_INTERVAL_MS 100
+#define MAX_POLL_FDS 24
+#define ATTACH_RETRY_S 1
 
 static volatile int running = 1;
+static struct timespec start_time;
 static struct apollo_control *control;
+static snd_ctl_t *clock_ctl;
+
+/* OSC gateway, off unless a port is given */
+static struct apollo_osc *osc;
+static unsigned short osc_port;
+static const char *osc_addr;
+static unsigned int osc_push_ms = APOLLO_OSC_PUSH_MS;
+
+/* Metrics endpoint on localhost, off unless a port is given */
+static struct apollo_metrics *metrics;
+static unsigned short metrics_port;
+
+/* Where flight recorder reports go */
+static const char *flight_dir = APOLLO_FLIGHT_DIR;
 
 /* Signal handler */
 static void signal_handler(int sig)
@@ -96,58 +123,242 @@ static void remove_pid_file(void)
 	unlink(PID_FILE);
 }
 
-/* Initialize ALSA mixer controls */
-static int init_alsa_mixer(void)
+/* Read a single-valued integer or boolean control by name */
+static int clock_read(const char *name, long *value)
 {
-	snd_mixer_t *mixer;
-	snd_mixer_elem_t *elem;
+	snd_ctl_elem_value_t *val;
 	int err;
 
-	err = snd_mixer_open(&mixer, 0);
-	if (err < 0) {
-		syslog(LOG_ERR, "Failed to open mixer: %s", snd_strerror(err));
+	snd_ctl_elem_value_alloca(&val);
+	snd_ctl_elem_value_set_interface(val, SND_CTL_ELEM_IFACE_MIXER);
+	snd_ctl_elem_value_set_name(val, name);
+
+	err = snd_ctl_elem_read(clock_ctl, val);
+	if (err < 0)
 		return err;
-	}
 
-	err = snd_mixer_attach(mixer, "hw:Apollo");
+	*value = snd_ctl_elem_value_get_integer(val, 0);
+	return 0;
+}
+
+static void xrun_report(void)
+{
+	snd_ctl_elem_value_t *val;
+
+	snd_ctl_elem_value_alloca(&val);
+	snd_ctl_elem_value_set_interface(val, SND_CTL_ELEM_IFACE_MIXER);
+	snd_ctl_elem_value_set_name(val, "Xrun Count");
+
+	if (snd_ctl_elem_read(clock_ctl, val) < 0)
+		return;
+
+	syslog(LOG_WARNING, "Xrun: %ld playback, %ld capture since load",
+	       snd_ctl_elem_value_get_integer(val, 0), snd_ctl_elem_value_get_integer(val, 1));
+}
+
+/* The driver froze its event ring on an xrun or engine error */
+static void flight_report(void)
+{
+	char path[PATH_MAX];
+	int ret;
+
+	ret = apollo_flight_collect(clock_ctl, control, flight_dir, path, sizeof(path));
+	if (ret > 0)
+		syslog(LOG_WARNING, "Flight recorder saved to %s", path);
+	else if (ret < 0 && ret != -ENOENT && ret != -ENODEV)
+		syslog(LOG_ERR, "Failed to collect flight recorder: %s", strerror(-ret));
+}
+
+static void clock_report(void)
+{
+	long locked = 0, rate = 0, losses = 0;
+
+	if (clock_read("Clock Lock Status", &locked) < 0)
+		return;
+	clock_read("Clock Detected Rate", &rate);
+	clock_read("Clock Lock Losses", &losses);
+
+	if (locked)
+		syslog(LOG_INFO, "Clock locked, detected rate %ld Hz", rate);
+	else
+		syslog(LOG_WARNING, "Clock not locked (%ld lock losses)", losses);
+}
+
+/*
+ * The driver raises lock and rate changes and xruns from its interrupt
+ * handler as control events, so subscribing is enough; nothing is polled.
+ * After the device went away this is retried quietly until it is back.
+ */
+static int clock_monitor_open(int retry)
+{
+	int err;
+
+	err = snd_ctl_open(&clock_ctl, CTL_NAME, SND_CTL_NONBLOCK);
 	if (err < 0) {
-		syslog(LOG_ERR, "Failed to attach mixer: %s", snd_strerror(err));
-		snd_mixer_close(mixer);
+		if (!retry)
+			syslog(LOG_INFO, "Waiting for device %s: %s", CTL_NAME,
+			       snd_strerror(err));
+		clock_ctl = NULL;
 		return err;
 	}
 
-	err = snd_mixer_selem_register(mixer, NULL, NULL);
+	err = snd_ctl_subscribe_events(clock_ctl, 1);
 	if (err < 0) {
-		syslog(LOG_ERR, "Failed to register mixer: %s", snd_strerror(err));
-		snd_mixer_close(mixer);
+		syslog(LOG_ERR, "Failed to subscribe to control events: %s", snd_strerror(err));
+		snd_ctl_close(clock_ctl);
+		clock_ctl = NULL;
 		return err;
 	}
 
-	err = snd_mixer_load(mixer);
-	if (err < 0) {
-		syslog(LOG_ERR, "Failed to load mixer: %s", snd_strerror(err));
-		snd_mixer_close(mixer);
-		return err;
+	if (retry)
+		syslog(LOG_INFO, "Device attached");
+	apollo_sd_notify("STATUS=Device attached");
+	if (metrics)
+		apollo_metrics_set_device(metrics, clock_ctl);
+
+	clock_report();
+
+	/* It may have frozen while nobody was listening */
+	flight_report();
+	return 0;
+}
+
+static void clock_monitor_close(void)
+{
+	if (metrics)
+		apollo_metrics_set_device(metrics, NULL);
+	if (clock_ctl) {
+		snd_ctl_close(clock_ctl);
+		apollo_sd_notify("STATUS=Waiting for device");
 	}
+	clock_ctl = NULL;
+}
 
-	/* Enumerate and log available controls */
-	for (elem = snd_mixer_first_elem(mixer); elem; elem = snd_mixer_elem_next(elem)) {
-		syslog(LOG_INFO, "Mixer element: %s", snd_mixer_selem_get_name(elem));
+static void clock_monitor_handle(void)
+{
+	snd_ctl_event_t *event;
+	int report = 0, xrun = 0, flight = 0;
+
+	snd_ctl_event_alloca(&event);
+
+	while (snd_ctl_read(clock_ctl, event) > 0) {
+		unsigned int mask;
+		const char *name;
+
+		if (snd_ctl_event_get_type(event) != SND_CTL_EVENT_ELEM)
+			continue;
+
+		mask = snd_ctl_event_elem_get_mask(event);
+		if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+			syslog(LOG_WARNING, "Device removed, clock monitoring stopped");
+			clock_monitor_close();
+			return;
+		}
+		if (!(mask & SND_CTL_EVENT_MASK_VALUE))
+			continue;
+
+		name = snd_ctl_event_elem_get_name(event);
+		if (strcmp(name, "Clock Lock Status") == 0 ||
+		    strcmp(name, "Clock Detected Rate") == 0)
+			report = 1;
+		else if (strcmp(name, "Xrun Count") == 0)
+			xrun = 1;
+		else if (strcmp(name, "Flight Recorder Frozen") == 0)
+			flight = 1;
 	}
 
-	snd_mixer_close(mixer);
-	return 0;
+	/* A drop usually changes both; log the settled state once */
+	if (report)
+		clock_report();
+	if (xrun)
+		xrun_report();
+	if (flight)
+		flight_report();
+}
+
+/* Milliseconds on CLOCK_MONOTONIC since start */
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*
+ * Milliseconds since the process was created, which is exec time for a
+ * service, from the start time in /proc/self/stat. It is in clock ticks
+ * since boot, so only good to 10 ms at the usual 100 Hz; -1 if unknown.
+ */
+static double exec_elapsed_ms(void)
+{
+	char buf[1024], *p;
+	unsigned long long ticks;
+	struct timespec now;
+	long hz = sysconf(_SC_CLK_TCK);
+	ssize_t len;
+	int fd, i;
+
+	fd = open("/proc/self/stat", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0 || hz <= 0)
+		return -1;
+	buf[len] = '\0';
+
+	/* The command name may contain spaces; starttime is 20 fields after it */
+	p = strrchr(buf, ')');
+	for (i = 0; p && i < 20; i++)
+		p = strchr(p + 1, ' ');
+	if (!p || sscanf(p, "%llu", &ticks) != 1)
+		return -1;
+
+	clock_gettime(CLOCK_BOOTTIME, &now);
+	return now.tv_sec * 1e3 + now.tv_nsec / 1e6 - ticks * 1e3 / hz;
+}
+
+/*
+ * Take the sockets systemd opened for us from apollo.socket: a datagram
+ * socket is the OSC gateway, a stream socket the metrics endpoint. They
+ * replace the -o and -m ports.
+ */
+static void open_activated_sockets(void)
+{
+	int n = apollo_sd_listen_fds();
+	int fd, type;
+	socklen_t len;
+
+	for (fd = APOLLO_SD_LISTEN_FDS_START; fd < APOLLO_SD_LISTEN_FDS_START + n; fd++) {
+		len = sizeof(type);
+		if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0)
+			type = -1;
+
+		if (type == SOCK_DGRAM && !osc) {
+			osc = apollo_osc_open_fd(control, fd, osc_push_ms);
+			osc_port = 0;
+		} else if (type == SOCK_STREAM && !metrics) {
+			metrics = apollo_metrics_open_fd(control, fd);
+			metrics_port = 0;
+		} else {
+			syslog(LOG_WARNING, "Ignoring unexpected socket %d from systemd", fd);
+			close(fd);
+		}
+	}
 }
 
 /* Main daemon loop */
 static void daemon_loop(void)
 {
 	struct apollo_config config;
+	time_t last_attach = time(NULL);
+	double exec_ms;
 
 	syslog(LOG_INFO, "Apollo daemon starting");
 
-	/* Initialize control interface */
-	control = apollo_control_init();
+	/* The I/O thread attaches the mixer while we carry on */
+	control = apollo_control_open(APOLLO_CONTROL_LAZY);
 	if (!control) {
 		syslog(LOG_ERR, "Failed to initialize control interface");
 		return;
@@ -159,32 +370,128 @@ static void daemon_loop(void)
 		apollo_control_default_config(&config);
 	}
 
-	/* Initialize ALSA mixer */
-	if (init_alsa_mixer() < 0) {
-		syslog(LOG_WARNING, "Failed to initialize ALSA mixer");
+	/* Before the device is opened, so the first attach is counted */
+	open_activated_sockets();
+	if (metrics_port) {
+		metrics = apollo_metrics_open(control, NULL, metrics_port);
+		if (!metrics)
+			syslog(LOG_WARNING, "Metrics endpoint unavailable");
+	}
+
+	if (osc_port) {
+		osc = apollo_osc_open(control, osc_addr, osc_port, osc_push_ms);
+		if (!osc)
+			syslog(LOG_WARNING, "OSC gateway unavailable");
 	}
 
-	syslog(LOG_INFO, "Apollo daemon running");
+	/* Clients may connect now; requests fail with ENODEV until the device is there */
+	apollo_sd_notify("READY=1\nSTATUS=Waiting for device");
+	exec_ms = exec_elapsed_ms();
+	if (exec_ms >= 0)
+		syslog(LOG_INFO, "Apollo daemon ready after %.1f ms (%.0f ms since process start)",
+		       elapsed_ms(&start_time), exec_ms);
+	else
+		syslog(LOG_INFO, "Apollo daemon ready after %.1f ms", elapsed_ms(&start_time));
 
-	while (running) {
-		/* Monitor device status and handle control requests */
-		apollo_control_process_events(control);
+	clock_monitor_open(0);
 
-		/* Sleep for 100ms */
-		usleep(100000);
+	while (running) {
+		struct pollfd fds[MAX_POLL_FDS];
+		int nfds = 0, clock_nfds = 0;
+
+		/* Room is kept for the control, OSC and metrics descriptors */
+		if (clock_ctl)
+			clock_nfds = snd_ctl_poll_descriptors(clock_ctl, fds, MAX_POLL_FDS - 8);
+		if (clock_nfds < 0)
+			clock_nfds = 0;
+		nfds = clock_nfds + apollo_control_get_fds(control, fds + clock_nfds,
+							   MAX_POLL_FDS - clock_nfds);
+		if (osc)
+			nfds += apollo_osc_get_fds(osc, fds + nfds, MAX_POLL_FDS - nfds);
+		if (metrics)
+			nfds += apollo_metrics_get_fds(metrics, fds + nfds, MAX_POLL_FDS - nfds);
+
+		/* Clock events wake us at once; the timeout paces the rest */
+		if (poll(fds, nfds, LOOP_INTERVAL_MS) > 0 && clock_ctl) {
+			unsigned short revents = 0;
+
+			snd_ctl_poll_descriptors_revents(clock_ctl, fds, clock_nfds, &revents);
+			if (revents & POLLIN)
+				clock_monitor_handle();
+			else if (revents & (POLLERR | POLLHUP))
+				clock_monitor_close();
+		}
+
+		/* Datagrams first: their updates may complete in this dispatch */
+		if (osc)
+			apollo_osc_handle(osc);
+
+		/* Completions of async control requests */
+		apollo_control_dispatch(control);
+
+		if (metrics)
+			apollo_metrics_handle(metrics);
+
+		/* Reattach after the device was unplugged or the driver reloaded */
+		if (!clock_ctl && time(NULL) - last_attach >= ATTACH_RETRY_S) {
+			last_attach = time(NULL);
+			clock_monitor_open(1);
+		}
 	}
 
+	apollo_osc_close(osc);
+	clock_monitor_close();
+	apollo_sd_notify("STOPPING=1");
+	apollo_metrics_close(metrics);
 	apollo_control_cleanup(control);
 	syslog(LOG_INFO, "Apollo daemon stopped");
 }
 
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-f] [-o port] [-b address] [-i ms] [-m port] [-r dir]\n"
+		"  -f          stay in the foreground\n"
+		"  -o port     accept OSC on this UDP port (default: off)\n"
+		"  -b address  IPv4 address to bind OSC to (default: all)\n"
+		"  -i ms       interval between pushes to OSC subscribers (default: %d)\n"
+		"  -m port     serve Prometheus metrics on 127.0.0.1:port (default: off)\n"
+		"  -r dir      write flight recorder reports here (default: %s)\n",
+		prog, APOLLO_OSC_PUSH_MS, APOLLO_FLIGHT_DIR);
+}
+
 int main(int argc, char *argv[])
 {
 	int daemon_mode = 1;
+	int opt;
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
 
 	/* Parse command line arguments */
-	if (argc > 1 && strcmp(argv[1], "-f") == 0) {
-		daemon_mode = 0;
+	while ((opt = getopt(argc, argv, "fo:b:i:m:r:")) != -1) {
+		switch (opt) {
+		case 'f':
+			daemon_mode = 0;
+			break;
+		case 'o':
+			osc_port = atoi(optarg);
+			break;
+		case 'b':
+			osc_addr = optarg;
+			break;
+		case 'i':
+			osc_push_ms = atoi(optarg) > 0 ? atoi(optarg) : APOLLO_OSC_PUSH_MS;
+			break;
+		case 'm':
+			metrics_port = atoi(optarg);
+			break;
+		case 'r':
+			flight_dir = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
 	}
 
 	/* Initialize syslog */
@@ -195,6 +502,10 @@ int main(int argc, char *argv[])
 	signal(SIGINT, signal_handler);
 	signal(SIGHUP, signal_handler);
 
+	/* Under systemd the manager does the job of daemonize() */
+	if (getenv("NOTIFY_SOCKET"))
+		daemon_mode = 0;
+
 	if (daemon_mode) {
 		daemonize();
 		write_pid_file();